@@ -40,4 +40,16 @@ void global_setup_callback(const std::string& result_str);
  */
 void global_eval_callback(int request_id, const std::string& result_str);
 
+/**
+ * @brief Global C-style callback for outputs streamed during an execution.
+ *
+ * This function is bound and exported to JavaScript via Emscripten. It is
+ * invoked by the OCaml backend whenever outputs are flushed before an `Eval`
+ * action completes, so that they can be published immediately.
+ *
+ * @param request_id The unique ID of the original execution request.
+ * @param outputs_str A JSON string containing a list of outputs.
+ */
+void global_stream_callback(int request_id, const std::string& outputs_str);
+
 #endif // XEUS_OCAML_CALLBACKS_HPP
\ No newline at end of file
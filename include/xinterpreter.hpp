@@ -10,9 +10,12 @@
 #define XEUS_OCAML_INTERPRETER_HPP
 
 #include <map>
+#include <memory>
 #include <string>
+#include <vector>
 
 #include "nlohmann/json.hpp"
+#include "xeus/xcomm.hpp"
 #include "xeus/xinterpreter.hpp"
 #include "xeus_ocaml_config.hpp"
 #include <emscripten/val.h>
@@ -49,12 +52,26 @@ namespace xeus_ocaml
          *
          * This method is invoked by the global C-style callback function when a response
          * from an asynchronous 'Eval' action is received from the OCaml/JS backend.
+         * Responses arrive in request order; a cell that failed, or that was aborted
+         * because an earlier queued cell failed, gets an error reply.
          *
          * @param request_id The unique ID of the original execution request.
          * @param result_str The JSON string result from the JavaScript backend.
          */
         void handle_eval_callback(int request_id, const std::string& result_str);
 
+        /**
+         * @brief Public callback handler for outputs streamed during an execution.
+         *
+         * This method is invoked by the global C-style callback function when the
+         * OCaml backend flushes outputs before an 'Eval' action completes. The
+         * outputs are published immediately.
+         *
+         * @param request_id The unique ID of the original execution request.
+         * @param outputs_str A JSON string containing a list of outputs.
+         */
+        void handle_stream_callback(int request_id, const std::string& outputs_str);
+
         /**
          * @brief Public callback handler for the initial setup result.
          *
@@ -62,6 +79,19 @@ namespace xeus_ocaml
          * It checks for success and then triggers Phase 2 via the ocaml_engine.
          */
         void handle_setup_callback(const std::string& result_str);
+
+        /**
+         * @brief Public callback handler for the progress of the startup.
+         *
+         * This method is invoked each time a tier of the startup completes:
+         * `Ready` once cells can be executed, then the background tiers. The
+         * progress is logged, kept for frontends opening an `xocaml.status`
+         * comm later, and sent to the ones already open.
+         *
+         * @param progress_str A JSON-encoded startup progress, with the `tier`,
+         *                     the number of `files` it loaded and `elapsed_ms`.
+         */
+        void handle_setup_progress(const std::string& progress_str);
         
         // Static method to get the singleton instance.
         static interpreter& get_instance();
@@ -78,11 +108,64 @@ namespace xeus_ocaml
 
         /**
          * @brief Processes and publishes outputs from a successful execution.
+         * Nothing is published for a silent request.
          * @param request_id The ID of the original request.
          * @param outputs A JSON array of outputs from the OCaml toplevel.
          */
         void handle_execution_output(int request_id, const nl::json& outputs);
 
+        /**
+         * @brief Takes ownership of an `xocaml.expand` comm opened by the frontend.
+         *
+         * Each message received on the comm is an `Expand` request, with the
+         * `handle` of an elided value and optional `depth` and `length` printing
+         * budgets. The reply carries the printed value as `text`, or an `error`.
+         *
+         * @param comm The comm opened by the frontend.
+         */
+        void open_expand_comm(xeus::xcomm&& comm);
+
+        /**
+         * @brief Takes ownership of an `xocaml.speculate` comm opened by the frontend.
+         *
+         * Each message received on the comm carries, as `cells`, the sources
+         * of the cells below the one being executed, in notebook order. They
+         * are parsed, type-checked and compiled ahead of time while the kernel is idle.
+         * No reply is sent.
+         *
+         * @param comm The comm opened by the frontend.
+         */
+        void open_speculate_comm(xeus::xcomm&& comm);
+
+        /**
+         * @brief Takes ownership of an `xocaml.status` comm opened by the frontend.
+         *
+         * The comm receives the startup progress reached so far as soon as it
+         * is opened, as a `progress` list, and then each tier as it completes,
+         * as a single `progress` entry. Any message sent on the comm is
+         * answered with the full list again.
+         *
+         * @param comm The comm opened by the frontend.
+         */
+        void open_status_comm(xeus::xcomm&& comm);
+
+        /**
+         * @brief Takes ownership of a comm opened by the frontend, until the frontend closes it.
+         * @param comm The comm opened by the frontend.
+         * @return The comm, owned by the interpreter.
+         */
+        xeus::xcomm* adopt_comm(xeus::xcomm&& comm);
+
+        /**
+         * @brief Forgets a comm the frontend closed.
+         *
+         * The comm is still running its close handler, so it is only destroyed
+         * when the next comm is opened.
+         *
+         * @param comm The closed comm.
+         */
+        void release_comm(xeus::xcomm* comm);
+
         /**
          * @brief Sends the final reply (success or error) for an execution request.
          * @param request_id The ID of the original request.
@@ -90,16 +173,39 @@ namespace xeus_ocaml
          */
         void handle_final_response(int request_id, const std::string& error_summary);
 
+        /**
+         * @brief Sends an `aborted` reply for an execution request that was not run,
+         * as a cell queued before it failed.
+         * @param request_id The ID of the original request.
+         */
+        void handle_aborted_response(int request_id);
+
         // Structure to hold state for pending asynchronous requests.
         struct pending_request
         {
             send_reply_callback m_callback;
             int m_execution_count;
+            bool m_silent; // Whether the request asked for its outputs not to be published.
         };
 
         std::map<int, pending_request> m_pending_requests;
         int m_request_id_counter;
 
+        // Comms opened by the frontend, kept alive until the frontend closes them.
+        std::vector<std::unique_ptr<xeus::xcomm>> m_comms;
+
+        // Comms closed by the frontend, destroyed when the next comm is opened.
+        std::vector<std::unique_ptr<xeus::xcomm>> m_closed_comms;
+
+        // The `xocaml.status` comms among them, which receive the startup progress.
+        std::vector<xeus::xcomm*> m_status_comms;
+
+        // The tiers of the startup completed so far, in order.
+        nl::json m_startup_progress = nl::json::array();
+
+        // Whether a restart was requested, so the toplevel is reset before the next execution.
+        bool m_reset_pending = false;
+
         // Singleton instance pointer.
         static interpreter* s_instance;
     };
@@ -60,6 +60,21 @@ namespace xeus_ocaml
          */
         void call_toplevel_async(const nl::json& request, emscripten::val callback);
 
+        /**
+         * @brief Asynchronously executes a Toplevel command with output streaming.
+         *
+         * Same as `call_toplevel_async(request, callback)`, but outputs flushed by
+         * the OCaml backend before the command completes are delivered to
+         * `stream_callback` as a JSON string containing a list of outputs. For
+         * `Setup`, each completed tier of the startup is delivered instead, as
+         * a JSON string describing the tier.
+         *
+         * @param request A JSON object representing the Toplevel action and its payload.
+         * @param callback The JavaScript-bound callback receiving the final result.
+         * @param stream_callback The JavaScript-bound callback receiving streamed outputs.
+         */
+        void call_toplevel_async(const nl::json& request, emscripten::val callback, emscripten::val stream_callback);
+
         /**
          * @brief Calls the OCaml function to mount the Emscripten FS device.
          */
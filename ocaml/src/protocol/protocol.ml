@@ -33,6 +33,8 @@ let to_msource_position : position -> Msource.position = function
 (** Configuration data required for the initial kernel setup. *)
 type dynamic_setup_config = {
   dsc_url: string; (** The base URL from which to fetch dynamic standard library files and other assets. *)
+  cache_limit: int option [@default None]; (** The maximum size of the persistent artifact cache, in bytes. *)
+  max_concurrent_requests: int option [@default None]; (** The maximum number of requests in flight at once. *)
 } [@@deriving yojson]
 
 (**
@@ -43,10 +45,13 @@ type action =
   | Complete_prefix of { source : source; position : position } (** A request for code completion at a given position. *)
   | Type_enclosing of { source : source; position : position } (** A request for the type of the expression enclosing a given position. *)
   | Document of { source : source; position : position } (** A request for the documentation (docstring) of the identifier at a given position. *)
-  | Eval of { source : source } (** A request to evaluate a block of source code. *)
+  | Eval of { source : source; stop_on_error : bool [@default false] } (** A request to evaluate a block of source code. With [stop_on_error], a failure aborts the evaluations queued after it. *)
   | All_errors of { source : source } (** A request to get all syntax and type errors in a source buffer. *)
   | Setup of dynamic_setup_config (** The initial command to set up the kernel environment. *)
   | List_files of { path: string } (** A utility command to list files in the virtual filesystem (for debugging). *)
+  | Expand of { handle : int; depth : int option [@default None]; length : int option [@default None] } (** A request to print more of a toplevel value whose printing was elided. Omitted budgets are derived from the handle's last printing. *)
+  | Reset (** A request to reset the toplevel to its post-setup state, keeping loaded artifacts. *)
+  | Speculate of { sources : source list } (** The sources of the upcoming cells, to prepare while the kernel is idle. *)
   [@@deriving yojson { strict = false }]
 
 (** Represents a single structured error or warning from the OCaml toolchain. *)
@@ -69,6 +74,24 @@ type output =
   | DisplayData of Yojson.Safe.t (** A rich output represented as a JSON MIME bundle, for rendering HTML, images, etc. *)
 [@@deriving yojson]
 
+(**
+   The tiers of the kernel startup. Cells can be executed once the [Ready]
+   tier is reached; the other tiers complete in the background, in order.
+*)
+type startup_tier =
+  | Ready          (** The critical files are loaded, and the toplevel and Merlin are initialized. *)
+  | Interfaces     (** All the interfaces of the standard library are loaded. *)
+  | Documentation  (** The `.cmt` and `.cmti` files of the standard library are loaded. *)
+  | Merlin_warm    (** Merlin has type-checked a buffer using the common modules, filling its caches. *)
+[@@deriving yojson]
+
+(** The progress of the startup, streamed to the frontend as each tier completes. *)
+type startup_progress = {
+  tier : startup_tier;  (** The tier that completed. *)
+  files : int;          (** The number of files loaded by the tier. *)
+  elapsed_ms : float;   (** The time since the [Setup] action was received, in milliseconds. *)
+} [@@deriving yojson]
+
 (** A record representing a list of completion candidates from Merlin. *)
 type completions = {
   from: int; (** The starting position (byte offset) of the text to be replaced. *)
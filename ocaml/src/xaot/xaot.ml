@@ -0,0 +1,137 @@
+(**
+    {1 Ahead-of-Time Notebook Compilation}
+    @author Davy Cottet
+
+    This module implements the [#compile_notebook "file.ipynb"] and
+    [#load_notebook "file.ipynb"] directives. Notebooks that are run over and
+    over, such as dashboards, otherwise pay for the parsing, typing and
+    compilation of every phrase by the toplevel on each run.
+
+    [#compile_notebook] converts the code cells of the notebook into a single
+    compilation unit with {!Xnotebook}, and compiles it with the compiler
+    driver, as `ocamlc -c` would, into a [.cmi] and a [.cmo] stored in the
+    `_aot` directory next to the notebook on `/drive`. A manifest records the
+    libraries to load first and the digest of the notebook. The driver runs in
+    a worker set up by {!Xparallel} with the libraries loaded so far: it
+    resets the load path, the counter of identifier stamps and the typing
+    state, which the toplevel's own would not survive.
+
+    [#load_notebook] then loads the unit in one step: its libraries are
+    loaded, and its code is linked into the toplevel. When the directory also
+    holds a JS module built by the `xocaml-compile-notebook` tool, which runs
+    `js_of_ocaml` ahead of time as well, the module is evaluated directly.
+    Otherwise the [.cmo] is loaded as [#load] would, which converts its
+    bytecode to JavaScript once, for the whole unit.
+ *)
+
+open Js_of_ocaml
+open Lwt.Syntax
+open Xutil
+
+let read_file path = In_channel.with_open_bin path In_channel.input_all
+
+(** Writes a file on the `/drive` mount, which is backed by the Emscripten FS device. *)
+let write_drive_file path content =
+  Out_channel.with_open_bin path (fun oc -> Out_channel.output_string oc content)
+
+(**
+    Loads the libraries of a notebook with [#require], in order.
+    @return The outputs of the loader, and whether every library was loaded.
+ *)
+let require_all ~base_url libraries =
+  let+ results = Lwt_list.map_s (fun name -> Xlibloader.load_on_demand ~base_url ~name) libraries in
+  let outputs = List.map (function Ok output | Error output -> output) results in
+  (outputs, List.for_all Result.is_ok results)
+
+(**
+    Compiles a unit on behalf of the toplevel, or [None] until a compiler is
+    installed with {!set_compiler}.
+ *)
+let compiler : (name:string -> string -> (string * string) Lwt.t) option ref = ref None
+
+let set_compiler compile_unit = compiler := Some compile_unit
+
+(**
+    Handles the argument of the [#compile_notebook] directive.
+    @param base_url The base URL of the libraries loaded with [#require].
+    @param path The absolute path of the notebook.
+    @return A message describing the compiled unit, or an error message if
+            the notebook cannot be read or converted, if one of its
+            libraries cannot be loaded, or with the syntax or typing errors
+            of the unit, as the compiler reports them.
+ *)
+let compile ~base_url path =
+  match read_file path with
+  | exception Sys_error msg -> Lwt.return (Error msg)
+  | contents ->
+    match Xnotebook.of_ipynb ~path contents with
+    | Error msg -> Lwt.return (Error msg)
+    | Ok notebook ->
+      let* outputs, loaded = require_all ~base_url notebook.requires in
+      if not loaded then
+        Lwt.return (Error (String.concat "\n" (List.filter_map (function Protocol.Stderr msg -> Some msg | _ -> None) outputs)))
+      else begin
+        let prefix = Xnotebook.artifact_prefix path in
+        let dir = Filename.dirname prefix in
+        if not (Sys.file_exists dir) then Sys.mkdir dir 0o755;
+        write_drive_file (prefix ^ ".ml") notebook.source;
+        (* A JS module built by the tool from an earlier version would shadow the new unit. *)
+        if Sys.file_exists (prefix ^ ".js") then Sys.remove (prefix ^ ".js");
+        match !compiler with
+        | None -> Lwt.return (Error "No compiler is installed: the kernel is not set up.")
+        | Some compile_unit ->
+          log (Printf.sprintf "[AOT] Compiling %s into %s.cmo" path prefix);
+          Lwt.catch
+            (fun () ->
+              let* cmi, cmo = compile_unit ~name:(Filename.basename prefix) notebook.source in
+              write_drive_file (prefix ^ ".cmi") cmi;
+              write_drive_file (prefix ^ ".cmo") cmo;
+              write_drive_file (prefix ^ ".aot") (Xnotebook.manifest ~digest:(Digest.string contents) notebook);
+              Lwt.return (Ok (Printf.sprintf "Compiled %d cell(s) into module %s (%s.cmo). Load it with #load_notebook %S."
+                                notebook.cells notebook.name prefix path)))
+            (function
+              | Failure report -> Lwt.return (Error (Printf.sprintf "%sCould not compile %s." report path))
+              | exn -> Lwt.fail exn)
+      end
+
+(** Publishes the interface of a compiled notebook for Merlin, replacing any previous version. *)
+let publish_interface ~name cmi =
+  let published = Filename.concat user_cmis_path (String.uncapitalize_ascii name ^ ".cmi") in
+  try
+    if Sys.file_exists published then Sys.remove published;
+    Sys_js.create_file ~name:published ~content:(read_file cmi)
+  with exn ->
+    log (Printf.sprintf "[AOT] Could not publish interface of %s: %s" name (Printexc.to_string exn))
+
+(**
+    Handles the argument of the [#load_notebook] directive.
+    @param base_url The base URL of the libraries loaded with [#require].
+    @param ppf The formatter receiving the errors of the bytecode loader.
+    @param path The absolute path of the notebook.
+    @return A message confirming the load, or an error message if the
+            notebook was not compiled or could not be loaded.
+ *)
+let load ~base_url ppf path =
+  let prefix = Xnotebook.artifact_prefix path in
+  let name = Xnotebook.module_name path in
+  match read_file (prefix ^ ".aot") with
+  | exception Sys_error _ ->
+    Lwt.return (Error (Printf.sprintf "%s has not been compiled: run #compile_notebook %S first." path path))
+  | manifest ->
+    let digest, requires = Xnotebook.read_manifest manifest in
+    let* _, loaded = require_all ~base_url requires in
+    if not loaded then Lwt.return (Error (Printf.sprintf "Could not load the libraries of %s: %s." name (String.concat ", " requires)))
+    else begin
+      Topdirs.dir_directory (Filename.dirname prefix);
+      let linked =
+        if Sys.file_exists (prefix ^ ".js") then (ignore (Js.Unsafe.eval_string (read_file (prefix ^ ".js"))); true)
+        else Toploop.load_file ppf (prefix ^ ".cmo")
+      in
+      if not linked then Lwt.return (Error (Printf.sprintf "Could not load module %s." name))
+      else begin
+        publish_interface ~name (prefix ^ ".cmi");
+        let stale = Sys.file_exists path && Digest.to_hex (Digest.file path) <> digest in
+        Lwt.return (Ok (Printf.sprintf "Module %s loaded.%s" name
+                          (if stale then " The notebook changed since it was compiled; #compile_notebook updates it." else "")))
+      end
+    end
@@ -0,0 +1,49 @@
+(**
+   {1 Ahead-of-Time Notebook Compilation}
+   @author Davy Cottet
+
+   The [#compile_notebook] and [#load_notebook] directives. A notebook is
+   compiled once into a [.cmi] and a [.cmo] in the `_aot` directory next to
+   it, and later sessions load the compiled unit in one step instead of
+   executing every phrase through the toplevel. A JS module built ahead of
+   time by the `xocaml-compile-notebook` tool is loaded instead of the [.cmo]
+   when present.
+ *)
+
+(**
+   Installs the compiler of [#compile_notebook], which runs the compiler
+   driver out of the toplevel's process.
+   @param compile_unit Compiles the source of a unit, given the name of its
+                       files, and returns the contents of its [.cmi] and
+                       [.cmo]. It fails with [Failure] and the compiler's
+                       report on a syntax or typing error.
+ *)
+val set_compiler : (name:string -> string -> (string * string) Lwt.t) -> unit
+
+(**
+   Installs the compiler of [#compile_notebook], which runs the compiler
+   driver out of the toplevel.
+   @param compile_unit Compiles the source of a unit, given the base name of
+                       its files, and returns the contents of its [.cmi] and
+                       [.cmo]. It fails with [Failure] and the compiler's
+                       report on a syntax or typing error.
+ *)
+val set_compiler : (name:string -> string -> (string * string) Lwt.t) -> unit
+
+(**
+   Handles the argument of the [#compile_notebook] directive: compiles the
+   code cells of the notebook at [path] into a compilation unit.
+   @param base_url The base URL of the libraries loaded with [#require].
+   @return A message describing the compiled unit, or an error message,
+           which includes the syntax or typing errors of the unit.
+ *)
+val compile : base_url:string -> string -> (string, string) result Lwt.t
+
+(**
+   Handles the argument of the [#load_notebook] directive: loads the
+   libraries and the compiled unit of the notebook at [path].
+   @param base_url The base URL of the libraries loaded with [#require].
+   @param ppf The formatter receiving the errors of the bytecode loader.
+   @return A message confirming the load, or an error message.
+ *)
+val load : base_url:string -> Format.formatter -> string -> (string, string) result Lwt.t
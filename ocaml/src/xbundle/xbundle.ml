@@ -7,17 +7,28 @@
    completion and documentation.
  
    The tool reads a list of library names from a text file, resolves their
-   full dependency trees using `ocamlfind`, and then performs two main actions
+   full dependency trees using `ocamlfind`, and then performs three main actions
    for each library:
    1.  It compiles the library and all its dependencies into a single JavaScript
        bundle using `js_of_ocaml --toplevel`.
-   2.  It finds and copies all Merlin artifacts for the library and its
-       dependencies into the current directory.
+   2.  It finds all Merlin artifacts for the library and its dependencies.
+       An artifact needed by several of the bundled libraries, such as those
+       of a common dependency, is written once into the current directory,
+       as a `<digest>.blob` file named after its MD5 digest, so that two
+       artifacts with the same name but different contents cannot overwrite
+       each other.
+   3.  It packs the bundle and the other artifacts, which only this library
+       needs, into a single {!Xpack} archive, which the kernel fetches in one
+       request, or by byte ranges when some of the artifacts are already
+       loaded. Every content is therefore stored once, in an archive or as a
+       blob.
  
    Finally, it generates an OCaml module (`external_libs.ml`) containing a
-   hashtable that maps each bundled library name to its corresponding JS file
-   and list of artifact filenames. This module is used by the `xeus-ocaml`
-   kernel at runtime to dynamically load libraries via the `#require` directive.
+   hashtable that maps each bundled library name to its corresponding JS file,
+   archive, list of artifact filenames, content digests and top-level module
+   names. This module is the manifest used by the `xeus-ocaml` kernel at
+   runtime to dynamically load libraries via the `#require` directive: the
+   digests let it fetch each distinct content once, verify it, and cache it.
  *)
 
 open Bos
@@ -100,6 +111,12 @@ let find_files_by_exts dir exts =
       List.exists (fun ext -> Fpath.has_ext ext path) exts
      )
 
+(* Tells whether a module name is an internal module of a Dune-wrapped library
+   (e.g., `Graph__Pack`), which cannot be referred to by name. *)
+let is_wrapped_internal name =
+  let rec from i = i + 1 < String.length name && ((name.[i] = '_' && name.[i + 1] = '_') || from (i + 1)) in
+  from 0
+
 (* Runs `ocamlfind query` to get the path to a library's `.cma` file. *)
 let ocamlfind_cma ~preds lib = get_cmd_output Bos.Cmd.(v "ocamlfind" % "query" % lib % "-a-format" % "-predicates" % preds)
 
@@ -154,7 +171,9 @@ let get_dependencies ~ppx targets =
 (* Generates the content for the `external_libs.ml` module.
    This module contains a hashtable mapping library names to their bundle data.
    @param data A list of tuples, where each tuple contains a library name and
-               its associated JS bundle name and list of artifact filenames.
+               its associated JS bundle name, archive name and digest, list of
+               artifact filenames, digests of the bundle and the artifacts, and
+               list of top-level module names.
    @return A string containing the full OCaml module source code.
  *)
 let generate_ml_file_content data =
@@ -163,7 +182,11 @@ let generate_ml_file_content data =
     "";
     "type library = {";
     "  js_bundle: string;";
+    "  pack: string;";
+    "  pack_digest: string;";
     "  artifacts: string list;";
+    "  digests: (string * string) list;";
+    "  modules: string list;";
     "}";
     "";
     "let libraries : (string, library) Hashtbl.t = Hashtbl.create 10";
@@ -171,14 +194,19 @@ let generate_ml_file_content data =
     "let () =";
   ] in
   let add_lib_entries =
-    List.map (fun (lib_name, (js_bundle, artifacts)) ->
-      let artifacts_str =
-        artifacts
+    List.map (fun (lib_name, (js_bundle, pack, pack_digest, artifacts, digests, modules)) ->
+      let list_str l =
+        l
         |> List.map (Printf.sprintf "%S")
         |> String.concat "; "
       in
-      Printf.sprintf "  Hashtbl.add libraries %S {\n    js_bundle = %S;\n    artifacts = [%s];\n  };"
-        lib_name js_bundle artifacts_str
+      let pairs_str l =
+        l
+        |> List.map (fun (name, digest) -> Printf.sprintf "(%S, %S)" name digest)
+        |> String.concat "; "
+      in
+      Printf.sprintf "  Hashtbl.add libraries %S {\n    js_bundle = %S;\n    pack = %S;\n    pack_digest = %S;\n    artifacts = [%s];\n    digests = [%s];\n    modules = [%s];\n  };"
+        lib_name js_bundle pack pack_digest (list_str artifacts) (pairs_str digests) (list_str modules)
     ) data
   in
   String.concat "\n" (header @ add_lib_entries)
@@ -190,9 +218,9 @@ let generate_ml_file_content data =
 let main libs_file_path =
   try
     let libs_to_bundle = read_lines (Fpath.v libs_file_path) in
-    let ml_module_data = ref [] in
 
-    List.iter (fun lib_name ->
+    (* First, compile each library and collect its artifacts. *)
+    let bundles = List.map (fun lib_name ->
       Format.printf "--- Bundling library: %s ---\n%!" lib_name;
       let all_deps = get_dependencies ~ppx:false [lib_name] in
       Format.printf "  Found %d dependencies.\n%!" (List.length all_deps);
@@ -206,18 +234,34 @@ let main libs_file_path =
         )
       in
 
-      (* Copy the found artifacts to the current directory for bundling. *)
-      let copied_artifact_basenames =
-        all_artifacts
-        |> List.map (fun src_path ->
-            let dst_path = Fpath.(v "." // base src_path) in
+      (* Read the artifacts, by name. An artifact found twice with different
+         contents is a conflict: the first one is kept, in dependency order. *)
+      let artifact_contents =
+        List.fold_left (fun acc src_path ->
+            let name = Fpath.basename src_path in
             let content = run_or_raise @@ OS.File.read src_path in
-            run_or_raise @@ OS.File.write dst_path content;
-            Fpath.basename dst_path
-           )
-        |> List.sort_uniq String.compare
+            match List.assoc_opt name acc with
+            | None -> (name, content) :: acc
+            | Some kept ->
+              if kept <> content then
+                Format.printf "  [Warning] Conflicting versions of '%s', keeping the first one (ignoring %s).\n%!" name (Fpath.to_string src_path);
+              acc)
+          [] all_artifacts
+        |> List.sort (fun (a, _) (b, _) -> String.compare a b)
+      in
+
+      (* The top-level modules of the library itself, used by the kernel to
+         prefetch it when a cell refers to one of them. Dune-wrapped internal
+         modules (`lib__Module.cmi`) are not accessible by name and are left out. *)
+      let top_modules =
+        match List.find_opt (fun dep -> dep.name = lib_name) all_deps with
+        | None -> []
+        | Some dep ->
+          find_files_by_exts (Fpath.parent (Fpath.v dep.cma)) [".cmi"]
+          |> List.map (fun path -> String.capitalize_ascii (Fpath.basename (Fpath.rem_ext path)))
+          |> List.filter (fun name -> not (is_wrapped_internal name))
+          |> List.sort_uniq String.compare
       in
-      Format.printf "  Copied %d artifacts to current directory.\n%!" (List.length copied_artifact_basenames);
 
       (* Compile the library and its dependencies into a single JS bundle. *)
       let js_bundle_name = lib_name ^ ".js" in
@@ -234,13 +278,37 @@ let main libs_file_path =
       in
       run_or_raise (Result.bind result Fun.id);
       Format.printf "  Generated JS bundle: %s\n%!" js_bundle_name;
+      let js_content = run_or_raise @@ OS.File.read js_bundle_path in
+      (lib_name, js_bundle_name, js_content, artifact_contents, top_modules)
+    ) libs_to_bundle in
+
+    (* Then store each artifact once: the ones several libraries need as
+       content-addressed blobs, the others in the archive of their library. *)
+    let packed, blobs =
+      Xpack.partition_shared (List.map (fun (lib_name, _, _, artifacts, _) -> (lib_name, artifacts)) bundles)
+    in
+    List.iter (fun (name, content) -> run_or_raise @@ OS.File.write (Fpath.v name) content) blobs;
+    Format.printf "--- Wrote %d artifact(s) shared by several libraries as blobs ---\n%!" (List.length blobs);
+
+    let ml_module_data = List.map2 (fun (lib_name, js_bundle_name, js_content, artifacts, top_modules) (_, own) ->
+        (* Pack the bundle and the artifacts of the library's own, so that they can be fetched in one request. *)
+        let pack_name = lib_name ^ ".xpack" in
+        let pack = Xpack.create ((js_bundle_name, js_content) :: own) in
+        run_or_raise @@ OS.File.write (Fpath.v pack_name) pack;
+        Format.printf "  Generated archive: %s (%d of %d artifacts)\n%!" pack_name (List.length own) (List.length artifacts);
 
-      (* Store metadata for the final ML module generation. *)
-      ml_module_data := (lib_name, (js_bundle_name, copied_artifact_basenames)) :: !ml_module_data
-    ) libs_to_bundle;
+        (* Store metadata for the final ML module generation. *)
+        let digests =
+          (js_bundle_name, Digest.to_hex (Digest.string js_content))
+          :: List.map (fun (name, content) -> (name, Digest.to_hex (Digest.string content))) artifacts
+        in
+        let pack_digest = Digest.to_hex (Digest.string pack) in
+        (lib_name, (js_bundle_name, pack_name, pack_digest, List.map fst artifacts, digests, top_modules)))
+      bundles packed
+    in
 
     (* Generate and write the external_libs.ml file. *)
-    let ml_content = generate_ml_file_content (List.rev !ml_module_data) in
+    let ml_content = generate_ml_file_content ml_module_data in
     let ml_path = Fpath.v "external_libs.ml" in
     run_or_raise @@ OS.File.write ml_path ml_content;
     Format.printf "\n--- Successfully generated module: external_libs.ml ---\n%!";
@@ -0,0 +1,213 @@
+(**
+    {1 Persistent Artifact Cache}
+    @author Davy Cottet
+
+    Keeps the files downloaded by the loader, such as the `.cmi` files of the
+    standard library and the bundles of the libraries, in an IndexedDB
+    database of the browser, so that the next sessions read them locally
+    instead of downloading them again. The HTTP cache of the browser is not
+    reliable for this: it may revalidate, or drop, files at any time.
+
+    Files are stored by the hexadecimal MD5 digest of their content. A key
+    therefore never goes stale: a file changed by a new build of the kernel
+    has a new key, and the old one is evicted when space is needed. The
+    database holds two object stores: [blobs], the contents, and [entries],
+    the size and last use of each content, which the eviction reads without
+    loading the contents. When the total size exceeds {!set_limit}, the
+    contents used least recently are removed. Changing the layout of the
+    database requires a new {!schema_version}, which drops the stores of
+    the previous versions on the next open.
+
+    The cache is an optimization only: every operation succeeds, returning
+    nothing when IndexedDB is not available or fails.
+ *)
+
+open Js_of_ocaml
+open Js_of_ocaml_lwt
+open Lwt.Syntax
+open Xutil
+
+(** The name of the database. *)
+let db_name = "xocaml-artifacts"
+
+(** The version of the layout of the database. *)
+let schema_version = 1
+
+(** The object store of the contents, by digest. *)
+let blobs = "blobs"
+
+(** The object store of the sizes and last uses of the contents, by digest. *)
+let entries = "entries"
+
+(** The maximum total size of the contents, in bytes. *)
+let limit = ref (64 * 1024 * 1024)
+
+(** The delay, in seconds, between a write and the eviction that follows. *)
+let eviction_delay = 1.
+
+(** Whether an eviction is scheduled. *)
+let eviction_scheduled = ref false
+
+(** The IndexedDB factory of the global scope, if any. *)
+let factory () : Js.Unsafe.any Js.Optdef.t = Js.Unsafe.get Js.Unsafe.global (Js.string "indexedDB")
+
+(** Tells whether the cache can be used in this environment. *)
+let available () = Js.Optdef.test (factory ())
+
+(** Sets a handler of an event of an IndexedDB request or transaction. *)
+let on target event f = Js.Unsafe.set target (Js.string event) (Js.wrap_callback (fun _ -> f ()))
+
+(** Calls a method of an IndexedDB object. *)
+let call target meth args = Js.Unsafe.meth_call target meth (Array.map Js.Unsafe.inject args)
+
+(** The wall-clock time, in milliseconds, which orders the uses across sessions. *)
+let now () : float = Js.Unsafe.fun_call (Js.Unsafe.pure_js_expr "Date.now") [||]
+
+(** Creates the object stores, dropping those of a previous version of the layout. *)
+let upgrade db =
+  let names = Js.Unsafe.get db (Js.string "objectStoreNames") in
+  List.iter (fun store ->
+      if Js.to_bool (call names "contains" [| Js.string store |]) then ignore (call db "deleteObjectStore" [| Js.string store |]);
+      ignore (call db "createObjectStore" [| Js.string store |]))
+    [ blobs; entries ]
+
+(** Opens the database. *)
+let open_database () =
+  Js.Optdef.case (factory ()) (fun () -> Lwt.return_none) (fun factory ->
+    let promise, resolver = Lwt.wait () in
+    (try
+       let request = Js.Unsafe.meth_call factory "open" [| Js.Unsafe.inject (Js.string db_name); Js.Unsafe.inject schema_version |] in
+       on request "upgradeneeded" (fun () ->
+         log (Printf.sprintf "[Cache] Creating the stores of %s, version %d." db_name schema_version);
+         upgrade (Js.Unsafe.get request (Js.string "result")));
+       on request "success" (fun () -> Lwt.wakeup_later resolver (Some (Js.Unsafe.get request (Js.string "result"))));
+       on request "error" (fun () ->
+         log (Printf.sprintf "[Cache] Could not open %s." db_name);
+         Lwt.wakeup_later resolver None);
+       on request "blocked" (fun () -> Lwt.wakeup_later resolver None)
+     with exn ->
+       log (Printf.sprintf "[Cache] IndexedDB is not usable: %s" (Printexc.to_string exn));
+       Lwt.wakeup_later resolver None);
+    promise)
+
+(** The database, opened on first use. *)
+let database = lazy (open_database ())
+
+(**
+    Runs [f] on the object stores of a new transaction of the database.
+    @return The result of [f] once the transaction completed, or [default]
+            if it failed or the database is not available.
+ *)
+let with_transaction ~mode ~default f =
+  let* db = Lazy.force database in
+  match db with
+  | None -> Lwt.return default
+  | Some db ->
+    try
+      let transaction = call db "transaction" [| Js.Unsafe.inject (Js.array [| Js.string blobs; Js.string entries |]); Js.Unsafe.inject (Js.string mode) |] in
+      let store name = call transaction "objectStore" [| Js.string name |] in
+      let promise, resolver = Lwt.wait () in
+      let result = f ~blobs:(store blobs) ~entries:(store entries) in
+      on transaction "complete" (fun () -> Lwt.wakeup_later resolver (result ()));
+      on transaction "error" (fun () -> log "[Cache] Transaction failed."; Lwt.wakeup_later resolver default);
+      on transaction "abort" (fun () -> Lwt.wakeup_later resolver default);
+      promise
+    with exn ->
+      log (Printf.sprintf "[Cache] Transaction failed: %s" (Printexc.to_string exn));
+      Lwt.return default
+
+(** Records the size and the last use of a content. *)
+let touch entries key size =
+  ignore (call entries "put" [| Js.Unsafe.inject (object%js val size = size val used = now () end); Js.Unsafe.inject (Js.string key) |])
+
+(**
+    Looks contents up, and records their use.
+    @param keys The digests of the contents, in hexadecimal.
+    @return The contents found, by digest.
+ *)
+let get_all keys =
+  let found = Hashtbl.create 64 in
+  if keys = [] then Lwt.return found
+  else
+    let+ found =
+      with_transaction ~mode:"readwrite" ~default:found (fun ~blobs ~entries ->
+        List.iter (fun key ->
+            let request = call blobs "get" [| Js.string key |] in
+            on request "success" (fun () ->
+              let result : Js.js_string Js.t Js.Optdef.t = Js.Unsafe.get request (Js.string "result") in
+              Js.Optdef.iter result (fun content ->
+                let content = Js.to_bytestring content in
+                Hashtbl.replace found key content;
+                touch entries key (String.length content))))
+          keys;
+        fun () -> found)
+    in
+    if Hashtbl.length found > 0 then log (Printf.sprintf "[Cache] %d of %d file(s) found locally." (Hashtbl.length found) (List.length keys));
+    found
+
+(** Removes the contents used least recently until the total size is within {!limit}. *)
+let evict () =
+  with_transaction ~mode:"readwrite" ~default:() (fun ~blobs ~entries ->
+    let keys = call entries "getAllKeys" [||] and records = call entries "getAll" [||] in
+    on records "success" (fun () ->
+      let keys : Js.js_string Js.t array = Js.to_array (Js.Unsafe.get keys (Js.string "result")) in
+      let records = Js.to_array (Js.Unsafe.get records (Js.string "result")) in
+      let uses =
+        Array.mapi (fun i record ->
+            (Js.to_string keys.(i), (Js.Unsafe.get record (Js.string "size") : int), (Js.Unsafe.get record (Js.string "used") : float)))
+          records
+      in
+      let total = ref (Array.fold_left (fun total (_, size, _) -> total + size) 0 uses) in
+      if !total > !limit then begin
+        Array.sort (fun (_, _, a) (_, _, b) -> Float.compare a b) uses;
+        let evicted = ref 0 in
+        Array.iter (fun (key, size, _) ->
+            if !total > !limit then begin
+              ignore (call blobs "delete" [| Js.string key |]);
+              ignore (call entries "delete" [| Js.string key |]);
+              total := !total - size;
+              incr evicted
+            end)
+          uses;
+        log (Printf.sprintf "[Cache] Evicted %d file(s), %d bytes left." !evicted !total)
+      end);
+    fun () -> ())
+
+(** Runs {!evict} once the writes of the moment are done. *)
+let schedule_eviction () =
+  if not !eviction_scheduled then begin
+    eviction_scheduled := true;
+    Lwt.async (fun () ->
+      let* () = Lwt_js.sleep eviction_delay in
+      eviction_scheduled := false;
+      evict ())
+  end
+
+(**
+    Sets the maximum total size of the contents, in bytes. The contents
+    beyond a lowered limit are evicted shortly after.
+ *)
+let set_limit bytes =
+  limit := max 0 bytes;
+  if available () then schedule_eviction ()
+
+(**
+    Stores contents, then evicts the contents used least recently if the
+    total size exceeds the limit.
+    @param contents The contents, each with its digest in hexadecimal.
+ *)
+let put_all contents =
+  if contents = [] then Lwt.return_unit
+  else
+    let+ () =
+      with_transaction ~mode:"readwrite" ~default:() (fun ~blobs ~entries ->
+        List.iter (fun (key, content) ->
+            ignore (call blobs "put" [| Js.Unsafe.inject (Js.bytestring content); Js.Unsafe.inject (Js.string key) |]);
+            touch entries key (String.length content))
+          contents;
+        fun () -> ())
+    in
+    schedule_eviction ()
+
+(** The key of a content: its hexadecimal MD5 digest. *)
+let key_of_content content = Digest.to_hex (Digest.string content)
@@ -0,0 +1,38 @@
+(**
+   {1 Persistent Artifact Cache}
+   @author Davy Cottet
+
+   Keeps downloaded files in an IndexedDB database of the browser, by the
+   hexadecimal MD5 digest of their content, so that the next sessions read
+   them locally instead of downloading them again. The contents used least
+   recently are evicted when the total size exceeds a limit.
+
+   Every operation succeeds: when IndexedDB is not available or fails,
+   lookups find nothing and writes are dropped.
+ *)
+
+(** Tells whether IndexedDB is available in this environment. *)
+val available : unit -> bool
+
+(**
+   Sets the maximum total size of the cached contents, in bytes (64 MiB by
+   default). The contents beyond a lowered limit are evicted shortly after.
+ *)
+val set_limit : int -> unit
+
+(** The key of a content: its hexadecimal MD5 digest. *)
+val key_of_content : string -> string
+
+(**
+   Looks contents up, and records their use.
+   @param keys The digests of the contents, in hexadecimal.
+   @return The contents found, by digest.
+ *)
+val get_all : string list -> (string, string) Hashtbl.t Lwt.t
+
+(**
+   Stores contents. The contents used least recently are evicted shortly
+   after, if the total size exceeds the limit.
+   @param contents The contents, each with its digest in hexadecimal.
+ *)
+val put_all : (string * string) list -> unit Lwt.t
@@ -0,0 +1,188 @@
+(**
+    {1 Bounded Output Capture}
+    @author Davy Cottet
+
+    This module implements the arena in which the toplevel captures the outputs
+    of a cell execution before they are sent to the frontend.
+
+    Standard stream output arrives as many tiny strings (one per channel
+    flush). Consecutive strings of the same stream are coalesced into chunks of
+    at most {!chunk_size} bytes, so appending is amortized O(1) and the
+    frontend receives a few large messages instead of thousands of small ones.
+
+    Each arena enforces a byte cap and a message cap for the whole cell. Once
+    either cap is reached, further outputs are not kept in memory: they are
+    spilled to a file in {!spill_dir} on the persistent `/drive` mount, and a
+    truncation notice pointing to that file is appended when the cell finishes.
+    A runaway print loop therefore cannot exhaust the heap.
+ *)
+
+open Xutil
+
+(** The maximum number of bytes of output kept in memory for a single cell. *)
+let max_bytes = ref (4 * 1024 * 1024)
+
+(** The maximum number of output messages kept for a single cell. *)
+let max_messages = ref 10_000
+
+(** The size above which a stream chunk is closed and a new one started. *)
+let chunk_size = 64 * 1024
+
+(** The directory where overflowing outputs are written. It is visible in the file browser. *)
+let spill_dir = "/drive/xocaml_outputs"
+
+(**
+    The number of the last spill file created. Spill files of earlier sessions
+    are kept, so numbering skips the names already taken.
+ *)
+let spill_counter = ref 0
+
+(** The number of names {!open_spill_file} tries before giving up. *)
+let max_spill_attempts = 1000
+
+(** The standard stream a chunk belongs to. *)
+type stream = Out | Err
+
+(** A capture arena for one cell execution. *)
+type t = {
+  mutable outputs : Protocol.output list;  (** Closed outputs, most recent first. *)
+  mutable chunk : (stream * Buffer.t) option; (** The stream chunk being appended to. *)
+  mutable bytes : int;                      (** Bytes accepted in memory for this cell. *)
+  mutable messages : int;                   (** Messages accepted in memory for this cell. *)
+  mutable spill : (string * out_channel) option; (** The spill file, once the caps are exceeded. *)
+  mutable spilled_bytes : int;              (** Bytes written to the spill file. *)
+}
+
+(** Creates an empty arena. *)
+let create () =
+  { outputs = []; chunk = None; bytes = 0; messages = 0; spill = None; spilled_bytes = 0 }
+
+(** Moves the current stream chunk, if any, to the list of closed outputs. *)
+let close_chunk t =
+  match t.chunk with
+  | None -> ()
+  | Some (stream, buf) ->
+    let contents = Buffer.contents buf in
+    t.outputs <- (match stream with Out -> Protocol.Stdout contents | Err -> Protocol.Stderr contents) :: t.outputs;
+    t.chunk <- None
+
+(**
+    The textual form of an output, as written to the spill file. A rich output
+    is written as its [text/plain] representation, as a terminal would show
+    it; one without any is only named by its MIME types, since the spill file
+    is read as text.
+ *)
+let output_text = function
+  | Protocol.Stdout s | Protocol.Stderr s | Protocol.Value s -> s
+  | Protocol.DisplayData (`Assoc bundle) ->
+    (match List.assoc_opt "text/plain" bundle with
+     | Some (`String text) -> text ^ "\n"
+     | _ -> Printf.sprintf "[%s output]\n" (String.concat ", " (List.map fst bundle)))
+  | Protocol.DisplayData _ -> "[rich output]\n"
+
+(** The number of bytes an output accounts for against {!max_bytes}. *)
+let output_size = function
+  | Protocol.Stdout s | Protocol.Stderr s | Protocol.Value s -> String.length s
+  | Protocol.DisplayData data -> String.length (Yojson.Safe.to_string data)
+
+(**
+    Creates a new spill file in {!spill_dir}, named after the first number
+    that no existing file uses. The file is opened with [Open_excl], so a file
+    written by an earlier session, which the user may still refer to, is
+    never overwritten.
+    @return The path of the file and a channel writing to it.
+    @raise Sys_error if no free name was found.
+ *)
+let open_spill_file () =
+  if not (Sys.file_exists spill_dir) then Sys.mkdir spill_dir 0o755;
+  let rec attempt remaining =
+    incr spill_counter;
+    let path = Filename.concat spill_dir (Printf.sprintf "cell-%d.txt" !spill_counter) in
+    if Sys.file_exists path && remaining > 1 then attempt (remaining - 1)
+    else
+      match open_out_gen [ Open_wronly; Open_creat; Open_excl; Open_binary ] 0o644 path with
+      | oc -> (path, oc)
+      | exception Sys_error _ when remaining > 1 -> attempt (remaining - 1)
+  in
+  attempt max_spill_attempts
+
+(**
+    Writes an output to the spill file, opening it on the first overflow.
+    Errors are only logged: in the worst case the output is dropped.
+ *)
+let spill t output =
+  try
+    let channel =
+      match t.spill with
+      | Some (_, oc) -> oc
+      | None ->
+        let path, oc = open_spill_file () in
+        log (Printf.sprintf "[Capture] Output caps exceeded, spilling to %s" path);
+        t.spill <- Some (path, oc);
+        oc
+    in
+    let text = output_text output in
+    output_string channel text;
+    t.spilled_bytes <- t.spilled_bytes + String.length text
+  with exn ->
+    log (Printf.sprintf "[Capture] Could not spill output: %s" (Printexc.to_string exn))
+
+(**
+    Adds an output to the arena. Standard stream text is appended to the
+    current chunk of the same stream; other outputs close the current chunk.
+    Outputs exceeding the caps are spilled to disk instead.
+ *)
+let add t output =
+  let size = output_size output in
+  if Option.is_some t.spill || t.bytes + size > !max_bytes || t.messages >= !max_messages then
+    spill t output
+  else begin
+    t.bytes <- t.bytes + size;
+    match output, t.chunk with
+    | Protocol.Stdout s, Some (Out, buf) | Protocol.Stderr s, Some (Err, buf) when Buffer.length buf < chunk_size ->
+      Buffer.add_string buf s
+    | (Protocol.Stdout s | Protocol.Stderr s), _ ->
+      close_chunk t;
+      let buf = Buffer.create (max 256 (String.length s)) in
+      Buffer.add_string buf s;
+      t.chunk <- Some ((match output with Protocol.Stderr _ -> Err | _ -> Out), buf);
+      t.messages <- t.messages + 1
+    | (Protocol.Value _ | Protocol.DisplayData _), _ ->
+      close_chunk t;
+      t.outputs <- output :: t.outputs;
+      t.messages <- t.messages + 1
+  end
+
+(** Adds a list of outputs to the arena, in order. *)
+let add_all t outputs = List.iter (add t) outputs
+
+(**
+    Takes the outputs accumulated since the last call, in the order they were
+    added. The caps keep counting across calls, as they apply to the whole cell.
+ *)
+let drain t =
+  close_chunk t;
+  let outputs = List.rev t.outputs in
+  t.outputs <- [];
+  outputs
+
+(** Builds the notice shown in place of the outputs written to [path]. *)
+let truncation_notice ~path ~spilled_bytes =
+  let relative = Filename.basename spill_dir ^ "/" ^ Filename.basename path in
+  let text = Printf.sprintf "[Output truncated: %d more bytes were written to %s]" spilled_bytes path in
+  let html = Printf.sprintf "<em>Output truncated: %d more bytes were written to <a href=\"%s\" target=\"_blank\">%s</a>.</em>" spilled_bytes relative relative in
+  Protocol.DisplayData (`Assoc [ ("text/plain", `String text); ("text/html", `String html) ])
+
+(**
+    Takes the remaining outputs of the cell and closes the arena. If the caps
+    were exceeded, the spill file is closed and a truncation notice linking to
+    it is appended.
+ *)
+let finish t =
+  let outputs = drain t in
+  match t.spill with
+  | None -> outputs
+  | Some (path, oc) ->
+    close_out_noerr oc;
+    t.spill <- None;
+    outputs @ [ truncation_notice ~path ~spilled_bytes:t.spilled_bytes ]
@@ -0,0 +1,46 @@
+(**
+   {1 Bounded Output Capture}
+   @author Davy Cottet
+
+   The arena in which the toplevel captures the outputs of a cell execution.
+   Consecutive standard stream writes are coalesced into chunks with amortized
+   O(1) appends, and each cell is subject to a byte cap and a message cap.
+   Outputs beyond the caps are spilled to a file in {!spill_dir} and replaced
+   by a truncation notice linking to it.
+ *)
+
+(** The maximum number of bytes of output kept in memory for a single cell. *)
+val max_bytes : int ref
+
+(** The maximum number of output messages kept for a single cell. *)
+val max_messages : int ref
+
+(** The directory of the persistent VFS where overflowing outputs are written. *)
+val spill_dir : string
+
+(** A capture arena for one cell execution. *)
+type t
+
+(** Creates an empty arena. *)
+val create : unit -> t
+
+(**
+   Adds an output to the arena. Standard stream text is appended to the
+   current chunk of the same stream. Outputs exceeding the caps are spilled.
+ *)
+val add : t -> Protocol.output -> unit
+
+(** Adds a list of outputs to the arena, in order. *)
+val add_all : t -> Protocol.output list -> unit
+
+(**
+   Takes the outputs accumulated since the last call, in the order they were
+   added. The caps keep counting across calls, as they apply to the whole cell.
+ *)
+val drain : t -> Protocol.output list
+
+(**
+   Takes the remaining outputs of the cell and closes the arena. If the caps
+   were exceeded, a truncation notice linking to the spill file is appended.
+ *)
+val finish : t -> Protocol.output list
@@ -0,0 +1,91 @@
+(**
+    {1 Toplevel Environment Checkpoints}
+    @author Davy Cottet
+
+    This module implements the [#checkpoint "name"] and [#restore "name"]
+    directives, which let users roll the toplevel back to an earlier state
+    without restarting the kernel and re-executing their cells.
+
+    A checkpoint is cheap because the toplevel state is mostly persistent data:
+    - {!Toploop.toplevel_env} is an immutable typing environment, so capturing
+      it is a pointer copy, and restoring it is a single assignment;
+    - the values of toplevel definitions are stored in the global value table
+      under names that include the unique stamp of their identifier. A later
+      redefinition of [x] creates a new entry instead of overwriting the old
+      one, so the values referenced by a restored environment are still there.
+
+    Values are shared, not copied: mutations of refs, arrays or mutable fields
+    made after a checkpoint are still visible once it is restored.
+
+    The registry of libraries loaded with [#require] is recorded as well.
+    Their JavaScript bundles cannot be unlinked, so libraries loaded after a
+    checkpoint stay available once it is restored; the restore message lists
+    them.
+
+    The state reached at the end of the toplevel setup is recorded by
+    {!save_initial}, and {!reset} returns to it: this is how [#reset] restarts
+    the toplevel without reloading anything.
+ *)
+
+open Xutil
+
+(** A snapshot of the toplevel state. *)
+type t = {
+  env : Env.t;               (** The typing environment of the toplevel. *)
+  libraries : string list;   (** The libraries loaded when the checkpoint was taken. *)
+}
+
+(** The checkpoints taken in this session, by name. *)
+let checkpoints : (string, t) Hashtbl.t = Hashtbl.create 8
+
+(**
+    Handles the argument of the [#checkpoint] directive: records the current
+    toplevel state under [name], replacing any previous checkpoint of that name.
+    @return A message confirming the checkpoint.
+ *)
+let checkpoint name =
+  let libraries = Xlibloader.loaded_libraries () in
+  Hashtbl.replace checkpoints name { env = !Toploop.toplevel_env; libraries };
+  log (Printf.sprintf "[Checkpoint] Saved checkpoint '%s'." name);
+  Printf.sprintf "Checkpoint '%s' saved." name
+
+(**
+    Handles the argument of the [#restore] directive: makes the toplevel state
+    recorded under [name] current again. No phrase is re-executed.
+    @return A message confirming the restore, or an error message if there is
+            no checkpoint of that name.
+ *)
+let restore name =
+  match Hashtbl.find_opt checkpoints name with
+  | None ->
+    let known = Hashtbl.fold (fun name _ acc -> name :: acc) checkpoints [] |> List.sort String.compare in
+    Error (Printf.sprintf "Unknown checkpoint '%s'. Known checkpoints: %s." name
+             (if known = [] then "none" else String.concat ", " known))
+  | Some { env; libraries } ->
+    Toploop.toplevel_env := env;
+    log (Printf.sprintf "[Checkpoint] Restored checkpoint '%s'." name);
+    let still_linked = List.filter (fun lib -> not (List.mem lib libraries)) (Xlibloader.loaded_libraries ()) in
+    Ok (match still_linked with
+        | [] -> Printf.sprintf "Checkpoint '%s' restored." name
+        | libs -> Printf.sprintf "Checkpoint '%s' restored. Libraries loaded since then stay available: %s." name (String.concat ", " libs))
+
+(** The toplevel state recorded right after setup, restored by {!reset}. *)
+let initial = ref None
+
+(** Records the current toplevel state as the post-setup state. *)
+let save_initial () =
+  initial := Some { env = !Toploop.toplevel_env; libraries = Xlibloader.loaded_libraries () }
+
+(**
+    Makes the post-setup toplevel state current again and forgets all named
+    checkpoints, which would otherwise keep the values of their environments
+    alive.
+    @raise Failure if {!save_initial} was never called.
+ *)
+let reset () =
+  match !initial with
+  | None -> failwith "No post-setup toplevel state was recorded."
+  | Some { env; _ } ->
+    Toploop.toplevel_env := env;
+    Hashtbl.reset checkpoints;
+    log "[Checkpoint] Toplevel reset to its post-setup state."
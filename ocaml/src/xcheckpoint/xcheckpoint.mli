@@ -0,0 +1,42 @@
+(**
+   {1 Toplevel Environment Checkpoints}
+   @author Davy Cottet
+
+   Named snapshots of the toplevel state, taken with [#checkpoint "name"] and
+   restored with [#restore "name"]. Restoring a checkpoint does not re-execute
+   any phrase: the typing environment recorded at checkpoint time becomes the
+   current one, and it still refers to the values defined at that time.
+
+   Only bindings are rolled back, not the contents of mutable values: a ref,
+   an array, a mutable record field or a [Hashtbl.t] defined before the
+   checkpoint and modified after it keeps its modified contents once the
+   checkpoint is restored. Side effects on the outside world (files, outputs,
+   loaded libraries) are not undone either.
+
+   The post-setup state is recorded as well, and [#reset] returns to it.
+ *)
+
+(**
+   Handles the argument of the [#checkpoint] directive: records the current
+   toplevel state under [name], replacing any previous checkpoint of that name.
+   @return A message confirming the checkpoint.
+ *)
+val checkpoint : string -> string
+
+(**
+   Handles the argument of the [#restore] directive. Values mutated since the
+   checkpoint keep their current contents.
+   @return A message confirming the restore, or an error message if there is
+           no checkpoint named [name].
+ *)
+val restore : string -> (string, string) result
+
+(** Records the current toplevel state as the post-setup state, restored by {!reset}. *)
+val save_initial : unit -> unit
+
+(**
+   Makes the post-setup toplevel state current again and forgets all named
+   checkpoints.
+   @raise Failure if {!save_initial} was never called.
+ *)
+val reset : unit -> unit
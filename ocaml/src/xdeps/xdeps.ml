@@ -0,0 +1,197 @@
+(**
+    {1 Cell Dependency Tracking}
+    @author Davy Cottet
+
+    This module records, for every executed cell, the toplevel names it
+    defines and the names of other cells it references, so that the cells
+    whose inputs were redefined since they ran can be found and re-run.
+
+    Names are qualified by their namespace (["value x"], ["type t"],
+    ["module M"], ["constructor C"], ...) and collected from the parse tree of
+    each phrase. References through a module path count as references to its
+    root module. Local bindings shadowing a toplevel name are not told apart,
+    which can only make a cell look dependent when it is not; names brought
+    in by [include] or [open] are not tracked.
+
+    Each definition of a name gets a new version. A cell remembers the version
+    of each name it referenced, and is stale once one of them was redefined by
+    another cell. The kernel does not know the notebook's cell ids, so a cell
+    execution is taken as a new run of a recorded cell when it has the same
+    source, or else when it redefines one of the same names.
+ *)
+
+(** A recorded cell. *)
+type cell = {
+  id : int;                           (** A unique identifier. *)
+  mutable source : string;            (** The code of the last run. *)
+  mutable defines : string list;      (** The names defined by the last run. *)
+  mutable seen : (string * int) list; (** The names of other cells referenced by the last run, with the version they had then. *)
+}
+
+(** The recorded cells, in the order of their first run. *)
+let cells : cell list ref = ref []
+
+(** The cells being run, innermost first. *)
+let running : cell list ref = ref []
+
+(** The current version of each defined name, and the cell defining it. *)
+let versions : (string, int * int) Hashtbl.t = Hashtbl.create 64
+
+(** The clock numbering versions and cells. *)
+let clock = ref 0
+
+(** Advances the clock. *)
+let tick () = incr clock; !clock
+
+(** The root module of a module path. *)
+let rec root = function
+  | Longident.Lident s -> s
+  | Longident.Ldot (lid, _) | Longident.Lapply (lid, _) -> root lid
+
+(**
+    Collects the names defined by a phrase, and the names it references.
+    @return The defined names and the referenced names.
+ *)
+let names_of_phrase = function
+  | Parsetree.Ptop_dir _ -> ([], [])
+  | Parsetree.Ptop_def structure ->
+    let open Parsetree in
+    let defs = ref [] and refs = ref [] in
+    let define ns name = defs := (ns ^ " " ^ name) :: !defs in
+    let reference ns (lid : Longident.t Location.loc) =
+      refs := (match lid.txt with Longident.Lident s -> ns ^ " " ^ s | path -> "module " ^ root path) :: !refs
+    in
+    let open Ast_iterator in
+    let iterator = {
+      default_iterator with
+      expr = (fun self e ->
+          (match e.pexp_desc with
+           | Pexp_ident lid -> reference "value" lid
+           | Pexp_construct (lid, _) -> reference "constructor" lid
+           | Pexp_field (_, lid) | Pexp_setfield (_, lid, _) -> reference "label" lid
+           | Pexp_record (fields, _) -> List.iter (fun (lid, _) -> reference "label" lid) fields
+           | _ -> ());
+          default_iterator.expr self e);
+      pat = (fun self p ->
+          (match p.ppat_desc with
+           | Ppat_construct (lid, _) -> reference "constructor" lid
+           | Ppat_record (fields, _) -> List.iter (fun (lid, _) -> reference "label" lid) fields
+           | _ -> ());
+          default_iterator.pat self p);
+      typ = (fun self t ->
+          (match t.ptyp_desc with Ptyp_constr (lid, _) -> reference "type" lid | _ -> ());
+          default_iterator.typ self t);
+      module_expr = (fun self m ->
+          (match m.pmod_desc with Pmod_ident lid -> reference "module" lid | _ -> ());
+          default_iterator.module_expr self m);
+      module_type = (fun self m ->
+          (match m.pmty_desc with Pmty_ident lid -> reference "module type" lid | _ -> ());
+          default_iterator.module_type self m);
+    } in
+    iterator.structure iterator structure;
+    let pattern_iterator = {
+      default_iterator with
+      pat = (fun self p ->
+          (match p.ppat_desc with
+           | Ppat_var name | Ppat_alias (_, name) -> define "value" name.txt
+           | _ -> ());
+          default_iterator.pat self p);
+    } in
+    let define_type (decl : type_declaration) =
+      define "type" decl.ptype_name.txt;
+      match decl.ptype_kind with
+      | Ptype_variant constructors -> List.iter (fun (c : constructor_declaration) -> define "constructor" c.pcd_name.txt) constructors
+      | Ptype_record labels -> List.iter (fun (l : label_declaration) -> define "label" l.pld_name.txt) labels
+      | Ptype_abstract | Ptype_open -> ()
+    in
+    let define_module (binding : module_binding) = Option.iter (define "module") binding.pmb_name.txt in
+    List.iter (fun (item : structure_item) ->
+        match item.pstr_desc with
+        | Pstr_value (_, bindings) -> List.iter (fun (vb : value_binding) -> pattern_iterator.pat pattern_iterator vb.pvb_pat) bindings
+        | Pstr_primitive vd -> define "value" vd.pval_name.txt
+        | Pstr_type (_, decls) -> List.iter define_type decls
+        | Pstr_typext ext -> List.iter (fun (c : extension_constructor) -> define "constructor" c.pext_name.txt) ext.ptyext_constructors
+        | Pstr_exception exn -> define "constructor" exn.ptyexn_constructor.pext_name.txt
+        | Pstr_module binding -> define_module binding
+        | Pstr_recmodule bindings -> List.iter define_module bindings
+        | Pstr_modtype decl -> define "module type" decl.pmtd_name.txt
+        | Pstr_class decls -> List.iter (fun (c : class_declaration) -> define "class" c.pci_name.txt) decls
+        | Pstr_class_type decls -> List.iter (fun (c : class_type_declaration) -> define "class type" c.pci_name.txt) decls
+        | Pstr_eval _ | Pstr_open _ | Pstr_include _ | Pstr_attribute _ | Pstr_extension _ -> ())
+      structure;
+    (List.rev !defs, List.rev !refs)
+
+(** Starts recording a run of the cell with the given source. *)
+let start source =
+  let cell = { id = tick (); source; defines = []; seen = [] } in
+  running := cell :: !running;
+  cell
+
+(**
+    Records a phrase of the innermost running cell, once it was executed
+    without error: a phrase failing to type-check or raising defines nothing,
+    and must not make the cells using its names stale. References are
+    recorded before definitions, so [let x = x + 1] depends on the previous
+    [x].
+ *)
+let record phrase =
+  match !running with
+  | [] -> ()
+  | cell :: _ ->
+    let defs, refs = names_of_phrase phrase in
+    List.iter (fun name ->
+        match Hashtbl.find_opt versions name with
+        | Some (version, definer) when definer <> cell.id && not (List.mem_assoc name cell.seen) ->
+          cell.seen <- (name, version) :: cell.seen
+        | _ -> ())
+      refs;
+    List.iter (fun name ->
+        Hashtbl.replace versions name (tick (), cell.id);
+        if not (List.mem name cell.defines) then cell.defines <- name :: cell.defines)
+      defs
+
+(**
+    Stops recording a cell run. It replaces the record of a previous run of
+    the same cell, keeping its place in the order, or is added at the end if
+    it defines a name. A cell defining nothing, such as a bare expression or
+    [#run_stale], cannot make another cell stale, and is not recorded, so
+    that the list of cells does not grow with every evaluation.
+ *)
+let finish cell =
+  running := List.filter (fun c -> c != cell) !running;
+  let previous =
+    match List.find_opt (fun old -> old.source = cell.source) !cells with
+    | Some _ as found -> found
+    | None -> List.find_opt (fun old -> List.exists (fun name -> List.mem name old.defines) cell.defines) !cells
+  in
+  match previous with
+  | None -> if cell.defines <> [] then cells := !cells @ [ cell ]
+  | Some old ->
+    Hashtbl.filter_map_inplace (fun _ (version, id) -> Some (version, if id = cell.id then old.id else id)) versions;
+    old.source <- cell.source;
+    old.defines <- cell.defines;
+    old.seen <- cell.seen
+
+(**
+    The recorded cells to re-run, in order: those referencing a name
+    redefined by another cell since they ran, and, transitively, those
+    referencing a name defined by a cell to re-run.
+    @return The sources of the cells.
+ *)
+let stale_cells () =
+  let stale = ref [] in
+  List.iter (fun cell ->
+      let outdated (name, seen_version) =
+        match Hashtbl.find_opt versions name with
+        | Some (version, definer) ->
+          definer <> cell.id && (version > seen_version || List.exists (fun s -> s.id = definer) !stale)
+        | None -> false
+      in
+      if List.exists outdated cell.seen then stale := cell :: !stale)
+    !cells;
+  List.rev_map (fun cell -> cell.source) !stale
+
+(** Forgets all recorded cells, e.g. when the toplevel environment is reset. *)
+let reset () =
+  cells := [];
+  Hashtbl.reset versions
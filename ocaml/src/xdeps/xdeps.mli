@@ -0,0 +1,34 @@
+(**
+   {1 Cell Dependency Tracking}
+   @author Davy Cottet
+
+   Records the toplevel names each executed cell defines and references, to
+   find the cells whose inputs were redefined since they ran. A cell
+   execution is taken as a new run of a recorded cell when it has the same
+   source, or else when it redefines one of the same names.
+ *)
+
+(** A cell run being recorded. *)
+type cell
+
+(** Starts recording a run of the cell with the given source. *)
+val start : string -> cell
+
+(** Records a phrase executed by the innermost cell being recorded. *)
+val record : Parsetree.toplevel_phrase -> unit
+
+(**
+   Stops recording a cell run. It replaces the record of a previous run of
+   the same cell, or is added after the recorded cells.
+ *)
+val finish : cell -> unit
+
+(**
+   The recorded cells referencing a name redefined by another cell since they
+   ran, and transitively the cells depending on them.
+   @return Their sources, in the order the cells were first run.
+ *)
+val stale_cells : unit -> string list
+
+(** Forgets all recorded cells. *)
+val reset : unit -> unit
@@ -22,6 +22,9 @@ let () = log "[XFS] Module loaded."
  *)
 let fs_ref : Js.Unsafe.any Js.Opt.t ref = ref Js.null
 
+(** Whether the device has been mounted at `/drive/`. *)
+let mounted = ref false
+
 (**
     A helper to safely retrieve the cached FS object.
     @raise Failure if the FS has not been initialized by calling {!mount_drive}.
@@ -51,9 +54,11 @@ let get_fs () =
    
     The function includes error handling and will log critical failures to the
     console if the Emscripten `FS` object cannot be found or the device fails
-    to mount.
+    to mount. Calling it again once the device is mounted, as a kernel restart
+    that reuses the toplevel does, has no effect.
  *)
 let mount_drive () =
+  if !mounted then log "[XFS] mount_drive: Device already mounted at /drive/." else
   try
     (* Step 1: Find and cache the Emscripten FS object if not already done. *)
     if not (Js.Opt.test !fs_ref) then (
@@ -138,6 +143,7 @@ let mount_drive () =
         ("device", Js.Unsafe.inject device_obj)
       |])
     |]);
+    mounted := true;
     log "[XFS] SUCCESS: Mounted Emscripten FS device from OCaml at /drive/";
 
     (* Step 4: Change the current working directory to the new mount point. *)
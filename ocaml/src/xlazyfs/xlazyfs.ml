@@ -0,0 +1,148 @@
+(**
+    {1 Lazy Fault-In of VFS Files}
+    @author Davy Cottet
+
+    Makes a directory of the `/static/` VFS device list files whose content is
+    only fetched when they are first used. Most sessions only touch a handful
+    of the standard library modules, and need their `.cmt`/`.cmti` files only
+    when documentation is requested, so downloading all of them at startup is
+    mostly wasted.
+
+    The `/static/` device of `js_of_ocaml` is an in-memory device. Its
+    [exists], [isFile] and [readdir] methods are extended so that the files of
+    the manifest are visible before they are loaded: both the toplevel and
+    Merlin look modules up in the listing of their load path directories. Its
+    [open], [stat] and [lstat] methods fault a pending file in first, with the
+    synchronous [fetch] function given to {!mount}, then proceed as usual.
+    Files written by other means, e.g. by a background prefetch with
+    {!provide}, are no longer pending.
+ *)
+
+open Js_of_ocaml
+open Xutil
+
+(** The root of the device extended by this module. *)
+let device_root = "/static/"
+
+(** The files of the manifest not loaded yet, by path relative to {!device_root}. *)
+let pending : (string, unit) Hashtbl.t = Hashtbl.create 512
+
+(** The synchronous fetch function faulting the files in, set by {!mount}. *)
+let fetcher : (string -> string option) ref = ref (fun _ -> None)
+
+(** Whether the methods of the device were extended already. *)
+let installed = ref false
+
+(** Finds the in-memory device mounted at {!device_root}. *)
+let static_device () =
+  let mount_points = Js.to_array (Js.Unsafe.get (Js.Unsafe.get Js.Unsafe.global (Js.string "jsoo_runtime")) (Js.string "jsoo_mount_point")) in
+  match Array.find_opt (fun mount -> Js.to_string (Js.Unsafe.get mount (Js.string "path")) = device_root) mount_points with
+  | Some mount -> Js.Unsafe.get mount (Js.string "device")
+  | None -> failwith ("No device mounted at " ^ device_root)
+
+(** Calls the original method [meth] of the device with the arguments of the call being intercepted. *)
+let call_original device meth args : Js.Unsafe.any =
+  Js.Unsafe.meth_call meth "apply" [| Js.Unsafe.inject device; Js.Unsafe.inject args |]
+
+(** The path relative to the device given as first argument of a method, without a trailing slash. *)
+let name_of args =
+  let name = Js.to_string (Js.Unsafe.get args 0) in
+  if String.ends_with ~suffix:"/" name then String.sub name 0 (String.length name - 1) else name
+
+(**
+    Loads a pending file into the device. The file only stops being pending
+    once it is fetched: after a failed fetch, e.g. while offline, it stays
+    listed and the next access tries again.
+ *)
+let fault_in name =
+  let started = now_ms () in
+  match !fetcher (Filename.basename name) with
+  | Some content ->
+    Hashtbl.remove pending name;
+    Sys_js.create_file ~name:(device_root ^ name) ~content;
+    log (Printf.sprintf "[LazyFS] Faulted in %s (%d bytes, %.1f ms)." name (String.length content) (now_ms () -. started))
+  | None -> log (Printf.sprintf "[LazyFS] Could not fault in %s, it will be fetched again on its next use." name)
+
+(**
+    Tells whether [name] is a pending file. A pending file that the original
+    device holds already, written without {!provide}, stops being pending.
+ *)
+let is_pending device exists name =
+  Hashtbl.mem pending name
+  && begin
+    let held = Js.to_bool (Js.Unsafe.meth_call exists "call" [| Js.Unsafe.inject device; Js.Unsafe.inject (Js.string name) |]) in
+    if held then Hashtbl.remove pending name;
+    not held
+  end
+
+(** Replaces the method [meth_name] of the device, if it has one, with [f original args]. *)
+let override device meth_name f =
+  let original = Js.Unsafe.get device (Js.string meth_name) in
+  if Js.Optdef.test original then
+    Js.Unsafe.set device (Js.string meth_name)
+      (Js.Unsafe.callback_with_arguments (fun args -> f original args))
+
+(** Extends the methods of the device, once. *)
+let install () =
+  if not !installed then begin
+    let device = static_device () in
+    let exists = Js.Unsafe.get device (Js.string "exists") in
+    let listed original args =
+      if is_pending device exists (name_of args) then Js.Unsafe.inject Js._true else call_original device original args
+    in
+    let faulting original args =
+      let name = name_of args in
+      if is_pending device exists name then fault_in name;
+      call_original device original args
+    in
+    override device "exists" listed;
+    override device "isFile" listed;
+    override device "open" faulting;
+    override device "stat" faulting;
+    override device "lstat" faulting;
+    override device "readdir" (fun original args ->
+      let dir = name_of args in
+      let entries : Js.js_string Js.t Js.js_array Js.t = Js.Unsafe.coerce (call_original device original args) in
+      let listed = Hashtbl.create 64 in
+      Array.iter (fun entry -> Hashtbl.replace listed (Js.to_string entry) ()) (Js.to_array entries);
+      Hashtbl.iter (fun name () ->
+        if Filename.dirname name = dir && not (Hashtbl.mem listed (Filename.basename name)) then
+          ignore (entries##push (Js.string (Filename.basename name)))) pending;
+      Js.Unsafe.inject entries);
+    installed := true
+  end
+
+(** The path of [file] in [dir], relative to {!device_root}. *)
+let relative_path ~dir file =
+  let prefix = String.length device_root in
+  Filename.concat (String.sub dir prefix (String.length dir - prefix)) file
+
+(**
+    Makes files of a directory of the `/static/` device available lazily.
+    @param dir The absolute path of the directory, e.g. ["/static/cmis"].
+    @param files The names of the files of the manifest. Files the directory
+                 already holds are ignored.
+    @param fetch Fetches the content of a file, given its name, synchronously.
+ *)
+let mount ~dir ~files ~fetch =
+  if not (String.starts_with ~prefix:device_root dir) then invalid_arg ("Xlazyfs.mount: " ^ dir);
+  install ();
+  fetcher := fetch;
+  List.iter (fun file ->
+    let path = Filename.concat dir file in
+    if not (Sys.file_exists path) then Hashtbl.replace pending (relative_path ~dir file) ()) files;
+  log (Printf.sprintf "[LazyFS] %d file(s) of %s will be fetched on first use." (Hashtbl.length pending) dir)
+
+(** Tells whether a file is known but not loaded yet. *)
+let is_lazy ~dir file = Hashtbl.mem pending (relative_path ~dir file)
+
+(**
+    Writes the content of a pending file fetched ahead of its first use, e.g.
+    by a background prefetch. Files already loaded are left untouched.
+ *)
+let provide ~dir file content =
+  if is_lazy ~dir file then begin
+    Hashtbl.remove pending (relative_path ~dir file);
+    let path = Filename.concat dir file in
+    if not (Sys.file_exists path) then Sys_js.create_file ~name:path ~content
+  end
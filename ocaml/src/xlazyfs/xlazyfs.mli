@@ -0,0 +1,32 @@
+(**
+   {1 Lazy Fault-In of VFS Files}
+   @author Davy Cottet
+
+   Makes a directory of the `/static/` VFS device list files that are only
+   fetched when they are first opened. The files of the manifest are visible
+   to [Sys.file_exists] and [Sys.readdir] before they are loaded, so that the
+   toplevel and Merlin find them in their load path.
+ *)
+
+(**
+   Makes files of a directory of the `/static/` device available lazily.
+   @param dir The absolute path of the directory, e.g. ["/static/cmis"].
+   @param files The names of the files of the manifest. Files the directory
+                already holds are ignored.
+   @param fetch Fetches the content of a file, given its name, synchronously.
+                It is called on the first [open] or [stat] of the file.
+   @raise Invalid_argument if [dir] is not on the `/static/` device.
+ *)
+val mount : dir:string -> files:string list -> fetch:(string -> string option) -> unit
+
+(** Tells whether a file of a directory is known but not loaded yet. *)
+val is_lazy : dir:string -> string -> bool
+
+(**
+   Writes the content of a pending file fetched ahead of its first use, e.g.
+   by a background prefetch. Files already loaded are left untouched.
+   @param dir The directory of the file.
+   @param file The name of the file.
+   @param content Its content.
+ *)
+val provide : dir:string -> string -> string -> unit
@@ -35,6 +35,99 @@ let get_and_clear_outputs () =
   extra_outputs := [];
   result
 
+(**
+    The function flushing pending outputs to the frontend. It is installed by
+    the toplevel for the duration of each cell execution and does nothing
+    outside of it.
+ *)
+let flush_hook = ref (fun () -> ())
+
+(**
+    Internal function for the toplevel to install the function used by
+    {!flush_outputs} to stream pending outputs. This is not intended for direct
+    use by end-users.
+    @param f The function flushing all pending outputs of the running cell.
+ *)
+let set_flush_hook f =
+  flush_hook := f
+
+(**
+    Publishes the outputs produced so far by the running cell (standard streams
+    and rich outputs) without waiting for the cell to finish. Call it from long
+    computations to report progress.
+    @example [`for i = 1 to 100 do step i; Printf.printf "%d%%\n" i; flush_outputs () done`]
+ *)
+let flush_outputs () =
+  flush stdout;
+  flush stderr;
+  !flush_hook ()
+
+(**
+    Publishes the outputs produced so far, like {!flush_outputs}, then gives
+    control back to the JavaScript event loop until its next turn, so that
+    network completions, timers and other promises can make progress. The
+    running cell awaits the returned promise before its next phrase.
+    @example [`let rec loop i = if i <= 100 then (step i; Lwt.bind (yield ()) (fun () -> loop (i + 1))) else Lwt.return_unit;; loop 1`]
+ *)
+let yield () =
+  flush_outputs ();
+  Js_of_ocaml_lwt.Lwt_js.yield ()
+
+(**
+    The timings of a toplevel phrase, as measured when the [#time true]
+    directive is active.
+ *)
+type timing = {
+  compile_ms : float;       (** Time spent type-checking and compiling the phrase to JavaScript, in milliseconds. *)
+  run_ms : float;           (** Time spent running the compiled phrase, in milliseconds. *)
+  heap_delta : int option;  (** Change of the JavaScript heap size, in bytes, if the engine reports it. *)
+}
+
+(** The timings of the last phrase executed with [#time true]. *)
+let last = ref None
+
+(**
+    Internal function for the toplevel to record the timings of a phrase.
+    This is not intended for direct use by end-users.
+ *)
+let set_last_timing timing =
+  last := Some timing
+
+(**
+    Returns the timings of the last phrase executed while the [#time true]
+    directive was active.
+    @example [`#time true;; let _ = fib 30;; match last_timing () with Some t -> t.run_ms | None -> nan`]
+ *)
+let last_timing () = !last
+
+(**
+    The depth and length budgets of the toplevel value printer, applied at the
+    start of the next cell. Each call to {!set_print_budget} stores a new pair,
+    so the toplevel can tell that it was called even with unchanged budgets.
+ *)
+let budget = ref (100, 300)
+
+(**
+    Sets the budgets of the toplevel value printer for the next cells. Parts
+    of a value beyond them are elided with [...], so that printing a huge value
+    costs no more than printing a small one. The [#print_depth] and
+    [#print_length] directives override them until this function is called
+    again.
+    @param depth The maximum nesting depth printed.
+    @param length The maximum number of nodes printed.
+ *)
+let set_print_budget ?depth ?length () =
+  let current_depth, current_length = !budget in
+  budget := (Option.value ~default:current_depth depth, Option.value ~default:current_length length)
+
+(**
+    Internal function for the toplevel to read the printer budgets.
+    This is not intended for direct use by end-users.
+    @return The depth and length budgets, as the pair stored by the last call
+    to {!set_print_budget}.
+ *)
+let print_budget () = !budget
+
 (**
     A generic helper to create a display data object with a single MIME type
     and add it to the output list.
@@ -173,4 +266,229 @@ let output_pdf_base64 s =
     @param s A string containing a valid Graphviz dot specification.
  *)
 let output_dot s =
-  create_and_add_display_data "application/vnd.graphviz.dot" (`String s)
\ No newline at end of file
+  create_and_add_display_data "application/vnd.graphviz.dot" (`String s)
+
+(* --- Benchmarking --- *)
+
+(**
+    A statistical micro-benchmark harness, in the style of `core_bench`.
+
+    Each test is first warmed up, so that the JavaScript engine has compiled it
+    with its optimizing tier. It is then run in batches of geometrically
+    increasing sizes, each batch being timed with the high-resolution
+    {!Xutil.now_ms} clock, until the time quota of the test is spent. The time
+    per run is the slope of the ordinary least squares regression of batch
+    time on batch size: fixed per-batch costs (timer reads, loop setup) end up
+    in the intercept, and occasional pauses of the garbage collector weigh
+    little against the whole series of batches.
+ *)
+module Bench = struct
+  (** A named benchmark. *)
+  type test = { name : string; run : unit -> unit }
+
+  (** The estimate produced for a test. *)
+  type result = {
+    name : string;           (** The name of the test. *)
+    time_per_run_ns : float; (** The estimated time of one run, in nanoseconds. *)
+    ci95_ns : float;         (** The half-width of the 95% confidence interval of the estimate, in nanoseconds. *)
+    r_square : float;        (** The coefficient of determination of the regression. *)
+    runs : int;              (** The total number of runs measured. *)
+    batches : int;           (** The number of batches measured. *)
+  }
+
+  (**
+      Creates a test. The result of [f] is kept opaque to the compiler, so
+      that its computation cannot be optimized away.
+      @param name The name displayed in the results.
+      @param f The code to measure.
+   *)
+  let test name f = { name; run = (fun () -> ignore (Sys.opaque_identity (f ()))) }
+
+  (** Runs [f] [n] times and returns the elapsed time in milliseconds. *)
+  let time_batch f n =
+    let start = Xutil.now_ms () in
+    for _ = 1 to n do f () done;
+    Xutil.now_ms () -. start
+
+  (** Fits [t = a + b * n] by ordinary least squares; returns [b], its standard error and R². *)
+  let regress points =
+    let m = float_of_int (List.length points) in
+    let mean f = List.fold_left (fun acc p -> acc +. f p) 0. points /. m in
+    let mean_n = mean fst and mean_t = mean snd in
+    let sxx = List.fold_left (fun acc (n, _) -> acc +. ((n -. mean_n) ** 2.)) 0. points in
+    let sxy = List.fold_left (fun acc (n, t) -> acc +. ((n -. mean_n) *. (t -. mean_t))) 0. points in
+    let syy = List.fold_left (fun acc (_, t) -> acc +. ((t -. mean_t) ** 2.)) 0. points in
+    let slope = if sxx > 0. then sxy /. sxx else mean_t /. mean_n in
+    let intercept = mean_t -. (slope *. mean_n) in
+    let ss_res = List.fold_left (fun acc (n, t) -> acc +. ((t -. intercept -. (slope *. n)) ** 2.)) 0. points in
+    let std_err = if m > 2. && sxx > 0. then sqrt (ss_res /. (m -. 2.) /. sxx) else nan in
+    let r_square = if syy > 0. then 1. -. (ss_res /. syy) else 1. in
+    (slope, std_err, r_square)
+
+  (**
+      Measures a test.
+      @param warmup_ms The time spent running the test before measuring it.
+      @param quota_ms The time spent measuring it.
+   *)
+  let measure_one ~warmup_ms ~quota_ms (test : test) =
+    let warmup_end = Xutil.now_ms () +. warmup_ms in
+    while Xutil.now_ms () < warmup_end do test.run () done;
+    let deadline = Xutil.now_ms () +. quota_ms in
+    let rec loop size points runs =
+      if Xutil.now_ms () >= deadline && List.length points >= 3 then (points, runs)
+      else begin
+        let n = int_of_float (Float.round size) in
+        let t = time_batch test.run n in
+        loop (Float.max (size *. 1.05) (size +. 1.)) ((float_of_int n, t) :: points) (runs + n)
+      end
+    in
+    let points, runs = loop 1. [] 0 in
+    let slope, std_err, r_square = regress points in
+    { name = test.name; time_per_run_ns = slope *. 1e6; ci95_ns = 1.96 *. std_err *. 1e6;
+      r_square; runs; batches = List.length points }
+
+  (**
+      Measures each test in turn.
+      @param warmup_ms The time spent warming up each test (default: 100 ms).
+      @param quota_ms The time spent measuring each test (default: 1000 ms).
+      @return The estimates, in the order of the tests.
+   *)
+  let measure ?(warmup_ms = 100.) ?(quota_ms = 1000.) tests =
+    List.map (measure_one ~warmup_ms ~quota_ms) tests
+
+  (** Formats a duration given in nanoseconds with an adapted unit. *)
+  let format_ns ns =
+    let a = Float.abs ns in
+    if a < 1e3 then Printf.sprintf "%.2f ns" ns
+    else if a < 1e6 then Printf.sprintf "%.2f us" (ns /. 1e3)
+    else if a < 1e9 then Printf.sprintf "%.2f ms" (ns /. 1e6)
+    else Printf.sprintf "%.2f s" (ns /. 1e9)
+
+  (**
+      Displays results as a comparative table, each test being also expressed
+      as a percentage of the slowest one, and optionally as a bar chart.
+      @param chart Whether to also render a Vega-Lite chart (default: [false]).
+   *)
+  let display ?(chart = false) results =
+    let slowest = List.fold_left (fun acc r -> Float.max acc r.time_per_run_ns) 0. results in
+    let percentage r = if slowest > 0. then 100. *. r.time_per_run_ns /. slowest else 100. in
+    let rows = List.map (fun r ->
+      [ r.name; format_ns r.time_per_run_ns; "± " ^ format_ns r.ci95_ns; Printf.sprintf "%.4f" r.r_square;
+        string_of_int r.runs; Printf.sprintf "%.2f%%" (percentage r) ]) results
+    in
+    let header = [ "Name"; "Time/Run"; "95% CI"; "R²"; "Runs"; "Percentage" ] in
+    let widths = List.fold_left (fun ws row -> List.map2 (fun w cell -> max w (String.length cell)) ws row)
+        (List.map String.length header) rows in
+    let text_row row = String.concat "  " (List.map2 (fun w cell -> cell ^ String.make (w - String.length cell) ' ') widths row) in
+    let text = String.concat "\n" (text_row header :: List.map text_row rows) in
+    let html_row tag row = "<tr>" ^ String.concat "" (List.map (fun cell -> Printf.sprintf "<%s>%s</%s>" tag cell tag) row) ^ "</tr>" in
+    let escape s = String.concat "&lt;" (String.split_on_char '<' (String.concat "&amp;" (String.split_on_char '&' s))) in
+    let html = "<table>" ^ html_row "th" header ^ String.concat "" (List.map (fun row -> html_row "td" (List.map escape row)) rows) ^ "</table>" in
+    output_display_data (`Assoc [ ("text/plain", `String text); ("text/html", `String html) ]);
+    if chart then
+      output_vegalite (Yojson.Safe.to_string (`Assoc [
+        ("$schema", `String "https://vega.github.io/schema/vega-lite/v5.json");
+        ("data", `Assoc [ ("values", `List (List.map (fun r ->
+           `Assoc [ ("name", `String r.name); ("ns", `Float r.time_per_run_ns);
+                    ("low", `Float (r.time_per_run_ns -. r.ci95_ns)); ("high", `Float (r.time_per_run_ns +. r.ci95_ns)) ]) results)) ]);
+        ("encoding", `Assoc [ ("y", `Assoc [ ("field", `String "name"); ("type", `String "nominal"); ("sort", `Null); ("title", `Null) ]) ]);
+        ("layer", `List [
+           `Assoc [ ("mark", `String "bar");
+                    ("encoding", `Assoc [ ("x", `Assoc [ ("field", `String "ns"); ("type", `String "quantitative"); ("title", `String "Time per run (ns)") ]) ]) ];
+           `Assoc [ ("mark", `String "rule");
+                    ("encoding", `Assoc [ ("x", `Assoc [ ("field", `String "low"); ("type", `String "quantitative") ]);
+                                          ("x2", `Assoc [ ("field", `String "high") ]) ]) ] ]) ]))
+
+  (**
+      Measures the tests and displays the results.
+      @example [`Bench.(run ~chart:true [ test "List" (fun () -> List.init 100 Fun.id); test "Array" (fun () -> Array.init 100 Fun.id) ])`]
+   *)
+  let run ?warmup_ms ?quota_ms ?chart tests =
+    display ?chart (measure ?warmup_ms ?quota_ms tests)
+end
+
+(**
+    Data-parallel evaluation on a pool of Web Workers (worker threads in
+    Node.js).
+
+    A cell runs on a single JavaScript thread. A pool spawns workers that each
+    run their own instance of the kernel's OCaml runtime, load the libraries
+    required so far and compile the given source files, like [#mod_use]. The
+    function to apply is designated by its path in those files (e.g.
+    ["Sim.run"]), since closures cannot be sent to another thread; inputs and
+    results cross threads through [Marshal].
+
+    The workers themselves are managed by a backend installed by the kernel
+    (see {!set_backend}); this module only splits the inputs into chunks and
+    merges the results back in order.
+ *)
+module Parallel = struct
+  (** A pool of workers, as provided by the backend. *)
+  type pool = {
+    size : int;                                           (** The number of workers. *)
+    run : string -> string array -> string array Lwt.t;  (** Applies a function to marshalled chunks. *)
+    shutdown : unit -> unit;                              (** Terminates the workers. *)
+  }
+
+  (** Internal function for the backend to build a pool. *)
+  let make_pool ~size ~run ~shutdown = { size; run; shutdown }
+
+  (** The function spawning pools, installed by the kernel. *)
+  let backend : (?workers:int -> sources:string list -> unit -> pool) option ref = ref None
+
+  (** Internal function for the kernel to install the function spawning pools. *)
+  let set_backend spawn = backend := Some spawn
+
+  (**
+      Spawns a pool of workers.
+      @param workers The number of workers (default: the number of cores, minus one).
+      @param sources The source files compiled in each worker, like [#mod_use].
+      @raise Failure if parallel evaluation is not available in this kernel.
+   *)
+  let create ?workers ?(sources = []) () =
+    match !backend with
+    | Some spawn -> spawn ?workers ~sources ()
+    | None -> failwith "Xlib.Parallel is not available in this kernel."
+
+  (** The number of workers of a pool. *)
+  let size pool = pool.size
+
+  (** Terminates the workers of a pool. Pending calls are rejected. *)
+  let shutdown pool = pool.shutdown ()
+
+  (**
+      Applies a function of the pool's source files to every input, in
+      parallel. The inputs are split into chunks that are balanced across the
+      workers as they become idle.
+      As with [Marshal], the result type is not checked: annotate it.
+      @param chunk_size The number of inputs sent to a worker at once
+                        (default: enough for about four chunks per worker).
+      @param name The path of a one-argument function, such as ["Sim.run"].
+      @return The results, in the order of the inputs.
+      @example [`(Parallel.map pool "Sim.run" (List.init 64 Fun.id) : float list Lwt.t)`]
+   *)
+  let map pool ?chunk_size name inputs =
+    let inputs = Array.of_list inputs in
+    let count = Array.length inputs in
+    let chunk_size =
+      match chunk_size with
+      | Some size -> max 1 size
+      | None -> max 1 ((count + 4 * pool.size - 1) / (4 * pool.size))
+    in
+    let chunks =
+      Array.init ((count + chunk_size - 1) / chunk_size) (fun i ->
+          let first = i * chunk_size in
+          Marshal.to_string (Array.sub inputs first (min chunk_size (count - first))) [])
+    in
+    Lwt.map
+      (fun outputs -> Array.to_list (Array.concat (Array.to_list (Array.map (fun output -> Marshal.from_string output 0) outputs))))
+      (pool.run name chunks)
+
+  (**
+      Applies a function of the pool's source files to every input in
+      parallel, like {!map}, and folds the results in order with [reduce].
+      @example [`Parallel.map_reduce pool "Sim.run" ~reduce:( +. ) ~init:0. inputs`]
+   *)
+  let map_reduce pool ?chunk_size name ~reduce ~init inputs =
+    Lwt.map (List.fold_left reduce init) (map pool ?chunk_size name inputs)
+end
@@ -14,6 +14,69 @@
  *)
 val get_and_clear_outputs : unit -> Protocol.output list
 
+(**
+  Internal function for the toplevel to install the function used by
+  {!flush_outputs} to stream pending outputs. This is not intended for direct
+  use by end-users.
+  @param f The function flushing all pending outputs of the running cell.
+ *)
+val set_flush_hook : (unit -> unit) -> unit
+
+(**
+  Publishes the outputs produced so far by the running cell (standard streams
+  and rich outputs) without waiting for the cell to finish. Call it from long
+  computations to report progress.
+ *)
+val flush_outputs : unit -> unit
+
+(**
+  Publishes the outputs produced so far, like {!flush_outputs}, then gives
+  control back to the JavaScript event loop until its next turn, so that
+  network completions, timers and other promises can make progress.
+  @return A promise resolved on the next turn of the event loop.
+ *)
+val yield : unit -> unit Lwt.t
+
+(**
+  The timings of a toplevel phrase, as measured when the [#time true]
+  directive is active.
+ *)
+type timing = {
+  compile_ms : float;       (** Time spent type-checking and compiling the phrase to JavaScript, in milliseconds. *)
+  run_ms : float;           (** Time spent running the compiled phrase, in milliseconds. *)
+  heap_delta : int option;  (** Change of the JavaScript heap size, in bytes, if the engine reports it. *)
+}
+
+(**
+  Internal function for the toplevel to record the timings of a phrase.
+  This is not intended for direct use by end-users.
+ *)
+val set_last_timing : timing -> unit
+
+(**
+  Returns the timings of the last phrase executed while the [#time true]
+  directive was active, or [None] if no phrase was timed yet.
+ *)
+val last_timing : unit -> timing option
+
+(**
+  Sets the budgets of the toplevel value printer for the next cells. Parts of
+  a value beyond them are elided with [...]; the [#expand] directive prints
+  more of an elided value. The [#print_depth] and [#print_length] directives
+  override them until this function is called again.
+  @param depth The maximum nesting depth printed (default: 100).
+  @param length The maximum number of nodes printed (default: 300).
+ *)
+val set_print_budget : ?depth:int -> ?length:int -> unit -> unit
+
+(**
+  Internal function for the toplevel to read the printer budgets.
+  This is not intended for direct use by end-users.
+  @return The depth and length budgets, as the pair stored by the last call
+  to {!set_print_budget}.
+ *)
+val print_budget : unit -> int * int
+
 (**
   Renders a full MIME bundle as a cell output. This is the most flexible
   function for creating rich output with multiple representations.
@@ -105,3 +168,100 @@ val output_vega : string -> unit
     @param s A string containing a valid Graphviz dot specification.
  *)
 val output_dot : string -> unit
+
+(**
+  A statistical micro-benchmark harness, in the style of `core_bench`. Tests
+  are warmed up, then run in batches of increasing sizes; the time per run is
+  estimated by least squares regression of batch time on batch size.
+ *)
+module Bench : sig
+  (** A named benchmark. *)
+  type test
+
+  (** The estimate produced for a test. *)
+  type result = {
+    name : string;           (** The name of the test. *)
+    time_per_run_ns : float; (** The estimated time of one run, in nanoseconds. *)
+    ci95_ns : float;         (** The half-width of the 95% confidence interval of the estimate, in nanoseconds. *)
+    r_square : float;        (** The coefficient of determination of the regression. *)
+    runs : int;              (** The total number of runs measured. *)
+    batches : int;           (** The number of batches measured. *)
+  }
+
+  (**
+    Creates a test.
+    @param name The name displayed in the results.
+    @param f The code to measure. Its result is kept opaque to the compiler.
+   *)
+  val test : string -> (unit -> 'a) -> test
+
+  (**
+    Measures each test in turn.
+    @param warmup_ms The time spent warming up each test (default: 100 ms).
+    @param quota_ms The time spent measuring each test (default: 1000 ms).
+    @return The estimates, in the order of the tests.
+   *)
+  val measure : ?warmup_ms:float -> ?quota_ms:float -> test list -> result list
+
+  (**
+    Displays results as a comparative table, and optionally as a bar chart.
+    @param chart Whether to also render a Vega-Lite chart (default: [false]).
+   *)
+  val display : ?chart:bool -> result list -> unit
+
+  (** Measures the tests and displays the results. *)
+  val run : ?warmup_ms:float -> ?quota_ms:float -> ?chart:bool -> test list -> unit
+end
+
+(**
+  Data-parallel evaluation on a pool of Web Workers (worker threads in
+  Node.js). Each worker runs its own OCaml runtime with the libraries required
+  so far and the pool's source files compiled in. The function to apply is
+  designated by its path in those files, and inputs and results are
+  marshalled, so they must not contain closures.
+ *)
+module Parallel : sig
+  (** A pool of workers. *)
+  type pool
+
+  (**
+    Spawns a pool of workers.
+    @param workers The number of workers (default: the number of cores, minus one).
+    @param sources The source files compiled in each worker, like [#mod_use].
+    @raise Failure if parallel evaluation is not available in this kernel.
+   *)
+  val create : ?workers:int -> ?sources:string list -> unit -> pool
+
+  (** The number of workers of a pool. *)
+  val size : pool -> int
+
+  (** Terminates the workers of a pool. Pending calls are rejected. *)
+  val shutdown : pool -> unit
+
+  (**
+    Applies a function of the pool's source files to every input, in
+    parallel. As with [Marshal], the result type is not checked: annotate it.
+    @param chunk_size The number of inputs sent to a worker at once
+                      (default: enough for about four chunks per worker).
+    @param name The path of a one-argument function, such as ["Sim.run"].
+    @return The results, in the order of the inputs.
+   *)
+  val map : pool -> ?chunk_size:int -> string -> 'a list -> 'b list Lwt.t
+
+  (** Like {!map}, then folds the results in order with [reduce]. *)
+  val map_reduce : pool -> ?chunk_size:int -> string -> reduce:('b -> 'b -> 'b) -> init:'b -> 'a list -> 'b Lwt.t
+
+  (**
+    Internal function for the kernel to build a pool from its workers. This is
+    not intended for direct use by end-users.
+    @param run Applies the named function to marshalled arrays of inputs,
+               returning marshalled arrays of results in the same order.
+   *)
+  val make_pool : size:int -> run:(string -> string array -> string array Lwt.t) -> shutdown:(unit -> unit) -> pool
+
+  (**
+    Internal function for the kernel to install the function spawning pools.
+    This is not intended for direct use by end-users.
+   *)
+  val set_backend : (?workers:int -> sources:string list -> unit -> pool) -> unit
+end
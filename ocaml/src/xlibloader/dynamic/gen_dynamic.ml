@@ -27,8 +27,24 @@ let () =
         (* Sort for deterministic output. *)
         let sorted_files = List.sort_uniq String.compare artifact_files in
         List.iter (fun file -> Printf.fprintf out "  %S;\n" file) sorted_files;
-        Printf.fprintf out "]\n"
+        Printf.fprintf out "]\n";
+        (* The hexadecimal MD5 digest of each file, which the loader checks and caches it by. *)
+        Printf.fprintf out "\nlet digests : (string * string) list = [\n";
+        List.iter (fun file ->
+            Printf.fprintf out "  (%S, %S);\n" file (Digest.to_hex (Digest.file (Filename.concat dynamic_stdlib_dir file))))
+          sorted_files;
+        Printf.fprintf out "]\n";
+        (* The archive packing all the files above, fetched in one request when present. *)
+        let pack = "stdlib.xpack" in
+        let pack_path = Filename.concat dynamic_stdlib_dir pack in
+        if Sys.file_exists pack_path
+        then begin
+          Printf.fprintf out "\nlet pack : string option = Some %S\n" pack;
+          (* The digest of the archive identifies its index in the persistent cache of the loader. *)
+          Printf.fprintf out "\nlet pack_digest : string option = Some %S\n" (Digest.to_hex (Digest.file pack_path))
+        end
+        else Printf.fprintf out "\nlet pack : string option = None\n\nlet pack_digest : string option = None\n"
       with Sys_error _ ->
         Printf.eprintf "Warning: 'dynamic/stdlib' directory not found. Generating empty dynamic list.\n%!";
-        Printf.fprintf out "]\n"
+        Printf.fprintf out "]\n\nlet digests : (string * string) list = []\n\nlet pack : string option = None\n\nlet pack_digest : string option = None\n"
     )
\ No newline at end of file
@@ -13,12 +13,31 @@
         asynchronously fetches the remaining standard library artifacts (`.cmi`,
         `.cmt`, `.cmti`) from a specified base URL and writes them to the VFS.
         This ensures Merlin has full access to the standard library for
-        completion and documentation.
+        completion and documentation. The artifacts are listed at once but
+        faulted in on first use with {!Xlazyfs}, each one with a byte range
+        request into the {!Xpack} archive packing them, and the most
+        frequently used ones are prefetched in the background.
    
     3.  **On-Demand Dynamic Loading:** When a user issues a `#require "lib_name"`
         directive in a notebook, the {!load_on_demand} function is called. It
         fetches the pre-compiled JavaScript bundle and all associated Merlin
-        artifacts for that specific library.
+        artifacts for that specific library, from the archive of the library.
+        When some of the artifacts were already loaded with another library,
+        only the index of the archive and the byte ranges of the missing
+        members are fetched.
+
+    A standard library file missing from its archive, or whose archive cannot
+    be fetched, is fetched on its own.
+
+    The build records the MD5 digest of every file in the manifests
+    (`Dynamic_files.digests` and `External_libs.libraries`). Files are
+    verified against them, cached by them in the {!Xcache}, and shared by
+    them between libraries: a content needed by several libraries is left
+    out of their archives, served once, content-addressed, as
+    `<digest>.blob`, which never goes stale in the HTTP cache either, and
+    fetched once even when the libraries are loaded together. A file
+    whose name is already used by a different content is reported and left
+    out, rather than silently replacing the other one.
    
     This hybrid approach ensures a fast initial startup while providing comprehensive
     and extensible language support.
@@ -32,57 +51,529 @@ open Merlin_utils.Std
 (** The designated path within the `js_of_ocaml` VFS where all Merlin artifacts are stored. *)
 let merlin_vfs_path = "/static/cmis"
 
+(**
+    The registry of the libraries loaded with {!load_on_demand}, in loading
+    order (most recent first). A bundle can only be executed once per session,
+    as its modules stay linked even when the toplevel environment is restored.
+ *)
+let loaded = ref []
+
+(** The names of the libraries loaded so far, in loading order. *)
+let loaded_libraries () = List.rev !loaded
+
+(**
+    The number of bytes requested first when only some members of an archive
+    are needed: enough for the header and the index of most archives, which
+    then take a single request.
+ *)
+let index_probe = 32768
+
+(** The digests of the files of {!merlin_vfs_path} known to the loader, by name. *)
+let vfs_digests : (string, string) Hashtbl.t = Hashtbl.create 512
+
+(** Tells whether a content matches its expected digest, if one is known. *)
+let matches digest content =
+  match digest with
+  | Some digest -> String.equal (Xcache.key_of_content content) digest
+  | None -> true
+
+(** Indexes the members of an archive by name. *)
+let members_table members =
+  let table = Hashtbl.create 64 in
+  List.iter members ~f:(fun (name, content) -> Hashtbl.replace table name content);
+  table
+
+(** The index of an {!Xpack} archive, fetched with {!fetch_index}. *)
+type pack_index = {
+  pack_url : string;                          (** The URL of the archive. *)
+  data_offset : int;                          (** The offset of the data in the archive. *)
+  entries : (string, Xpack.entry) Hashtbl.t;  (** The members of the archive, by name. *)
+}
+
+(** Downloads the raw index of an {!Xpack} archive, in a single request for most archives. *)
+let download_index ~group ~url =
+  let* head = Xnetwork.async_get_range ~group url ~offset:0 ~length:index_probe in
+  match Option.bind head ~f:Xpack.index_size, head with
+  | Some index_size, Some head ->
+    if Xpack.data_offset ~index_size <= String.length head then Lwt.return (Some (Stdlib.String.sub head Xpack.header_size index_size))
+    else Xnetwork.async_get_range ~group ~check:(fun index -> Stdlib.String.length index = index_size)
+        url ~offset:Xpack.header_size ~length:index_size
+  | _ -> Lwt.return_none
+
+(**
+    Fetches the index of an {!Xpack} archive, from the {!Xcache} when its key
+    is known, and downloads it otherwise. A cached index that cannot be read
+    is downloaded again, and replaced in the cache.
+    @param group The group of the requests.
+    @param key The key of the index in the cache, such as the digest of the
+               archive, which identifies its content.
+    @param url The URL of the archive.
+    @return The index, or [None] if the archive could not be fetched or read.
+ *)
+let fetch_index ~group ~key ~url =
+  let parse index =
+    Option.map (Xpack.parse_index index) ~f:(fun entries ->
+      let table = Hashtbl.create 512 in
+      List.iter entries ~f:(fun (entry : Xpack.entry) -> Hashtbl.replace table entry.name entry);
+      { pack_url = url; data_offset = Xpack.data_offset ~index_size:(String.length index); entries = table })
+  in
+  let download () =
+    let* index = download_index ~group ~url in
+    let parsed = Option.bind index ~f:parse in
+    (match key, index, parsed with
+     | Some key, Some index, Some _ -> Lwt.async (fun () -> Xcache.put_all [ (key, index) ])
+     | _ -> ());
+    Lwt.return parsed
+  in
+  let* cached =
+    match key with
+    | Some key -> let* found = Xcache.get_all [ key ] in Lwt.return (Hashtbl.find_opt found key)
+    | None -> Lwt.return_none
+  in
+  match Option.map cached ~f:parse with
+  | Some (Some index) -> Lwt.return (Some index)
+  | Some None ->
+    log (Printf.sprintf "[Loader] The cached index of %s cannot be read, downloading it again." url);
+    download ()
+  | None -> download ()
+
+(** Stores intact members of an archive in the {!Xcache}, in the background. *)
+let cache_members members =
+  if members <> [] then
+    Lwt.async (fun () ->
+      Xcache.put_all (List.map members ~f:(fun ((entry : Xpack.entry), content) -> (Digest.to_hex entry.digest, content))))
+
+(**
+    Fetches members of an archive whose index is known. Members held by the
+    {!Xcache} are read from it; the others are downloaded by byte ranges,
+    neighbouring members sharing a request, and stored in the cache. A range
+    holding a truncated or damaged member is fetched again, and members whose
+    digest still does not match are left out.
+    @param group The group of the requests.
+    @param index The index of the archive.
+    @param names The names of the members to fetch. Unknown names are ignored.
+    @return The intact members fetched, by name.
+ *)
+let fetch_members ~group index names =
+  let wanted = List.filter_map names ~f:(Hashtbl.find_opt index.entries) in
+  let* cached = Xcache.get_all (List.map wanted ~f:(fun (entry : Xpack.entry) -> Digest.to_hex entry.digest)) in
+  let hits = List.filter_map wanted ~f:(fun (entry : Xpack.entry) ->
+      match Hashtbl.find_opt cached (Digest.to_hex entry.digest) with
+      | Some content when Xpack.verify entry content -> Some (entry.name, content)
+      | _ -> None) in
+  let wanted = List.filter wanted ~f:(fun (entry : Xpack.entry) -> not (List.mem_assoc entry.name ~map:hits)) in
+  log (Printf.sprintf "[Loader] Fetching %d of the %d members of %s (%d cached)."
+         (List.length wanted) (Hashtbl.length index.entries) index.pack_url (List.length hits));
+  let spans = Xpack.spans wanted in
+  let requests = List.map spans ~f:(fun (first, last, entries) -> ((index.data_offset + first, last - first), (first, entries))) in
+  let intact range content =
+    let first, entries = List.assoc range requests in
+    List.for_all entries ~f:(fun entry -> Option.is_some (Xpack.member_of_span ~first content entry))
+  in
+  let* ranges = Xnetwork.async_get_ranges ~group ~check:intact index.pack_url (List.map requests ~f:fst) in
+  let downloaded =
+    List.concat (List.map2 spans ranges ~f:(fun (first, _, entries) range ->
+        match range with
+        | None -> []
+        | Some range ->
+          List.filter_map entries ~f:(fun (entry : Xpack.entry) ->
+            Option.map ~f:(fun content -> (entry, content)) (Xpack.member_of_span ~first range entry))))
+  in
+  cache_members downloaded;
+  Lwt.return (members_table (hits @ List.map downloaded ~f:(fun ((entry : Xpack.entry), content) -> (entry.name, content))))
+
+(**
+    Fetches members of an {!Xpack} archive. When all of them are needed and
+    no {!Xcache} is available, the archive is fetched whole, in one request.
+    Otherwise its index is fetched first, then only the members that are
+    neither cached nor already present, by byte ranges. An archive, or a
+    range, holding a member that does not match its digest is fetched again.
+    @param group The group of the requests.
+    @param key The key of the index of the archive in the cache, if known.
+    @param url The URL of the archive.
+    @param names The names of the members to fetch, or [None] for all of them.
+    @return The intact members fetched, by name, or [None] if the archive could
+            not be fetched or read.
+ *)
+let fetch_pack ~group ~key ~url names =
+  match names with
+  | None ->
+    let* archive = Xnetwork.async_get ~group ~check:Xpack.intact url in
+    Lwt.return (Option.bind archive ~f:(fun archive -> Option.map ~f:members_table (Xpack.read archive)))
+  | Some names ->
+    let* index = fetch_index ~group ~key ~url in
+    match index with
+    | None -> Lwt.return_none
+    | Some index -> let* members = fetch_members ~group index names in Lwt.return (Some members)
+
+(**
+    Fetches a standard library file synchronously, when the compiler or
+    Merlin opens it before it was prefetched: from the archive when its index
+    is known, by a single byte range, and on its own otherwise. A file from
+    the archive is also stored in the {!Xcache} for the next sessions.
+ *)
+let fault_in ~url index filename =
+  let from_pack =
+    match Option.bind index ~f:(fun index -> Option.map (Hashtbl.find_opt index.entries filename) ~f:(fun entry -> (index, entry))) with
+    | None -> None
+    | Some (index, (entry : Xpack.entry)) ->
+      match Xnetwork.sync_get ~range:(index.data_offset + entry.offset, entry.size) index.pack_url with
+      | Some content when Xpack.verify entry content -> cache_members [ (entry, content) ]; Some content
+      | _ -> None
+  in
+  match from_pack with
+  | Some _ -> from_pack
+  | None -> Xnetwork.sync_get ~check:(matches (Hashtbl.find_opt vfs_digests filename)) (Filename.concat url filename)
+
+(**
+    The standard library files the toplevel reads while it is set up: they
+    are fetched before {!setup} completes, rather than faulted in one by one.
+ *)
+let critical_files = [ "xlib.cmi"; "camlinternalFormatBasics.cmi" ]
+
+(**
+    The standard library files used by most sessions, fetched first by
+    {!load_interfaces} so that their first use does not wait for the network.
+ *)
+let frequent_files = [
+  "camlinternalFormat.cmi"; "stdlib__List.cmi"; "stdlib__Array.cmi"; "stdlib__String.cmi";
+  "stdlib__Bytes.cmi"; "stdlib__Char.cmi"; "stdlib__Int.cmi"; "stdlib__Float.cmi";
+  "stdlib__Option.cmi"; "stdlib__Result.cmi"; "stdlib__Seq.cmi"; "stdlib__Fun.cmi";
+  "stdlib__Printf.cmi"; "stdlib__Format.cmi"; "stdlib__Buffer.cmi"; "stdlib__Hashtbl.cmi";
+  "stdlib__Map.cmi"; "stdlib__Set.cmi"; "stdlib__Random.cmi"; "lwt.cmi"; "lwt_js.cmi";
+]
+
+(** The root URL of the standard library files, set by {!setup}. *)
+let stdlib_url = ref ""
+
+(** The index of the archive of the standard library, fetched by {!setup}. *)
+let stdlib_index : pack_index option ref = ref None
+
+(**
+    Fetches standard library files ahead of their first use and writes them to
+    the VFS, unless they were faulted in meanwhile. A file that cannot be
+    fetched is left to be faulted in on its first use.
+    @param priority The priority of the requests.
+    @param files The names of the files.
+    @return The number of files written.
+ *)
+let prefetch_files ~priority files =
+  let group = Xnetwork.group priority in
+  let files = List.filter files ~f:(fun file -> Xlazyfs.is_lazy ~dir:merlin_vfs_path file) in
+  let* members =
+    match !stdlib_index with
+    | Some index -> fetch_members ~group index files
+    | None -> Lwt.return (Hashtbl.create 0)
+  in
+  let* written =
+    Lwt_list.map_p (fun file ->
+        let* content =
+          match Hashtbl.find_opt members file with
+          | Some content -> Lwt.return (Some content)
+          | None ->
+            Xnetwork.async_get ~group ~check:(matches (Hashtbl.find_opt vfs_digests file)) (Filename.concat !stdlib_url file)
+        in
+        match content with
+        | Some content when Xlazyfs.is_lazy ~dir:merlin_vfs_path file ->
+          Xlazyfs.provide ~dir:merlin_vfs_path file content;
+          Lwt.return 1
+        | Some _ -> Lwt.return 0
+        | None ->
+          log (Printf.sprintf "[Loader] Could not prefetch %s, it will be fetched on first use." file);
+          Lwt.return 0)
+      files
+  in
+  Lwt.return (List.fold_left written ~init:0 ~f:( + ))
+
+(**
+    Loads the interfaces of the standard library not loaded yet, the
+    {!frequent_files} first. This is the first background tier of the startup.
+    @return The number of files loaded.
+ *)
+let load_interfaces () =
+  let* frequent = prefetch_files ~priority:Xnetwork.Background frequent_files in
+  let* others = prefetch_files ~priority:Xnetwork.Background (List.filter Dynamic_files.files ~f:(fun file -> Filename.check_suffix file ".cmi")) in
+  Lwt.return (frequent + others)
+
+(**
+    Loads the `.cmt` and `.cmti` files of the standard library not loaded yet,
+    which Merlin only reads for documentation. This is the second background
+    tier of the startup.
+    @return The number of files loaded.
+ *)
+let load_documentation () =
+  prefetch_files ~priority:Xnetwork.Background (List.filter Dynamic_files.files ~f:(fun file ->
+    Filename.check_suffix file ".cmt" || Filename.check_suffix file ".cmti"))
+
 (**
     Performs the initial file setup for the kernel environment.
    
     This function orchestrates the loading of all files necessary for the OCaml
     standard library to function correctly within the toplevel and Merlin. It
     first writes any statically-linked files (like `stdlib.cmi`) to the virtual
-    filesystem, then asynchronously fetches all other standard library artifacts
-    (`.cmt`, `.cmti`, and other `.cmi` files) from the server.
+    filesystem, then makes all other standard library artifacts (`.cmt`,
+    `.cmti`, and other `.cmi` files) available lazily with {!Xlazyfs}: they are
+    listed in the VFS at once, but each one is only fetched when it is first
+    opened. The index of the archive of the standard library is fetched, so
+    that a file is faulted in with a single byte range request, and only the
+    {!critical_files} are fetched before the promise resolves. On a warm
+    start, the index is read from the {!Xcache}, which keeps the artifacts
+    across sessions, and every standard library file it holds is written to
+    the VFS in one lookup, before any file can be faulted in, so that only the
+    files missing from the cache are fetched. This is the
+    critical tier of the startup: {!load_interfaces} and {!load_documentation}
+    load the rest in the background.
    
     This function must be called and awaited successfully *before* the OCaml
     toplevel or Merlin engine are initialized to prevent `Env.Error` exceptions.
    
+    @param preloaded Artifacts fetched elsewhere, e.g. by the kernel that
+                     spawned this worker, written to the VFS instead of being
+                     fetched.
     @param base_url The root URL from which to fetch the dynamic standard library files.
-    @return A promise that resolves when all initial files have been loaded.
+    @return A promise that resolves when the files are available, to the
+            number of files written to the VFS: the static, cached,
+            preloaded and critical files.
  *)
-let setup ~base_url:url =
+let setup ?(preloaded = []) ~base_url:url =
   log "[Loader] Initial setup started.";
 
   (* --- Static Loading --- *)
   log (Printf.sprintf "[Loader] Writing %d static files to VFS path: %s" (List.length Static_files.files) merlin_vfs_path);
-  List.iter Static_files.files ~f:(fun (name, content) ->
-    let path = Filename.concat merlin_vfs_path name in
-    if not (Sys.file_exists path) then (
-      log (Printf.sprintf "[Loader] Writing static file: %s" path);
-      Js_of_ocaml.Sys_js.create_file ~name:path ~content
-    ) else (
-      log (Printf.sprintf "[Loader] Skipping static file, already exists: %s" path)
-    ));
-
-  (* --- Initial Dynamic Loading (Simplified) --- *)
-  log (Printf.sprintf "[Loader] Asynchronously fetching %d dynamic artifact files from base URL: %s" (List.length Dynamic_files.files) url);
-  
-  let fetch_one_file filename =
-    let vfs_path = Filename.concat merlin_vfs_path filename in
-    if Sys.file_exists vfs_path then begin
-      log (Printf.sprintf "[Loader] Skipping async download, file already exists: %s" vfs_path);
-      Lwt.return_unit
-    end else begin
-      let fetch_url = Filename.concat url filename in
-      log (Printf.sprintf "[Loader] Fetching dynamic file: %s" fetch_url);
-      let* content_opt = Xnetwork.async_get fetch_url in
-      Option.iter content_opt ~f:(fun content ->
-        log (Printf.sprintf "[Loader] SUCCESS: Fetched and writing to VFS: %s" vfs_path);
-        Js_of_ocaml.Sys_js.create_file ~name:vfs_path ~content);
-      Lwt.return_unit
-    end
+  let static =
+    List.filter Static_files.files ~f:(fun (name, content) ->
+      let path = Filename.concat merlin_vfs_path name in
+      if not (Sys.file_exists path) then (
+        log (Printf.sprintf "[Loader] Writing static file: %s" path);
+        Js_of_ocaml.Sys_js.create_file ~name:path ~content;
+        true
+      ) else (
+        log (Printf.sprintf "[Loader] Skipping static file, already exists: %s" path);
+        false
+      ))
+  in
+
+  (* --- Lazy Dynamic Loading --- *)
+  (* The files kept by the Xcache from earlier sessions are looked up at once, while the index is fetched. *)
+  let cached = Xcache.get_all (List.map Dynamic_files.digests ~f:snd) in
+  let* index =
+    match Dynamic_files.pack with
+    | Some pack -> fetch_index ~group:(Xnetwork.group Xnetwork.Critical) ~key:Dynamic_files.pack_digest ~url:(Filename.concat url pack)
+    | None -> Lwt.return_none
   in
+  log (Printf.sprintf "[Loader] Listing %d dynamic artifact files, fetched on first use from base URL: %s" (List.length Dynamic_files.files) url);
+  stdlib_url := url;
+  stdlib_index := index;
+  List.iter Dynamic_files.digests ~f:(fun (file, digest) -> Hashtbl.replace vfs_digests file digest);
+  let* cached = cached in
+  Xlazyfs.mount ~dir:merlin_vfs_path ~files:Dynamic_files.files ~fetch:(fault_in ~url index);
+  let from_cache =
+    List.filter Dynamic_files.digests ~f:(fun (file, digest) ->
+      match Hashtbl.find_opt cached digest with
+      | Some content when matches (Some digest) content && Xlazyfs.is_lazy ~dir:merlin_vfs_path file ->
+        Xlazyfs.provide ~dir:merlin_vfs_path file content;
+        true
+      | _ -> false)
+  in
+  if from_cache <> [] then log (Printf.sprintf "[Loader] %d file(s) read from the cache." (List.length from_cache));
+  let preloaded =
+    List.filter preloaded ~f:(fun (file, content) ->
+      if Xlazyfs.is_lazy ~dir:merlin_vfs_path file then (Xlazyfs.provide ~dir:merlin_vfs_path file content; true)
+      else if not (Sys.file_exists (Filename.concat merlin_vfs_path file)) then
+        (Js_of_ocaml.Sys_js.create_file ~name:(Filename.concat merlin_vfs_path file) ~content; true)
+      else false)
+  in
+  if preloaded <> [] then log (Printf.sprintf "[Loader] %d preloaded file(s) written." (List.length preloaded));
+  let* critical = prefetch_files ~priority:Xnetwork.Critical critical_files in
+  log (Printf.sprintf "[Loader] %d critical file(s) fetched. Setup complete." critical);
+  Lwt.return (List.length static + List.length from_cache + List.length preloaded + critical)
+
+(**
+    Lists the artifacts of {!merlin_vfs_path} fetched so far, from the
+    standard library or with a library: the files with a known digest that are
+    not pending in the {!Xlazyfs}. The statically embedded files are left out.
+    @return The names and contents of the files.
+ *)
+let fetched_files () =
+  Hashtbl.fold (fun file _ files ->
+      let path = Filename.concat merlin_vfs_path file in
+      if Xlazyfs.is_lazy ~dir:merlin_vfs_path file || not (Sys.file_exists path) then files
+      else (file, Js_of_ocaml.Sys_js.read_file ~name:path) :: files)
+    vfs_digests []
+
+(**
+    The downloads of a library's JavaScript bundle and Merlin artifacts,
+    started by {!prefetch} ahead of its loading. Contents are kept in memory
+    rather than written to the VFS: an artifact visible to the type checker
+    before its bundle is executed would let code compile against modules that
+    are not linked yet.
+ *)
+type fetch = {
+  groups : Xnetwork.group list;                    (** The groups of the downloads, including the shared ones. *)
+  js : string option Lwt.t;                        (** The content of the JavaScript bundle. *)
+  contents : (string * string option Lwt.t) list;  (** The content of each artifact, by file name. *)
+}
+
+(**
+    Raises the priority of the downloads of a fetch that are still waiting,
+    including the downloads it shares with another library.
+ *)
+let promote fetch priority = List.iter fetch.groups ~f:(fun group -> Xnetwork.promote group priority)
+
+(**
+    The fetches started by {!prefetch}, by library name, until the library is
+    loaded or the fetch expires.
+ *)
+let prefetched : (string, fetch) Hashtbl.t = Hashtbl.create 8
 
-  let* () = Lwt.join (List.map ~f:fetch_one_file Dynamic_files.files) in
-  log "[Loader] All initial dynamic files processed. Setup complete.";
-  Lwt.return_unit
+(**
+    The time in seconds after which the downloads of a prefetch that no
+    [#require] claimed are dropped, e.g. when the scan guessed wrong.
+ *)
+let prefetch_lifetime = 300.
+
+(**
+    The downloads of contents in flight, with their group, by digest, shared
+    by the libraries needing them.
+ *)
+let in_flight : (string, Xnetwork.group * string option Lwt.t) Hashtbl.t = Hashtbl.create 64
+
+(** The digest of a file of a library, as recorded in the manifest. *)
+let digest_of (lib : External_libs.library) file =
+  Option.map (List.find_opt lib.digests ~f:(fun (name, _) -> String.equal name file)) ~f:snd
+
+(**
+    Tells whether an artifact of a library is in the VFS already, e.g. loaded
+    with another library. An artifact of the same name but with a different
+    content is reported: the one loaded first is kept.
+ *)
+let is_present lib file =
+  Sys.file_exists (Filename.concat merlin_vfs_path file)
+  && begin
+    (match Hashtbl.find_opt vfs_digests file, digest_of lib file with
+     | Some loaded, Some digest when not (String.equal loaded digest) ->
+       log (Printf.sprintf "[Loader] WARNING: '%s' differs from the version already loaded, which is kept." file)
+     | _ -> ());
+    true
+  end
+
+(**
+    Writes an artifact of a library to the VFS and records its digest. An
+    artifact written meanwhile, e.g. by another library sharing it, is kept.
+ *)
+let write_artifact lib file content =
+  if not (is_present lib file) then begin
+    Sys_js.create_file ~name:(Filename.concat merlin_vfs_path file) ~content;
+    Option.iter (digest_of lib file) ~f:(fun digest -> Hashtbl.replace vfs_digests file digest)
+  end
+
+(**
+    Starts the downloads of the files of a library from its archive. Artifacts
+    already in the VFS, shared with a library loaded earlier, are not fetched
+    again: only the byte ranges of the other members are. A member the archive
+    download did not deliver intact is fetched again on its own, by its byte
+    range. The artifacts that several libraries need are not in the archives,
+    as its index shows, but stored once, as blobs: they are fetched on their
+    own, by digest, and verified. Contents already being downloaded for
+    another library are shared rather than requested twice, unless that
+    download fails.
+ *)
+let start_fetch ~priority ~base_url (lib : External_libs.library) =
+  let group = Xnetwork.group priority in
+  let missing = List.filter lib.artifacts ~f:(fun artifact_file -> not (is_present lib artifact_file)) in
+  let shared, needed = List.partition missing ~f:(fun artifact_file ->
+      match digest_of lib artifact_file with
+      | Some digest -> Hashtbl.mem in_flight digest
+      | None -> false) in
+  let pack_url = Filename.concat base_url lib.pack in
+  let pack =
+    fetch_pack ~group ~key:(Some lib.pack_digest) ~url:pack_url
+      (if List.length needed = List.length lib.artifacts && not (Xcache.available ()) then None
+       else Some (lib.js_bundle :: needed))
+  in
+  (* The index tells the members of the archive from the blobs; it is only needed when a member is missing. *)
+  let index = lazy (fetch_index ~group ~key:(Some lib.pack_digest) ~url:pack_url) in
+  let member file =
+    let digest = digest_of lib file in
+    let* members = pack in
+    match Option.bind members ~f:(fun members -> Hashtbl.find_opt members file) with
+    | Some content -> Lwt.return (Some content)
+    | None ->
+      let* index = Lazy.force index in
+      match index with
+      | Some index when Hashtbl.mem index.entries file ->
+        log (Printf.sprintf "[Loader] Fetching '%s' again from %s." file lib.pack);
+        let* members = fetch_members ~group index [ file ] in
+        Lwt.return (Hashtbl.find_opt members file)
+      | _ ->
+        let url = Filename.concat base_url (match digest with Some digest -> Xpack.blob_name digest | None -> file) in
+        Xnetwork.async_get ~group ~check:(matches digest) url
+  in
+  let share file =
+    match digest_of lib file with
+    | None -> member file
+    | Some digest ->
+      match Hashtbl.find_opt in_flight digest with
+      | Some (_, download) ->
+        (* A download that failed for the other library is tried again for this one. *)
+        let* content = download in
+        if Option.is_some content then Lwt.return content else member file
+      | None ->
+        let download = member file in
+        Hashtbl.replace in_flight digest (group, download);
+        Lwt.on_termination download (fun () -> Hashtbl.remove in_flight digest);
+        download
+  in
+  let shared_groups = List.filter_map shared ~f:(fun artifact_file ->
+      Option.map (Option.bind (digest_of lib artifact_file) ~f:(Hashtbl.find_opt in_flight)) ~f:fst) in
+  if shared <> [] then
+    log (Printf.sprintf "[Loader] %d artifact(s) of '%s' shared with downloads in flight." (List.length shared) lib.pack);
+  { groups = group :: shared_groups;
+    js = member lib.js_bundle;
+    contents = List.map missing ~f:(fun artifact_file -> (artifact_file, share artifact_file)) }
+
+(**
+    Finds the library of the manifest that defines a top-level module.
+    @param module_name A module name, such as ["Graph"].
+    @return The name of the library, if it is bundled with the kernel.
+ *)
+let library_of_module module_name =
+  Hashtbl.fold (fun name (lib : External_libs.library) found ->
+      match found with
+      | Some _ -> found
+      | None -> if List.mem module_name ~set:lib.modules then Some name else None)
+    External_libs.libraries None
+
+(**
+    Starts downloading the bundle and the artifacts of a library in the
+    background, so that a later {!load_on_demand} only has to wait for what is
+    still in flight. Unknown or loaded libraries are ignored, and the waiting
+    downloads of a library already prefetched are promoted to [priority] if
+    it is higher. The downloaded contents are kept in memory for
+    {!prefetch_lifetime} seconds at most: a prefetch no [#require] claims by
+    then is dropped.
+    @param priority The priority of the downloads: [Interactive] when the
+                    library is about to be required by a submitted cell,
+                    [Background] when it is only guessed.
+    @param base_url The root URL where the library's files are stored.
+    @param name The name of the library to prefetch.
+ *)
+let prefetch ~priority ~base_url ~name =
+  match Hashtbl.find_opt External_libs.libraries name, Hashtbl.find_opt prefetched name with
+  | Some _, Some fetch -> promote fetch priority
+  | Some lib, None when not (List.mem name ~set:!loaded) ->
+      log (Printf.sprintf "[Loader] Prefetching library '%s'." name);
+      let fetch = start_fetch ~priority ~base_url lib in
+      Hashtbl.replace prefetched name fetch;
+      Lwt.async (fun () ->
+        let* () = Js_of_ocaml_lwt.Lwt_js.sleep prefetch_lifetime in
+        (match Hashtbl.find_opt prefetched name with
+         | Some unclaimed when unclaimed == fetch ->
+           log (Printf.sprintf "[Loader] Dropping the unclaimed prefetch of library '%s'." name);
+           Hashtbl.remove prefetched name
+         | _ -> ());
+        Lwt.return_unit)
+  | _ -> ()
 
 (**
     Dynamically loads a pre-compiled third-party OCaml library on-demand.
@@ -94,7 +585,9 @@ let setup ~base_url:url =
    
     The JavaScript bundle is executed to make the library's modules available, and
     the artifacts are written to the virtual filesystem to enable code completion
-    and documentation for the new library.
+    and documentation for the new library. Downloads started by {!prefetch} are
+    reused, and those still waiting are promoted to the [Interactive] priority,
+    ahead of the background downloads; a failed download is retried by the next call.
    
     @param base_url The root URL where the library's `.js` bundle and artifact files are stored.
     @param name The name of the library to load (e.g., "ocamlgraph").
@@ -105,32 +598,39 @@ let setup ~base_url:url =
 let load_on_demand ~base_url ~name : (Protocol.output, Protocol.output) result Lwt.t =
   log (Printf.sprintf "[Loader] Looking up library '%s' for on-demand loading..." name);
   match Hashtbl.find_opt External_libs.libraries name with
+  | Some _ when List.mem name ~set:!loaded ->
+      let msg = Printf.sprintf "Library '%s' is already loaded." name in
+      log (Printf.sprintf "[Loader] SKIPPED: %s" msg);
+      Lwt.return (Ok (Protocol.Stdout msg))
   | None ->
       let error_msg = Printf.sprintf "Error: Library '%s' not found. It may not be included in the kernel build." name in
       log ("[Loader] FAILURE: " ^ error_msg);
       Lwt.return (Error (Protocol.Stderr error_msg))
-  | Some { js_bundle; artifacts } ->
+  | Some ({ js_bundle; artifacts; _ } as lib) ->
+      (* Take over the prefetched downloads, if any, so a failure is not cached. *)
+      let fetch =
+        match Hashtbl.find_opt prefetched name with
+        | Some fetch -> Hashtbl.remove prefetched name; promote fetch Xnetwork.Interactive; fetch
+        | None -> start_fetch ~priority:Xnetwork.Interactive ~base_url lib
+      in
       try%lwt
         log (Printf.sprintf "[Loader] Found library. JS bundle: '%s', Artifacts: %d" js_bundle (List.length artifacts));
-        (* Fetch and execute the main JS bundle for the library. *)
+        (* Wait for the main JS bundle of the library and execute it. *)
         let js_promise =
-          let js_url = Filename.concat base_url js_bundle in
-          let* js_content_opt = Xnetwork.async_get js_url in
+          let* js_content_opt = fetch.js in
           match js_content_opt with
           | Some content -> Js.Unsafe.eval_string content |> ignore; Lwt.return_unit
-          | None -> Lwt.fail_with ("Failed to fetch JS bundle: " ^ js_url)
+          | None -> Lwt.fail_with ("Failed to fetch JS bundle: " ^ Filename.concat base_url js_bundle)
         in
-        (* Concurrently, fetch all associated Merlin artifacts. *)
-        let artifact_promises = List.map ~f:(fun artifact_file ->
-            let artifact_url = Filename.concat base_url artifact_file in
-            let* content_opt = Xnetwork.async_get artifact_url in
+        (* Concurrently, write all associated Merlin artifacts as they arrive. *)
+        let artifact_promises = List.map ~f:(fun (artifact_file, content_promise) ->
+            let* content_opt = content_promise in
             match content_opt with
             | Some content ->
-                let path = Filename.concat merlin_vfs_path artifact_file in
-                Sys_js.create_file ~name:path ~content;
+                write_artifact lib artifact_file content;
                 Lwt.return_unit
             | None -> Lwt.fail_with ("Failed to fetch artifact: " ^ artifact_file)
-          ) artifacts
+          ) fetch.contents
         in
         (* Wait for all files to be fetched and processed. *)
         let* () = Lwt.join (js_promise :: artifact_promises) in
@@ -138,6 +638,7 @@ let load_on_demand ~base_url ~name : (Protocol.output, Protocol.output) result L
 
         (* Inform the toplevel that new modules are available in this directory. *)
         Topdirs.dir_directory merlin_vfs_path;
+        loaded := name :: !loaded;
 
         let msg = Printf.sprintf "Library '%s' and its %d artifacts loaded successfully." name (List.length artifacts) in
         log (Printf.sprintf "[Loader] SUCCESS: %s" msg);
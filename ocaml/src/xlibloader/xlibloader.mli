@@ -13,21 +13,52 @@
  *)
 
 (**
-   Performs the initial file setup for the kernel environment.
+   Performs the initial file setup for the kernel environment: the critical
+   tier of the startup.
 
-   This function orchestrates the loading of all files necessary for the OCaml
-   standard library to function correctly within the toplevel and Merlin. It
-   first writes any statically-linked files (like `stdlib.cmi`) to the virtual
-   filesystem, then asynchronously fetches all other standard library artifacts
-   (`.cmt`, `.cmti`, and other `.cmi` files) from the server.
+   It writes the statically-linked files (like `stdlib.cmi`) to the virtual
+   filesystem, and makes all other standard library artifacts (`.cmt`,
+   `.cmti`, and other `.cmi` files) available lazily: they are listed in the
+   VFS, but each one is only fetched when it is first opened, unless a
+   background tier loaded it before. The files kept by the persistent cache
+   from earlier sessions are written at once, in one lookup. Only the few
+   files read while the toplevel is set up are fetched before the promise
+   resolves.
 
    This function must be called and awaited successfully *before* the OCaml
    toplevel or Merlin engine are initialized to prevent `Env.Error` exceptions.
 
+   @param preloaded Artifacts fetched elsewhere, e.g. by the kernel that
+                    spawned this worker, written to the VFS instead of being
+                    fetched.
    @param base_url The root URL from which to fetch the dynamic standard library files.
-   @return A promise that resolves when all initial files have been loaded.
+   @return A promise that resolves when the toplevel can be set up, to the
+           number of files written to the VFS.
  *)
-val setup : base_url:string -> unit Lwt.t
+val setup : ?preloaded:(string * string) list -> base_url:string -> int Lwt.t
+
+(**
+   Lists the artifacts of the VFS fetched so far, from the standard library
+   or with a library, to be passed to the [setup] of another toplevel.
+   @return The names and contents of the files.
+ *)
+val fetched_files : unit -> (string * string) list
+
+(**
+   Loads the interfaces of the standard library not loaded yet, the most
+   frequently used ones first. This is the first background tier of the
+   startup, run once the kernel is ready.
+   @return The number of files loaded.
+ *)
+val load_interfaces : unit -> int Lwt.t
+
+(**
+   Loads the `.cmt` and `.cmti` files of the standard library not loaded yet,
+   which Merlin only reads for documentation. This is the second background
+   tier of the startup.
+   @return The number of files loaded.
+ *)
+val load_documentation : unit -> int Lwt.t
 
 (**
    Dynamically loads a pre-compiled third-party OCaml library on-demand.
@@ -39,7 +70,9 @@ val setup : base_url:string -> unit Lwt.t
 
    The JavaScript bundle is executed to make the library's modules available, and
    the artifacts are written to the virtual filesystem to enable code completion
-   and documentation for the new library.
+   and documentation for the new library. Downloads started by {!prefetch} are
+   reused, and those still waiting are promoted to the [Interactive] priority,
+   ahead of the background downloads; a failed download is retried by the next call.
 
    @param base_url The root URL where the library's `.js` bundle and artifact files are stored.
    @param name The name of the library to load (e.g., "ocamlgraph").
@@ -50,4 +83,31 @@ val setup : base_url:string -> unit Lwt.t
 val load_on_demand
   :  base_url:string
   -> name:string
-  -> (Protocol.output, Protocol.output) result Lwt.t
\ No newline at end of file
+  -> (Protocol.output, Protocol.output) result Lwt.t
+
+(**
+   Starts downloading the bundle and the artifacts of a library in the
+   background, so that a later {!load_on_demand} only has to wait for what is
+   still in flight. Unknown or loaded libraries are ignored, and the waiting
+   downloads of a library already prefetched are promoted to [priority] if it
+   is higher.
+   @param priority The priority of the downloads: [Interactive] when a
+                   submitted cell is about to require the library,
+                   [Background] when the library is only guessed.
+   @param base_url The root URL where the library's files are stored.
+   @param name The name of the library to prefetch.
+ *)
+val prefetch : priority:Xnetwork.priority -> base_url:string -> name:string -> unit
+
+(**
+   Finds the library of the manifest that defines a top-level module.
+   @param module_name A module name, such as ["Graph"].
+   @return The name of the library, if it is bundled with the kernel.
+ *)
+val library_of_module : string -> string option
+
+(**
+   The names of the libraries loaded with {!load_on_demand} in this session,
+   in loading order. A library already in this list is not loaded again.
+ *)
+val loaded_libraries : unit -> string list
@@ -25,13 +25,14 @@ let stdlib_path = "/static/cmis"
 (**
  * The main Merlin configuration object.
  * It is configured to look for the standard library in the {!stdlib_path}
- * within the virtual filesystem.
+ * within the virtual filesystem, and for user modules in {!Xutil.user_cmis_path}.
  *)
 let config =
   let initial = Mconfig.initial in
   { initial with
     merlin = { initial.merlin with
-      stdlib = Some stdlib_path }}
+      stdlib = Some stdlib_path;
+      build_path = [ user_cmis_path ] }}
 
 (**
   Initializes the Merlin configuration.
@@ -69,6 +70,15 @@ let dispatch source query  =
     Query_commands.dispatch pipeline query
   )
 
+(**
+  Warms Merlin up in the background of the startup: a small buffer using the
+  most common standard library modules is type-checked, which loads their
+  interfaces into Merlin's caches before the first request of the user.
+ *)
+let warm_up () =
+  let source = Msource.make "let _ = List.map, Array.length, String.concat, Printf.sprintf, Hashtbl.create, Option.map" in
+  ignore (dispatch source (Query_protocol.Errors { lexing = true; parsing = true; typing = true }))
+
 (**
   Internal helper module for code completion logic.
   This code is adapted from Merlin's frontend tools to correctly identify
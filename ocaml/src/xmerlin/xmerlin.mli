@@ -18,6 +18,13 @@
  *)
 val initialize : unit -> unit
 
+(**
+  Warms Merlin up by type-checking a small buffer that uses the most common
+  standard library modules, which fills its caches before the first request.
+  This is the last background tier of the startup.
+ *)
+val warm_up : unit -> unit
+
 (**
   Processes a synchronous, Merlin-related action from the kernel protocol.
  
@@ -0,0 +1,523 @@
+(**
+    {1 Compiled-Module Cache for [#use] and [#mod_use]}
+    @author Davy Cottet
+
+    This module implements a content-addressed cache for OCaml source files
+    loaded from the persistent `/drive` filesystem with the `#use` and
+    `#mod_use` directives. Shared helper files are typically loaded at the top
+    of every notebook, so without a cache each kernel start re-reads, re-lexes
+    and re-parses all of them.
+
+    Every entry lives in {!cache_dir} and is keyed on the digest of the file
+    contents, the directive kind and the compiler version. An entry holds the
+    parsed toplevel phrases of the file, which only depend on its contents, so
+    an entry stays valid whatever the other files loaded. The interface of a
+    module loaded with `#mod_use` does depend on them: it is saved from the
+    environment after every load, and published to {!Xutil.user_cmis_path} so
+    that Merlin can complete on its contents.
+
+    The code produced by the toplevel is relocated against the global table of
+    the running session, so it cannot be replayed in another session and is
+    not persisted. Within a session, each file is also kept typed and
+    compiled: the additions every phrase made to the typing environment, and
+    the compiled code of the phrase.
+    Loading the file again in the same environment, i.e. with every name the
+    file refers to still bound to the same definition, runs the compiled code
+    and re-adds the typed definitions, skipping type-checking and compilation.
+ *)
+
+open Js_of_ocaml
+open Xutil
+
+let () = log "[Modcache] Module loaded."
+
+(** The directory of the persistent VFS where cache entries are stored. *)
+let cache_dir = "/drive/.xocaml_cache"
+
+(** The two directives served by the cache. *)
+type kind = Use | Mod_use
+
+(** A cache entry, marshalled to [<key>.phrases] in {!cache_dir}. *)
+type entry = {
+  version : string;                         (** The [Sys.ocaml_version] that wrote the entry. *)
+  phrases : Parsetree.toplevel_phrase list; (** The parsed contents of the file. *)
+}
+
+(** A definition a phrase added to the toplevel environment. *)
+type binding =
+  | Value of Ident.t * Types.value_description
+  | Type of Ident.t * Types.type_declaration
+  | Extension of Ident.t * Types.extension_constructor
+  | Module of Ident.t * Types.module_presence * Types.module_declaration
+  | Modtype of Ident.t * Types.modtype_declaration
+
+(** A phrase of a loaded file, as typed and compiled in this session. *)
+type compiled_phrase = {
+  bindings : binding list; (** The definitions the phrase added to the environment, in order. *)
+  run : unit -> Obj.t;     (** The compiled code of the phrase. *)
+  warnings : string;       (** The warnings of its type-checking, when they were not reported yet. *)
+}
+
+(**
+    Maps the path of each file loaded in this session to its last typed and
+    compiled version, with the key it is valid under: the cache key of the file
+    and the digest of the environment it was typed in.
+ *)
+let compiled_files : (string, string * compiled_phrase list) Hashtbl.t = Hashtbl.create 8
+
+(** The compiled phrases collected by the [toplevelCompile] observer, while a phrase of a file is executed. *)
+let captured : Js.Unsafe.any list ref option ref = ref None
+
+(** Whether the [toplevelCompile] observer has been installed. *)
+let observer_installed = ref false
+
+(** The compiled phrase kept by the [toplevelCompile] interceptor, while {!compile_phrase} compiles a phrase without running it. *)
+let deferred : Js.Unsafe.any option ref option ref = ref None
+
+(** Whether the [toplevelCompile] interceptor has been installed. *)
+let interceptor_installed = ref false
+
+(** The closure the toplevel runs in place of a phrase compiled by {!compile_phrase}: it returns [()]. *)
+let skip_run : Js.Unsafe.any = Js.Unsafe.pure_js_expr "(function (_unit) { return 0; })"
+
+(**
+    Computes the cache key of a source file.
+    @param kind The directive loading the file, since [#mod_use] wraps the phrases in a module.
+    @param source The full contents of the file.
+    @return A hexadecimal digest.
+ *)
+let cache_key kind source =
+  let kind_tag = match kind with Use -> "use" | Mod_use -> "mod_use" in
+  Digest.to_hex (Digest.string (String.concat "\000" [ Sys.ocaml_version; kind_tag; Digest.string source ]))
+
+let entry_path key = Filename.concat cache_dir (key ^ ".phrases")
+let published_cmi_path modname = Filename.concat user_cmis_path (String.uncapitalize_ascii modname ^ ".cmi")
+
+(** Derives the module name used by [#mod_use] from a file path, e.g. ["/drive/my_utils.ml"] gives ["My_utils"]. *)
+let module_name path =
+  String.capitalize_ascii (Filename.remove_extension (Filename.basename path))
+
+(** Writes a file on the `/drive` mount, which is backed by the Emscripten FS device. *)
+let write_drive_file path content =
+  Out_channel.with_open_bin path (fun oc -> Out_channel.output_string oc content)
+
+let read_file path = In_channel.with_open_bin path In_channel.input_all
+
+(**
+    Reads and validates a cache entry.
+    @return [Some entry] if the entry exists and was written by the running compiler.
+ *)
+let read_entry key =
+  let path = entry_path key in
+  if not (Sys.file_exists path) then None
+  else
+    match In_channel.with_open_bin path (fun ic -> (Marshal.from_channel ic : entry)) with
+    | entry when String.equal entry.version Sys.ocaml_version -> Some entry
+    | _ -> None
+    | exception exn ->
+      log (Printf.sprintf "[Modcache] Ignoring unreadable entry %s: %s" path (Printexc.to_string exn));
+      None
+
+(**
+    Writes a cache entry, creating {!cache_dir} if needed. Failures are only
+    logged: the cache is an optimization and must never prevent a file from loading.
+ *)
+let write_entry key entry =
+  try
+    if not (Sys.file_exists cache_dir) then Sys.mkdir cache_dir 0o755;
+    write_drive_file (entry_path key) (Marshal.to_string entry [])
+  with exn ->
+    log (Printf.sprintf "[Modcache] Could not write cache entry %s: %s" key (Printexc.to_string exn))
+
+(** Parses a whole source file into toplevel phrases, using the toplevel's own [#use] parser. *)
+let parse_source path source =
+  let lexbuf = Lexing.from_string source in
+  Location.init lexbuf path;
+  Location.input_name := path;
+  !Toploop.parse_use_file lexbuf
+
+(**
+    Wraps the contents of a file in a module definition, as [#mod_use] does.
+    @raise Failure if the file contains toplevel directives.
+ *)
+let wrap_in_module modname phrases =
+  let items =
+    List.concat_map
+      (function
+        | Parsetree.Ptop_def items -> items
+        | Parsetree.Ptop_dir _ -> failwith "Toplevel directives are not allowed in a #mod_use file.")
+      phrases
+  in
+  let open Ast_helper in
+  Parsetree.Ptop_def [ Str.module_ (Mb.mk (Location.mknoloc (Some modname)) (Mod.structure items)) ]
+
+(** Saves the signature of a freshly defined toplevel module as a `.cmi`, and publishes it for Merlin. *)
+let save_interface modname =
+  try
+    match Env.find_module_by_name (Longident.Lident modname) !Toploop.toplevel_env with
+    | _, { Types.md_type = Types.Mty_signature sg; _ } ->
+      let cmi_file = published_cmi_path modname in
+      if Sys.file_exists cmi_file then Sys.remove cmi_file;
+      ignore (Env.save_signature ~alerts:Misc.Stdlib.String.Map.empty sg (Unit_info.Artifact.from_filename cmi_file))
+    | _ -> ()
+  with exn ->
+    log (Printf.sprintf "[Modcache] Could not save interface of %s: %s" modname (Printexc.to_string exn))
+
+(** The namespaces in which the names referred to by a file are looked up. *)
+type namespace = Value_ns | Type_ns | Constructor_ns | Label_ns | Module_ns | Modtype_ns
+
+(** A name a file refers to: an unqualified name, or the first module of a qualified one. *)
+let reference namespace lid =
+  let rec head = function Longident.Lident name -> name | Ldot (lid, _) | Lapply (lid, _) -> head lid in
+  match lid with
+  | Longident.Lident name -> (namespace, name)
+  | lid -> (Module_ns, head lid)
+
+(** Collects the names a phrase refers to, with the namespace they are looked up in. *)
+let references phrase =
+  let found = ref [] in
+  let add namespace { Location.txt; _ } = found := reference namespace txt :: !found in
+  let open Ast_iterator in
+  let iterator =
+    { default_iterator with
+      expr = (fun self e ->
+        (match e.pexp_desc with
+         | Pexp_ident lid -> add Value_ns lid
+         | Pexp_construct (lid, _) -> add Constructor_ns lid
+         | Pexp_field (_, lid) | Pexp_setfield (_, lid, _) -> add Label_ns lid
+         | Pexp_record (fields, _) -> List.iter (fun (lid, _) -> add Label_ns lid) fields
+         | _ -> ());
+        default_iterator.expr self e);
+      pat = (fun self p ->
+        (match p.ppat_desc with
+         | Ppat_construct (lid, _) -> add Constructor_ns lid
+         | Ppat_record (fields, _) -> List.iter (fun (lid, _) -> add Label_ns lid) fields
+         | Ppat_type lid -> add Type_ns lid
+         | _ -> ());
+        default_iterator.pat self p);
+      typ = (fun self t ->
+        (match t.ptyp_desc with
+         | Ptyp_constr (lid, _) -> add Type_ns lid
+         | Ptyp_package (lid, _) -> add Modtype_ns lid
+         | _ -> ());
+        default_iterator.typ self t);
+      module_expr = (fun self m ->
+        (match m.pmod_desc with Pmod_ident lid -> add Module_ns lid | _ -> ());
+        default_iterator.module_expr self m);
+      module_type = (fun self m ->
+        (match m.pmty_desc with
+         | Pmty_ident lid -> add Modtype_ns lid
+         | Pmty_alias lid -> add Module_ns lid
+         | _ -> ());
+        default_iterator.module_type self m) }
+  in
+  (match phrase with
+   | Parsetree.Ptop_def str -> iterator.structure iterator str
+   | Parsetree.Ptop_dir _ -> ());
+  !found
+
+(**
+    Lists the names a phrase defines at the toplevel. The values of a
+    non-recursive binding are left out when [own] is set, since the binding
+    itself refers to the previous definitions of these names.
+ *)
+let definitions ~own phrase =
+  let names = ref [] in
+  let add namespace name = names := (namespace, name) :: !names in
+  let rec pattern_vars (p : Parsetree.pattern) =
+    match p.ppat_desc with
+    | Ppat_var { txt; _ } -> add Value_ns txt
+    | Ppat_alias (p, { txt; _ }) -> add Value_ns txt; pattern_vars p
+    | Ppat_tuple ps | Ppat_array ps -> List.iter pattern_vars ps
+    | Ppat_construct (_, Some (_, p)) | Ppat_variant (_, Some p) | Ppat_constraint (p, _)
+    | Ppat_lazy p | Ppat_exception p | Ppat_open (_, p) -> pattern_vars p
+    | Ppat_record (fields, _) -> List.iter (fun (_, p) -> pattern_vars p) fields
+    | Ppat_or (p1, p2) -> pattern_vars p1; pattern_vars p2
+    | _ -> ()
+  in
+  let constructor { Parsetree.pext_name = { txt; _ }; _ } = add Constructor_ns txt in
+  let type_declaration (decl : Parsetree.type_declaration) =
+    add Type_ns decl.ptype_name.txt;
+    match decl.ptype_kind with
+    | Ptype_variant constructors -> List.iter (fun (c : Parsetree.constructor_declaration) -> add Constructor_ns c.pcd_name.txt) constructors
+    | Ptype_record labels -> List.iter (fun (l : Parsetree.label_declaration) -> add Label_ns l.pld_name.txt) labels
+    | Ptype_abstract | Ptype_open -> ()
+  in
+  let module_name = function { Location.txt = Some name; _ } -> add Module_ns name | _ -> () in
+  let structure_item (item : Parsetree.structure_item) =
+    match item.pstr_desc with
+    | Pstr_value (Nonrecursive, _) when own -> ()
+    | Pstr_value (_, bindings) -> List.iter (fun (vb : Parsetree.value_binding) -> pattern_vars vb.pvb_pat) bindings
+    | Pstr_primitive { pval_name = { txt; _ }; _ } -> add Value_ns txt
+    | Pstr_type (_, decls) -> List.iter type_declaration decls
+    | Pstr_typext { ptyext_constructors; _ } -> List.iter constructor ptyext_constructors
+    | Pstr_exception { ptyexn_constructor; _ } -> constructor ptyexn_constructor
+    | Pstr_module { pmb_name; _ } -> module_name pmb_name
+    | Pstr_recmodule bindings -> List.iter (fun (mb : Parsetree.module_binding) -> module_name mb.pmb_name) bindings
+    | Pstr_modtype { pmtd_name = { txt; _ }; _ } -> add Modtype_ns txt
+    | _ -> ()
+  in
+  (match phrase with
+   | Parsetree.Ptop_def str -> List.iter structure_item str
+   | Parsetree.Ptop_dir _ -> ());
+  !names
+
+(** Identifies a path down to the stamps of its identifiers, which change whenever a name is redefined. *)
+let rec path_key = function
+  | Path.Pident id -> Ident.unique_name id
+  | Path.Pdot (path, name) -> path_key path ^ "." ^ name
+  | Path.Papply (functor_path, arg_path) -> path_key functor_path ^ "(" ^ path_key arg_path ^ ")"
+  | Path.Pextra_ty (path, _) -> path_key path ^ "#"
+
+(** Identifies the definition a name refers to in an environment. *)
+let resolve env (namespace, name) =
+  let lid = Longident.Lident name in
+  let type_key ty = match Types.get_desc ty with Types.Tconstr (path, _, _) -> path_key path | _ -> "?" in
+  try
+    match namespace with
+    | Value_ns -> "v:" ^ path_key (fst (Env.find_value_by_name lid env))
+    | Type_ns -> "t:" ^ path_key (fst (Env.find_type_by_name lid env))
+    | Module_ns -> "m:" ^ path_key (fst (Env.find_module_by_name lid env))
+    | Modtype_ns -> "mt:" ^ path_key (fst (Env.find_modtype_by_name lid env))
+    | Constructor_ns -> "c:" ^ type_key (Env.find_constructor_by_name lid env).cstr_res
+    | Label_ns -> "l:" ^ type_key (Env.find_label_by_name lid env).lbl_res
+  with _ -> "unbound:" ^ name
+
+(**
+    Computes the digest of the environment a file is typed in: the definitions
+    that the names it refers to, and does not define itself, are bound to.
+    @param env The environment the file is about to be loaded in.
+    @param phrases The parsed phrases of the file.
+ *)
+let environment_key env phrases =
+  let rec collect defined acc = function
+    | [] -> acc
+    | phrase :: rest ->
+      let own = definitions ~own:true phrase in
+      let external_refs =
+        List.filter (fun name -> not (List.mem name defined || List.mem name own)) (references phrase)
+      in
+      collect (definitions ~own:false phrase @ defined) (external_refs @ acc) rest
+  in
+  collect [] [] phrases
+  |> List.sort_uniq compare
+  |> List.map (resolve env)
+  |> String.concat "\000"
+  |> Digest.string
+  |> Digest.to_hex
+
+(** Raised when a phrase changed the environment in a way that cannot be replayed. *)
+exception Not_replayable
+
+(**
+    Lists the definitions added to the environment [before] to obtain [after],
+    by walking the summary of [after] back to the one of [before].
+    @raise Not_replayable if the environment was changed otherwise, e.g. by an [open].
+ *)
+let bindings_between ~before after =
+  let stop = Env.summary before in
+  let rec collect acc summary =
+    if summary == stop then acc
+    else
+      match summary with
+      | Env.Env_value (summary, id, vd) -> collect (Value (id, vd) :: acc) summary
+      | Env.Env_type (summary, id, td) -> collect (Type (id, td) :: acc) summary
+      | Env.Env_extension (summary, id, ext) -> collect (Extension (id, ext) :: acc) summary
+      | Env.Env_module (summary, id, presence, md) -> collect (Module (id, presence, md) :: acc) summary
+      | Env.Env_modtype (summary, id, mtd) -> collect (Modtype (id, mtd) :: acc) summary
+      | _ -> raise Not_replayable
+  in
+  collect [] (Env.summary after)
+
+(** Adds a definition recorded by {!bindings_between} back to an environment. *)
+let add_binding env = function
+  | Value (id, vd) -> Env.add_value id vd env
+  | Type (id, td) -> Env.add_type ~check:false id td env
+  | Extension (id, ext) -> Env.add_extension ~check:false ~rebind:false id ext env
+  | Module (id, presence, md) -> Env.add_module_declaration ~check:false id presence md env
+  | Modtype (id, mtd) -> Env.add_modtype id mtd env
+
+(** Prints a replayed definition as the toplevel prints a new one, with its value for a value. *)
+let print_binding env ppf binding =
+  let print_item ppf item = Printtyp.signature ppf [ item ] in
+  match binding with
+  | Value (id, ({ val_kind = Val_reg; _ } as vd)) ->
+    let value = Toploop.eval_value_path env (Path.Pident id) in
+    Format.fprintf ppf "@[<2>%a =@ %a@]@." print_item (Types.Sig_value (id, vd, Exported))
+      (Toploop.print_value env value) vd.val_type
+  | Value (id, vd) -> Format.fprintf ppf "%a@." print_item (Types.Sig_value (id, vd, Exported))
+  | Type (id, td) -> Format.fprintf ppf "%a@." print_item (Types.Sig_type (id, td, Trec_not, Exported))
+  | Extension (id, ext) ->
+    let status = if Path.same ext.ext_type_path Predef.path_exn then Types.Text_exception else Types.Text_first in
+    Format.fprintf ppf "%a@." print_item (Types.Sig_typext (id, ext, status, Exported))
+  | Module (id, presence, md) -> Format.fprintf ppf "%a@." print_item (Types.Sig_module (id, presence, md, Trec_not, Exported))
+  | Modtype (id, mtd) -> Format.fprintf ppf "%a@." print_item (Types.Sig_modtype (id, mtd, Exported))
+
+(** Installs the observer collecting the compiled phrases into {!captured}, once. *)
+let install_observer () =
+  if not !observer_installed then
+    observer_installed :=
+      observe_toplevel_compile (fun run -> Option.iter (fun runs -> runs := run :: !runs) !captured)
+
+(**
+    Executes a phrase with {!Toploop.execute_phrase}, recording its compiled
+    code and the definitions it added to the environment.
+    @return Whether the phrase succeeded, and its compiled version if it can be replayed.
+ *)
+let execute_and_record ppf phrase =
+  let before = !Toploop.toplevel_env in
+  let runs = ref [] in
+  captured := Some runs;
+  let ok = Fun.protect ~finally:(fun () -> captured := None) (fun () -> Toploop.execute_phrase true ppf phrase) in
+  let compiled =
+    match !runs with
+    | [ run ] when ok ->
+      (try Some { bindings = bindings_between ~before !Toploop.toplevel_env; run = Obj.magic run; warnings = "" }
+       with Not_replayable -> None)
+    | _ -> None
+  in
+  (ok, compiled)
+
+(**
+    Executes phrases in order, stopping at the first one whose evaluation fails.
+    @return Whether every phrase succeeded, and their compiled versions if all of them can be replayed.
+ *)
+let execute_phrases ppf phrases =
+  install_observer ();
+  let rec loop acc = function
+    | [] -> (true, Option.map List.rev acc)
+    | phrase :: rest ->
+      match execute_and_record ppf phrase with
+      | false, _ -> (false, None)
+      | true, compiled -> loop (Option.bind acc (fun acc -> Option.map (fun c -> c :: acc) compiled)) rest
+  in
+  loop (Some []) phrases
+
+(**
+    Runs a compiled phrase and installs the environment [extend] builds from
+    the current one and its definitions, printing them as the toplevel would,
+    after the warnings of its type-checking if they were not reported yet.
+    @return [true] if the phrase ran without raising an exception.
+ *)
+let run_in ppf extend { bindings; run; warnings } =
+  if warnings <> "" then Format.fprintf !Location.formatter_for_warnings "%s@?" warnings;
+  match run () with
+  | _ ->
+    let env = extend !Toploop.toplevel_env bindings in
+    Toploop.toplevel_env := env;
+    Printtyp.wrap_printing_env ~error:false env (fun () -> List.iter (print_binding env ppf) bindings);
+    true
+  | exception exn ->
+    Format.fprintf ppf "Exception: %s.@." (Printexc.to_string exn);
+    false
+
+(**
+    Runs the compiled phrases of a file again and re-adds their definitions to
+    the environment, printing them as the toplevel would.
+    @return [true] if every phrase ran without raising an exception.
+ *)
+let replay ppf compiled_phrases =
+  List.for_all (run_in ppf (List.fold_left add_binding)) compiled_phrases
+
+(** Installs the interceptor keeping the phrases compiled by {!compile_phrase} from running, once. *)
+let install_interceptor () =
+  if not !interceptor_installed then
+    interceptor_installed :=
+      intercept_toplevel_compile (fun run ->
+        match !deferred with
+        | Some slot -> slot := Some run; skip_run
+        | None -> run)
+
+(**
+    Type-checks and compiles a phrase as {!Toploop.execute_phrase} would, but
+    without running it: the toplevel runs a closure doing nothing instead, and
+    the compiled code is kept. The toplevel environment is left as it was,
+    and the warnings of the phrase are kept to be reported when it is run.
+    @return The compiled phrase and the environment it leads to, or [None] if
+            the phrase does not type-check, or changes the environment in a
+            way that cannot be replayed.
+ *)
+let compile_phrase phrase =
+  install_interceptor ();
+  let before = !Toploop.toplevel_env in
+  let slot = ref None in
+  let buffer = Buffer.create 256 in
+  let warnings_ppf = Format.formatter_of_buffer buffer in
+  let formatter_for_warnings = !Location.formatter_for_warnings in
+  Location.formatter_for_warnings := warnings_ppf;
+  deferred := Some slot;
+  let ok =
+    Fun.protect
+      ~finally:(fun () -> deferred := None; Location.formatter_for_warnings := formatter_for_warnings)
+      (fun () -> try Toploop.execute_phrase false (Format.formatter_of_buffer (Buffer.create 16)) phrase with _ -> false)
+  in
+  let after = !Toploop.toplevel_env in
+  Toploop.toplevel_env := before;
+  Format.pp_print_flush warnings_ppf ();
+  match !slot with
+  | Some run when ok ->
+    (try Some ({ bindings = bindings_between ~before after; run = Obj.magic run; warnings = Buffer.contents buffer }, after)
+     with Not_replayable -> None)
+  | _ -> None
+
+(**
+    Runs a phrase compiled by {!compile_phrase}, in the environment it was
+    compiled in, and installs the environment it leads to.
+    @return [true] if the phrase ran without raising an exception.
+ *)
+let run_compiled ppf (compiled, after) = run_in ppf (fun _ _ -> after) compiled
+
+(**
+    Loads a source file as the [#use] or [#mod_use] directive would, going
+    through the cache.
+
+    On a hit, the file is neither lexed nor parsed again. On a miss, the file is
+    parsed with the toplevel parser and a new entry is written. If the file was
+    already loaded in this session, in the same environment, its compiled
+    phrases are run again without being typechecked or compiled. Otherwise the
+    phrases are executed in order, stopping at the first one whose evaluation
+    fails, and their compiled version is kept for the next load. In both cases
+    their results are printed on [ppf].
+
+    @param kind Whether to execute the phrases directly ([Use]) or inside a module ([Mod_use]).
+    @param ppf The formatter receiving the toplevel's output.
+    @param path The absolute path of the source file.
+    @return [true] if every phrase executed successfully.
+    @raise exn Any typing or syntax error, exactly as {!Toploop.execute_phrase} would.
+ *)
+let load ~kind ppf path =
+  let source = read_file path in
+  let key = cache_key kind source in
+  let modname = module_name path in
+  let entry =
+    match read_entry key with
+    | Some entry ->
+      log (Printf.sprintf "[Modcache] HIT for %s (%s)" path key);
+      entry
+    | _ ->
+      log (Printf.sprintf "[Modcache] MISS for %s (%s)" path key);
+      let phrases = parse_source path source in
+      let entry = { version = Sys.ocaml_version; phrases } in
+      write_entry key entry;
+      entry
+  in
+  let phrases =
+    match kind with
+    | Use -> entry.phrases
+    | Mod_use -> [ wrap_in_module modname entry.phrases ]
+  in
+  let compiled_key = key ^ environment_key !Toploop.toplevel_env entry.phrases in
+  let ok =
+    match Hashtbl.find_opt compiled_files path with
+    | Some (valid_key, compiled_phrases) when String.equal valid_key compiled_key ->
+      log (Printf.sprintf "[Modcache] Running the compiled phrases of %s" path);
+      replay ppf compiled_phrases
+    | _ ->
+      let ok, compiled_phrases = execute_phrases ppf phrases in
+      (match compiled_phrases with
+       | Some compiled_phrases -> Hashtbl.replace compiled_files path (compiled_key, compiled_phrases)
+       | None -> Hashtbl.remove compiled_files path);
+      ok
+  in
+  if ok && kind = Mod_use then save_interface modname;
+  ok
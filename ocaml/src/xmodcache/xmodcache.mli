@@ -0,0 +1,61 @@
+(**
+   {1 Compiled-Module Cache for [#use] and [#mod_use]}
+   @author Davy Cottet
+
+   A content-addressed cache for source files loaded from the persistent
+   `/drive` filesystem with the `#use` and `#mod_use` directives.
+
+   Entries are stored in {!cache_dir} and keyed on the digest of the file
+   contents, the directive kind and the compiler version. They hold the parsed
+   phrases of the file. The interface of a module loaded with `#mod_use` is
+   published to {!Xutil.user_cmis_path} for Merlin.
+
+   Within a session, files are also kept typed and compiled, and loading one
+   again in the same environment skips its type-checking and compilation.
+ *)
+
+(** The directory of the persistent VFS where cache entries are stored. *)
+val cache_dir : string
+
+(** The two directives served by the cache. *)
+type kind = Use | Mod_use
+
+(**
+   Loads a source file as the [#use] or [#mod_use] directive would, going
+   through the cache.
+
+   On a hit, the file is neither lexed nor parsed again. On a miss, the file is
+   parsed with the toplevel parser and a new entry is written. If the file was
+   already loaded in this session, in the same environment, its compiled
+   phrases are run again without being typechecked or compiled. Otherwise the
+   phrases are executed in order, stopping at the first one whose evaluation
+   fails. In both cases their results are printed on [ppf].
+
+   @param kind Whether to execute the phrases directly ([Use]) or inside a module ([Mod_use]).
+   @param ppf The formatter receiving the toplevel's output.
+   @param path The absolute path of the source file.
+   @return [true] if every phrase executed successfully.
+   @raise exn Any typing or syntax error, exactly as {!Toploop.execute_phrase} would.
+ *)
+val load : kind:kind -> Format.formatter -> string -> bool
+
+(** A phrase typed and compiled by the toplevel, which can be run without either. *)
+type compiled_phrase
+
+(**
+   Type-checks and compiles a phrase as the toplevel would, without running
+   it, and leaves the toplevel environment as it was. Its warnings are
+   reported when it is run.
+   @return The compiled phrase and the environment it leads to, or [None] if
+           the phrase does not type-check, or changes the environment in a way
+           that cannot be replayed, e.g. with an [open].
+ *)
+val compile_phrase : Parsetree.toplevel_phrase -> (compiled_phrase * Env.t) option
+
+(**
+   Runs a phrase compiled by {!compile_phrase}, which must be done in the
+   environment it was compiled in, and installs the environment it leads to.
+   Its definitions are printed on [ppf] as the toplevel would.
+   @return [true] if the phrase ran without raising an exception.
+ *)
+val run_compiled : Format.formatter -> compiled_phrase * Env.t -> bool
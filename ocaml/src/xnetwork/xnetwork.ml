@@ -5,56 +5,167 @@
     asynchronous network requests within the browser. It abstracts the
     callback-based nature of `XmlHttpRequest` into a more convenient Lwt-based
     API for use throughout the OCaml kernel.
+
+    Asynchronous requests go through a scheduler, so that the hundreds of
+    files fetched in the background do not saturate the connections of the
+    browser. At most {!max_concurrent} requests are in flight at once; the
+    others wait in one queue per {!priority}, and a request is only started
+    when no request of a higher priority is waiting. A `#require` of the user
+    therefore always goes ahead of background prefetches, including the
+    requests of a prefetch it takes over, whose {!group} it promotes. Requests failing
+    with a network error, a server error, or content that does not pass its
+    integrity check are retried with an exponential backoff.
  *)
 
+open Js_of_ocaml
+open Js_of_ocaml_lwt
+open Lwt.Syntax
 open Xutil
 
+(** The priority classes of the requests, from the most to the least urgent. *)
+type priority =
+  | Interactive  (** A request the user is waiting for, such as a `#require`. *)
+  | Critical     (** A request needed before the kernel is ready. *)
+  | Background   (** A prefetch, or a background tier of the startup. *)
+
 (**
-    Asynchronously fetches the content of a given URL.
-   
+    A group of requests sharing a priority, such as the downloads of a
+    library. Its priority can be raised with {!promote} while its requests
+    wait, e.g. when the user requires a library prefetched in the background.
+ *)
+type group = { mutable priority : priority }
+
+(** Creates a group of requests of the given priority. *)
+let group priority = { priority }
+
+(** The maximum number of requests in flight at once. *)
+let max_concurrent = ref 6
+
+(** Sets the maximum number of requests in flight at once (at least 1). *)
+let set_max_concurrent n = max_concurrent := max 1 n; log (Printf.sprintf "[Network] At most %d requests in flight." !max_concurrent)
+
+(** The number of retries of a failed request, by default. *)
+let default_retries = 3
+
+(** The delay before the first retry, in seconds, doubled at each retry. *)
+let retry_delay = 0.25
+
+(** A request waiting for a free slot: how to start it, and its group. *)
+type waiting_request = { start : unit -> unit Lwt.t; owner : group }
+
+(** The requests waiting for a free slot, one queue per priority. *)
+let waiting : waiting_request Queue.t array = [| Queue.create (); Queue.create (); Queue.create () |]
+
+(** The number of requests in flight. *)
+let in_flight = ref 0
+
+(** The rank of a priority, which indexes {!waiting}. *)
+let rank = function Interactive -> 0 | Critical -> 1 | Background -> 2
+
+(** Starts waiting requests, most urgent first, while slots are free. *)
+let rec pump () =
+  if !in_flight < !max_concurrent then
+    match Array.find_opt (fun queue -> not (Queue.is_empty queue)) waiting with
+    | None -> ()
+    | Some queue ->
+      let { start; _ } = Queue.pop queue in
+      incr in_flight;
+      Lwt.async (fun () -> Lwt.finalize start (fun () -> decr in_flight; pump (); Lwt.return_unit));
+      pump ()
+
+(** Runs [f] once a slot is free for a request of the group, at the group's current priority. *)
+let schedule owner f =
+  let promise, resolver = Lwt.wait () in
+  Queue.push { start = (fun () -> let+ result = f () in Lwt.wakeup_later resolver result); owner } waiting.(rank owner.priority);
+  pump ();
+  promise
+
+(**
+    Raises the priority of a group of requests. Its waiting requests move to
+    the queue of the new priority, in order, behind the requests already
+    there; requests scheduled later, such as retries, use it too. A priority
+    lower than the group's is ignored.
+ *)
+let promote owner priority =
+  if rank priority < rank owner.priority then begin
+    let queue = waiting.(rank owner.priority) in
+    let others = Queue.create () in
+    Queue.iter (fun request -> Queue.push request (if request.owner == owner then waiting.(rank priority) else others)) queue;
+    Queue.clear queue;
+    Queue.transfer others queue;
+    owner.priority <- priority;
+    pump ()
+  end
+
+(**
+    Extracts the requested bytes from the body of a successful response.
+    A server ignoring the [Range] header answers with status 200 and the
+    whole content, from which the range is extracted.
+ *)
+let body_of_response ?range ~status body =
+  match range with
+  | Some (offset, length) when status = 200 ->
+    if offset > String.length body then None
+    else Some (String.sub body offset (max 0 (min length (String.length body - offset))))
+  | _ -> Some body
+
+(** Formats the value of the [Range] header requesting [length] bytes from [offset]. *)
+let range_header (offset, length) = Printf.sprintf "bytes=%d-%d" offset (offset + length - 1)
+
+(**
+    Performs an asynchronous GET request, optionally for a byte range only.
+
     This function uses the `Js_of_ocaml` bindings for the `XmlHttpRequest` API
     to perform an asynchronous GET request. It bridges the callback-based
     browser API with OCaml's Lwt library by creating a promise with `Lwt.task`.
     The promise is resolved in the `onload` or `onerror` callbacks of the request.
-   
+
     The request is configured to receive an `arraybuffer` to ensure that both
     text and binary files are handled correctly without corruption, before being
     converted to an OCaml string.
-   
+
+    @param range The offset and length of the bytes to request with a `Range`
+                 header. A server honouring it answers with status 206; one
+                 ignoring it answers with status 200 and the whole content,
+                 from which the range is then extracted.
     @param url The URL to fetch.
-    @return A promise that resolves to [`Some string`] on success, or [`None`] if the
-            fetch fails for any reason (e.g., network error, 404 status).
+    @return A promise that resolves to [Ok (content, whole)] on success, [whole]
+            being the whole content when the server ignored the range, or to
+            [Error status] on failure, the status being 0 for a network error.
  *)
-let async_get (url : string) : string option Lwt.t =
-  let open Js_of_ocaml in
+let request ?range (url : string) : (string * string option, int) result Lwt.t =
   try
     let promise, resolver = Lwt.task () in
     let req = XmlHttpRequest.create () in
     req##.responseType := Js.string "arraybuffer";
     req##_open (Js.string "GET") (Js.string url) Js._true;
+    Option.iter (fun range -> req##setRequestHeader (Js.string "Range") (Js.string (range_header range))) range;
     req##.onload
     := Dom.handler (fun _ ->
-         if req##.status = 200
+         let status = req##.status in
+         if status = 200 || (status = 206 && Option.is_some range)
          then (
            log (Printf.sprintf "[Network] Successfully fetched %s" url);
            Js.Opt.case
              (File.CoerceTo.arrayBuffer req##.response)
-             (fun () -> Lwt.wakeup_later resolver None)
+             (fun () -> Lwt.wakeup_later resolver (Error status))
              (fun response_buf ->
                let str = Typed_array.String.of_arrayBuffer response_buf in
-               Lwt.wakeup_later resolver (Some str)))
+               let whole = if status = 200 && Option.is_some range then Some str else None in
+               let content = Option.map (fun content -> (content, whole)) (body_of_response ?range ~status str) in
+               Lwt.wakeup_later resolver (Option.to_result ~none:status content)))
          else (
            log
              (Printf.sprintf
                 "[Network] Failed to fetch %s (status: %d)"
                 url
-                req##.status);
-           Lwt.wakeup_later resolver None);
+                status);
+           Lwt.wakeup_later resolver (Error status));
          Js._true);
     req##.onerror
     := Dom.handler (fun _ ->
          log (Printf.sprintf "[Network] Network error while fetching %s" url);
-         Lwt.wakeup_later resolver None;
+         Lwt.wakeup_later resolver (Error 0);
          Js._true);
     req##send Js.null;
     promise
@@ -62,5 +173,147 @@ let async_get (url : string) : string option Lwt.t =
   | exn ->
     Console.console##error
       (Js.string (Printf.sprintf "[Network] Exception: %s" (Printexc.to_string exn)));
-    Lwt.return_none
-;;
\ No newline at end of file
+    Lwt.return (Error 0)
+
+(**
+    Tells whether a failed request may succeed if retried: after a network
+    error, a server error, or a rejected content (status 200 or 206).
+ *)
+let is_transient status = status = 0 || status >= 500 || status = 200 || status = 206
+
+(**
+    Fetches a URL through the scheduler, retrying transient failures.
+    @param owner The group of the request, which gives its priority.
+    @param retries The number of retries after the first attempt.
+    @param check An integrity check of the content; a content failing it is
+                 treated as a transient failure.
+    @param range The offset and length of the bytes to request.
+    @param url The URL to fetch.
+    @return The content, with the whole content when the server ignored the
+            range, or [None] once all attempts failed.
+ *)
+let fetch ~owner ~retries ~check ?range url =
+  let rec attempt n =
+    let* result = schedule owner (fun () -> request ?range url) in
+    let failure =
+      match result with
+      | Ok (content, _) when check content -> None
+      | Ok _ -> log (Printf.sprintf "[Network] Integrity check failed for %s" url); Some 200
+      | Error status -> Some status
+    in
+    match failure, result with
+    | None, Ok result -> Lwt.return (Some result)
+    | Some status, _ when is_transient status && n < retries ->
+      let delay = retry_delay *. (2. ** float_of_int n) in
+      log (Printf.sprintf "[Network] Retrying %s in %.2f s (attempt %d of %d)" url delay (n + 2) (retries + 1));
+      let* () = Lwt_js.sleep delay in
+      attempt (n + 1)
+    | _ ->
+      log (Printf.sprintf "[Network] Giving up on %s" url);
+      Lwt.return_none
+  in
+  attempt 0
+
+(**
+    Asynchronously fetches the content of a given URL, through the scheduler.
+    @param priority The priority class of the request ([Background] by default).
+    @param group The group of the request, whose priority is used instead.
+    @param retries The number of retries of transient failures.
+    @param check An integrity check of the content, such as a digest comparison.
+    @param url The URL to fetch.
+    @return A promise that resolves to [`Some string`] on success, or [`None`] if the
+            fetch fails for any reason (e.g., network error, 404 status).
+ *)
+let async_get ?(priority = Background) ?group:owner ?(retries = default_retries) ?(check = fun _ -> true) (url : string) : string option Lwt.t =
+  let owner = Option.value owner ~default:(group priority) in
+  let+ result = fetch ~owner ~retries ~check url in
+  Option.map fst result
+
+(**
+    Asynchronously fetches a byte range of the content of a given URL, through
+    the scheduler. The result may be shorter than [length] when the content
+    ends before.
+    @param url The URL to fetch.
+    @param offset The offset of the first byte.
+    @param length The number of bytes.
+    @return A promise that resolves to [`Some string`] on success, or [`None`] on failure.
+ *)
+let async_get_range ?(priority = Background) ?group:owner ?(retries = default_retries) ?(check = fun _ -> true) (url : string) ~offset ~length : string option Lwt.t =
+  let owner = Option.value owner ~default:(group priority) in
+  let+ result = fetch ~owner ~retries ~check ~range:(offset, length) url in
+  Option.map fst result
+
+(**
+    Asynchronously fetches several byte ranges of the content of a given URL.
+    The first range is requested alone: when the server ignores the [Range]
+    header and sends the whole content, the other ranges are extracted from
+    it instead of downloading the whole content once per range. Otherwise
+    they are requested in parallel.
+    @param check An integrity check of the bytes of a range, given the range.
+    @param url The URL to fetch.
+    @param ranges The offsets and lengths of the ranges.
+    @return A promise that resolves to the bytes of each range, in order, or
+            [None] for a range that could not be fetched.
+ *)
+let async_get_ranges ?(priority = Background) ?group:owner ?(retries = default_retries) ?(check = fun _ _ -> true) (url : string) ranges : string option list Lwt.t =
+  let owner = Option.value owner ~default:(group priority) in
+  let get range = fetch ~owner ~retries ~check:(check range) ~range url in
+  match ranges with
+  | [] -> Lwt.return []
+  | first :: others ->
+    let* result = get first in
+    match result with
+    | Some (content, Some whole) ->
+      log (Printf.sprintf "[Network] %s ignores byte ranges: extracting %d more range(s) from the whole content." url (List.length others));
+      Lwt.return (Some content :: List.map (fun range ->
+          Option.bind (body_of_response ~range ~status:200 whole) (fun content -> if check range content then Some content else None)) others)
+    | _ ->
+      let+ others = Lwt_list.map_p (fun range -> let+ result = get range in Option.map fst result) others in
+      Option.map fst result :: others
+
+(**
+    Fetches the content of a given URL, or a byte range of it, synchronously.
+    The calling thread is blocked until the response arrives, which browsers
+    only allow in workers, where the kernel runs. This is reserved to the few
+    places that cannot wait for a promise, such as a file read by the
+    compiler being faulted in by {!Xlazyfs}. The request bypasses the
+    scheduler, as the user is waiting for it, and transient failures are
+    retried at once.
+    @param retries The number of retries of transient failures.
+    @param check An integrity check of the content.
+    @param range The offset and length of the bytes to request.
+    @param url The URL to fetch.
+    @return The content on success, or [None] on failure.
+ *)
+let sync_get ?(retries = default_retries) ?(check = fun _ -> true) ?range (url : string) : string option =
+  let once () =
+    try
+      let req = XmlHttpRequest.create () in
+      req##_open (Js.string "GET") (Js.string url) Js._false;
+      req##.responseType := Js.string "arraybuffer";
+      Option.iter (fun range -> req##setRequestHeader (Js.string "Range") (Js.string (range_header range))) range;
+      req##send Js.null;
+      let status = req##.status in
+      if status = 200 || (status = 206 && Option.is_some range) then
+        Js.Opt.case (File.CoerceTo.arrayBuffer req##.response)
+          (fun () -> Error status)
+          (fun response_buf ->
+            match body_of_response ?range ~status (Typed_array.String.of_arrayBuffer response_buf) with
+            | Some content when check content -> Ok content
+            | _ -> Error status)
+      else Error status
+    with
+    | exn ->
+      log (Printf.sprintf "[Network] Exception in synchronous fetch of %s: %s" url (Printexc.to_string exn));
+      Error 0
+  in
+  let rec attempt n =
+    match once () with
+    | Ok content -> Some content
+    | Error status when is_transient status && n < retries -> attempt (n + 1)
+    | Error status ->
+      log (Printf.sprintf "[Network] Failed to fetch %s synchronously (status: %d)" url status);
+      None
+  in
+  attempt 0
+;;
@@ -5,8 +5,38 @@
     asynchronous network requests within the browser. It abstracts the
     callback-based nature of `XmlHttpRequest` into a more convenient Lwt-based
     API for use throughout the OCaml kernel.
+
+    Asynchronous requests are scheduled: a bounded number of them are in
+    flight at once, the most urgent {!priority} first, and transient failures
+    (network errors, server errors, failed integrity checks) are retried with
+    an exponential backoff.
  *)
 
+(** The priority classes of the requests, from the most to the least urgent. *)
+type priority =
+  | Interactive  (** A request the user is waiting for, such as a `#require`. *)
+  | Critical     (** A request needed before the kernel is ready. *)
+  | Background   (** A prefetch, or a background tier of the startup. *)
+
+(**
+   A group of requests sharing a priority, such as the downloads of a
+   library, whose priority can be raised while its requests wait.
+ *)
+type group
+
+(** Creates a group of requests of the given priority. *)
+val group : priority -> group
+
+(**
+   Raises the priority of a group of requests: its waiting requests, and the
+   ones it schedules later, go ahead of the requests of lower priorities. A
+   priority lower than the group's is ignored.
+ *)
+val promote : group -> priority -> unit
+
+(** Sets the maximum number of requests in flight at once (6 by default, at least 1). *)
+val set_max_concurrent : int -> unit
+
 (**
     Asynchronously fetches the content of a given URL.
    
@@ -14,9 +44,67 @@
     It is designed to be safe for fetching both text and binary content by requesting
     an `arraybuffer` and then converting it to a string.
    
+    @param priority The priority class of the request, [Background] by default.
+    @param group The group of the request, whose priority is used instead.
+    @param retries The number of retries of transient failures, 3 by default.
+    @param check An integrity check of the content, such as a digest
+                 comparison. A content failing it is fetched again.
     @param url The URL of the resource to fetch.
     @return A promise that resolves to [`Some string`] containing the file content
             on success (HTTP 200), or [`None`] if the fetch fails for any reason
             (e.g., a network error or a non-200 status code like 404).
  *)
-val async_get : string -> string option Lwt.t
\ No newline at end of file
+val async_get : ?priority:priority -> ?group:group -> ?retries:int -> ?check:(string -> bool) -> string -> string option Lwt.t
+
+(**
+    Asynchronously fetches a byte range of the content of a given URL, with a
+    `Range` header. When the server ignores the header and sends the whole
+    content, the range is extracted from it. The result may be shorter than
+    [length] when the content ends before.
+
+    @param priority The priority class of the request, [Background] by default.
+    @param group The group of the request, whose priority is used instead.
+    @param retries The number of retries of transient failures, 3 by default.
+    @param check An integrity check of the bytes.
+    @param url The URL of the resource to fetch.
+    @param offset The offset of the first byte.
+    @param length The number of bytes.
+    @return A promise that resolves to [`Some string`] containing the bytes on
+            success (HTTP 206 or 200), or [`None`] if the fetch fails.
+ *)
+val async_get_range :
+  ?priority:priority -> ?group:group -> ?retries:int -> ?check:(string -> bool) -> string -> offset:int -> length:int -> string option Lwt.t
+
+(**
+    Asynchronously fetches several byte ranges of the content of a given URL.
+    The first range is requested alone: when the server ignores the `Range`
+    header and sends the whole content, the other ranges are extracted from
+    it rather than downloading the whole content once per range. Otherwise
+    the other ranges are requested in parallel.
+
+    @param priority The priority class of the requests, [Background] by default.
+    @param group The group of the requests, whose priority is used instead.
+    @param retries The number of retries of transient failures, 3 by default.
+    @param check An integrity check of the bytes of a range, given the range.
+    @param url The URL of the resource to fetch.
+    @param ranges The offsets and lengths of the ranges.
+    @return A promise that resolves to the bytes of each range, in order, or
+            [None] for a range that could not be fetched.
+ *)
+val async_get_ranges :
+  ?priority:priority -> ?group:group -> ?retries:int -> ?check:(int * int -> string -> bool) -> string -> (int * int) list -> string option list Lwt.t
+
+(**
+    Fetches the content of a given URL, or a byte range of it, synchronously.
+    This blocks the calling thread until the response arrives, which browsers
+    only allow in workers. It is reserved to the places that cannot wait for a
+    promise, such as files faulted in by {!Xlazyfs} while the compiler reads
+    them. It bypasses the scheduler, and retries transient failures at once.
+
+    @param retries The number of retries of transient failures, 3 by default.
+    @param check An integrity check of the content.
+    @param range The offset and length of the bytes to request.
+    @param url The URL of the resource to fetch.
+    @return The content on success, or [None] if the fetch fails.
+ *)
+val sync_get : ?retries:int -> ?check:(string -> bool) -> ?range:int * int -> string -> string option
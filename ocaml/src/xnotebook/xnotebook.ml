@@ -0,0 +1,148 @@
+(**
+    {1 Notebooks as Compilation Units}
+    @author Davy Cottet
+
+    Turns the code cells of a Jupyter notebook into the source of a single
+    OCaml compilation unit, so that a notebook can be compiled once, ahead of
+    time, instead of phrase by phrase by the toplevel on every run. It is
+    shared by the `#compile_notebook` directive of the kernel and by the
+    `xocaml-compile-notebook` command-line tool, which must agree on the
+    layout of the compiled artifacts.
+
+    The code cells are concatenated in order, each one preceded by `;;` and a
+    line directive naming the cell, so that compilation errors point into the
+    notebook. The unit starts with `open Xlib`, as the toplevel environment
+    does. `#require` directives are removed from the source and recorded in
+    the {!manifest}, as the libraries must be loaded before the unit; any
+    other directive cannot be compiled and is reported as an error.
+ *)
+
+(** A notebook converted to a compilation unit. *)
+type t = {
+  name : string;            (** The module name of the unit. *)
+  requires : string list;   (** The libraries loaded with [#require], in order. *)
+  cells : int;              (** The number of code cells. *)
+  source : string;          (** The source code of the unit. *)
+}
+
+(** The directory, next to the notebook, where its compiled artifacts are stored. *)
+let artifacts_dir = "_aot"
+
+(** Tells whether [c] may appear in a module name. *)
+let is_ident_char = function
+  | 'A' .. 'Z' | 'a' .. 'z' | '0' .. '9' | '_' | '\'' -> true
+  | _ -> false
+
+(**
+    Derives the module name of a notebook from its path, e.g.
+    ["/drive/sales-dashboard.ipynb"] gives ["Sales_dashboard"].
+ *)
+let module_name path =
+  let base = String.map (fun c -> if is_ident_char c then c else '_') (Filename.remove_extension (Filename.basename path)) in
+  match base.[0] with
+  | 'A' .. 'Z' | 'a' .. 'z' -> String.capitalize_ascii base
+  | _ -> "Notebook_" ^ base
+  | exception Invalid_argument _ -> "Notebook"
+
+(**
+    The path prefix of the compiled artifacts of a notebook: the [.ml], [.cmi],
+    [.cmo], [.js] and manifest files are named after it.
+ *)
+let artifact_prefix path =
+  Filename.concat (Filename.concat (Filename.dirname path) artifacts_dir)
+    (String.uncapitalize_ascii (module_name path))
+
+(** The source of a cell, stored either as a string or as a list of lines. *)
+let cell_source (cell : Yojson.Safe.t) =
+  match cell with
+  | `Assoc fields -> (
+    match List.assoc_opt "source" fields with
+    | Some (`String s) -> s
+    | Some (`List lines) -> String.concat "" (List.map (function `String l -> l | _ -> "") lines)
+    | _ -> "")
+  | _ -> ""
+
+(** The sources of the code cells of a notebook, in order. *)
+let code_cells (notebook : Yojson.Safe.t) =
+  match notebook with
+  | `Assoc fields -> (
+    match List.assoc_opt "cells" fields with
+    | Some (`List cells) ->
+      List.filter_map (fun cell ->
+        match cell with
+        | `Assoc cell_fields when List.assoc_opt "cell_type" cell_fields = Some (`String "code") -> Some (cell_source cell)
+        | _ -> None) cells
+    | _ -> [])
+  | _ -> []
+
+(**
+    Classifies a line of a cell: [`Require lib] for a [#require "lib"]
+    directive, [`Directive name] for any other directive, [`Code] otherwise.
+    Directives are only recognized at the start of a line.
+ *)
+let classify_line line =
+  let line = String.trim line in
+  if String.length line < 2 || line.[0] <> '#' || not (is_ident_char line.[1]) then `Code
+  else
+    let name_end = ref 1 in
+    while !name_end < String.length line && is_ident_char line.[!name_end] do incr name_end done;
+    let name = String.sub line 1 (!name_end - 1) in
+    match name, String.index_opt line '"' with
+    | "require", Some first -> (
+      match String.index_from_opt line (first + 1) '"' with
+      | Some last -> `Require (String.sub line (first + 1) (last - first - 1))
+      | None -> `Directive name)
+    | _ -> `Directive name
+
+(**
+    Converts the JSON contents of a notebook into a compilation unit.
+    @param path The path of the notebook, which names the unit and its cells.
+    @param contents The JSON contents of the notebook.
+    @return The unit, or an error message naming the first directive that
+            cannot be compiled.
+ *)
+let of_ipynb ~path contents =
+  match Yojson.Safe.from_string contents with
+  | exception Yojson.Json_error msg -> Error (Printf.sprintf "%s is not a valid notebook: %s" path msg)
+  | json ->
+    let cells = code_cells json in
+    let buffer = Buffer.create 4096 and requires = ref [] in
+    Buffer.add_string buffer "open Xlib\n";
+    let rec add_cells index = function
+      | [] -> Ok ()
+      | cell :: rest ->
+        Printf.bprintf buffer ";;\n# 1 \"%s [cell %d]\"\n" path index;
+        let rec add_lines = function
+          | [] -> add_cells (index + 1) rest
+          | line :: lines -> (
+            match classify_line line with
+            | `Code -> Buffer.add_string buffer line; Buffer.add_char buffer '\n'; add_lines lines
+            | `Require lib ->
+              if not (List.mem lib !requires) then requires := lib :: !requires;
+              Buffer.add_char buffer '\n';
+              add_lines lines
+            | `Directive name ->
+              Error (Printf.sprintf "%s [cell %d]: the #%s directive cannot be compiled ahead of time." path index name))
+        in
+        add_lines (String.split_on_char '\n' cell)
+    in
+    Result.map (fun () ->
+      { name = module_name path; requires = List.rev !requires; cells = List.length cells; source = Buffer.contents buffer })
+      (add_cells 1 cells)
+
+(**
+    The manifest stored next to the compiled artifacts: the digest of the
+    notebook they were compiled from, then the libraries to load first, one
+    per line.
+ *)
+let manifest ~digest notebook =
+  String.concat "\n" (Digest.to_hex digest :: notebook.requires) ^ "\n"
+
+(**
+    Reads a manifest written by {!manifest}.
+    @return The hexadecimal digest of the notebook and the libraries to load.
+ *)
+let read_manifest contents =
+  match List.filter (fun line -> line <> "") (String.split_on_char '\n' contents) with
+  | [] -> ("", [])
+  | digest :: requires -> (digest, requires)
@@ -0,0 +1,57 @@
+(**
+   {1 Notebooks as Compilation Units}
+   @author Davy Cottet
+
+   Turns the code cells of a Jupyter notebook into the source of a single
+   OCaml compilation unit, for the `#compile_notebook` directive and the
+   `xocaml-compile-notebook` tool. Cells are concatenated in order after
+   `open Xlib`, `#require` directives are moved to a manifest, and any other
+   directive is rejected.
+ *)
+
+(** A notebook converted to a compilation unit. *)
+type t = {
+  name : string;            (** The module name of the unit. *)
+  requires : string list;   (** The libraries loaded with [#require], in order. *)
+  cells : int;              (** The number of code cells. *)
+  source : string;          (** The source code of the unit. *)
+}
+
+(** The directory, next to the notebook, where its compiled artifacts are stored. *)
+val artifacts_dir : string
+
+(** Derives the module name of a notebook from its path, e.g. ["sales-dashboard.ipynb"] gives ["Sales_dashboard"]. *)
+val module_name : string -> string
+
+(**
+   The path prefix of the compiled artifacts of a notebook, in {!artifacts_dir}:
+   the [.ml], [.cmi], [.cmo], [.js] and [.aot] manifest files are named after it.
+ *)
+val artifact_prefix : string -> string
+
+(**
+   Classifies a line of a cell: [`Require lib] for a [#require "lib"]
+   directive, [`Directive name] for any other directive, [`Code] otherwise.
+   Directives are only recognized at the start of a line.
+ *)
+val classify_line : string -> [ `Code | `Directive of string | `Require of string ]
+
+(**
+   Converts the JSON contents of a notebook into a compilation unit.
+   @param path The path of the notebook, which names the unit and its cells.
+   @return The unit, or an error message naming the first directive that
+           cannot be compiled.
+ *)
+val of_ipynb : path:string -> string -> (t, string) result
+
+(**
+   The manifest stored next to the compiled artifacts: the digest of the
+   notebook they were compiled from, and the libraries to load first.
+ *)
+val manifest : digest:Digest.t -> t -> string
+
+(**
+   Reads a manifest written by {!manifest}.
+   @return The hexadecimal digest of the notebook and the libraries to load.
+ *)
+val read_manifest : string -> string * string list
@@ -0,0 +1,83 @@
+(* {1 Ahead-of-Time Notebook Compiler}
+   @author Davy Cottet
+
+   A command-line tool compiling the code cells of a notebook, once, into a
+   module that later sessions load in one step instead of re-running every
+   phrase through the toplevel. The notebook is converted to a compilation
+   unit by {!Xnotebook}, then:
+   1.  `ocamlfind ocamlc -c` compiles it against `xocaml.lib` and the
+       libraries of its `#require` directives, producing the `.cmi` and `.cmo`;
+   2.  `js_of_ocaml --toplevel` turns the `.cmo` into a JS module that the
+       kernel links into a running toplevel, as it does for library bundles;
+   3.  with `--node`, the unit is also linked with its libraries into a
+       standalone script, so that it can be run headless with `node`.
+
+   The artifacts are written to the `_aot` directory next to the notebook,
+   where the `#load_notebook` directive of the kernel looks for them.
+ *)
+
+open Bos
+
+(* Exception raised for unrecoverable errors during the compilation. *)
+exception Fatal_error of string
+
+(* Unwraps a [Bos.OS] result, raising [Fatal_error] on errors. *)
+let run_or_raise = function
+  | Ok v -> v
+  | Error (`Msg s) -> raise (Fatal_error s)
+
+(* Runs a command, echoing it, and fails if it does not exit successfully. *)
+let run cmd =
+  Format.printf "  %s\n%!" (Cmd.to_string cmd);
+  run_or_raise (OS.Cmd.run cmd)
+
+(* Compiles the notebook at [notebook] into the directory [out_dir]. *)
+let main notebook out_dir node =
+  try
+    let contents = run_or_raise (OS.File.read (Fpath.v notebook)) in
+    let nb =
+      match Xnotebook.of_ipynb ~path:notebook contents with
+      | Ok nb -> nb
+      | Error msg -> raise (Fatal_error msg)
+    in
+    let prefix =
+      match out_dir with
+      | Some dir -> Fpath.(v dir / String.uncapitalize_ascii nb.name)
+      | None -> Fpath.v (Xnotebook.artifact_prefix notebook)
+    in
+    ignore (run_or_raise (OS.Dir.create (Fpath.parent prefix)));
+    Format.printf "--- Compiling %d cell(s) of %s into module %s ---\n%!" nb.cells notebook nb.name;
+
+    let source = Fpath.add_ext "ml" prefix and cmo = Fpath.add_ext "cmo" prefix in
+    run_or_raise (OS.File.write source nb.source);
+    let packages = String.concat "," ("xocaml.lib" :: nb.requires) in
+    run Cmd.(v "ocamlfind" % "ocamlc" % "-c" % "-package" % packages % p source);
+    run Cmd.(v "js_of_ocaml" % "--toplevel" % "--no-cmis" % p cmo % "-o" % p (Fpath.add_ext "js" prefix));
+    if node then begin
+      let byte = Fpath.add_ext "byte" prefix in
+      run Cmd.(v "ocamlfind" % "ocamlc" % "-linkpkg" % "-package" % packages % p cmo % "-o" % p byte);
+      run Cmd.(v "js_of_ocaml" % p byte % "-o" % p (Fpath.add_ext "node.js" prefix))
+    end;
+    run_or_raise (OS.File.write (Fpath.add_ext "aot" prefix) (Xnotebook.manifest ~digest:(Digest.string contents) nb));
+    Format.printf "--- Successfully compiled: %s ---\n%!" (Fpath.to_string (Fpath.add_ext "js" prefix))
+  with
+  | Fatal_error msg -> Printf.eprintf "Error: %s\n%!" msg; exit 1
+  | ex -> Printf.eprintf "An unexpected error occurred: %s\n%s\n%!" (Printexc.to_string ex) (Printexc.get_backtrace ()); exit 1
+
+(* Cmdliner term for the notebook to compile. *)
+let notebook_arg = Cmdliner.Arg.(required & pos 0 (some file) None & info [] ~docv:"NOTEBOOK")
+
+(* Cmdliner term for the output directory, defaulting to `_aot` next to the notebook. *)
+let out_dir_arg = Cmdliner.Arg.(value & opt (some string) None & info [ "o" ] ~docv:"DIR" ~doc:"Write the artifacts to $(docv).")
+
+(* Cmdliner term for the standalone Node.js script. *)
+let node_arg = Cmdliner.Arg.(value & flag & info [ "node" ] ~doc:"Also link a standalone script that runs the notebook with node.")
+
+(* Cmdliner term for the main function. *)
+let main_term = Cmdliner.Term.(const main $ notebook_arg $ out_dir_arg $ node_arg)
+
+(* Cmdliner command definition. *)
+let cmd_main = Cmdliner.Cmd.v (Cmdliner.Cmd.info "xocaml-compile-notebook") main_term
+
+(* Execute the command-line interface. *)
+let () = exit (Cmdliner.Cmd.eval cmd_main)
@@ -8,20 +8,24 @@
     C++ part of the kernel (running as WebAssembly) can call into. This API is
     registered in the global JavaScript scope under the `xocaml` object.
    
-    The exported API consists of three key functions:
+    The exported API consists of four key functions:
    
     - `processMerlinAction(jsonString)`: A **synchronous** function for handling
       quick, non-blocking code intelligence requests (completion, inspection, etc.).
       It takes a JSON string and immediately returns a JSON string.
    
-    - `processToplevelAction(jsonString, callback)`: An **asynchronous** function for
+    - `processToplevelAction(jsonString, callback, onOutput?)`: An **asynchronous** function for
       handling potentially long-running operations like code evaluation (`Eval`) or
       the initial kernel setup (`Setup`). It takes a JSON string and a JavaScript
       callback function. It returns immediately, and the result (as a JSON string)
-      is delivered later by invoking the provided callback.
+      is delivered later by invoking the provided callback. Outputs flushed while
+      an evaluation is still running are streamed to the optional `onOutput` callback.
    
     - `mountFS()`: A function to trigger the mounting of the Emscripten virtual
       filesystem device from within OCaml.
+
+    - `parallelWorker(postMessage)`: The entry point of the workers spawned by
+      {!Xlib.Parallel}, which load this same bundle (see {!Xparallel}).
    
     This module orchestrates the initialization sequence and delegates incoming
     requests to the appropriate sub-modules (`Xmerlin`, `Xtoplevel`, `Xlibloader`).
@@ -72,7 +76,10 @@ let create_error_response msg = create_response "error" (`String msg)
     and encodes the result back into a JSON string for the C++ caller.
    
     It specifically rejects `Eval` and `Setup` actions, which must be handled
-    asynchronously.
+    asynchronously. `Expand` actions, which print more of an elided toplevel
+    value, are bounded and are therefore served here as well, by {!Xprint}.
+    `Speculate` actions only schedule work, with {!Xtoplevel.speculate}, and
+    return at once, with the counts of {!Xspeculate.stats} so far.
    
     @param json_str_js A JavaScript string containing the JSON-encoded {!Protocol.action}.
     @return A JavaScript string containing the JSON-encoded response.
@@ -82,8 +89,17 @@ let process_merlin_action_sync (json_str_js : Js.js_string Js.t) : Js.js_string
   let response_json =
     try
       match Protocol.action_of_yojson (Yojson.Safe.from_string json_str) with
-      | Ok (Eval _ | Setup _) ->
+      | Ok (Eval _ | Setup _ | Reset) ->
           create_error_response "This action must be called asynchronously."
+      | Ok (Speculate { sources }) ->
+          Xtoplevel.speculate sources;
+          let taken, compiled = Xspeculate.stats () in
+          create_success_response (`Assoc [ ("taken", `Int taken); ("compiled", `Int compiled) ])
+      | Ok (Expand { handle; depth; length }) -> (
+          match Xprint.expand ?depth ?length handle with
+          | Ok text -> create_success_response (`String text)
+          | Error msg -> create_error_response msg
+      )
       | Ok action -> (
           match Xmerlin.process_merlin_action action with
           | Some result -> create_success_response (yojson_basic_to_safe result)
@@ -96,42 +112,141 @@ let process_merlin_action_sync (json_str_js : Js.js_string Js.t) : Js.js_string
   in
   Yojson.Safe.to_string response_json |> Js.string
 
+(** The tiers of the startup reached so far, with the number of files each one loaded, in order. *)
+let reached_tiers : (Protocol.startup_tier * int) list ref = ref []
+
+(** The callback of the latest [Setup] action following the progress of the startup. *)
+let progress_listener : (Protocol.startup_progress -> unit) option ref = ref None
+
+(** The time the latest [Setup] action was received, in milliseconds. *)
+let setup_started = ref 0.
+
+(** Sends a tier of the startup to the {!progress_listener}. *)
+let send_progress tier files =
+  let progress = { Protocol.tier; files; elapsed_ms = Xutil.now_ms () -. !setup_started } in
+  Xutil.log (Printf.sprintf "[Xocaml] Startup tier %s reached after %.0f ms."
+               (Yojson.Safe.to_string (Protocol.startup_tier_to_yojson tier)) progress.elapsed_ms);
+  Option.iter !progress_listener ~f:(fun on_progress -> on_progress progress)
+
+(** Records a tier of the startup that completed, and reports it. *)
+let report tier files =
+  reached_tiers := !reached_tiers @ [ (tier, files) ];
+  send_progress tier files
+
+(**
+    Runs the background tiers of the startup, once the kernel is ready: the
+    remaining interfaces of the standard library, then its documentation
+    files, then the warm-up of Merlin. Each completed tier is reported with
+    {!report}, and a failed tier does not prevent the next ones.
+ *)
+let background_tiers () =
+  let tier name load =
+    Lwt.catch load (fun exn ->
+      Xutil.log (Printf.sprintf "[Xocaml] Startup tier %s failed: %s" name (Printexc.to_string exn));
+      Lwt.return 0)
+  in
+  let* interfaces = tier "interfaces" Xlibloader.load_interfaces in
+  report Protocol.Interfaces interfaces;
+  let* documentation = tier "documentation" Xlibloader.load_documentation in
+  report Protocol.Documentation documentation;
+  let* () = Js_of_ocaml_lwt.Lwt_js.yield () in
+  let* _ = tier "merlin" (fun () -> Xmerlin.warm_up (); Lwt.return 0) in
+  report Protocol.Merlin_warm 0;
+  Lwt.return_unit
+
 (**
     The asynchronous entry point for handling Toplevel-related actions. This function
     is exported to JavaScript as `xocaml.processToplevelAction`.
    
-    It decodes the action from the input JSON. For an `Eval` action, it calls
-    {!Xtoplevel.eval}. For a `Setup` action, it orchestrates the full kernel
-    initialization sequence: file loading, toplevel setup, and Merlin setup.
+    It decodes the action from the input JSON. For an `Eval` action, it queues
+    the cell with {!Xtoplevel.submit}, so that evaluations received while
+    another one runs are pipelined and answered in order. The response class
+    is "failed" when a phrase of the cell failed, with the outputs as value,
+    and "aborted" when the cell was not run after such a failure. For a `Setup`
+    action, it orchestrates the full kernel initialization sequence: file
+    loading, toplevel setup, and Merlin setup. Only the critical tier of the
+    files is loaded before the response: the other tiers are loaded by
+    {!background_tiers}, and each tier reached, starting with [Ready], is
+    streamed through [on_output] as a {!Protocol.startup_progress}, with the
+    time elapsed since the action was received.
+    A `Reset` action, or a `Setup` action received once the toplevel is set up
+    (a kernel restart that reuses it), only resets the toplevel with
+    {!Xtoplevel.reset}: the loaded files and Merlin are kept as they are. Such
+    a `Setup` action reports the tiers reached so far again, [Ready] first,
+    and the tiers still loading are reported to it as they complete.
    
     The result of the Lwt promise is JSON-encoded and passed to the provided
     JavaScript callback function. All exceptions are caught and returned as
     structured error JSONs via the same callback.
+
+    For an `Eval` action, outputs flushed before the evaluation completes (see
+    {!Xtoplevel.eval}) are streamed through the optional [on_output] callback as
+    JSON-encoded lists of {!Protocol.output}. Without it, all outputs are
+    delivered at once through [callback].
    
     @param json_str_js A JavaScript string containing the JSON-encoded {!Protocol.action}.
     @param callback A JavaScript callback function that accepts a single string argument (the JSON response).
+    @param on_output An optional JavaScript callback receiving streamed outputs as a JSON string.
  *)
-let process_toplevel_action_async (json_str_js : Js.js_string Js.t) (callback : (Js.js_string Js.t -> unit) Js.callback) : unit =
+let process_toplevel_action_async (json_str_js : Js.js_string Js.t) (callback : (Js.js_string Js.t -> unit) Js.callback) (on_output : (Js.js_string Js.t -> unit) Js.callback Js.Optdef.t) : unit =
   let json_str = Js.to_string json_str_js in
+  let on_flush =
+    match Js.Optdef.to_option on_output with
+    | None -> None
+    | Some on_output ->
+      Some (fun outputs ->
+        let outputs_json = `List (List.map ~f:Protocol.output_to_yojson outputs) in
+        let outputs_js_string = Yojson.Safe.to_string outputs_json |> Js.string in
+        ignore (Js.Unsafe.fun_call on_output [| Js.Unsafe.inject outputs_js_string |]))
+  in
+  let on_progress =
+    match Js.Optdef.to_option on_output with
+    | None -> None
+    | Some on_output ->
+      Some (fun progress ->
+        let progress_js_string = Yojson.Safe.to_string (Protocol.startup_progress_to_yojson progress) |> Js.string in
+        ignore (Js.Unsafe.fun_call on_output [| Js.Unsafe.inject progress_js_string |]))
+  in
   let computation =
     Lwt.catch
       (fun () ->
         let action_res = Protocol.action_of_yojson (Yojson.Safe.from_string json_str) in
         match action_res with
-        | Ok (Protocol.Eval { source }) ->
+        | Ok (Protocol.Eval { source; stop_on_error }) ->
           Xutil.log "[Xocaml] Received Eval action.";
-          let* outputs = Xtoplevel.eval source in
-          let response_value = `List (List.map ~f:Protocol.output_to_yojson outputs) in
-          Lwt.return @@ create_success_response response_value
+          let outputs_value outputs = `List (List.map ~f:Protocol.output_to_yojson outputs) in
+          let* outcome = Xtoplevel.submit ?on_flush ~stop_on_error source in
+          Lwt.return @@ (match outcome with
+            | Xtoplevel.Completed outputs -> create_success_response (outputs_value outputs)
+            | Xtoplevel.Failed outputs -> create_response "failed" (outputs_value outputs)
+            | Xtoplevel.Aborted -> create_response "aborted" (`String "Execution aborted: a previous cell failed."))
+        | Ok Protocol.Reset ->
+          Xutil.log "[Xocaml] Received Reset action.";
+          Lwt.return @@ create_success_response (`String (Xtoplevel.reset ()))
+        | Ok (Protocol.Setup _) when Xtoplevel.is_initialized () ->
+          Xutil.log "[Xocaml] Received Setup action on an initialized kernel. Resetting the toplevel...";
+          setup_started := Xutil.now_ms ();
+          if Option.is_some on_progress then progress_listener := on_progress;
+          let message = Xtoplevel.reset () in
+          List.iter !reached_tiers ~f:(fun (tier, files) -> send_progress tier files);
+          Lwt.return @@ create_success_response (`String message)
         | Ok (Protocol.Setup setup_config) ->
           Xutil.log "[Xocaml] Received Setup action. Starting file loading...";
-          let* () = Xlibloader.setup ~base_url:setup_config.dsc_url in
+          setup_started := Xutil.now_ms ();
+          Option.iter setup_config.cache_limit ~f:Xcache.set_limit;
+          Option.iter setup_config.max_concurrent_requests ~f:Xnetwork.set_max_concurrent;
+          if Option.is_some on_progress then progress_listener := on_progress;
+          let* critical = Xlibloader.setup ~base_url:setup_config.dsc_url in
           Xutil.log "[Xocaml] File loading complete. Initializing Toplevel...";
           Xtoplevel.setup ~url:setup_config.dsc_url;
+          Xparallel.install ~setup_url:setup_config.dsc_url;
           Xutil.log "[Xocaml] Toplevel initialized. Initializing Merlin...";
           Xmerlin.initialize ();
           Xutil.log "[Xocaml] Merlin initialized. Setup successful.";
-          Lwt.return @@ create_success_response (`String "Setup Phase 1 complete")
+          report Protocol.Ready critical;
+          Lwt.async background_tiers;
+          let environment = if Xtoplevel.from_snapshot () then "snapshot" else "built" in
+          Lwt.return @@ create_success_response (`String (Printf.sprintf "Setup Phase 1 complete (environment: %s)" environment))
         | Ok _ ->
           Lwt.return @@ create_error_response "This action must be handled synchronously."
         | Error msg ->
@@ -153,7 +268,8 @@ let process_toplevel_action_async (json_str_js : Js.js_string Js.t) (callback :
     Main side-effect of the module.
     This block exports the OCaml functions to the JavaScript global scope, making
     them callable from the C++ kernel. It creates a global object named `xocaml`
-    with three properties: `processMerlinAction`, `processToplevelAction`, and `mountFS`.
+    with four properties: `processMerlinAction`, `processToplevelAction`,
+    `mountFS`, and `parallelWorker`, the entry point of {!Xlib.Parallel} workers.
  *)
 let () =
   Js.export "xocaml"
@@ -161,4 +277,5 @@ let () =
        val processMerlinAction = process_merlin_action_sync
        val processToplevelAction = process_toplevel_action_async
        val mountFS = Xfs.mount_drive
+       val parallelWorker = Xparallel.serve
     end)
\ No newline at end of file
@@ -14,11 +14,12 @@
     quick, non-blocking code intelligence requests (completion, inspection, etc.).
     It takes a JSON string and immediately returns a JSON string.
  
-  - `processToplevelAction(jsonString, callback)`: An **asynchronous** function for
+  - `processToplevelAction(jsonString, callback, onOutput?)`: An **asynchronous** function for
     handling potentially long-running operations like code evaluation (`Eval`) or
     the initial kernel setup (`Setup`). It takes a JSON string and a JavaScript
     callback function. It returns immediately, and the result (as a JSON string)
-    is delivered later by invoking the provided callback.
+    is delivered later by invoking the provided callback. Outputs flushed while
+    an evaluation is still running are streamed to the optional `onOutput` callback.
  
   - `mountFS()`: A function to trigger the mounting of the Emscripten virtual
     filesystem device from within OCaml.
@@ -0,0 +1,38 @@
+(* {1 Artifact Archive Packer}
+   @author Davy Cottet
+
+   A command-line tool packing the Merlin artifacts (`.cmi`, `.cmt`, `.cmti`)
+   of a directory into a single {!Xpack} archive, which the kernel fetches at
+   startup instead of requesting each file on its own. Files are packed in
+   name order, so that the archive is deterministic.
+ *)
+
+(* The extensions of the files to pack. *)
+let extensions = [ ".cmi"; ".cmt"; ".cmti" ]
+
+(* Packs the artifacts of [dir] into the archive [output]. *)
+let main dir output =
+  let files =
+    Sys.readdir dir
+    |> Array.to_list
+    |> List.filter (fun file -> List.exists (Filename.check_suffix file) extensions)
+    |> List.sort String.compare
+    |> List.map (fun file -> (file, In_channel.with_open_bin (Filename.concat dir file) In_channel.input_all))
+  in
+  Out_channel.with_open_bin output (fun oc -> Out_channel.output_string oc (Xpack.create files));
+  Printf.printf "Packed %d artifact(s) of %s into %s.\n%!" (List.length files) dir output
+
+(* Cmdliner term for the directory to pack. *)
+let dir_arg = Cmdliner.Arg.(required & pos 0 (some dir) None & info [] ~docv:"DIR")
+
+(* Cmdliner term for the archive to write. *)
+let output_arg = Cmdliner.Arg.(required & opt (some string) None & info [ "o" ] ~docv:"FILE" ~doc:"Write the archive to $(docv).")
+
+(* Cmdliner term for the main function. *)
+let main_term = Cmdliner.Term.(const main $ dir_arg $ output_arg)
+
+(* Cmdliner command definition. *)
+let cmd_main = Cmdliner.Cmd.v (Cmdliner.Cmd.info "xocaml-pack") main_term
+
+(* Execute the command-line interface. *)
+let () = exit (Cmdliner.Cmd.eval cmd_main)
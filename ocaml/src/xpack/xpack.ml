@@ -0,0 +1,196 @@
+(**
+    {1 Packed Artifact Archives}
+    @author Davy Cottet
+
+    The kernel needs hundreds of small files (`.cmi`, `.cmt`, `.cmti`, and the
+    JS bundles of libraries), and fetching them one request each makes the
+    per-request overhead dominate the startup. This module defines a simple
+    archive format that packs a set of files into one, so that the loader can
+    fetch them in a single request, or fetch its index and then only the byte
+    ranges of the members it needs. It is shared by the build tools, which
+    write the archives, and by the kernel, which reads them.
+
+    Contents needed by several archives, such as the artifacts of a library
+    that several bundled libraries depend on, are not packed: each one is
+    stored once, as a blob named after its digest (see {!partition_shared}).
+
+    An archive is laid out as follows, integers being 32-bit big-endian:
+    - a header: the 8-byte {!magic}, then the size of the index;
+    - the index: for each member, the length of its name on 16 bits, its name,
+      the offset of its content from the start of the data, its size, and
+      the 16-byte MD5 digest of its content;
+    - the data: the contents of the members, concatenated in index order.
+ *)
+
+(** A member of an archive, as described by the index. *)
+type entry = {
+  name : string;        (** The file name of the member. *)
+  offset : int;         (** The offset of its content from the start of the data. *)
+  size : int;           (** The size of its content, in bytes. *)
+  digest : Digest.t;    (** The MD5 digest of its content. *)
+}
+
+(** The magic number starting every archive, which includes the format version. *)
+let magic = "XOCPACK1"
+
+(** The size of the header, which precedes the index. *)
+let header_size = String.length magic + 4
+
+(**
+    Packs files into an archive.
+    @param files The name and content of each file, in the order of the archive.
+    @return The content of the archive.
+ *)
+let create files =
+  let index = Buffer.create 4096 and data = Buffer.create 65536 in
+  List.iter (fun (name, content) ->
+    Buffer.add_uint16_be index (String.length name);
+    Buffer.add_string index name;
+    Buffer.add_int32_be index (Int32.of_int (Buffer.length data));
+    Buffer.add_int32_be index (Int32.of_int (String.length content));
+    Buffer.add_string index (Digest.string content);
+    Buffer.add_string data content) files;
+  let archive = Buffer.create (header_size + Buffer.length index + Buffer.length data) in
+  Buffer.add_string archive magic;
+  Buffer.add_int32_be archive (Int32.of_int (Buffer.length index));
+  Buffer.add_buffer archive index;
+  Buffer.add_buffer archive data;
+  Buffer.contents archive
+
+(**
+    Reads the size of the index from the start of an archive.
+    @param prefix The first bytes of the archive, at least {!header_size} of them.
+    @return The size of the index, or [None] if [prefix] is not the start of an archive.
+ *)
+let index_size prefix =
+  if String.length prefix < header_size || not (String.starts_with ~prefix:magic prefix) then None
+  else Some (Int32.to_int (String.get_int32_be prefix (String.length magic)))
+
+(** The offset of the data in an archive whose index has [index_size] bytes. *)
+let data_offset ~index_size = header_size + index_size
+
+(**
+    Decodes the index of an archive.
+    @param index The bytes of the index, which follow the header.
+    @return The members, in the order of the archive, or [None] if the index is truncated.
+ *)
+let parse_index index =
+  let rec loop pos acc =
+    if pos = String.length index then Some (List.rev acc)
+    else if pos + 2 > String.length index then None
+    else
+      let name_length = String.get_uint16_be index pos in
+      let pos = pos + 2 in
+      if pos + name_length + 24 > String.length index then None
+      else
+        let name = String.sub index pos name_length in
+        let pos = pos + name_length in
+        let offset = Int32.to_int (String.get_int32_be index pos) in
+        let size = Int32.to_int (String.get_int32_be index (pos + 4)) in
+        let digest = String.sub index (pos + 8) 16 in
+        loop (pos + 24) ({ name; offset; size; digest } :: acc)
+  in
+  loop 0 []
+
+(** Tells whether [content] is the intact content of the member [entry]. *)
+let verify entry content =
+  String.length content = entry.size && Digest.equal (Digest.string content) entry.digest
+
+(**
+    Extracts the members of a complete archive.
+    @param archive The content of the archive.
+    @return The name and content of each member whose content is intact, or
+            [None] if [archive] is not an archive.
+ *)
+let read archive =
+  match index_size archive with
+  | None -> None
+  | Some index_size when data_offset ~index_size > String.length archive -> None
+  | Some index_size ->
+    let data = data_offset ~index_size in
+    Option.map
+      (List.filter_map (fun entry ->
+         if data + entry.offset + entry.size > String.length archive then None
+         else
+           let content = String.sub archive (data + entry.offset) entry.size in
+           if verify entry content then Some (entry.name, content) else None))
+      (parse_index (String.sub archive header_size index_size))
+
+(**
+    Tells whether an archive is complete and every member it indexes is
+    intact, so that a damaged download can be told apart and fetched again.
+ *)
+let intact archive =
+  match index_size archive, read archive with
+  | Some index_size, Some members ->
+    (match parse_index (String.sub archive header_size index_size) with
+     | Some entries -> List.length entries = List.length members
+     | None -> false)
+  | _ -> false
+
+(**
+    Groups members into the byte ranges to fetch. Members whose contents are
+    separated by less than [max_gap] bytes share a range, so that fetching a
+    few unneeded bytes saves a request.
+    @param entries The members to fetch.
+    @return For each range, its start and end offsets in the data (end
+            excluded), and the members it holds.
+ *)
+let spans ?(max_gap = 4096) entries =
+  let sorted = List.sort (fun a b -> compare a.offset b.offset) entries in
+  let close (first, last, members) = (first, last, List.rev members) in
+  let rec loop current acc = function
+    | [] -> List.rev (Option.fold ~none:acc ~some:(fun span -> close span :: acc) current)
+    | entry :: rest -> (
+      match current with
+      | Some (first, last, members) when entry.offset - last <= max_gap ->
+        loop (Some (first, max last (entry.offset + entry.size), entry :: members)) acc rest
+      | _ ->
+        let acc = Option.fold ~none:acc ~some:(fun span -> close span :: acc) current in
+        loop (Some (entry.offset, entry.offset + entry.size, [ entry ])) acc rest)
+  in
+  loop None [] sorted
+
+(**
+    Extracts a member from the content of a range returned by {!spans}.
+    @param first The start offset of the range in the data.
+    @param range The content of the range.
+    @return The content of the member, if it is intact.
+ *)
+let member_of_span ~first range entry =
+  let start = entry.offset - first in
+  if start < 0 || start + entry.size > String.length range then None
+  else
+    let content = String.sub range start entry.size in
+    if verify entry content then Some content else None
+
+(** The name of the file holding a content stored as a blob, after its hexadecimal MD5 digest. *)
+let blob_name digest = digest ^ ".blob"
+
+(**
+    Splits the files of several archives between the archives and blobs. A
+    content found in more than one archive is stored once, as a blob, and
+    left out of the archives, which only hold the contents of their own.
+    @param archives The name and files of each archive.
+    @return The files each archive keeps, in the same order, and the blobs,
+            named with {!blob_name}, each listed once.
+ *)
+let partition_shared archives =
+  let owners = Hashtbl.create 1024 in
+  List.iter (fun (archive, files) ->
+      List.iter (fun (_, content) ->
+          let digest = Digest.to_hex (Digest.string content) in
+          let known = Option.value (Hashtbl.find_opt owners digest) ~default:[] in
+          if not (List.mem archive known) then Hashtbl.replace owners digest (archive :: known))
+        files)
+    archives;
+  let is_shared content = List.length (Hashtbl.find owners (Digest.to_hex (Digest.string content))) > 1 in
+  let kept = List.map (fun (archive, files) -> (archive, List.filter (fun (_, content) -> not (is_shared content)) files)) archives in
+  let blobs =
+    List.concat_map (fun (_, files) ->
+        List.filter_map (fun (_, content) ->
+            if is_shared content then Some (blob_name (Digest.to_hex (Digest.string content)), content) else None)
+          files)
+      archives
+  in
+  (kept, List.sort_uniq (fun (a, _) (b, _) -> String.compare a b) blobs)
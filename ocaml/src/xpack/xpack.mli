@@ -0,0 +1,93 @@
+(**
+   {1 Packed Artifact Archives}
+   @author Davy Cottet
+
+   A simple archive format packing the many small files of the kernel into
+   one, so that they can be fetched in a single request, or by byte ranges
+   after fetching the index. Each member is indexed with its offset, size and
+   MD5 digest, which is checked when it is extracted. Contents needed by
+   several archives are stored once, as blobs, instead.
+ *)
+
+(** A member of an archive, as described by the index. *)
+type entry = {
+  name : string;        (** The file name of the member. *)
+  offset : int;         (** The offset of its content from the start of the data. *)
+  size : int;           (** The size of its content, in bytes. *)
+  digest : Digest.t;    (** The MD5 digest of its content. *)
+}
+
+(** The magic number starting every archive, which includes the format version. *)
+val magic : string
+
+(** The size of the header, which precedes the index. *)
+val header_size : int
+
+(**
+   Packs files into an archive.
+   @param files The name and content of each file, in the order of the archive.
+   @return The content of the archive.
+ *)
+val create : (string * string) list -> string
+
+(**
+   Reads the size of the index from the start of an archive.
+   @param prefix The first bytes of the archive, at least {!header_size} of them.
+   @return The size of the index, or [None] if [prefix] is not the start of an archive.
+ *)
+val index_size : string -> int option
+
+(** The offset of the data in an archive whose index has [index_size] bytes. *)
+val data_offset : index_size:int -> int
+
+(**
+   Decodes the index of an archive.
+   @param index The bytes of the index, which follow the header.
+   @return The members, in the order of the archive, or [None] if the index is truncated.
+ *)
+val parse_index : string -> entry list option
+
+(** Tells whether a content is the intact content of a member. *)
+val verify : entry -> string -> bool
+
+(**
+   Extracts the members of a complete archive.
+   @param archive The content of the archive.
+   @return The name and content of each member whose content is intact, or
+           [None] if [archive] is not an archive.
+ *)
+val read : string -> (string * string) list option
+
+(** Tells whether an archive is complete and every member it indexes is intact. *)
+val intact : string -> bool
+
+(**
+   Groups members into the byte ranges to fetch, members separated by less
+   than [max_gap] bytes (4 KiB by default) sharing a range.
+   @param entries The members to fetch.
+   @return For each range, its start and end offsets in the data (end
+           excluded), and the members it holds.
+ *)
+val spans : ?max_gap:int -> entry list -> (int * int * entry list) list
+
+(**
+   Extracts a member from the content of a range returned by {!spans}.
+   @param first The start offset of the range in the data.
+   @param range The content of the range.
+   @return The content of the member, if it is intact.
+ *)
+val member_of_span : first:int -> string -> entry -> string option
+
+(** The name of the file holding a content stored as a blob, after its hexadecimal MD5 digest. *)
+val blob_name : string -> string
+
+(**
+   Splits the files of several archives between the archives and blobs. A
+   content found in more than one archive is stored once, as a blob, and
+   left out of the archives, which only hold the contents of their own.
+   @param archives The name and files of each archive.
+   @return The files each archive keeps, in the same order, and the blobs,
+           named with {!blob_name}, each listed once.
+ *)
+val partition_shared :
+  (string * (string * string) list) list -> (string * (string * string) list) list * (string * string) list
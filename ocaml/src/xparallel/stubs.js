@@ -0,0 +1,56 @@
+//Provides: xocaml_parallel_cores
+function xocaml_parallel_cores() {
+  if (typeof navigator !== "undefined" && navigator.hardwareConcurrency)
+    return navigator.hardwareConcurrency | 0;
+  if (typeof require === "function") {
+    try { return require("os").cpus().length; } catch (e) {}
+  }
+  return 1;
+}
+
+//Provides: xocaml_parallel_resolve
+function xocaml_parallel_resolve(url) {
+  // Resolves a URL relative to the kernel's worker, so that the pool's
+  // workers, whose scripts live elsewhere, can use it as is.
+  if (typeof location !== "undefined") {
+    try { return new URL(url, location.href).href; } catch (e) {}
+  }
+  return url;
+}
+
+//Provides: xocaml_parallel_spawn
+function xocaml_parallel_spawn(baseUrl, onMessage, onError) {
+  // The worker script and the kernel bundle it loads are installed next to
+  // the kernel, in the directory it is set up from, given as `baseUrl`.
+  // `globalThis.xocamlParallel` overrides their locations, and is required in
+  // Node.js: { script, bundle, preload }.
+  var config = globalThis.xocamlParallel || {};
+  var worker;
+  if (typeof Worker === "function" && typeof location !== "undefined") {
+    worker = new Worker(config.script || new URL("xocaml_worker.js", baseUrl).href);
+    worker.onmessage = function (event) { onMessage(event.data); };
+    worker.onerror = function (event) { onError(String(event.message || "Worker error")); };
+    worker.postMessage({ kind: "boot", bundle: config.bundle || new URL("xocaml.bc.js", baseUrl).href, preload: [] });
+  } else {
+    var threads = require("worker_threads");
+    worker = new threads.Worker(config.script);
+    worker.on("message", onMessage);
+    worker.on("error", function (err) { onError(String(err)); });
+    worker.postMessage({ kind: "boot", bundle: config.bundle, preload: config.preload || [] });
+    // A pool that is never shut down must not keep Node.js alive.
+    worker.unref();
+  }
+  return worker;
+}
+
+//Provides: xocaml_parallel_post
+function xocaml_parallel_post(worker, message) {
+  worker.postMessage(message);
+  return 0;
+}
+
+//Provides: xocaml_parallel_terminate
+function xocaml_parallel_terminate(worker) {
+  worker.terminate();
+  return 0;
+}
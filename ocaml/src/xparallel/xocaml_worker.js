@@ -0,0 +1,31 @@
+// The script run by each worker of an `Xlib.Parallel` pool. It loads the
+// kernel's OCaml bundle named in the first ("boot") message, then hands every
+// other message to the bundle's `xocaml.parallelWorker` entry point.
+(function () {
+  "use strict";
+  var isNode = typeof self === "undefined";
+  var port = isNode ? require("worker_threads").parentPort : self;
+  var handle = null;
+
+  function post(message) { port.postMessage(message); }
+
+  function receive(message) {
+    if (message.kind !== "boot") { handle(message); return; }
+    try {
+      var kernel;
+      if (isNode) {
+        message.preload.forEach(function (file) { require(file); });
+        kernel = require(message.bundle).xocaml;
+      } else {
+        importScripts(message.bundle);
+        kernel = self.xocaml;
+      }
+      handle = kernel.parallelWorker(post);
+    } catch (e) {
+      post({ kind: "error", id: 0, message: "Could not load the kernel in a worker: " + e });
+    }
+  }
+
+  if (isNode) port.on("message", receive);
+  else self.onmessage = function (event) { receive(event.data); };
+})();
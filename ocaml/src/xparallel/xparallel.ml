@@ -0,0 +1,343 @@
+(**
+    {1 Worker Pools}
+    @author Davy Cottet
+
+    This module is the backend of {!Xlib.Parallel}. It spawns pools of Web
+    Workers (worker threads in Node.js), schedules marshalled chunks of inputs
+    on them, and implements the worker side of the protocol.
+
+    Each worker runs `xocaml_worker.js`, which loads the kernel bundle and
+    hands every message to {!serve}. Both are loaded from the directory the
+    kernel was set up from, where they are installed next to it. The worker
+    then sets up its own toplevel from the artifacts the kernel has fetched
+    already, loads the libraries required in the kernel when the pool was
+    created, only downloading their bundles, and compiles the pool's source
+    files with [#mod_use]. Tasks name a function of those files; its value is
+    looked up in the worker's toplevel environment and applied to every input
+    of the chunk. A worker without source files also compiles the units of
+    {!Xaot}, out of the kernel's toplevel.
+
+    Chunks are scheduled by work stealing: each worker owns a contiguous range
+    of chunks and takes them from the front; a worker whose range is exhausted
+    steals the back half of the largest remaining range. Workers processing
+    cheap inputs thus take over the work of those stuck with expensive ones,
+    while each one still processes neighbouring inputs most of the time.
+ *)
+
+open Js_of_ocaml
+open Lwt.Syntax
+open Xutil
+
+external cores : unit -> int = "xocaml_parallel_cores"
+external resolve_url : Js.js_string Js.t -> Js.js_string Js.t = "xocaml_parallel_resolve"
+external spawn : Js.js_string Js.t -> (Js.Unsafe.any -> unit) Js.callback -> (Js.js_string Js.t -> unit) Js.callback -> Js.Unsafe.any = "xocaml_parallel_spawn"
+external post : Js.Unsafe.any -> Js.Unsafe.any -> unit = "xocaml_parallel_post"
+external terminate : Js.Unsafe.any -> unit = "xocaml_parallel_terminate"
+
+(**
+    The absolute URL the kernel was set up from, used by the workers to set up
+    theirs. The worker script and the kernel bundle are installed there too.
+ *)
+let setup_url = ref ""
+
+(** Builds a message of the given kind. *)
+let message kind fields =
+  Js.Unsafe.obj (Array.of_list (("kind", Js.Unsafe.inject (Js.string kind)) :: fields))
+
+(** Reads a field of a message. *)
+let field message name = Js.Unsafe.get message (Js.string name)
+
+(** The text of an exception, as reported to the other side. *)
+let error_message = function
+  | Failure msg -> msg
+  | exn -> Printexc.to_string exn
+
+(** {2 Kernel Side} *)
+
+(** A worker of a pool, seen from the kernel. *)
+type worker = {
+  handle : Js.Unsafe.any;                       (** The JavaScript worker. *)
+  ready : unit Lwt.t;                           (** Resolved once the worker is set up. *)
+  pending : (int, string Lwt.u) Hashtbl.t;      (** The tasks sent and not answered yet, by id. *)
+  mutable next_id : int;                        (** The id of the next task. *)
+}
+
+(** Rejects the setup, if still pending, and all the pending tasks of a worker. *)
+let fail_worker ~ready ~ready_resolver ~pending msg =
+  if Lwt.is_sleeping ready then Lwt.wakeup_later_exn ready_resolver (Failure msg);
+  Hashtbl.iter (fun _ resolver -> Lwt.wakeup_later_exn resolver (Failure msg)) pending;
+  Hashtbl.reset pending
+
+(** Spawns a worker and sends it the setup message [init]. *)
+let start_worker init =
+  let ready, ready_resolver = Lwt.wait () in
+  let pending = Hashtbl.create 4 in
+  let on_message msg =
+    let id : int = field msg "id" in
+    match Js.to_string (field msg "kind") with
+    | "ready" -> Lwt.wakeup_later ready_resolver ()
+    | "result" ->
+      Option.iter (fun resolver ->
+          Hashtbl.remove pending id;
+          Lwt.wakeup_later resolver (Js.to_bytestring (field msg "payload")))
+        (Hashtbl.find_opt pending id)
+    | "error" when id = 0 -> fail_worker ~ready ~ready_resolver ~pending (Js.to_string (field msg "message"))
+    | "error" ->
+      Option.iter (fun resolver ->
+          Hashtbl.remove pending id;
+          Lwt.wakeup_later_exn resolver (Failure (Js.to_string (field msg "message"))))
+        (Hashtbl.find_opt pending id)
+    | kind -> log (Printf.sprintf "[Parallel] Ignoring message of kind '%s'." kind)
+  in
+  let on_error msg = fail_worker ~ready ~ready_resolver ~pending ("Worker failed: " ^ Js.to_string msg) in
+  let handle = spawn (Js.string !setup_url) (Js.wrap_callback on_message) (Js.wrap_callback on_error) in
+  post handle init;
+  { handle; ready; pending; next_id = 1 }
+
+(** Terminates a worker, rejecting its pending tasks. *)
+let stop_worker worker =
+  terminate worker.handle;
+  Hashtbl.iter (fun _ resolver -> Lwt.wakeup_later_exn resolver (Failure "The pool was shut down.")) worker.pending;
+  Hashtbl.reset worker.pending
+
+(** Sends a message of the given kind to a worker once it is set up, and waits for the payload of its result. *)
+let request worker kind fields =
+  let* () = worker.ready in
+  let id = worker.next_id in
+  worker.next_id <- id + 1;
+  let promise, resolver = Lwt.wait () in
+  Hashtbl.replace worker.pending id resolver;
+  post worker.handle (message kind (("id", Js.Unsafe.inject id) :: fields));
+  promise
+
+(** Sends a chunk to a worker once it is set up, and waits for its results. *)
+let call worker name chunk =
+  request worker "task" [ ("name", Js.Unsafe.inject (Js.string name)); ("payload", Js.Unsafe.inject (Js.bytestring chunk)) ]
+
+(** The chunks a worker still owns: the indices from [first] to [last - 1]. *)
+type range = { mutable first : int; mutable last : int }
+
+(**
+    Takes the next chunk for worker [i]: the front of its own range, or else
+    the front of the back half it steals from the largest remaining range.
+ *)
+let rec next_chunk ranges i =
+  let own = ranges.(i) in
+  if own.first < own.last then begin
+    let chunk = own.first in
+    own.first <- chunk + 1;
+    Some chunk
+  end else begin
+    let victim = Array.fold_left (fun best r -> if r.last - r.first > best.last - best.first then r else best) own ranges in
+    let remaining = victim.last - victim.first in
+    if remaining = 0 then None
+    else begin
+      own.first <- victim.last - (remaining + 1) / 2;
+      own.last <- victim.last;
+      victim.last <- own.first;
+      next_chunk ranges i
+    end
+  end
+
+(**
+    Applies the function [name] to every chunk on the workers of a pool.
+    The first failure stops the distribution of chunks and rejects the result.
+    @return The results of the chunks, in order.
+ *)
+let run workers name chunks =
+  let count = Array.length chunks and size = Array.length workers in
+  let results = Array.make count "" in
+  let ranges = Array.init size (fun i -> { first = i * count / size; last = (i + 1) * count / size }) in
+  let failure = ref None in
+  let rec work i =
+    if Option.is_some !failure then Lwt.return_unit
+    else
+      match next_chunk ranges i with
+      | None -> Lwt.return_unit
+      | Some chunk ->
+        Lwt.try_bind (fun () -> call workers.(i) name chunks.(chunk))
+          (fun result -> results.(chunk) <- result; work i)
+          (fun exn -> if Option.is_none !failure then failure := Some exn; Lwt.return_unit)
+  in
+  let* () = Lwt.join (List.init size work) in
+  match !failure with
+  | Some exn -> Lwt.fail exn
+  | None -> Lwt.return results
+
+(**
+    The setup message of a worker. The source files are read from the
+    kernel's filesystem and sent along with the libraries loaded so far, and
+    the artifacts the kernel has fetched already, which the worker then does
+    not download again.
+ *)
+let init_message sources =
+  let source_objects =
+    List.map (fun path ->
+        let code = In_channel.with_open_bin path In_channel.input_all in
+        Js.Unsafe.obj [| ("path", Js.Unsafe.inject (Js.string path)); ("code", Js.Unsafe.inject (Js.bytestring code)) |])
+      sources
+  in
+  let libraries = List.map Js.string (Xlibloader.loaded_libraries ()) in
+  let files =
+    List.map (fun (name, content) ->
+        Js.Unsafe.obj [| ("name", Js.Unsafe.inject (Js.string name)); ("content", Js.Unsafe.inject (Js.bytestring content)) |])
+      (Xlibloader.fetched_files ())
+  in
+  message "init"
+    [ ("setup_url", Js.Unsafe.inject (Js.string !setup_url));
+      ("libraries", Js.Unsafe.inject (Js.array (Array.of_list libraries)));
+      ("files", Js.Unsafe.inject (Js.array (Array.of_list files)));
+      ("sources", Js.Unsafe.inject (Js.array (Array.of_list source_objects))) ]
+
+(** Spawns a pool for {!Xlib.Parallel.create}, whose workers are set up with the source files. *)
+let spawn_pool ?workers ~sources () =
+  let size = match workers with Some n -> max 1 n | None -> max 1 (cores () - 1) in
+  let init = init_message sources in
+  log (Printf.sprintf "[Parallel] Spawning a pool of %d workers." size);
+  let workers = Array.init size (fun _ -> start_worker init) in
+  Xlib.Parallel.make_pool ~size ~run:(run workers) ~shutdown:(fun () -> Array.iter stop_worker workers)
+
+(**
+    Compiles a unit for {!Xaot} in a worker spawned for it, so that the
+    compiler driver never touches the state of the kernel's toplevel.
+    @param name The base name of the files of the unit.
+    @param source The source of the unit.
+    @return The contents of the [.cmi] and the [.cmo] of the unit.
+ *)
+let compile_unit ~name source =
+  let worker = start_worker (init_message []) in
+  Lwt.finalize
+    (fun () ->
+      let+ payload =
+        request worker "compile" [ ("name", Js.Unsafe.inject (Js.string name)); ("source", Js.Unsafe.inject (Js.bytestring source)) ]
+      in
+      (Marshal.from_string payload 0 : string * string))
+    (fun () -> stop_worker worker; Lwt.return_unit)
+
+(**
+    Installs the pool backend of {!Xlib.Parallel} and the compiler of {!Xaot}.
+    @param setup_url The URL the kernel was set up from, relative to the
+                     kernel's worker or absolute.
+ *)
+let install ~setup_url:url =
+  setup_url := Js.to_string (resolve_url (Js.string url));
+  Xlib.Parallel.set_backend spawn_pool;
+  Xaot.set_compiler compile_unit
+
+(** {2 Worker Side} *)
+
+(** The directory of the worker's filesystem where the pool's source files are written. *)
+let sources_dir = "/static/parallel"
+
+(** The functions applied so far by this worker, by path. *)
+let functions : (string, Obj.t -> Obj.t) Hashtbl.t = Hashtbl.create 8
+
+(**
+    Looks up a function of one unlabelled argument in the worker's toplevel
+    environment.
+    @param name The path of the function, such as ["Sim.run"].
+    @raise Failure if the path is unbound or is not such a function.
+ *)
+let resolve name =
+  match Hashtbl.find_opt functions name with
+  | Some f -> f
+  | None ->
+    let env = !Toploop.toplevel_env in
+    let path, desc =
+      try Env.find_value_by_name (Parse.longident (Lexing.from_string name)) env
+      with _ -> failwith (Printf.sprintf "Unbound value %s in the source files of the pool." name)
+    in
+    (match Types.get_desc (Ctype.expand_head env desc.val_type) with
+     | Types.Tarrow (Asttypes.Nolabel, _, _, _) -> ()
+     | _ -> failwith (Printf.sprintf "%s is not a function of one unlabelled argument." name));
+    let f : Obj.t -> Obj.t = Obj.obj (Toploop.eval_value_path env path) in
+    Hashtbl.replace functions name f;
+    f
+
+(** Sets up the worker's toplevel as described by an ["init"] message. *)
+let initialize msg =
+  let url = Js.to_string (field msg "setup_url") in
+  let libraries = Array.to_list (Array.map Js.to_string (Js.to_array (field msg "libraries"))) in
+  let sources =
+    Array.to_list (Js.to_array (field msg "sources"))
+    |> List.map (fun source -> (Js.to_string (field source "path"), Js.to_bytestring (field source "code")))
+  in
+  let files =
+    Array.to_list (Js.to_array (field msg "files"))
+    |> List.map (fun file -> (Js.to_string (field file "name"), Js.to_bytestring (field file "content")))
+  in
+  let* _ = Xlibloader.setup ~preloaded:files ~base_url:url in
+  Xtoplevel.setup ~url;
+  let* () =
+    Lwt_list.iter_s (fun name ->
+        let* result = Xlibloader.load_on_demand ~base_url:url ~name in
+        match result with
+        | Ok _ -> Lwt.return_unit
+        | Error (Protocol.Stdout msg | Protocol.Stderr msg | Protocol.Value msg) -> Lwt.fail_with msg
+        | Error (Protocol.DisplayData _) -> Lwt.fail_with ("Could not load library " ^ name))
+      libraries
+  in
+  Lwt_list.iter_s (fun (path, code) ->
+      let copy = Filename.concat sources_dir (Filename.basename path) in
+      Sys_js.create_file ~name:copy ~content:code;
+      let* outputs = Xtoplevel.eval (Printf.sprintf "#mod_use %S;;" copy) in
+      match List.filter_map (function Protocol.Stderr s -> Some s | _ -> None) outputs with
+      | [] -> Lwt.return_unit
+      | errors -> Lwt.fail_with (Printf.sprintf "%s: %s" path (String.concat "" errors)))
+    sources
+
+(** The directory of the worker's filesystem where the units sent by {!compile_unit} are compiled. *)
+let units_dir = "/static/aot"
+
+(** The report of a syntax or typing error, as the compiler prints it. *)
+let compiler_report exn =
+  let buffer = Buffer.create 256 in
+  let ppf = Format.formatter_of_buffer buffer in
+  Location.report_exception ppf exn;
+  Format.pp_print_flush ppf ();
+  Buffer.contents buffer
+
+(**
+    Compiles the unit of a ["compile"] message with the compiler driver, as
+    `ocamlc -c` would, against the libraries of the worker's toplevel.
+    @return The marshalled contents of the [.cmi] and the [.cmo] of the unit.
+    @raise Failure with the compiler's report on a syntax or typing error.
+ *)
+let compile msg =
+  let prefix = Filename.concat units_dir (Js.to_string (field msg "name")) in
+  Sys_js.create_file ~name:(prefix ^ ".ml") ~content:(Js.to_bytestring (field msg "source"));
+  (* The driver resets the load path from the include directories. *)
+  let { Load_path.visible; _ } = Load_path.get_paths () in
+  Clflags.include_dirs := List.rev_append visible !Clflags.include_dirs;
+  (try Compile.implementation ~start_from:Clflags.Compiler_pass.Parsing ~source_file:(prefix ^ ".ml") ~output_prefix:prefix
+   with exn -> failwith (compiler_report exn));
+  let read path = In_channel.with_open_bin path In_channel.input_all in
+  Marshal.to_string (read (prefix ^ ".cmi"), read (prefix ^ ".cmo")) []
+
+(**
+    The entry point of a worker, exported as `xocaml.parallelWorker`.
+    @param post_message The JavaScript function posting a message to the kernel.
+    @return The function handling the messages received from the kernel.
+ *)
+let serve (post_message : Js.Unsafe.any) =
+  let reply msg = ignore (Js.Unsafe.fun_call post_message [| Js.Unsafe.inject msg |]) in
+  let reply_error id exn =
+    reply (message "error" [ ("id", Js.Unsafe.inject id); ("message", Js.Unsafe.inject (Js.string (error_message exn))) ])
+  in
+  Js.wrap_callback (fun msg ->
+      match Js.to_string (field msg "kind") with
+      | "init" ->
+        Lwt.on_any (initialize msg) (fun () -> reply (message "ready" [ ("id", Js.Unsafe.inject 0) ])) (reply_error 0)
+      | "task" ->
+        let id : int = field msg "id" in
+        (try
+           let f = resolve (Js.to_string (field msg "name")) in
+           let inputs : Obj.t array = Marshal.from_string (Js.to_bytestring (field msg "payload")) 0 in
+           let outputs = Marshal.to_string (Array.map f inputs) [] in
+           reply (message "result" [ ("id", Js.Unsafe.inject id); ("payload", Js.Unsafe.inject (Js.bytestring outputs)) ])
+         with exn -> reply_error id exn)
+      | "compile" ->
+        let id : int = field msg "id" in
+        (try reply (message "result" [ ("id", Js.Unsafe.inject id); ("payload", Js.Unsafe.inject (Js.bytestring (compile msg))) ])
+         with exn -> reply_error id exn)
+      | kind -> log (Printf.sprintf "[Parallel] Ignoring message of kind '%s'." kind))
@@ -0,0 +1,31 @@
+(**
+   {1 Worker Pools}
+   @author Davy Cottet
+
+   The backend of {!Xlib.Parallel}: pools of Web Workers (worker threads in
+   Node.js), each running its own instance of the kernel. Chunks of marshalled
+   inputs are balanced across the workers by work stealing, and the results
+   are merged back in order. The units of [#compile_notebook] are compiled in
+   such a worker too, out of the kernel's toplevel.
+
+   The workers run `xocaml_worker.js`, served next to the kernel. In Node.js,
+   `globalThis.xocamlParallel = { script; bundle; preload }` gives the paths
+   of that script, of the kernel bundle, and of modules to load before it.
+ *)
+
+(**
+   Installs the pool backend of {!Xlib.Parallel}, and the compiler of
+   {!Xaot}, which compiles each unit in a worker of its own.
+   @param setup_url The URL the kernel was set up from, which the workers set
+                    up their own toplevel from, and where their script and the
+                    kernel bundle are installed. A relative URL is resolved
+                    against the kernel's worker.
+ *)
+val install : setup_url:string -> unit
+
+(**
+   The entry point of a worker, exported as `xocaml.parallelWorker`.
+   @param post_message The JavaScript function posting a message to the kernel.
+   @return The function handling the messages received from the kernel.
+ *)
+val serve : Js_of_ocaml.Js.Unsafe.any -> (Js_of_ocaml.Js.Unsafe.any -> unit) Js_of_ocaml.Js.callback
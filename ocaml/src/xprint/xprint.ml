@@ -0,0 +1,164 @@
+(**
+    {1 Bounded Value Printing}
+    @author Davy Cottet
+
+    The toplevel prints the value of every phrase into a buffer, which is then
+    sent to the frontend as JSON and rendered. For a huge value, this can take
+    much longer than computing it. This module keeps that cost bounded:
+
+    - The depth and length budgets of the value printer default to the ones
+      set with {!Xlib.set_print_budget}, which are applied at the start of the
+      next cell. Budgets set with [#print_depth] or [#print_length] are kept
+      until {!Xlib.set_print_budget} is called again. Parts of a value beyond
+      the budgets are elided with [...].
+    - When the value bound by a definition is elided, it is retained under a
+      numeric handle. The [#expand] directive, or an [Expand] request from the
+      frontend, prints more of it on demand, with larger budgets, without
+      re-executing anything.
+
+    Only the most recent {!max_handles} values are retained. The values of
+    anonymous expressions ([- : t = ...]) cannot be retained, as the toplevel
+    does not bind them.
+ *)
+
+open Xutil
+
+(** A value retained for expansion. *)
+type handle = {
+  name : string;          (** The name the value was bound to. *)
+  env : Env.t;            (** The environment in which it was bound. *)
+  value : Obj.t;          (** The value itself. *)
+  ty : Types.type_expr;   (** Its type, which drives the printer. *)
+  mutable depth : int;    (** The depth budget it was last printed with. *)
+  mutable length : int;   (** The length budget it was last printed with. *)
+}
+
+(** The maximum number of values retained at once. *)
+let max_handles = 32
+
+let handles : (int, handle) Hashtbl.t = Hashtbl.create max_handles
+let handle_order = Queue.create ()
+let next_handle = ref 0
+
+(** Names of the values elided by the phrase being executed, most recent first. *)
+let elided_names = ref []
+
+(** Whether the phrase being executed printed an elided anonymous value. *)
+let anonymous_elided = ref false
+
+(** Tells whether the printer elided part of a value. *)
+let rec is_elided (v : Outcometree.out_value) =
+  match v with
+  | Oval_ellipsis -> true
+  | Oval_string (s, max_length, _) -> String.length s > max_length
+  | Oval_array values | Oval_list values | Oval_tuple values | Oval_constr (_, values) -> List.exists is_elided values
+  | Oval_record fields -> List.exists (fun (_, v) -> is_elided v) fields
+  | Oval_variant (_, Some v) | Oval_lazy v -> is_elided v
+  | _ -> false
+
+(** Records the elided values of a printed phrase. *)
+let record (phrase : Outcometree.out_phrase) =
+  match phrase with
+  | Ophr_eval (v, _) -> if is_elided v then anonymous_elided := true
+  | Ophr_signature items ->
+    List.iter (function
+      | Outcometree.Osig_value { oval_name; _ }, Some v when is_elided v -> elided_names := oval_name :: !elided_names
+      | _ -> ()) items
+  | Ophr_exception _ -> ()
+
+(** Whether the printing hook has been installed. *)
+let installed = ref false
+
+(** Installs the hook recording elided values around the toplevel's phrase printer. *)
+let install () =
+  if not !installed then begin
+    installed := true;
+    let print = !Toploop.print_out_phrase in
+    Toploop.print_out_phrase := (fun ppf phrase -> print ppf phrase; record phrase)
+  end
+
+(**
+    The {!Xlib.set_print_budget} setting last applied by {!begin_cell}, and the
+    budgets it set, to tell whether the user changed either since.
+ *)
+let applied_budget = ref None
+
+(**
+    Sets the printer budgets to the ones set with {!Xlib.set_print_budget},
+    unless the user changed them with [#print_depth] or [#print_length] since
+    they were last set, and {!Xlib.set_print_budget} was not called since.
+ *)
+let begin_cell () =
+  let budget = Xlib.print_budget () in
+  let current = (!Toploop.max_printer_depth, !Toploop.max_printer_steps) in
+  (match !applied_budget with
+   (* Every call to Xlib.set_print_budget stores a new pair, hence the physical comparison. *)
+   | Some (source, applied) when source == budget && current <> applied -> ()
+   | _ ->
+     let depth, length = budget in
+     Toploop.max_printer_depth := depth;
+     Toploop.max_printer_steps := length;
+     applied_budget := Some (budget, budget));
+  elided_names := [];
+  anonymous_elided := false
+
+(** Drops every retained value, e.g. when the toplevel environment is reset. *)
+let reset () =
+  Hashtbl.reset handles;
+  Queue.clear handle_order;
+  elided_names := [];
+  anonymous_elided := false
+
+(** Retains the current value of [name], returning its handle. *)
+let retain name =
+  let env = !Toploop.toplevel_env in
+  match Env.find_value_by_name (Longident.Lident name) env with
+  | path, desc ->
+    let value = Toploop.eval_value_path env path in
+    incr next_handle;
+    let id = !next_handle in
+    Hashtbl.replace handles id
+      { name; env; value; ty = desc.val_type; depth = !Toploop.max_printer_depth; length = !Toploop.max_printer_steps };
+    Queue.push id handle_order;
+    if Queue.length handle_order > max_handles then Hashtbl.remove handles (Queue.pop handle_order);
+    Some id
+  | exception exn ->
+    log (Printf.sprintf "[Print] Could not retain '%s': %s" name (Printexc.to_string exn));
+    None
+
+(**
+    Retains the values elided by the phrase that was just executed, and prints
+    on [ppf] how to expand them.
+ *)
+let report ppf =
+  let names = List.rev !elided_names in
+  elided_names := [];
+  List.iter (fun name ->
+    match retain name with
+    | Some id -> Format.fprintf ppf "(* %s was elided: #expand %d;; prints more of it. *)@." name id
+    | None -> ()) names;
+  if !anonymous_elided then begin
+    anonymous_elided := false;
+    Format.fprintf ppf "(* The value was elided: bind it with let to be able to expand it. *)@."
+  end
+
+(**
+    Prints more of a retained value. Without explicit budgets, the depth is
+    doubled and the length quadrupled with respect to the last printing.
+    @param handle The handle reported when the value was elided.
+    @return The printed value, or an error message for an unknown handle.
+ *)
+let expand ?depth ?length id =
+  match Hashtbl.find_opt handles id with
+  | None -> Error (Printf.sprintf "Unknown or expired value handle %d." id)
+  | Some handle ->
+    handle.depth <- Option.value ~default:(handle.depth * 2) depth;
+    handle.length <- Option.value ~default:(handle.length * 4) length;
+    let saved_depth = !Toploop.max_printer_depth and saved_length = !Toploop.max_printer_steps in
+    Toploop.max_printer_depth := handle.depth;
+    Toploop.max_printer_steps := handle.length;
+    Fun.protect
+      ~finally:(fun () -> Toploop.max_printer_depth := saved_depth; Toploop.max_printer_steps := saved_length)
+      (fun () ->
+        Ok (Format.asprintf "@[<2>%s =@ %a@]@." handle.name
+              (fun ppf () -> Toploop.print_value handle.env handle.value ppf handle.ty) ()))
@@ -0,0 +1,36 @@
+(**
+   {1 Bounded Value Printing}
+   @author Davy Cottet
+
+   Keeps the cost of printing toplevel values bounded. The printer budgets
+   default to the ones set with {!Xlib.set_print_budget}, and values bound by definitions whose
+   printing was elided are retained under a handle so that more of them can be
+   printed on demand, with [#expand] or an [Expand] request.
+ *)
+
+(** Installs the hook recording elided values. Must be called once the toplevel is initialized. *)
+val install : unit -> unit
+
+(**
+   Sets the printer budgets to the ones set with {!Xlib.set_print_budget},
+   unless the user changed them with [#print_depth] or [#print_length] since.
+   Called at the start of each cell.
+ *)
+val begin_cell : unit -> unit
+
+(** Drops every retained value, e.g. when the toplevel environment is reset. *)
+val reset : unit -> unit
+
+(**
+   Retains the values elided by the phrase that was just executed, and prints
+   on [ppf] how to expand them.
+ *)
+val report : Format.formatter -> unit
+
+(**
+   Prints more of a retained value. Without explicit budgets, the depth is
+   doubled and the length quadrupled with respect to the last printing.
+   @param handle The handle reported when the value was elided.
+   @return The printed value, or an error message for an unknown handle.
+ *)
+val expand : ?depth:int -> ?length:int -> int -> (string, string) result
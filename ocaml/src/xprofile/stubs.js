@@ -0,0 +1,81 @@
+//Provides: xocaml_profiler_now
+function xocaml_profiler_now() {
+  return typeof performance !== "undefined" ? performance.now() : Date.now();
+}
+
+//Provides: xocaml_profiler_start
+//Requires: xocaml_profiler_now
+function xocaml_profiler_start(interval) {
+  // Samples are taken by the probes the profiler inserts in the cell's
+  // functions and loops: a probe records the current stack once the sampling
+  // interval has elapsed since the previous sample. This works in any thread,
+  // the kernel's worker included, as it needs no engine-specific profiler.
+  var now = xocaml_profiler_now();
+  globalThis.__xocamlProfile = {
+    interval: interval, last: now, next: now + interval,
+    stacks: [], weights: [],
+    stackTraceLimit: Error.stackTraceLimit
+  };
+  // Keep deep stacks; this only has an effect in V8.
+  if (typeof Error.stackTraceLimit === "number") Error.stackTraceLimit = 256;
+  return 0;
+}
+
+//Provides: xocaml_profiler_frames
+function xocaml_profiler_frames(trace) {
+  // Parses a stack trace, in the V8 ("    at name (location)") or the
+  // SpiderMonkey/JavaScriptCore ("name@location") format, into the frames
+  // from the root to the leaf. The frame of the probe itself is dropped, as
+  // are the runtime's application helpers, and frames below the outermost
+  // evaluated code, i.e. those of the kernel running the cell.
+  var lines = String(trace || "").split("\n"), frames = [];
+  for (var i = 0; i < lines.length; i++) {
+    var line = lines[i], name, location;
+    var v8 = /^\s*at (?:new )?(?:(.*?) \((.*)\)|(.*))$/.exec(line);
+    if (v8) {
+      name = v8[1] || "(anonymous)";
+      location = v8[2] || v8[3] || "";
+    } else {
+      var at = line.indexOf("@");
+      if (at < 0) continue;
+      name = line.slice(0, at) || "(anonymous)";
+      location = line.slice(at + 1);
+    }
+    name = name.replace(/^Object\./, "");
+    frames.push({ name: name, evaluated: /eval|<anonymous>|Function/.test(location) });
+  }
+  frames.shift();
+  frames = frames.filter(function (frame) { return !/^caml_call/.test(frame.name); });
+  var outermost = -1;
+  for (var j = 0; j < frames.length; j++) if (frames[j].evaluated) outermost = j;
+  if (outermost >= 0) frames = frames.slice(0, outermost + 1);
+  return frames.map(function (frame) { return frame.name; }).reverse();
+}
+
+//Provides: xocaml_profiler_probe
+//Requires: xocaml_profiler_now, xocaml_profiler_frames
+function xocaml_profiler_probe(_unit) {
+  var state = globalThis.__xocamlProfile;
+  if (!state) return 0;
+  var now = xocaml_profiler_now();
+  if (now < state.next) return 0;
+  var names = xocaml_profiler_frames(new Error().stack);
+  if (names.length > 0) {
+    state.stacks.push(names);
+    state.weights.push(now - state.last);
+  }
+  state.last = now;
+  state.next = now + state.interval;
+  return 0;
+}
+
+//Provides: xocaml_profiler_stop
+function xocaml_profiler_stop(_unit) {
+  // The samples are returned as a list of sampled stacks, each given from the
+  // root to the leaf, and the time in milliseconds each sample accounts for.
+  var state = globalThis.__xocamlProfile;
+  globalThis.__xocamlProfile = undefined;
+  if (!state) return "";
+  if (typeof state.stackTraceLimit === "number") Error.stackTraceLimit = state.stackTraceLimit;
+  return JSON.stringify({ stacks: state.stacks, weights: state.weights });
+}
@@ -0,0 +1,266 @@
+(**
+    {1 Sampling Profiler}
+    @author Davy Cottet
+
+    This module implements the [#profile] directive, which runs the next cell
+    under a sampling profiler and renders the result as a flame graph in the
+    cell output.
+
+    JavaScript gives no way to interrupt the thread running a cell to look at
+    its stack, and the engines' own profilers are not available in the
+    kernel's worker. Samples are therefore taken by the profiled code itself:
+    the phrases of the profiled cell are instrumented with a probe at the
+    entry of every function and of every loop iteration. A probe reads the
+    clock and, once {!sample_interval} has elapsed since the previous sample,
+    records the current JavaScript stack, which is charged with the time
+    elapsed since then. Probes are placed before the body, so tail calls stay
+    tail calls. Sampling is implemented in `stubs.js`.
+
+    While a cell is profiled, the embedded compiler keeps readable function
+    names (see {!Xtier.set_readable_names}), so that frames of the code
+    compiled from the cell carry the names of the OCaml functions.
+
+    With [#profile "file.speedscope.json"], the samples are also saved in the
+    speedscope format, which can be opened at https://www.speedscope.app.
+ *)
+
+open Js_of_ocaml
+open Xutil
+
+external profiler_start : float -> unit = "xocaml_profiler_start"
+external profiler_stop : unit -> Js.js_string Js.t = "xocaml_profiler_stop"
+
+(** The time between two samples, in milliseconds. *)
+let sample_interval = 1.
+
+(** A profiling session of one cell. *)
+type session = {
+  save_to : string option;  (** Where to save the speedscope file, if requested. *)
+}
+
+(** The request made by the last [#profile] directive, for the next cell. *)
+let pending : string option option ref = ref None
+
+(** Whether a cell is being profiled, i.e. whether its phrases must be instrumented. *)
+let active = ref false
+
+(**
+    Handles the [#profile] directive: the next cell will be profiled.
+    @param save_to The file where the samples should also be saved, if any.
+    @return A message confirming the request.
+ *)
+let request ?save_to () =
+  let save_to = Option.map (fun file -> if Filename.is_relative file then Filename.concat (Sys.getcwd ()) file else file) save_to in
+  pending := Some save_to;
+  "The next cell will be profiled."
+
+(**
+    Starts the profiler if the previous cell requested it with [#profile].
+    @return [None] if no profile was requested.
+ *)
+let start () =
+  match !pending with
+  | None -> None
+  | Some save_to ->
+    pending := None;
+    log "[Profile] Profiler started.";
+    Xtier.set_readable_names true;
+    profiler_start sample_interval;
+    active := true;
+    Some { save_to }
+
+(**
+    The probe inserted by {!instrument}. It calls the sampling primitive
+    directly, so that the probe adds no OCaml frame to the sampled stacks.
+ *)
+let probe = lazy (
+  Parse.expression (Lexing.from_string
+    "let module Xocaml_profile = struct external probe : unit -> unit = \"xocaml_profiler_probe\" end in Xocaml_profile.probe ()"))
+
+(** Prepends the probe to an expression, which stays in tail position. *)
+let with_probe (expr : Parsetree.expression) =
+  Ast_helper.Exp.sequence ~loc:expr.pexp_loc (Lazy.force probe) expr
+
+(** The mapper inserting a probe at the entry of functions and loop bodies. *)
+let mapper =
+  let open Ast_mapper in
+  { default_mapper with
+    expr = (fun self e ->
+      let e = default_mapper.expr self e in
+      match e.pexp_desc with
+      | Pexp_function (params, constraint_, Pfunction_body body) ->
+        { e with pexp_desc = Pexp_function (params, constraint_, Pfunction_body (with_probe body)) }
+      | Pexp_function (params, constraint_, Pfunction_cases (cases, loc, attrs)) ->
+        let cases = List.map (fun (case : Parsetree.case) -> { case with pc_rhs = with_probe case.pc_rhs }) cases in
+        { e with pexp_desc = Pexp_function (params, constraint_, Pfunction_cases (cases, loc, attrs)) }
+      | Pexp_for (pattern, low, high, direction, body) ->
+        { e with pexp_desc = Pexp_for (pattern, low, high, direction, with_probe body) }
+      | Pexp_while (condition, body) ->
+        { e with pexp_desc = Pexp_while (condition, with_probe body) }
+      | _ -> e) }
+
+(**
+    Instruments a phrase of the profiled cell with sampling probes. Phrases
+    are returned unchanged when no cell is being profiled.
+ *)
+let instrument (phrase : Parsetree.toplevel_phrase) =
+  match phrase with
+  | Ptop_def str when !active -> Parsetree.Ptop_def (mapper.structure mapper str)
+  | phrase -> phrase
+
+(** Removes the numeric suffix `js_of_ocaml` appends to disambiguate names, as in [fib$1]. *)
+let demangle name =
+  match String.rindex_opt name '$' with
+  | Some i when i > 0 && i < String.length name - 1
+                && String.for_all (fun c -> c >= '0' && c <= '9') (String.sub name (i + 1) (String.length name - i - 1)) ->
+    String.sub name 0 i
+  | _ -> name
+
+(** A node of the call tree built from the samples. *)
+type node = {
+  name : string;
+  mutable total : float;  (** Time in this frame and its callees, in milliseconds. *)
+  mutable self : float;   (** Time in this frame itself, in milliseconds. *)
+  children : (string, node) Hashtbl.t;
+}
+
+let new_node name = { name; total = 0.; self = 0.; children = Hashtbl.create 4 }
+
+(** Merges sampled stacks, given from the root to the leaf, into a call tree. *)
+let build_tree stacks weights =
+  let root = new_node "all" in
+  List.iter2 (fun stack weight ->
+    root.total <- root.total +. weight;
+    let leaf = List.fold_left (fun node name ->
+      let child = match Hashtbl.find_opt node.children name with
+        | Some child -> child
+        | None -> let child = new_node name in Hashtbl.add node.children name child; child
+      in
+      child.total <- child.total +. weight;
+      child) root stack
+    in
+    leaf.self <- leaf.self +. weight) stacks weights;
+  root
+
+(** The children of a node, in a stable order. *)
+let sorted_children node =
+  Hashtbl.fold (fun _ child acc -> child :: acc) node.children [] |> List.sort (fun a b -> String.compare a.name b.name)
+
+let rec depth node = 1 + List.fold_left (fun acc child -> max acc (depth child)) 0 (sorted_children node)
+
+let escape_xml s =
+  let b = Buffer.create (String.length s) in
+  String.iter (function
+    | '&' -> Buffer.add_string b "&amp;" | '<' -> Buffer.add_string b "&lt;"
+    | '>' -> Buffer.add_string b "&gt;" | '"' -> Buffer.add_string b "&quot;"
+    | c -> Buffer.add_char b c) s;
+  Buffer.contents b
+
+(** The width of the flame graph, and the height of one frame, in pixels. *)
+let graph_width = 1200.
+let frame_height = 17.
+
+(**
+    Renders a call tree as an SVG flame graph: callers below their callees,
+    each frame as wide as the time spent in it. Hovering a frame shows its
+    name and timings.
+ *)
+let flame_graph root =
+  let rows = depth root in
+  let height = float_of_int rows *. frame_height in
+  let b = Buffer.create 16384 in
+  Printf.bprintf b "<svg xmlns=\"http://www.w3.org/2000/svg\" width=\"%.0f\" height=\"%.0f\" font-family=\"monospace\" font-size=\"11\">" graph_width height;
+  let scale = if root.total > 0. then graph_width /. root.total else 0. in
+  let rec render node level x =
+    let width = node.total *. scale in
+    if width >= 0.5 then begin
+      let y = height -. float_of_int (level + 1) *. frame_height in
+      let hue = Hashtbl.hash node.name mod 55 in
+      Printf.bprintf b "<g><title>%s (%.2f ms, %.1f%%, self %.2f ms)</title>" (escape_xml node.name) node.total (100. *. node.total /. root.total) node.self;
+      Printf.bprintf b "<rect x=\"%.2f\" y=\"%.2f\" width=\"%.2f\" height=\"%.0f\" fill=\"hsl(%d,80%%,60%%)\" stroke=\"white\" stroke-width=\"0.5\"/>" x y width (frame_height -. 1.) hue;
+      let chars = int_of_float (width /. 7.) - 1 in
+      if chars >= 3 then begin
+        let label = if String.length node.name <= chars then node.name else String.sub node.name 0 (chars - 2) ^ ".." in
+        Printf.bprintf b "<text x=\"%.2f\" y=\"%.2f\">%s</text>" (x +. 3.) (y +. frame_height -. 5.) (escape_xml label)
+      end;
+      Buffer.add_string b "</g>";
+      ignore (List.fold_left (fun x child -> render child (level + 1) x; x +. child.total *. scale) x (sorted_children node))
+    end
+  in
+  render root 0 0.;
+  Buffer.add_string b "</svg>";
+  Buffer.contents b
+
+(** Summarizes a call tree as the functions with the highest self time. *)
+let top_functions ?(count = 15) root =
+  let self_times = Hashtbl.create 64 in
+  let rec walk node =
+    if node != root then
+      Hashtbl.replace self_times node.name (node.self +. Option.value ~default:0. (Hashtbl.find_opt self_times node.name));
+    Hashtbl.iter (fun _ child -> walk child) node.children
+  in
+  walk root;
+  let sorted = Hashtbl.fold (fun name time acc -> (name, time) :: acc) self_times [] |> List.sort (fun (_, a) (_, b) -> Float.compare b a) in
+  let lines = List.filteri (fun i _ -> i < count) sorted |> List.map (fun (name, time) ->
+    Printf.sprintf "%10.2f ms %6.1f%%  %s" time (100. *. time /. root.total) name)
+  in
+  String.concat "\n" (Printf.sprintf "Profile: %.2f ms sampled. Top functions by self time:" root.total :: lines)
+
+(** Encodes samples in the speedscope "sampled" file format. *)
+let speedscope stacks weights =
+  let frames = Hashtbl.create 64 and names = ref [] in
+  let index name = match Hashtbl.find_opt frames name with
+    | Some i -> i
+    | None -> let i = Hashtbl.length frames in Hashtbl.add frames name i; names := name :: !names; i
+  in
+  let samples = List.map (fun stack -> `List (List.map (fun name -> `Int (index name)) stack)) stacks in
+  let total = List.fold_left (+.) 0. weights in
+  `Assoc [
+    ("$schema", `String "https://www.speedscope.app/file-format-schema.json");
+    ("shared", `Assoc [ ("frames", `List (List.rev_map (fun name -> `Assoc [ ("name", `String name) ]) !names)) ]);
+    ("profiles", `List [ `Assoc [
+      ("type", `String "sampled"); ("name", `String "xeus-ocaml cell"); ("unit", `String "milliseconds");
+      ("startValue", `Float 0.); ("endValue", `Float total);
+      ("samples", `List samples); ("weights", `List (List.map (fun w -> `Float w) weights)) ] ]);
+    ("exporter", `String "xeus-ocaml") ]
+
+(** Saves the samples as a speedscope file, returning a message describing the outcome. *)
+let save path stacks weights =
+  try
+    let oc = open_out_bin path in
+    Fun.protect ~finally:(fun () -> close_out oc) (fun () -> Yojson.Safe.to_channel oc (speedscope stacks weights));
+    Protocol.Stdout (Printf.sprintf "Profile saved to %s\n" path)
+  with exn -> Protocol.Stderr (Printf.sprintf "Could not save the profile to %s: %s\n" path (Printexc.to_string exn))
+
+(**
+    Stops the profiler started by {!start} and renders its samples. Call it
+    whether the cell succeeded or not, so that the profiler never outlives it.
+    @return The flame graph and summary of the profile, or an error message if
+            no samples could be read. Empty if no profile was requested.
+ *)
+let stop = function
+  | None -> []
+  | Some { save_to } ->
+    active := false;
+    let json = Js.to_string (profiler_stop ()) in
+    Xtier.set_readable_names false;
+    let result =
+      try
+        let open Yojson.Safe.Util in
+        let data = Yojson.Safe.from_string json in
+        let stacks = data |> member "stacks" |> to_list |> List.map (fun s -> to_list s |> List.map (fun n -> demangle (to_string n))) in
+        let weights = data |> member "weights" |> to_list |> List.map to_number in
+        Ok (stacks, weights)
+      with exn -> Error (Printexc.to_string exn)
+    in
+    match result with
+    | Error msg -> [ Protocol.Stderr (Printf.sprintf "Could not read the profile: %s\n" msg) ]
+    | Ok ([], _) -> [ Protocol.Stderr "The profile contains no samples: the cell ran too briefly.\n" ]
+    | Ok (stacks, weights) ->
+      let root = build_tree stacks weights in
+      let graph = Protocol.DisplayData (`Assoc [
+        ("image/svg+xml", `String (flame_graph root));
+        ("text/plain", `String (top_functions root)) ])
+      in
+      let saved = match save_to with Some path -> [ save path stacks weights ] | None -> [] in
+      graph :: saved
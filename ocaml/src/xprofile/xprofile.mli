@@ -0,0 +1,40 @@
+(**
+   {1 Sampling Profiler}
+   @author Davy Cottet
+
+   Support for the [#profile] directive, which runs the next cell under a
+   sampling profiler and renders an SVG flame graph of the result, optionally
+   saving the samples in the speedscope format. The phrases of the profiled
+   cell are instrumented with probes that sample the JavaScript stack at a
+   fixed interval, which works in the kernel's worker.
+ *)
+
+(** A profiling session of one cell. *)
+type session
+
+(**
+   Handles the [#profile] directive: the next cell will be profiled.
+   @param save_to The file where the samples should also be saved, if any.
+   @return A message confirming the request.
+ *)
+val request : ?save_to:string -> unit -> string
+
+(**
+   Starts the profiler if the previous cell requested it with [#profile].
+   @return [None] if no profile was requested.
+ *)
+val start : unit -> session option
+
+(**
+   Instruments a phrase of the cell being profiled with sampling probes.
+   Phrases are returned unchanged when no cell is being profiled.
+ *)
+val instrument : Parsetree.toplevel_phrase -> Parsetree.toplevel_phrase
+
+(**
+   Stops the profiler started by {!start} and renders its samples. It must be
+   called whether the cell succeeded or not.
+   @return The flame graph and summary of the profile, or an error message if
+           no samples could be read. Empty if no profile was requested.
+ *)
+val stop : session option -> Protocol.output list
@@ -0,0 +1,233 @@
+(**
+    {1 Speculative Preparation of Upcoming Cells}
+    @author Davy Cottet
+
+    While the user reads the output of a cell, the kernel is idle. The
+    frontend can send the sources of the cells below the current one (on the
+    `xocaml.speculate` comm), and this module prepares them in the idle time,
+    one small step at a time:
+    - each cell is parsed into its toplevel phrases, which are kept in a
+      cache keyed on the cell source. When the cell is executed, {!take}
+      hands them to the toplevel, which then skips lexing and parsing;
+    - its definitions are then type-checked and compiled to JavaScript in
+      sequence, as the toplevel will execute them, by
+      {!Xmodcache.compile_phrase}: the toplevel compiles each of them but runs
+      a closure doing nothing instead of its code, which is kept, and the
+      environment is left as it was. When the cell is executed in the same
+      environment, {!compiled} hands the compiled definitions to the toplevel,
+      which runs their code and installs the environment they were compiled
+      to, skipping type-checking and code generation;
+    - the phrases after the first one that cannot be compiled that way (a
+      directive, an [open], a module of a library that is not loaded yet...)
+      are only type-checked, inside a {!Btype} snapshot that is rolled back
+      afterwards. This still loads, ahead of time, the interfaces of the
+      modules they use, which is most of the typing cost of a first use of a
+      large library module.
+
+    A parse does not depend on the environment and stays valid. The compiled
+    code and the type-check do, so they are redone once the environment
+    changed, i.e. after each executed cell.
+
+    Work is only done while {!set_busy_check} reports the toplevel as idle,
+    and the scheduler hands back to the event loop between steps, so an
+    incoming execution request is never delayed by more than one step.
+ *)
+
+open Lwt.Syntax
+open Js_of_ocaml_lwt
+open Xutil
+
+(**
+    A definition of a cell compiled ahead of time: the structure item, the
+    environment it must be executed in, and its compiled version with the
+    environment it leads to.
+ *)
+type prepared = Parsetree.structure_item * Env.t * (Xmodcache.compiled_phrase * Env.t)
+
+(** An upcoming cell. *)
+type entry = {
+  source : string;                                         (** The source of the cell. *)
+  mutable parsed : bool;                                   (** Whether the cell was parsed. *)
+  mutable phrases : Parsetree.toplevel_phrase list option; (** Its phrases, or [None] on a syntax error. *)
+  mutable prepared_in : Env.t option;                      (** The environment it was last prepared in. *)
+  mutable compiled : prepared list;                        (** Its definitions compiled in that environment, in order. *)
+}
+
+(** The maximum number of upcoming cells prepared at once. *)
+let max_cells = 16
+
+(** The delay, in seconds, between two steps of preparation. *)
+let step_delay = 0.02
+
+(** The upcoming cells, in notebook order. *)
+let upcoming : entry list ref = ref []
+
+(** Whether the scheduler loop is running. *)
+let running = ref false
+
+(** The definitions compiled for the cell being executed, handed out by {!compiled}. *)
+let current : prepared list ref = ref []
+
+(** The number of cells executed from their prepared phrases, and of definitions run from their compiled code. *)
+let taken_cells = ref 0
+let compiled_definitions = ref 0
+
+(** Tells whether the toplevel is busy, in which case preparation waits. *)
+let is_busy = ref (fun () -> false)
+
+(** Sets the function telling whether the toplevel is busy executing cells. *)
+let set_busy_check f = is_busy := f
+
+(** Parses the phrases of a cell, as the toplevel would with a final [;;]. *)
+let parse entry =
+  let lexbuf = Lexing.from_string (entry.source ^ ";;") in
+  let rec loop acc =
+    match !Toploop.parse_toplevel_phrase lexbuf with
+    | phrase -> loop (phrase :: acc)
+    | exception End_of_file -> Some (List.rev acc)
+    | exception _ -> None
+  in
+  Lexer.init ();
+  entry.phrases <- loop [];
+  entry.parsed <- true
+
+(**
+    Type-checks structure items in sequence, against [env], and rolls the
+    typing back. Checking stops at the first error (e.g. a module of a
+    library that is not loaded yet).
+ *)
+let check env items =
+  let snapshot = Btype.snapshot () in
+  let rec loop env = function
+    | item :: rest ->
+      let _, _, _, _, env = Typemod.type_structure env [ item ] in
+      loop env rest
+    | [] -> ()
+  in
+  (try Warnings.without_warnings (fun () -> loop env items) with _ -> ());
+  Btype.backtrack snapshot
+
+(**
+    Compiles the definitions of a cell in sequence, each structure item on
+    its own as the toplevel executes them, starting from the current
+    environment. An expression is only type-checked: the toplevel evaluates
+    it without changing the environment. Compilation stops at the first item
+    that cannot be compiled or replayed.
+    @return The compiled definitions, and the items left.
+ *)
+let compile_items items =
+  let env = !Toploop.toplevel_env in
+  let rec loop acc = function
+    | ({ Parsetree.pstr_desc = Pstr_eval _; _ } as item) :: rest ->
+      check !Toploop.toplevel_env [ item ];
+      loop acc rest
+    | item :: rest as items ->
+      let before = !Toploop.toplevel_env in
+      (match Xmodcache.compile_phrase (Parsetree.Ptop_def [ item ]) with
+       | Some ((_, after) as compiled) ->
+         Toploop.toplevel_env := after;
+         loop ((item, before, compiled) :: acc) rest
+       | None -> (List.rev acc, items))
+    | [] -> (List.rev acc, [])
+  in
+  Fun.protect ~finally:(fun () -> Toploop.toplevel_env := env) (fun () -> loop [] items)
+
+(**
+    Prepares the phrases of a cell in the current environment: its
+    definitions are compiled up to the first directive or to the first one
+    that cannot be compiled, and the items after it are type-checked.
+ *)
+let prepare entry phrases =
+  let env = !Toploop.toplevel_env in
+  let rec definitions = function
+    | Parsetree.Ptop_def items :: rest -> items @ definitions rest
+    | Parsetree.Ptop_dir _ :: _ | [] -> []
+  in
+  let compiled, rest = compile_items (definitions phrases) in
+  let env_after = match List.rev compiled with (_, _, (_, after)) :: _ -> after | [] -> env in
+  check env_after rest;
+  entry.compiled <- compiled;
+  entry.prepared_in <- Some env
+
+(** Tells whether an entry has work left in the current environment. *)
+let needs_work entry =
+  not entry.parsed
+  || (Option.is_some entry.phrases
+      && match entry.prepared_in with Some env -> env != !Toploop.toplevel_env | None -> true)
+
+(** Performs the next step of preparation of an entry. *)
+let step entry =
+  if not entry.parsed then parse entry
+  else Option.iter (prepare entry) entry.phrases
+
+(** Prepares the upcoming cells one step at a time, while the toplevel is idle. *)
+let rec run () =
+  let* () = Lwt_js.sleep step_delay in
+  match List.find_opt needs_work !upcoming with
+  | Some entry when not (!is_busy ()) ->
+    (try step entry with exn -> log (Printf.sprintf "[Speculate] Step failed: %s" (Printexc.to_string exn)));
+    run ()
+  | _ -> running := false; Lwt.return_unit
+
+(**
+    Resumes the preparation of the upcoming cells, e.g. once a cell was
+    executed and the environment changed. Does nothing if it is running.
+ *)
+let resume () =
+  if not !running && List.exists needs_work !upcoming then begin
+    running := true;
+    Lwt.async run
+  end
+
+(**
+    Replaces the upcoming cells with [sources], in notebook order, and starts
+    preparing them. Cells already prepared keep their results.
+ *)
+let schedule sources =
+  let known = !upcoming in
+  upcoming :=
+    List.filteri (fun i _ -> i < max_cells) sources
+    |> List.map (fun source ->
+         match List.find_opt (fun entry -> String.equal entry.source source) known with
+         | Some entry -> entry
+         | None -> { source; parsed = false; phrases = None; prepared_in = None; compiled = [] });
+  log (Printf.sprintf "[Speculate] %d upcoming cell(s) scheduled." (List.length !upcoming));
+  resume ()
+
+(**
+    Takes the phrases prepared for a cell about to be executed. Its compiled
+    definitions are then handed out by {!compiled}.
+    @param source The source of the cell.
+    @return Its phrases, if the cell was parsed without error.
+ *)
+let take source =
+  match List.find_opt (fun entry -> String.equal entry.source source) !upcoming with
+  | Some ({ phrases = Some phrases; _ } as entry) ->
+    upcoming := List.filter (fun other -> other != entry) !upcoming;
+    current := entry.compiled;
+    incr taken_cells;
+    log (Printf.sprintf "[Speculate] Using the phrases prepared for the cell, with %d compiled definition(s)." (List.length entry.compiled));
+    Some phrases
+  | _ ->
+    current := [];
+    None
+
+(**
+    Takes the compiled version of a structure item of the cell being
+    executed, if it was compiled ahead of time in the current environment.
+    @return The compiled item and the environment it leads to, for {!Xmodcache.run_compiled}.
+ *)
+let compiled item =
+  match List.find_opt (fun (prepared, _, _) -> prepared == item) !current with
+  | Some (_, before, compiled) when before == !Toploop.toplevel_env ->
+    incr compiled_definitions;
+    Some compiled
+  | _ -> None
+
+(** The number of cells executed from their prepared phrases, and of definitions run from their compiled code, in this session. *)
+let stats () = (!taken_cells, !compiled_definitions)
+
+(** Forgets the upcoming cells, e.g. when the toplevel is reset. *)
+let reset () =
+  upcoming := [];
+  current := []
@@ -0,0 +1,50 @@
+(**
+   {1 Speculative Preparation of Upcoming Cells}
+   @author Davy Cottet
+
+   Prepares the cells below the current one while the toplevel is idle: they
+   are parsed, and their phrases kept for {!take}, then their definitions are
+   type-checked and compiled against the current environment without being
+   run, and kept for {!compiled}. The phrases that cannot be compiled ahead
+   are type-checked with the typing rolled back, which loads the interfaces
+   they use ahead of time. The preparation is repeated whenever the
+   environment changed.
+ *)
+
+(** Sets the function telling whether the toplevel is busy executing cells, in which case preparation waits. *)
+val set_busy_check : (unit -> bool) -> unit
+
+(**
+   Replaces the upcoming cells with [sources], in notebook order, and starts
+   preparing them in the background. Cells already prepared keep their results.
+ *)
+val schedule : string list -> unit
+
+(** Resumes the preparation of the upcoming cells, e.g. once a cell was executed. *)
+val resume : unit -> unit
+
+(**
+   Takes the phrases prepared for a cell about to be executed. Its compiled
+   definitions are then handed out by {!compiled}.
+   @param source The source of the cell.
+   @return Its phrases, if the cell was parsed without error.
+ *)
+val take : string -> Parsetree.toplevel_phrase list option
+
+(**
+   Takes the compiled version of a structure item of the cell being executed,
+   if it was compiled ahead of time in the current toplevel environment.
+   @param item A structure item of the phrases returned by {!take}.
+   @return The compiled item and the environment it leads to, to be run with
+           {!Xmodcache.run_compiled}.
+ *)
+val compiled : Parsetree.structure_item -> (Xmodcache.compiled_phrase * Env.t) option
+
+(**
+   Counts the cells executed from the phrases returned by {!take}, and the
+   definitions run from the code returned by {!compiled}, in this session.
+ *)
+val stats : unit -> int * int
+
+(** Forgets the upcoming cells, e.g. when the toplevel is reset. *)
+val reset : unit -> unit
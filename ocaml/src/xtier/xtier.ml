@@ -0,0 +1,367 @@
+(**
+    {1 Tiered Phrase Compilation}
+    @author Davy Cottet
+
+    Every toplevel phrase is compiled to JavaScript at runtime by the
+    `js_of_ocaml` compiler embedded in the kernel. Its optimizing passes
+    (inlining, dead code elimination, static evaluation, ...) pay off for code
+    that runs many times, but only slow down the turnaround of short phrases
+    such as [let x = 3].
+
+    This module selects a compilation tier for each phrase:
+    - {!Baseline} disables the optimizing passes, for the cheapest possible
+      code generation;
+    - {!Optimized} enables them, which is the compiler's default behaviour.
+
+    In the default [Auto] mode, a phrase is compiled with the optimizing tier
+    when its syntax shows that it may be hot: it contains a loop, a recursive
+    binding, or it has already been executed {!hot_threshold} times in this
+    session (e.g. a benchmark cell that is re-run). The tier can also be forced
+    for the rest of the session with the [#tier] directive.
+
+    A function defined once and then called from many other phrases is hot
+    too, although its own phrase is never run again. The phrases defining
+    functions with the baseline tier are therefore kept, and the phrases using
+    each function are counted. Once a function is used by {!hot_threshold}
+    phrases, its definition is executed again with the optimizing tier, which
+    rebinds the function to the optimized code for the phrases that follow.
+    This is only done while every name the definition refers to is still bound
+    to what it was when the function was defined, so that the new function
+    behaves like the old one.
+ *)
+
+open Xutil
+
+let () = log "[Tier] Module loaded."
+
+(** A compilation tier. *)
+type tier = Baseline | Optimized
+
+(** The tier selection policy set by the [#tier] directive. *)
+type mode = Auto | Forced of tier
+
+(** The current selection policy. *)
+let mode = ref Auto
+
+(** The `js_of_ocaml` compiler flags switched off in the {!Baseline} tier. *)
+let optimizing_passes = [ "inline"; "deadcode"; "staticeval"; "share"; "shortvar" ]
+
+(** The number of executions after which an identical phrase is promoted to {!Optimized}. *)
+let hot_threshold = 3
+
+(** The number of phrases whose executions are counted; the counters are cleared when it is reached. *)
+let max_tracked_phrases = 1024
+
+(** Execution counters of phrases, keyed on {!phrase_identity}. *)
+let execution_counts : (int, int) Hashtbl.t = Hashtbl.create 64
+
+(** A function defined by a phrase compiled with the {!Baseline} tier. *)
+type definition = {
+  phrase : Parsetree.toplevel_phrase;   (** The phrase defining the function. *)
+  env : Env.t;                          (** The toplevel environment the phrase was typed in. *)
+  path : Path.t;                        (** The binding of the function. *)
+  mutable uses : int;                   (** The number of phrases that used the binding so far. *)
+}
+
+(** The functions defined with the {!Baseline} tier and not promoted yet, by name. *)
+let definitions : (string, definition) Hashtbl.t = Hashtbl.create 64
+
+(** The number of phrases compiled with {!Optimized} because they were executed repeatedly, and of promoted functions. *)
+let promoted_phrases = ref 0
+let promoted_functions = ref 0
+
+let tier_to_string = function Baseline -> "baseline" | Optimized -> "optimized"
+
+(**
+    Tells whether a phrase contains a loop or a recursive binding, i.e. code
+    that is likely to run many times.
+ *)
+let has_hot_code (phrase : Parsetree.toplevel_phrase) =
+  let found = ref false in
+  let open Ast_iterator in
+  let iterator =
+    { default_iterator with
+      expr = (fun self e ->
+        (match e.pexp_desc with
+         | Pexp_for _ | Pexp_while _ | Pexp_let (Recursive, _, _) -> found := true
+         | _ -> ());
+        if not !found then default_iterator.expr self e);
+      structure_item = (fun self si ->
+        (match si.pstr_desc with
+         | Pstr_value (Recursive, _) -> found := true
+         | _ -> ());
+        if not !found then default_iterator.structure_item self si) }
+  in
+  (match phrase with
+   | Parsetree.Ptop_def str -> iterator.structure iterator str
+   | Parsetree.Ptop_dir _ -> ());
+  !found
+
+(**
+    Identifies a phrase cheaply: by its location in the cell, and by the
+    bounded structural hash of its syntax tree, which only looks at the first
+    few nodes. A cell that is run again gives its phrases the same identity.
+ *)
+let phrase_identity (phrase : Parsetree.toplevel_phrase) =
+  let loc = match phrase with
+    | Ptop_def ({ pstr_loc; _ } :: _) -> pstr_loc
+    | Ptop_def [] -> Location.none
+    | Ptop_dir { pdir_loc; _ } -> pdir_loc
+  in
+  Hashtbl.hash (loc.loc_start.pos_cnum, loc.loc_end.pos_cnum, Hashtbl.hash phrase)
+
+(**
+    Increments and returns the execution counter of a phrase. The counters are
+    cleared once {!max_tracked_phrases} phrases are tracked, so that a long
+    session does not accumulate them.
+ *)
+let count_execution phrase =
+  let key = phrase_identity phrase in
+  let count = 1 + Option.value ~default:0 (Hashtbl.find_opt execution_counts key) in
+  if count = 1 && Hashtbl.length execution_counts >= max_tracked_phrases then Hashtbl.reset execution_counts;
+  Hashtbl.replace execution_counts key count;
+  count
+
+(**
+    Selects the compilation tier of a phrase according to the current {!mode}.
+    In [Auto] mode, this also records one execution of the phrase.
+ *)
+let select phrase =
+  match !mode with
+  | Forced tier -> tier
+  | Auto ->
+    let count = count_execution phrase in
+    if has_hot_code phrase then Optimized
+    else if count >= hot_threshold then (incr promoted_phrases; Optimized)
+    else Baseline
+
+(** A name a phrase refers to, by the namespace it is looked up in. *)
+type reference =
+  | Value of Longident.t
+  | Type of Longident.t
+  | Module of Longident.t
+  | Module_type of Longident.t
+  | Class of Longident.t
+  | Constructor of Longident.t
+  | Label of Longident.t
+
+(**
+    Lists the names a phrase refers to. A qualified name is only listed by
+    the module it starts from: modules never change, so the rest of the path
+    is bound to the same definition as long as that module is.
+ *)
+let references (phrase : Parsetree.toplevel_phrase) =
+  let found = ref [] in
+  let rec roots : Longident.t -> string list = function
+    | Lident name -> [ name ]
+    | Ldot (lid, _) -> roots lid
+    | Lapply (functor_lid, arg) -> roots functor_lid @ roots arg
+  in
+  let add reference ({ txt; _ } : Longident.t Location.loc) =
+    match txt with
+    | Lident _ -> found := reference txt :: !found
+    | Ldot _ | Lapply _ -> List.iter (fun name -> found := Module (Lident name) :: !found) (roots txt)
+  in
+  let open Ast_iterator in
+  let iterator =
+    { default_iterator with
+      expr = (fun self e ->
+        (match e.pexp_desc with
+         | Pexp_ident lid -> add (fun lid -> Value lid) lid
+         | Pexp_construct (lid, _) -> add (fun lid -> Constructor lid) lid
+         | Pexp_field (_, lid) | Pexp_setfield (_, lid, _) -> add (fun lid -> Label lid) lid
+         | Pexp_record (fields, _) -> List.iter (fun (lid, _) -> add (fun lid -> Label lid) lid) fields
+         | Pexp_new lid -> add (fun lid -> Class lid) lid
+         | _ -> ());
+        default_iterator.expr self e);
+      pat = (fun self p ->
+        (match p.ppat_desc with
+         | Ppat_construct (lid, _) -> add (fun lid -> Constructor lid) lid
+         | Ppat_record (fields, _) -> List.iter (fun (lid, _) -> add (fun lid -> Label lid) lid) fields
+         | Ppat_type lid -> add (fun lid -> Type lid) lid
+         | Ppat_open (lid, _) -> add (fun lid -> Module lid) lid
+         | _ -> ());
+        default_iterator.pat self p);
+      typ = (fun self t ->
+        (match t.ptyp_desc with
+         | Ptyp_constr (lid, _) -> add (fun lid -> Type lid) lid
+         | Ptyp_class (lid, _) -> add (fun lid -> Class lid) lid
+         | _ -> ());
+        default_iterator.typ self t);
+      module_expr = (fun self m ->
+        (match m.pmod_desc with Pmod_ident lid -> add (fun lid -> Module lid) lid | _ -> ());
+        default_iterator.module_expr self m);
+      module_type = (fun self m ->
+        (match m.pmty_desc with Pmty_ident lid -> add (fun lid -> Module_type lid) lid | _ -> ());
+        default_iterator.module_type self m) }
+  in
+  (match phrase with
+   | Parsetree.Ptop_def str -> iterator.structure iterator str
+   | Parsetree.Ptop_dir _ -> ());
+  !found
+
+(** What a name is bound to: the path of a binding, or the definition of a constructor or label. *)
+type binding = Bound of Path.t | Defined of Types.Uid.t
+
+(** Looks up what a name is bound to in an environment, if it is bound. *)
+let resolve env reference =
+  try
+    Some (match reference with
+        | Value lid -> Bound (fst (Env.find_value_by_name lid env))
+        | Type lid -> Bound (fst (Env.find_type_by_name lid env))
+        | Module lid -> Bound (fst (Env.find_module_by_name lid env))
+        | Module_type lid -> Bound (fst (Env.find_modtype_by_name lid env))
+        | Class lid -> Bound (fst (Env.find_class_by_name lid env))
+        | Constructor lid -> Defined (Env.find_constructor_by_name lid env).Types.cstr_uid
+        | Label lid -> Defined (Env.find_label_by_name lid env).Types.lbl_uid)
+  with Not_found -> None
+
+let same_binding a b =
+  match a, b with
+  | Some (Bound p), Some (Bound q) -> Path.same p q
+  | Some (Defined u), Some (Defined v) -> Types.Uid.equal u v
+  | None, None -> true
+  | _ -> false
+
+(** Tells whether every name a phrase refers to is bound to the same thing in both environments. *)
+let same_meaning phrase ~before ~now =
+  List.for_all (fun reference -> same_binding (resolve before reference) (resolve now reference)) (references phrase)
+
+(** Tells whether an expression is syntactically a function, whose evaluation has no effect. *)
+let rec is_function (e : Parsetree.expression) =
+  match e.pexp_desc with
+  | Pexp_function _ -> true
+  | Pexp_newtype (_, e) | Pexp_constraint (e, _) -> is_function e
+  | _ -> false
+
+(**
+    The names of the functions a phrase defines, if it is a single [let]
+    binding functions only, which can thus be executed again.
+ *)
+let defined_functions (phrase : Parsetree.toplevel_phrase) =
+  let name (binding : Parsetree.value_binding) =
+    match binding.pvb_pat.ppat_desc with
+    | Ppat_var { txt; _ } | Ppat_constraint ({ ppat_desc = Ppat_var { txt; _ }; _ }, _) when is_function binding.pvb_expr -> Some txt
+    | _ -> None
+  in
+  match phrase with
+  | Ptop_def [ { pstr_desc = Pstr_value (_, bindings); _ } ] ->
+    let names = List.filter_map name bindings in
+    if List.length names = List.length bindings then names else []
+  | _ -> []
+
+(** Records the functions defined by a phrase compiled with the {!Baseline} tier, once it was executed. *)
+let record_definitions phrase ~env =
+  List.iter (fun name ->
+      match Env.find_value_by_name (Lident name) !Toploop.toplevel_env with
+      | path, _ ->
+        if Hashtbl.length definitions >= max_tracked_phrases then Hashtbl.reset definitions;
+        Hashtbl.replace definitions name { phrase; env; path; uses = 0 }
+      | exception Not_found -> ())
+    (defined_functions phrase)
+
+(**
+    Counts one use of each recorded function a phrase refers to.
+    @return The definitions that reached {!hot_threshold} uses.
+ *)
+let count_uses phrase =
+  let env = !Toploop.toplevel_env in
+  List.sort_uniq compare (List.filter_map (function Value (Lident name) -> Some name | _ -> None) (references phrase))
+  |> List.filter_map (fun name ->
+      match Hashtbl.find_opt definitions name with
+      | Some definition when same_binding (resolve env (Value (Lident name))) (Some (Bound definition.path)) ->
+        definition.uses <- definition.uses + 1;
+        if definition.uses >= hot_threshold then (Hashtbl.remove definitions name; Some (name, definition)) else None
+      | _ -> None)
+
+(** A formatter discarding everything, for the definitions executed again. *)
+let null_formatter = Format.make_formatter (fun _ _ _ -> ()) ignore
+
+(**
+    Executes the phrase of a hot function again, with the compiler configured
+    for the {!Optimized} tier, unless a name it refers to was rebound since.
+    Its warnings were reported the first time, and are not reported again.
+ *)
+let promote (name, definition) =
+  if same_meaning definition.phrase ~before:definition.env ~now:!Toploop.toplevel_env then begin
+    let warnings = Warnings.backup () in
+    ignore (Warnings.parse_options false "-a");
+    let promoted =
+      try Toploop.execute_phrase false null_formatter definition.phrase
+      with _ -> false
+    in
+    Warnings.restore warnings;
+    if promoted then begin
+      incr promoted_functions;
+      log (Printf.sprintf "[Tier] Recompiled %s with the optimized tier after %d uses." name definition.uses)
+    end
+  end
+
+(**
+    Whether the generated code must keep readable function names, e.g. so that
+    profiler samples can be mapped back to OCaml functions. This overrides the
+    variable shortening pass of both tiers.
+ *)
+let readable_names = ref false
+
+(** Configures the embedded `js_of_ocaml` compiler for the given tier. *)
+let apply tier =
+  let set = match tier with
+    | Baseline -> Js_of_ocaml_compiler.Config.Flag.disable
+    | Optimized -> Js_of_ocaml_compiler.Config.Flag.enable
+  in
+  List.iter set optimizing_passes;
+  if !readable_names then Js_of_ocaml_compiler.Config.Flag.disable "shortvar";
+  (if !readable_names then Js_of_ocaml_compiler.Config.Flag.enable else Js_of_ocaml_compiler.Config.Flag.disable) "pretty"
+
+(** Sets whether the generated code must keep readable function names. *)
+let set_readable_names flag =
+  readable_names := flag;
+  apply Optimized
+
+(** The `js_of_ocaml` compiler flags {!apply} sets. *)
+let tier_flags = "pretty" :: optimizing_passes
+
+(**
+    Runs [f] with the compiler configured for the tier selected for [phrase].
+    The hot functions [phrase] uses are promoted first, so that it calls their
+    optimized code. The compiler flags are restored afterwards, so that code
+    compiled outside of the toplevel keeps the configuration it had.
+ *)
+let with_tier phrase f =
+  let saved = List.map (fun flag -> (flag, Js_of_ocaml_compiler.Config.Flag.find flag)) tier_flags in
+  Fun.protect ~finally:(fun () -> List.iter (fun (flag, value) -> Js_of_ocaml_compiler.Config.Flag.set flag value) saved)
+    (fun () ->
+      let tier = select phrase in
+      let hot = if !mode = Auto then count_uses phrase else [] in
+      if hot <> [] then (apply Optimized; List.iter promote hot);
+      log (Printf.sprintf "[Tier] Compiling phrase with the %s tier." (tier_to_string tier));
+      apply tier;
+      let env = !Toploop.toplevel_env in
+      let result = f () in
+      if tier = Baseline && !mode = Auto then record_definitions phrase ~env;
+      result)
+
+(**
+    Handles the argument of the [#tier] directive.
+    @param arg One of ["auto"], ["baseline"] or ["optimized"], or ["status"]
+               to describe the policy and the promotions so far.
+    @return A message describing the policy, or an error message.
+ *)
+let set_mode arg =
+  match String.lowercase_ascii (String.trim arg) with
+  | "auto" -> mode := Auto; Ok "Compilation tier: auto."
+  | "baseline" -> mode := Forced Baseline; Ok "Compilation tier: baseline for all phrases."
+  | "optimized" -> mode := Forced Optimized; Ok "Compilation tier: optimized for all phrases."
+  | "status" ->
+    let policy = match !mode with Auto -> "auto" | Forced tier -> tier_to_string tier ^ " for all phrases" in
+    Ok (Printf.sprintf "Compilation tier: %s. Promoted to the optimized tier: %d phrase(s), %d function(s)."
+          policy !promoted_phrases !promoted_functions)
+  | other -> Error (Printf.sprintf "Unknown compilation tier '%s'. Expected \"auto\", \"baseline\", \"optimized\" or \"status\"." other)
+
+(** Forgets the execution counters of all phrases and the recorded functions, e.g. when the toplevel environment is reset. *)
+let reset () =
+  Hashtbl.reset execution_counts;
+  Hashtbl.reset definitions;
+  promoted_phrases := 0;
+  promoted_functions := 0
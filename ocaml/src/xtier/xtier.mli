@@ -0,0 +1,40 @@
+(**
+   {1 Tiered Phrase Compilation}
+   @author Davy Cottet
+
+   Selects how much optimization the embedded `js_of_ocaml` compiler spends on
+   each toplevel phrase. Short phrases are compiled with the cheapest code
+   generation ({!Baseline}), while phrases that contain loops or recursive
+   bindings, or that are executed repeatedly, get the optimizing passes
+   ({!Optimized}). A function used by many phrases is compiled again with the
+   optimizing passes.
+ *)
+
+(** A compilation tier. *)
+type tier = Baseline | Optimized
+
+(**
+   Runs [f] with the compiler configured for the tier selected for [phrase],
+   after compiling again the hot functions [phrase] uses. The compiler flags
+   are restored afterwards.
+   @param phrase The phrase about to be executed by [f].
+ *)
+val with_tier : Parsetree.toplevel_phrase -> (unit -> 'a) -> 'a
+
+(**
+   Handles the argument of the [#tier] directive.
+   @param arg One of ["auto"], ["baseline"] or ["optimized"], or ["status"]
+              to describe the policy and the promotions so far.
+   @return A message describing the policy, or an error message.
+ *)
+val set_mode : string -> (string, string) result
+
+(**
+   Sets whether the generated code must keep readable function names instead
+   of shortened ones, in every tier. Profiling uses it to map samples back to
+   OCaml functions.
+ *)
+val set_readable_names : bool -> unit
+
+(** Forgets the execution counters of all phrases and functions, e.g. when the toplevel environment is reset. *)
+val reset : unit -> unit
@@ -0,0 +1,83 @@
+(**
+    {1 Phrase Timing}
+    @author Davy Cottet
+
+    This module implements the [#time true] / [#time false] directive. While it
+    is active, every toplevel phrase reports how long it took to compile and to
+    run, measured with the high-resolution {!Xutil.now_ms} clock, together with
+    the change of the JavaScript heap size.
+
+    Compilation and execution both happen inside [Toploop.execute_phrase]. To
+    tell them apart, a probe wraps the [toplevelCompile] hook through which the
+    `js_of_ocaml` runtime compiles each phrase to JavaScript: everything before
+    the hook returns (type-checking, translation, code generation) counts as
+    compile time, and everything after it as run time. If the hook cannot be
+    found, the whole phrase is reported as compile time.
+
+    The timings of the last phrase are also available to user code through
+    {!Xlib.last_timing}.
+ *)
+
+open Xutil
+
+(** Whether phrases are currently timed. *)
+let enabled = ref false
+
+(** The time at which the phrase being measured finished compiling. *)
+let compiled_at = ref None
+
+(** Whether the compile probe has already been installed. *)
+let probe_installed = ref false
+
+(** Installs the probe around the runtime's [toplevelCompile] hook, once. *)
+let install_probe () =
+  if not !probe_installed then begin
+    probe_installed := true;
+    if not (observe_toplevel_compile (fun _ -> compiled_at := Some (now_ms ()))) then
+      log "[Time] toplevelCompile hook not found, compile and run times will not be separated."
+  end
+
+(**
+    Handles the argument of the [#time] directive.
+    @return A message describing the new state.
+ *)
+let set_enabled flag =
+  if flag then install_probe ();
+  enabled := flag;
+  if flag then "Phrase timing enabled." else "Phrase timing disabled."
+
+(**
+    Runs [f], which executes one phrase, and measures it if timing is enabled.
+    The timings are also recorded for {!Xlib.last_timing}.
+    @return The result of [f], and its timings if they were measured.
+ *)
+let measure f =
+  if not !enabled then (f (), None)
+  else begin
+    compiled_at := None;
+    let heap_before = js_heap_used () in
+    let start = now_ms () in
+    let result = f () in
+    let stop = now_ms () in
+    let compiled = Option.value ~default:stop !compiled_at in
+    let heap_delta = match heap_before, js_heap_used () with
+      | Some before, Some after -> Some (after - before)
+      | _ -> None
+    in
+    let timing = { Xlib.compile_ms = compiled -. start; run_ms = stop -. compiled; heap_delta } in
+    Xlib.set_last_timing timing;
+    (result, Some timing)
+  end
+
+(** Formats a byte count with a sign and a binary unit. *)
+let format_bytes n =
+  let sign = if n < 0 then "-" else "+" in
+  let n = float_of_int (abs n) in
+  if n < 1024. then Printf.sprintf "%s%.0f B" sign n
+  else if n < 1024. *. 1024. then Printf.sprintf "%s%.1f KiB" sign (n /. 1024.)
+  else Printf.sprintf "%s%.1f MiB" sign (n /. (1024. *. 1024.))
+
+(** Formats timings as a single compact line. *)
+let to_string { Xlib.compile_ms; run_ms; heap_delta } =
+  Printf.sprintf "Time: compile %.2f ms, run %.2f ms%s" compile_ms run_ms
+    (match heap_delta with Some n -> ", heap " ^ format_bytes n | None -> "")
@@ -0,0 +1,25 @@
+(**
+   {1 Phrase Timing}
+   @author Davy Cottet
+
+   Support for the [#time] directive: while it is active, each toplevel phrase
+   reports its compile time and run time, measured separately with a
+   high-resolution clock, and the change of the JavaScript heap size.
+ *)
+
+(**
+   Handles the argument of the [#time] directive.
+   @param flag Whether phrases should be timed.
+   @return A message describing the new state.
+ *)
+val set_enabled : bool -> string
+
+(**
+   Runs [f], which executes one phrase, and measures it if timing is enabled.
+   The timings are also recorded for {!Xlib.last_timing}.
+   @return The result of [f], and its timings if they were measured.
+ *)
+val measure : (unit -> 'a) -> 'a * Xlib.timing option
+
+(** Formats timings as a single compact line. *)
+val to_string : Xlib.timing -> string
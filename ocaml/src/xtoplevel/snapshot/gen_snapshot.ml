@@ -0,0 +1,33 @@
+(* gen_snapshot.ml *)
+#use "topfind" ;;
+#require "compiler-libs.common";;
+
+(* Builds the environment the kernel starts with: the initial environment,
+   with Stdlib opened, and Xlib opened on top of it as `open Xlib;;` would.
+   Only its summary is marshalled: unlike [Env.t], it is plain data, and the
+   runtime rebuilds the environment from it with [Envaux.env_from_summary].
+   A kernel that cannot use the snapshot builds the environment itself at
+   every startup, so a failure here fails the build rather than going unseen. *)
+let () =
+  let xlib_cmi = Sys.argv.(1) in
+  match
+    Clflags.include_dirs := [ Filename.dirname xlib_cmi ];
+    Clflags.open_modules := [ "Xlib" ];
+    Compmisc.init_path ();
+    let env = Compmisc.initial_env () in
+    (* The snapshot is only valid for the same compiler and the same
+       interfaces: the runtime compares these CRCs with the ones of the
+       units the kernel is linked with, see [Xtoplevel.snapshot_matches]. *)
+    let crcs = List.map (fun unit -> (unit, Digest.to_hex (Env.crc_of_unit unit))) [ "Stdlib"; "Xlib" ] in
+    (Marshal.to_string (Env.summary env) [], crcs)
+  with
+  | exception exn ->
+    Printf.eprintf "Error: could not build the toplevel environment snapshot (%s).\n%!" (Printexc.to_string exn);
+    exit 2
+  | summary, crcs ->
+    let out = open_out_bin "env_snapshot.ml" in
+    Printf.fprintf out "(* This file is generated by gen_snapshot.ml. DO NOT EDIT. *)\n";
+    Printf.fprintf out "let ocaml_version = %S\n" Sys.ocaml_version;
+    Printf.fprintf out "let crcs = [ %s ]\n" (String.concat "; " (List.map (fun (unit, crc) -> Printf.sprintf "(%S, %S)" unit crc) crcs));
+    Printf.fprintf out "let summary = %S\n" summary;
+    close_out out
@@ -20,6 +20,7 @@ open Js_of_ocaml
 open Lwt.Syntax
 open Xutil
 open Js_of_ocaml_toplevel
+open Js_of_ocaml_lwt
 
 let () = log "[Toplevel] Module loaded."
 
@@ -28,6 +29,45 @@ let is_setup = ref false
 (** A reference to store the base URL for loading third-party libraries. *)
 let lib_base_url = ref ""
 
+(**
+    Tells whether the build-time {!Env_snapshot} is valid for this kernel: it
+    must have been built by the same compiler, from the interfaces of Stdlib
+    and Xlib the kernel is linked with. Their CRCs are compared with the ones
+    the toplevel registers for the kernel's own units when it is initialized,
+    so no interface has to be read or digested at startup.
+ *)
+let snapshot_matches () =
+  Env_snapshot.ocaml_version = Sys.ocaml_version
+  && List.for_all (fun (unit, crc) ->
+      match Env.crc_of_unit unit with
+      | linked -> Digest.to_hex linked = crc
+      | exception _ -> false)
+    Env_snapshot.crcs
+
+(** Whether {!setup} restored the initial environment from {!Env_snapshot}. *)
+let restored_snapshot = ref false
+
+(**
+    Tries to install the initial environment precomputed at build time, with
+    Stdlib and Xlib already opened. This skips the type-checking, compilation
+    and execution of `open Xlib;;` at every startup.
+    @return [false] if the snapshot was built for other interfaces than the
+            ones of the kernel, or if it cannot be restored.
+ *)
+let restore_snapshot () =
+  try
+    if not (snapshot_matches ()) then (
+      log "[Toplevel] Environment snapshot is stale, building the environment.";
+      false)
+    else (
+      let summary : Env.summary = Marshal.from_string Env_snapshot.summary 0 in
+      Toploop.toplevel_env := Envaux.env_from_summary summary Subst.identity;
+      log "[Toplevel] Initial environment restored from the build-time snapshot.";
+      true)
+  with exn ->
+    log (Printf.sprintf "[Toplevel] Could not restore the environment snapshot: %s" (Printexc.to_string exn));
+    false
+
 (**
     Initializes the OCaml toplevel environment.
    
@@ -39,6 +79,9 @@ let lib_base_url = ref ""
     - Creating the initial compiler environment, which requires `stdlib.cmi`.
     - Automatically opening the {!Xlib} module to make rich display functions
       globally available to the user.
+
+    The last two steps are replaced by {!restore_snapshot} when the build-time
+    snapshot of the environment matches the interfaces the kernel is linked with.
    
     @param url The base URL where third-party library files are located. This is
                stored and used later when handling `#require` directives.
@@ -50,58 +93,344 @@ let setup ~url =
   log "[Toplevel] Starting OCaml Toplevel setup...";
   if not !is_setup then (
     JsooTop.initialize ();
-    log "[Toplevel] Setting up initial toplevel environment...";
-    (try
-      (* This is the critical step that requires stdlib.cmi to be in the VFS. *)
-      Toploop.toplevel_env := Compmisc.initial_env ()
-    with exn ->
-      let backtrace = Printexc.get_backtrace () in
-      log (Printf.sprintf "[Toplevel] FATAL ERROR in Compmisc.initial_env: %s\n%s" (Printexc.to_string exn) backtrace);
-      raise exn);
-    log "[Toplevel] Initial environment created successfully.";
-
+    Xprint.install ();
     Sys.interactive := false;
-    (* Silently execute `open Xlib;;` to make rich display functions available. *)
-    let init_code = "open Xlib;;" in
-    let silent_formatter = Format.formatter_of_buffer (Buffer.create 16) in
-    if not (JsooTop.use silent_formatter init_code) then
-      Js.Unsafe.global##.console##warn (Js.string "Warning: Could not auto-open Xlib module.");
+    restored_snapshot := restore_snapshot ();
+    if not !restored_snapshot then (
+      log "[Toplevel] Setting up initial toplevel environment...";
+      (try
+        (* This is the critical step that requires stdlib.cmi to be in the VFS. *)
+        Toploop.toplevel_env := Compmisc.initial_env ()
+      with exn ->
+        let backtrace = Printexc.get_backtrace () in
+        log (Printf.sprintf "[Toplevel] FATAL ERROR in Compmisc.initial_env: %s\n%s" (Printexc.to_string exn) backtrace);
+        raise exn);
+      log "[Toplevel] Initial environment created successfully.";
+
+      (* Silently execute `open Xlib;;` to make rich display functions available. *)
+      let init_code = "open Xlib;;" in
+      let silent_formatter = Format.formatter_of_buffer (Buffer.create 16) in
+      if not (JsooTop.use silent_formatter init_code) then
+        Js.Unsafe.global##.console##warn (Js.string "Warning: Could not auto-open Xlib module."));
 
     lib_base_url := url;
     is_setup := true;
+    Xcheckpoint.save_initial ();
     log "[Toplevel] OCaml Toplevel setup complete."
   ) else log "[Toplevel] Already initialized."
 
+(** Tells whether {!setup} has completed. *)
+let is_initialized () = !is_setup
+
+(** Tells whether {!setup} restored the initial environment from the build-time snapshot. *)
+let from_snapshot () = !restored_snapshot
+
 (**
-    Helper function to parse a string of code into a list of toplevel phrases.
-    It continues parsing until [End_of_file] is reached and wraps parsing
-    errors in a [result] type.
-    @param lexbuf The lexer buffer initialized with the user's code.
-    @return A list where each element is [`Ok phrase] or [`Error exn].
+    Resets the toplevel to the state reached at the end of {!setup}, without
+    reloading anything: the typing environment becomes the post-setup one
+    again, and the values retained by {!Xcheckpoint}, {!Xprint} and {!Xdeps},
+    and the execution counters of {!Xtier}, are dropped. The VFS, the libraries loaded with `#require` and the Merlin
+    caches are kept, so the libraries stay available without being fetched or
+    linked again.
+
+    The values of the toplevel definitions themselves stay in the global value
+    table of the toplevel, which cannot be cleared, but nothing refers to them
+    any more once the environment is reset.
+    @return A message confirming the reset.
+ *)
+let reset () =
+  if not !is_setup
+  then failwith "Toplevel not initialized. Call Xtoplevel.setup first.";
+  Xcheckpoint.reset ();
+  Xprint.reset ();
+  Xdeps.reset ();
+  Xtier.reset ();
+  Xspeculate.reset ();
+  ignore (Xlib.get_and_clear_outputs ());
+  match Xlibloader.loaded_libraries () with
+  | [] -> "Toplevel reset."
+  | libs -> Printf.sprintf "Toplevel reset. Loaded libraries stay available: %s." (String.concat ", " libs)
+
+(**
+    Creates a lexer buffer over the code of a cell, followed by a final `;;`
+    so that the last phrase needs no terminator. The cell is served to the
+    lexer in chunks, without being copied.
+    @param code The user's code.
  *)
-let rec parse_all_phrases lexbuf =
+let cell_lexbuf code =
+  let sources = ref [ code; ";;" ] and offset = ref 0 in
+  let rec refill bytes max_len =
+    match !sources with
+    | [] -> 0
+    | source :: rest ->
+      let len = min max_len (String.length source - !offset) in
+      Bytes.blit_string source !offset bytes 0 len;
+      offset := !offset + len;
+      if !offset >= String.length source then (sources := rest; offset := 0);
+      if len = 0 then refill bytes max_len else len
+  in
+  Lexing.from_function refill
+
+(**
+    Parses the next toplevel phrase of a cell.
+    @param lexbuf The lexer buffer created by {!cell_lexbuf}.
+    @return [None] at the end of the cell, or the phrase wrapped in a [result],
+            parsing errors being returned as [Error exn].
+ *)
+let next_phrase lexbuf =
   match !Toploop.parse_toplevel_phrase lexbuf with
-  | phrase -> Ok phrase :: parse_all_phrases lexbuf
-  | exception End_of_file -> []
-  | exception err -> [ Error err ]
+  | phrase -> Some (Ok phrase)
+  | exception End_of_file -> None
+  | exception err -> Some (Error err)
+
+(**
+    Scans the code of a cell for the libraries it depends on: the arguments of
+    its `#require` directives and the libraries of {!External_libs} defining
+    the first module of a module path it mentions, such as [Graph] in
+    [Graph.Pack.Digraph] or [open Graph]. A capitalized identifier on its own,
+    which may be a constructor, is not taken for a module. The scan only lexes
+    the code, so it covers every phrase of the cell before any of them is
+    parsed or executed, skips comments and string literals, and stops at the
+    first lexical error.
+    @param code The user's code.
+    @return The library names, in order of first reference.
+ *)
+let scan_dependencies code =
+  let lexbuf = Lexing.from_string code in
+  let libraries = ref [] in
+  let add name = if not (List.mem name !libraries) then libraries := name :: !libraries in
+  let add_module module_name = Option.iter add (Xlibloader.library_of_module module_name) in
+  let rec scan previous =
+    match Lexer.token lexbuf, previous with
+    | Parser.EOF, _ -> ()
+    | Parser.HASH, _ -> scan `Hash
+    | Parser.LIDENT "require", `Hash -> scan `Require
+    | Parser.STRING (name, _, _), `Require -> add name; scan `Other
+    | (Parser.OPEN | Parser.INCLUDE), _ -> scan `Open
+    | Parser.BANG, `Open -> scan `Open
+    | Parser.UIDENT module_name, `Open -> add_module module_name; scan `Path
+    (* Only the first module of a path is looked up: [Pack] in [Graph.Pack] is not a library's. *)
+    | Parser.UIDENT _, `Dot -> scan `Path
+    | Parser.DOT, `Path -> scan `Dot
+    | Parser.DOT, `Module module_name -> add_module module_name; scan `Dot
+    | Parser.UIDENT module_name, _ -> scan (`Module module_name)
+    | _ -> scan `Other
+    | exception Lexer.Error _ -> ()
+  in
+  Lexer.init ();
+  scan `Other;
+  List.rev !libraries
+
+(** Whether a phrase of the cell being evaluated failed. It is reset by {!eval}. *)
+let cell_failed = ref false
+
+(**
+    Runs a phrase with [run], timed by {!Xtime}. Values whose printing was
+    elided are retained by {!Xprint}. Errors, and the timings of [#time], are
+    reported on [err_formatter].
+    @return [true] if the phrase was executed without error.
+ *)
+let execute_run formatter err_formatter run =
+  try
+    let success, timing = Xtime.measure run in
+    Xprint.report formatter;
+    Option.iter (fun timing -> Format.fprintf err_formatter "%s@." (Xtime.to_string timing)) timing;
+    if not success then cell_failed := true;
+    success
+  with exn -> Errors.report_error err_formatter exn; Format.pp_print_flush err_formatter (); cell_failed := true; false
+
+(**
+    Executes a phrase made of a single structure item or directive, compiled
+    with the tier selected by {!Xtier}, by {!execute_run}.
+    @return [true] if the phrase was executed without error.
+ *)
+let execute_item formatter err_formatter phrase =
+  execute_run formatter err_formatter (fun () -> Xtier.with_tier phrase (fun () -> Toploop.execute_phrase true formatter phrase))
+
+(**
+    Runs a structure item compiled ahead of time by {!Xspeculate}, reported
+    like the items executed by {!execute_item}.
+    @return [true] if the item was run without error.
+ *)
+let execute_compiled formatter err_formatter compiled =
+  execute_run formatter err_formatter (fun () -> Xmodcache.run_compiled formatter compiled)
+
+(**
+    The name an expression phrase is bound to by {!execute_expression}, so
+    that its value can be awaited. The binding is removed from the toplevel
+    environment once the phrase is reported.
+ *)
+let await_binding = "__xocaml_await__"
+
+(** Tells whether a type is an Lwt promise, ['a Lwt.t]. *)
+let is_promise env ty =
+  match Types.get_desc (Ctype.expand_head env ty) with
+  | Types.Tconstr (path, [ _ ], _) -> Path.name path = "Lwt.t"
+  | _ -> false
+
+(**
+    Waits until a promise is resolved, whether it is fulfilled or rejected.
+ *)
+let await_promise (promise : Obj.t Lwt.t) =
+  Lwt.try_bind (fun () -> promise) (fun _ -> Lwt.return_unit) (fun _ -> Lwt.return_unit)
+
+(**
+    The phrase printing the outcome of the awaited promise like a toplevel
+    expression: its value and type, or the exception it was rejected with.
+ *)
+let resolved_phrase = lazy (
+  Printf.sprintf
+    "(fun (type a) (promise : a Lwt.t) : a -> match Lwt.state promise with Lwt.Return v -> v | Lwt.Fail exn -> raise exn | Lwt.Sleep -> assert false) %s;;"
+    await_binding
+  |> Lexing.from_string
+  |> !Toploop.parse_toplevel_phrase)
+
+(**
+    Executes an expression phrase, awaiting its value if it is an Lwt promise.
+
+    The expression is executed as a binding to {!await_binding}, so that it is
+    type-checked only once and its value can be found afterwards. The binding
+    is reported like the expression would be ([- : t = v]), unless its value
+    is a promise: the report is then held back until the promise is resolved,
+    and replaced by its value or exception. The binding is finally removed
+    from the toplevel environment, so that neither completion nor [#show]
+    sees it.
+    @return A promise resolved once the phrase, and its promise if any, are
+            done, with [true] if the phrase was executed without error.
+ *)
+let execute_expression formatter err_formatter ~loc ~attrs expr =
+  let env_before = !Toploop.toplevel_env in
+  let binding = Ast_helper.(Str.value ~loc Asttypes.Nonrecursive [ Vb.mk ~loc ~attrs (Pat.var (Location.mknoloc await_binding)) expr ]) in
+  let awaited = ref None in
+  let print = !Toploop.print_out_phrase in
+  Toploop.print_out_phrase := (fun ppf phrase ->
+    match phrase with
+    | Outcometree.Ophr_signature [ (Osig_value { oval_name; oval_type; _ }, value) ] when oval_name = await_binding ->
+      let env = !Toploop.toplevel_env in
+      let path, desc = Env.find_value_by_name (Longident.Lident await_binding) env in
+      if is_promise env desc.val_type then awaited := Some (Obj.obj (Toploop.eval_value_path env path))
+      else Option.iter (fun value -> print ppf (Outcometree.Ophr_eval (value, oval_type))) value
+    | _ -> print ppf phrase);
+  let success =
+    Fun.protect ~finally:(fun () -> Toploop.print_out_phrase := print)
+      (fun () -> execute_item formatter err_formatter (Parsetree.Ptop_def [ binding ]))
+  in
+  let* () =
+    match !awaited with
+    | Some promise when success ->
+      let* () = await_promise promise in
+      ignore (execute_item formatter err_formatter (Lazy.force resolved_phrase));
+      Lwt.return_unit
+    | _ -> Lwt.return_unit
+  in
+  Toploop.toplevel_env := env_before;
+  Lwt.return success
+
+(**
+    Executes a standard toplevel phrase, printing its result on [formatter].
+    A definition containing several structure items is split so that each item
+    is executed and reported on its own, by {!execute_item}. In a cell run
+    under [#profile], each item is first instrumented by {!Xprofile.instrument}.
+    Otherwise, an item {!Xspeculate} compiled ahead of time in the current
+    environment is run from its compiled code, by {!execute_compiled}.
+    The names an item defines and references are recorded by {!Xdeps} once it
+    was executed without error.
+
+    An expression whose value is an Lwt promise is awaited before the next
+    item runs, by {!execute_expression}, and its value is printed in place of
+    the promise. Other promises started earlier keep running meanwhile, so
+    independent tasks overlap.
+    @return A promise resolved once every item has been executed.
+ *)
+let execute_phrase formatter err_formatter toplevel_phrase =
+  let sub_phrases = match toplevel_phrase with | Parsetree.Ptop_def s -> List.map (fun si -> Parsetree.Ptop_def [ si ]) s | Parsetree.Ptop_dir _ as p -> [ p ] in
+  Lwt_list.iter_s (fun sub_phrase ->
+    let* success =
+      match Xprofile.instrument sub_phrase with
+      | Parsetree.Ptop_def [ { pstr_desc = Pstr_eval (expr, attrs); pstr_loc = loc } ] ->
+        execute_expression formatter err_formatter ~loc ~attrs expr
+      | Parsetree.Ptop_def [ item ] as instrumented when instrumented == sub_phrase ->
+        Lwt.return (match Xspeculate.compiled item with
+          | Some compiled -> execute_compiled formatter err_formatter compiled
+          | None -> execute_item formatter err_formatter instrumented)
+      | instrumented -> Lwt.return (execute_item formatter err_formatter instrumented)
+    in
+    if success then Xdeps.record sub_phrase;
+    Lwt.return_unit) sub_phrases
+
+(**
+    Handles the [#bench "expr"] directive by executing a phrase that measures
+    [expr] with {!Xlib.Bench}. The expression is type-checked and compiled like
+    any other phrase; the [let ()] binding keeps the toplevel from printing a
+    value.
+ *)
+let execute_bench formatter err_formatter expr =
+  let code = Printf.sprintf "let () = Xlib.Bench.run [ Xlib.Bench.test %S (fun () -> (%s)) ];;" expr expr in
+  match !Toploop.parse_toplevel_phrase (Lexing.from_string code) with
+  | phrase -> ignore (execute_item formatter err_formatter phrase)
+  | exception exn -> Errors.report_error err_formatter exn; Format.pp_print_flush err_formatter ()
+
+(**
+    Resolves the file argument of a `#use` or `#mod_use` directive against the
+    current working directory.
+    @return [Some path] if the file lives on the persistent `/drive` mount, and
+            can therefore be served by {!Xmodcache}.
+ *)
+let drive_path file =
+  let path = if Filename.is_relative file then Filename.concat (Sys.getcwd ()) file else file in
+  if String.starts_with ~prefix:"/drive/" path then Some path else None
+
+(**
+    The minimum time, in seconds, between two yields to the JavaScript event
+    loop during an evaluation. Yielding after every phrase would make cells
+    with many small phrases pay the event loop round-trip each time.
+ *)
+let yield_interval = 0.05
 
 (**
     Parses and evaluates a string of OCaml code.
    
     This is the main execution function for the kernel. It takes a block of code,
     splits it into individual toplevel phrases (ending in `;;`), and executes
-    them sequentially.
+    them sequentially. Phrases are parsed one at a time, right before being
+    executed, so very large cells neither build a list of phrases nor grow the
+    stack.
    
     It captures all outputs generated during execution, including standard streams,
     the printed value of the last expression, and any rich outputs created via
-    the {!Xlib} module. It also provides special handling for the `#require "lib_name"`
-    directive by delegating to the {!Xlibloader.load_on_demand} function.
+    the {!Xlib} module, in a bounded {!Xcapture} arena: outputs beyond the
+    per-cell caps are spilled to `/drive` and replaced by a truncation notice.
+    It also provides special handling for the `#require "lib_name"`
+    directive by delegating to the {!Xlibloader.load_on_demand} function, and
+    prefetches the libraries found by {!scan_dependencies} before the first
+    phrase runs, so that their download overlaps with the execution. It also
+    serves `#use`/`#mod_use` of files in `/drive` through the {!Xmodcache} cache,
+    and `#compile_notebook`/`#load_notebook` of notebooks in `/drive` through {!Xaot}.
+    The `#checkpoint` and `#restore` directives are handled by {!Xcheckpoint},
+    `#reset` by {!reset},
+    `#time` by {!Xtime}, `#profile` by {!Xprofile}, `#bench` by {!Xlib.Bench},
+    and `#expand` by {!Xprint}. The names each cell defines and references are
+    recorded by {!Xdeps}, and `#run_stale` re-runs the cells that depend on
+    names redefined since they ran.
+
+    An expression phrase whose value is an Lwt promise is awaited before the
+    next phrase runs (see {!execute_phrase}).
+
+    Between phrases, the evaluation cooperatively yields to the JavaScript event
+    loop (at most every {!yield_interval} seconds), so that network completions
+    and incoming messages can make progress while a long cell runs. When
+    [on_flush] is given, the outputs collected so far are streamed through it at
+    each yield and whenever user code calls {!Xlib.flush_outputs} or
+    {!Xlib.yield}.
    
+    @param on_flush An optional function receiving batches of outputs as soon
+                    as they are flushed, before the evaluation completes.
     @param code The string of OCaml code to evaluate.
-    @return A promise that resolves to a list of all captured {!Protocol.output}
-            items, which will be sent to the Jupyter frontend for display.
+    @return A promise that resolves to the list of captured {!Protocol.output}
+            items that were not already streamed through [on_flush], which will
+            be sent to the Jupyter frontend for display.
  *)
-let eval (code : string) : Protocol.output list Lwt.t =
+let eval ?on_flush (code : string) : Protocol.output list Lwt.t =
   log (Printf.sprintf "[Toplevel] Evaluating code:\n%s" code);
   if not !is_setup
   then failwith "Toplevel not initialized. Call Xtoplevel.setup first.";
@@ -110,52 +439,259 @@ let eval (code : string) : Protocol.output list Lwt.t =
   let buffer = Buffer.create 1024 in
   let formatter = Format.formatter_of_buffer buffer in
   let err_formatter = Format.formatter_of_out_channel stderr in
-  let std_outputs_ref = ref [] in
-  Js_of_ocaml.Sys_js.set_channel_flusher stdout (fun s -> std_outputs_ref := Protocol.Stdout s :: !std_outputs_ref);
-  Js_of_ocaml.Sys_js.set_channel_flusher stderr (fun s -> std_outputs_ref := Protocol.Stderr s :: !std_outputs_ref);
+  (* All outputs of the cell are captured in a bounded arena; standard streams
+     are written to it directly as the channels are flushed. *)
+  let arena = Xcapture.create () in
+  Js_of_ocaml.Sys_js.set_channel_flusher stdout (fun s -> Xcapture.add arena (Protocol.Stdout s));
+  Js_of_ocaml.Sys_js.set_channel_flusher stderr (fun s -> Xcapture.add arena (Protocol.Stderr s));
   ignore (Xlib.get_and_clear_outputs ()); (* Clear any stale rich outputs *)
+  Xprint.begin_cell ();
+  cell_failed := false;
 
-  (* Function to collect all pending outputs from all sources. *)
+  (* Function to move all pending outputs from the other sources to the arena. *)
   let get_all_pending_outputs () =
     Format.pp_print_flush formatter ();
     let toplevel_value = Buffer.contents buffer in
     Buffer.clear buffer;
     let main_output = if toplevel_value <> "" then [ Protocol.Value toplevel_value ] else [] in
     let rich_outputs = Xlib.get_and_clear_outputs () in
-    let std_outputs = List.rev !std_outputs_ref in
-    std_outputs_ref := [];
-    List.concat [ std_outputs; rich_outputs; main_output ]
+    List.append rich_outputs main_output
   in
+  let collect outputs = Xcapture.add_all arena outputs in
 
-  (* --- Parse and Execute --- *)
-  let lexbuf = Lexing.from_string (code ^ ";;") in
-  let phrases = parse_all_phrases lexbuf in
-  log (Printf.sprintf "[Toplevel] Found %d phrase(s) to execute." (List.length phrases));
-
-  (* Asynchronously fold over the list of phrases, accumulating outputs. *)
-  let* final_outputs =
-    Lwt_list.fold_left_s
-      (fun acc_outputs phrase_result ->
-        let* new_outputs = match phrase_result with
-          (* Special case for #require directive *)
-          | Ok (Parsetree.Ptop_dir { pdir_name = { txt = "require"; _ }; pdir_arg = Some { pdira_desc = Pdir_string lib_name; _ }; _ }) ->
-            log (Printf.sprintf "[Toplevel] Handling #require for: %s" lib_name);
-            let* result = Xlibloader.load_on_demand ~base_url:!lib_base_url ~name:lib_name in
-            let linking_output = match result with | Ok o -> [ o ] | Error e -> [ e ] in
-            Lwt.return (List.append linking_output (get_all_pending_outputs ()))
-          (* Standard toplevel phrase *)
-          | Ok toplevel_phrase ->
-            let sub_phrases = match toplevel_phrase with | Parsetree.Ptop_def s -> List.map (fun si -> Parsetree.Ptop_def [ si ]) s | Parsetree.Ptop_dir _ as p -> [ p ] in
-            List.iter (fun sub_phrase -> try ignore (Toploop.execute_phrase true formatter sub_phrase) with | exn -> Errors.report_error err_formatter exn; Format.pp_print_flush err_formatter ()) sub_phrases;
-            Lwt.return (get_all_pending_outputs ())
-          (* Syntax error from parsing *)
-          | Error err ->
-            Errors.report_error err_formatter err;
-            Format.pp_print_flush err_formatter ();
-            Lwt.return (get_all_pending_outputs ())
+  (* Streams everything captured so far, if the caller asked for streaming. *)
+  let flush_outputs () =
+    collect (get_all_pending_outputs ());
+    match on_flush with
+    | Some f -> (match Xcapture.drain arena with [] -> () | outputs -> f outputs)
+    | None -> ()
+  in
+  Xlib.set_flush_hook flush_outputs;
+
+  (* Yields to the JS event loop once the last yield is older than [yield_interval]. *)
+  let last_yield = ref (Sys.time ()) in
+  let should_yield () = Sys.time () -. !last_yield >= yield_interval in
+  let yield_now () =
+    flush_outputs ();
+    let* () = Lwt_js.yield () in
+    last_yield := Sys.time ();
+    Lwt.return_unit
+  in
+
+  (* Executes one parsed phrase, collecting its outputs. *)
+  let rec execute_one phrase_result =
+    let* new_outputs = match phrase_result with
+      (* #run_stale re-runs the cells depending on redefined names *)
+      | Ok (Parsetree.Ptop_dir { pdir_name = { txt = "run_stale"; _ }; pdir_arg = None; _ }) ->
+        let stale = Xdeps.stale_cells () in
+        collect [ Protocol.Stdout (Printf.sprintf "Re-running %d stale cell(s).\n" (List.length stale)) ];
+        let* () = Lwt_list.iter_s run_cell stale in
+        Lwt.return (get_all_pending_outputs ())
+      (* Special case for #require directive *)
+      | Ok (Parsetree.Ptop_dir { pdir_name = { txt = "require"; _ }; pdir_arg = Some { pdira_desc = Pdir_string lib_name; _ }; _ }) ->
+        log (Printf.sprintf "[Toplevel] Handling #require for: %s" lib_name);
+        let* result = Xlibloader.load_on_demand ~base_url:!lib_base_url ~name:lib_name in
+        let linking_output = match result with | Ok o -> [ o ] | Error e -> cell_failed := true; [ e ] in
+        Lwt.return (List.append linking_output (get_all_pending_outputs ()))
+      (* #tier selects how much optimization phrases are compiled with *)
+      | Ok (Parsetree.Ptop_dir { pdir_name = { txt = "tier"; _ }; pdir_arg = Some { pdira_desc = Pdir_string arg; _ }; _ }) ->
+        let tier_output = match Xtier.set_mode arg with Ok msg -> Protocol.Stdout msg | Error msg -> Protocol.Stderr msg in
+        Lwt.return (tier_output :: get_all_pending_outputs ())
+      (* #time reports the compile and run time of each phrase *)
+      | Ok (Parsetree.Ptop_dir { pdir_name = { txt = "time"; _ }; pdir_arg = Some { pdira_desc = Pdir_bool flag; _ }; _ }) ->
+        Lwt.return (Protocol.Stdout (Xtime.set_enabled flag) :: get_all_pending_outputs ())
+      (* #profile runs the next cell under the sampling profiler *)
+      | Ok (Parsetree.Ptop_dir { pdir_name = { txt = "profile"; _ }; pdir_arg = None; _ }) ->
+        Lwt.return (Protocol.Stdout (Xprofile.request ()) :: get_all_pending_outputs ())
+      | Ok (Parsetree.Ptop_dir { pdir_name = { txt = "profile"; _ }; pdir_arg = Some { pdira_desc = Pdir_string save_to; _ }; _ }) ->
+        Lwt.return (Protocol.Stdout (Xprofile.request ~save_to ()) :: get_all_pending_outputs ())
+      (* #bench measures an expression with Xlib.Bench *)
+      | Ok (Parsetree.Ptop_dir { pdir_name = { txt = "bench"; _ }; pdir_arg = Some { pdira_desc = Pdir_string expr; _ }; _ }) ->
+        execute_bench formatter err_formatter expr;
+        Lwt.return (get_all_pending_outputs ())
+      (* #expand prints more of a value whose printing was elided *)
+      | Ok (Parsetree.Ptop_dir { pdir_name = { txt = "expand"; _ }; pdir_arg = Some { pdira_desc = Pdir_int (handle, None); _ }; _ }) ->
+        let expand_output = match Xprint.expand (int_of_string handle) with Ok text -> Protocol.Value text | Error msg -> Protocol.Stderr msg in
+        Lwt.return (expand_output :: get_all_pending_outputs ())
+      (* #reset returns to the post-setup toplevel, keeping loaded libraries *)
+      | Ok (Parsetree.Ptop_dir { pdir_name = { txt = "reset"; _ }; pdir_arg = None; _ }) ->
+        let reset_output = Protocol.Stdout (reset ()) in
+        Lwt.return (reset_output :: get_all_pending_outputs ())
+      (* #checkpoint and #restore snapshot and roll back the toplevel environment *)
+      | Ok (Parsetree.Ptop_dir { pdir_name = { txt = "checkpoint"; _ }; pdir_arg = Some { pdira_desc = Pdir_string name; _ }; _ }) ->
+        Lwt.return (Protocol.Stdout (Xcheckpoint.checkpoint name) :: get_all_pending_outputs ())
+      | Ok (Parsetree.Ptop_dir { pdir_name = { txt = "restore"; _ }; pdir_arg = Some { pdira_desc = Pdir_string name; _ }; _ }) ->
+        let restore_output = match Xcheckpoint.restore name with Ok msg -> Protocol.Stdout msg | Error msg -> Protocol.Stderr msg in
+        Lwt.return (restore_output :: get_all_pending_outputs ())
+      (* #use and #mod_use of /drive files go through the module cache *)
+      | Ok (Parsetree.Ptop_dir { pdir_name = { txt = ("use" | "mod_use") as directive; _ }; pdir_arg = Some { pdira_desc = Pdir_string file; _ }; _ } as toplevel_phrase) ->
+        (match drive_path file with
+         | Some path ->
+           log (Printf.sprintf "[Toplevel] Handling #%s through the module cache for: %s" directive path);
+           let kind = if directive = "use" then Xmodcache.Use else Xmodcache.Mod_use in
+           (try if not (Xmodcache.load ~kind formatter path) then cell_failed := true
+            with exn -> Errors.report_error err_formatter exn; Format.pp_print_flush err_formatter (); cell_failed := true);
+           Lwt.return (get_all_pending_outputs ())
+         | None ->
+           let* () = execute_phrase formatter err_formatter toplevel_phrase in
+           Lwt.return (get_all_pending_outputs ()))
+      (* #compile_notebook and #load_notebook compile a /drive notebook ahead of time and load it *)
+      | Ok (Parsetree.Ptop_dir { pdir_name = { txt = ("compile_notebook" | "load_notebook") as directive; _ }; pdir_arg = Some { pdira_desc = Pdir_string file; _ }; _ }) ->
+        let* result =
+          match drive_path file with
+          | None -> Lwt.return (Error (Printf.sprintf "Notebook %s is not on /drive." file))
+          | Some path ->
+            log (Printf.sprintf "[Toplevel] Handling #%s for: %s" directive path);
+            Lwt.catch
+              (fun () ->
+                if directive = "compile_notebook" then Xaot.compile ~base_url:!lib_base_url path
+                else Xaot.load ~base_url:!lib_base_url formatter path)
+              (fun exn ->
+                Errors.report_error err_formatter exn;
+                Format.pp_print_flush err_formatter ();
+                Lwt.return (Error (Printf.sprintf "Could not compile %s." file)))
         in
-        Lwt.return (List.append acc_outputs new_outputs))
-      [] phrases
+        let aot_output = match result with Ok msg -> Protocol.Stdout msg | Error msg -> cell_failed := true; Protocol.Stderr msg in
+        Lwt.return (aot_output :: get_all_pending_outputs ())
+      (* Standard toplevel phrase *)
+      | Ok toplevel_phrase ->
+        let* () = execute_phrase formatter err_formatter toplevel_phrase in
+        Lwt.return (get_all_pending_outputs ())
+      (* Syntax error from parsing *)
+      | Error err ->
+        Errors.report_error err_formatter err;
+        Format.pp_print_flush err_formatter ();
+        cell_failed := true;
+        Lwt.return (get_all_pending_outputs ())
+    in
+    collect new_outputs;
+    Lwt.return_unit
+
+  (* --- Parse and Execute --- *)
+  (* Phrases are parsed and executed one at a time, so execution starts as
+     soon as the first phrase is parsed and no phrase list is materialized.
+     They run in a synchronous loop, whose stack depth does not grow with the
+     number of phrases; it only hands back to Lwt when a phrase completes
+     asynchronously (e.g. #require) or when it is time to yield. Parsing stops
+     at the first syntax error. A cell prepared by {!Xspeculate} while the
+     toplevel was idle comes already parsed. *)
+  and run_code code =
+    let next =
+      match Xspeculate.take code with
+      | Some phrases ->
+        let rest = ref phrases in
+        (fun () -> match !rest with [] -> None | phrase :: tail -> rest := tail; Some (Ok phrase))
+      | None ->
+        let lexbuf = cell_lexbuf code in
+        (fun () -> next_phrase lexbuf)
+    in
+    let finished = ref false in
+    let rec run () =
+      let suspended = ref None in
+      while not !finished && Option.is_none !suspended do
+        if should_yield () then suspended := Some (yield_now ())
+        else
+          match next () with
+          | None -> finished := true
+          | Some phrase_result ->
+            (match phrase_result with Error _ -> finished := true | Ok _ -> ());
+            let promise = execute_one phrase_result in
+            (match Lwt.state promise with
+             | Lwt.Return () -> ()
+             | Lwt.Fail _ | Lwt.Sleep -> suspended := Some promise)
+      done;
+      match !suspended with
+      | None -> Lwt.return_unit
+      | Some promise -> let* () = promise in run ()
+    in
+    run ()
+
+  (* Runs the code of a cell, recording the names it defines and references. *)
+  and run_cell code =
+    let cell = Xdeps.start code in
+    Lwt.finalize (fun () -> run_code code) (fun () -> Xdeps.finish cell; Lwt.return_unit)
+  in
+
+  (* Start downloading the libraries the cell depends on while the phrases
+     before their use execute. *)
+  List.iter (fun name -> Xlibloader.prefetch ~priority:Xnetwork.Interactive ~base_url:!lib_base_url ~name) (scan_dependencies code);
+
+  (* Run the cell under the profiler if the previous one asked for it. The
+     profiler is stopped even if the cell raises. *)
+  let profile = Xprofile.start () in
+
+  let stale_before = List.length (Xdeps.stale_cells ()) in
+  let* () =
+    Lwt.finalize (fun () -> run_cell code) (fun () ->
+      Xlib.set_flush_hook (fun () -> ());
+      collect (Xprofile.stop profile);
+      Lwt.return_unit)
   in
+  (* Point out the cells this one made stale. *)
+  let stale_after = List.length (Xdeps.stale_cells ()) in
+  if stale_after > stale_before then
+    collect [ Protocol.Stdout (Printf.sprintf "%d cell(s) use definitions changed since they ran; #run_stale re-runs them.\n" stale_after) ];
   log "[Toplevel] Evaluation finished.";
-  Lwt.return final_outputs
\ No newline at end of file
+  Lwt.return (Xcapture.finish arena)
+
+(** The outcome of a cell evaluation submitted with {!submit}. *)
+type outcome =
+  | Completed of Protocol.output list  (** Every phrase succeeded. *)
+  | Failed of Protocol.output list     (** A phrase failed; the outputs include its error. *)
+  | Aborted                            (** The cell was not run, as a cell queued before it failed. *)
+
+(** The completion of the last submitted evaluation, after which the next one starts. *)
+let pipeline_tail = ref Lwt.return_unit
+
+(** The number of submitted evaluations that are not completed yet. *)
+let pipeline_length = ref 0
+
+(** Whether a failure with [stop_on_error] aborts the evaluations queued after it. *)
+let aborting = ref false
+
+(**
+    Queues the evaluation of a cell after the ones already submitted, so that
+    cells sent together, as "Run All" does, are run back to back without
+    waiting for a round trip to the frontend between them, and never overlap.
+
+    When the pipeline is busy, the libraries the queued cell depends on start
+    downloading right away, while the cells before it run. When a cell
+    submitted with [stop_on_error] fails, the cells queued after it are not
+    run, until the pipeline drains.
+
+    @param on_flush See {!eval}.
+    @param stop_on_error Whether a failure of this cell aborts the queued cells.
+    @param code The string of OCaml code to evaluate.
+    @return A promise resolved with the outcome of the cell, in submission order.
+ *)
+let submit ?on_flush ?(stop_on_error = false) code =
+  let previous = !pipeline_tail in
+  if Lwt.is_sleeping previous then
+    List.iter (fun name -> Xlibloader.prefetch ~priority:Xnetwork.Interactive ~base_url:!lib_base_url ~name) (scan_dependencies code);
+  incr pipeline_length;
+  let outcome =
+    let* () = previous in
+    if !aborting then Lwt.return Aborted
+    else
+      let* outputs = eval ?on_flush code in
+      if not !cell_failed then Lwt.return (Completed outputs)
+      else (if stop_on_error then aborting := true; Lwt.return (Failed outputs))
+  in
+  pipeline_tail := Lwt.catch (fun () -> Lwt.map ignore outcome) (fun _ -> Lwt.return_unit);
+  Lwt.finalize (fun () -> outcome) (fun () ->
+    decr pipeline_length;
+    if !pipeline_length = 0 then (aborting := false; Xspeculate.resume ());
+    Lwt.return_unit)
+
+(* Upcoming cells are only prepared while no submitted evaluation is pending. *)
+let () = Xspeculate.set_busy_check (fun () -> !pipeline_length > 0)
+
+(**
+    Prepares the cells below the current one while the toplevel is idle, with
+    {!Xspeculate}, and starts downloading the libraries they depend on.
+    @param sources The sources of the upcoming cells, in notebook order.
+ *)
+let speculate sources =
+  List.iter (fun code ->
+    List.iter (fun name -> Xlibloader.prefetch ~priority:Xnetwork.Background ~base_url:!lib_base_url ~name) (scan_dependencies code)) sources;
+  Xspeculate.schedule sources
@@ -28,6 +28,10 @@
    - Automatically opening the {!Xlib} module to make rich display functions
      globally available to the user.
 
+   When the environment snapshot precomputed at build time was built from the
+   same compiler and interfaces as the ones the kernel is linked with, the
+   last two steps are replaced by restoring it.
+
    @param url The base URL where third-party library files are located. This is
               stored and used later when handling `#require` directives.
    @before 0.1.0 This function has significant side effects, creating and modifying
@@ -36,20 +40,96 @@
  *)
 val setup : url:string -> unit
 
+(** Tells whether {!setup} has completed. *)
+val is_initialized : unit -> bool
+
+(** Tells whether {!setup} restored the initial environment from the build-time snapshot. *)
+val from_snapshot : unit -> bool
+
+(**
+   Resets the toplevel to the state reached at the end of {!setup}, without
+   reloading anything. The typing environment becomes the post-setup one
+   again and the values retained for checkpoints, [#expand] and dependency
+   tracking, and the execution counts of the compilation tiers, are dropped,
+   while the VFS, the libraries loaded with `#require`
+   and the Merlin caches are kept. This serves the `#reset` directive and
+   kernel restarts.
+   @return A message confirming the reset.
+ *)
+val reset : unit -> string
+
 (**
    Parses and evaluates a string of OCaml code.
 
    This is the main execution function for the kernel. It takes a block of code,
    splits it into individual toplevel phrases (ending in `;;`), and executes
-   them sequentially.
+   them sequentially. Phrases are parsed one at a time, right before being
+   executed, so very large cells neither build a list of phrases nor grow the
+   stack.
 
    It captures all outputs generated during execution, including standard streams,
    the printed value of the last expression, and any rich outputs created via
-   the {!Xlib} module. It also provides special handling for the `#require "lib_name"`
-   directive by delegating to the {!Xlibloader.load_on_demand} function.
+   the {!Xlib} module, in a bounded {!Xcapture} arena: outputs beyond the
+   per-cell caps are spilled to `/drive` and replaced by a truncation notice.
+   It also provides special handling for the `#require "lib_name"`
+   directive by delegating to the {!Xlibloader.load_on_demand} function, and
+   prefetches the libraries referenced anywhere in the cell (by `#require` or
+   by module name) before the first phrase runs, so that their download
+   overlaps with the execution. It also serves `#use`/`#mod_use` of files in `/drive` through the {!Xmodcache} cache,
+   and `#compile_notebook`/`#load_notebook` of notebooks in `/drive` through {!Xaot}.
+   The `#checkpoint` and `#restore` directives are handled by {!Xcheckpoint},
+   `#reset` by {!reset},
+   `#time` by {!Xtime}, `#profile` by {!Xprofile}, `#bench` by {!Xlib.Bench},
+   and `#expand` by {!Xprint}. The names each cell defines and references are
+   recorded by {!Xdeps}, and `#run_stale` re-runs the cells that depend on
+   names redefined since they ran.
+
+   An expression phrase whose value is an Lwt promise is awaited before the
+   next phrase runs, and its resolved value is printed in place of the promise.
+   Promises started by earlier phrases keep running meanwhile.
 
+   Between phrases, the evaluation cooperatively yields to the JavaScript event
+   loop, so that network completions and incoming messages can make progress
+   while a long cell runs. When [on_flush] is given, the outputs collected so far
+   are streamed through it at each yield and whenever user code calls
+   {!Xlib.flush_outputs} or {!Xlib.yield}.
+
+   @param on_flush An optional function receiving batches of outputs as soon
+                   as they are flushed, before the evaluation completes.
    @param code The string of OCaml code to evaluate.
-   @return A promise that resolves to a list of all captured {!Protocol.output}
-           items, which will be sent to the Jupyter frontend for display.
+   @return A promise that resolves to the list of captured {!Protocol.output}
+           items that were not already streamed through [on_flush], which will
+           be sent to the Jupyter frontend for display.
+ *)
+val eval : ?on_flush:(Protocol.output list -> unit) -> string -> Protocol.output list Lwt.t
+
+(** The outcome of a cell evaluation submitted with {!submit}. *)
+type outcome =
+  | Completed of Protocol.output list  (** Every phrase succeeded. *)
+  | Failed of Protocol.output list     (** A phrase failed; the outputs include its error. *)
+  | Aborted                            (** The cell was not run, as a cell queued before it failed. *)
+
+(**
+   Queues the evaluation of a cell with {!eval} after the ones already
+   submitted, so that cells sent together, as "Run All" does, run back to back
+   and never overlap. While earlier cells run, the libraries of the queued cell
+   are prefetched. When a cell submitted with [stop_on_error] fails, the cells
+   queued after it are {!Aborted}, until the pipeline drains.
+
+   @param on_flush See {!eval}.
+   @param stop_on_error Whether a failure of this cell aborts the queued cells.
+   @param code The string of OCaml code to evaluate.
+   @return A promise resolved with the outcome of the cell. Promises of
+           successive calls are resolved in submission order.
+ *)
+val submit : ?on_flush:(Protocol.output list -> unit) -> ?stop_on_error:bool -> string -> outcome Lwt.t
+
+(**
+   Prepares the cells below the current one while the toplevel is idle: they
+   are parsed, type-checked and compiled ahead of time by {!Xspeculate}, and
+   the libraries they depend on start downloading. A prepared cell is executed
+   without being parsed again, and its definitions run from their compiled
+   code when the environment is the one they were compiled in.
+   @param sources The sources of the upcoming cells, in notebook order.
  *)
-val eval : string -> Protocol.output list Lwt.t
\ No newline at end of file
+val speculate : string list -> unit
@@ -27,4 +27,85 @@
 let log (str : string) : unit =
   Js_of_ocaml.Console.console##log (Js_of_ocaml.Js.string str)
 #endif
-;;
\ No newline at end of file
+;;
+
+(**
+    The VFS directory where the interfaces of user modules (`#mod_use`d files,
+    compiled notebooks) are published, and where Merlin looks them up.
+ *)
+let user_cmis_path = "/static/usercmis"
+
+(** The JavaScript clock read by {!now_ms}: `performance.now`, or `Date.now` as a fallback. *)
+let js_now : Js_of_ocaml.Js.Unsafe.any =
+  Js_of_ocaml.Js.Unsafe.pure_js_expr
+    "(typeof performance !== 'undefined' ? function () { return performance.now(); } : Date.now)"
+
+(**
+    A high-resolution monotonic clock, in milliseconds, backed by
+    `performance.now()`. Unlike [Sys.time], it has sub-millisecond resolution
+    in the browser and in Node.js.
+    @return The number of milliseconds elapsed since an arbitrary origin.
+ *)
+let now_ms () : float =
+  Js_of_ocaml.Js.Unsafe.fun_call js_now [||]
+
+(**
+    The JavaScript function read by {!js_heap_used}: `performance.memory` in
+    Chromium, `process.memoryUsage()` in Node.js, and [-1] elsewhere.
+ *)
+let js_heap_probe : Js_of_ocaml.Js.Unsafe.any =
+  Js_of_ocaml.Js.Unsafe.pure_js_expr
+    "(function () {\
+       if (typeof performance !== 'undefined' && performance.memory) return performance.memory.usedJSHeapSize;\
+       if (typeof process !== 'undefined' && process.memoryUsage) return process.memoryUsage().heapUsed;\
+       return -1; })"
+
+(**
+    The size of the JavaScript heap currently in use, in bytes, when the engine
+    exposes it.
+    @return [None] if the engine does not report its heap usage.
+ *)
+let js_heap_used () : int option =
+  let used : float = Js_of_ocaml.Js.Unsafe.fun_call js_heap_probe [||] in
+  if used < 0. then None else Some (int_of_float used)
+
+(**
+    Wraps a compile function so that each of its results is passed through
+    [replace], and its replacement returned instead. The wrapper declares the
+    two parameters of the runtime's [toplevelCompile] hook, and copies the
+    arity cached in its [l] property: the runtime calls the hook through
+    [caml_call_gen], which reads the arity from [l] or [length].
+ *)
+let js_intercept_compile : Js_of_ocaml.Js.Unsafe.any =
+  Js_of_ocaml.Js.Unsafe.pure_js_expr
+    "(function (compile, replace) {\
+       var wrapped = function (code, debug) { return replace(compile.apply(this, arguments)); };\
+       if (compile.l !== undefined) wrapped.l = compile.l;\
+       return wrapped; })"
+
+(**
+    Installs [replace] around the [toplevelCompile] hook through which the
+    `js_of_ocaml` runtime compiles each toplevel phrase to JavaScript. It is
+    called with the compiled phrase, right after it is compiled, and the
+    toplevel runs the closure it returns instead.
+    @return [false] if the hook is not installed, i.e. before the toplevel is initialized.
+ *)
+let intercept_toplevel_compile (replace : Js_of_ocaml.Js.Unsafe.any -> Js_of_ocaml.Js.Unsafe.any) : bool =
+  let global = Js_of_ocaml.Js.Unsafe.global in
+  let compile : Js_of_ocaml.Js.Unsafe.any Js_of_ocaml.Js.Optdef.t = Js_of_ocaml.Js.Unsafe.get global "toplevelCompile" in
+  Js_of_ocaml.Js.Optdef.test compile
+  && begin
+    Js_of_ocaml.Js.Unsafe.set global "toplevelCompile"
+      (Js_of_ocaml.Js.Unsafe.fun_call js_intercept_compile
+         [| Js_of_ocaml.Js.Unsafe.inject compile; Js_of_ocaml.Js.Unsafe.inject (Js_of_ocaml.Js.wrap_callback replace) |]);
+    true
+  end
+
+(**
+    Installs [observer] around the [toplevelCompile] hook. The observer is
+    called with the compiled phrase, right after it is compiled and before it
+    runs.
+    @return [false] if the hook is not installed, i.e. before the toplevel is initialized.
+ *)
+let observe_toplevel_compile (observer : Js_of_ocaml.Js.Unsafe.any -> unit) : bool =
+  intercept_toplevel_compile (fun compiled -> observer compiled; compiled)
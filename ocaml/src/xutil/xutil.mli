@@ -21,4 +21,45 @@
    
     @param s The string message to log to the console.
  *)
-val log : string -> unit
\ No newline at end of file
+val log : string -> unit
+
+(**
+    The VFS directory where the interfaces of user modules (`#mod_use`d files,
+    compiled notebooks) are published, and where Merlin looks them up.
+ *)
+val user_cmis_path : string
+
+(**
+    A high-resolution monotonic clock, in milliseconds, backed by
+    `performance.now()`.
+    @return The number of milliseconds elapsed since an arbitrary origin.
+ *)
+val now_ms : unit -> float
+
+(**
+    The size of the JavaScript heap currently in use, in bytes.
+    @return [None] if the engine does not report its heap usage.
+ *)
+val js_heap_used : unit -> int option
+
+(**
+    Installs [replace] around the [toplevelCompile] hook through which the
+    `js_of_ocaml` runtime compiles each toplevel phrase to JavaScript. It
+    receives the compiled phrase, a closure running its code, right after it is
+    compiled, and the toplevel runs the closure it returns instead. The wrapper
+    keeps the arity of the hook, which the runtime relies on to call it.
+    @param replace The function called after each compilation.
+    @return [false] if the hook is not installed, i.e. before the toplevel is initialized.
+ *)
+val intercept_toplevel_compile : (Js_of_ocaml.Js.Unsafe.any -> Js_of_ocaml.Js.Unsafe.any) -> bool
+
+(**
+    Installs [observer] around the [toplevelCompile] hook through which the
+    `js_of_ocaml` runtime compiles each toplevel phrase to JavaScript. The
+    observer receives the compiled phrase, a closure running its code, right
+    after it is compiled and before it runs. The wrapper keeps the arity of the
+    hook, which the runtime relies on to call it.
+    @param observer The function called after each compilation.
+    @return [false] if the hook is not installed, i.e. before the toplevel is initialized.
+ *)
+val observe_toplevel_compile : (Js_of_ocaml.Js.Unsafe.any -> unit) -> bool
@@ -0,0 +1,89 @@
+// File: /tests/cache.test.js
+
+jest.setTimeout(30000);
+
+const setupPayload = { dsc_url: "../output/bld/rattler-build_xeus-ocaml/work/ocaml-build/xlibloader/dynamic/stdlib" };
+
+// Loads another instance of the kernel, as a new session of the same browser
+// would: it shares the IndexedDB database of the first one.
+const loadKernel = () => {
+  let kernel;
+  jest.isolateModules(() => {
+    kernel = require(global.xocamlParallel.bundle);
+  });
+  return kernel.xocaml;
+};
+
+// Runs the Setup command, and follows the tiers of the startup it reports.
+const setup = (toplevelAsync, payload) => {
+  const reached = [];
+  const waiting = [];
+  const response = new Promise((resolve) => {
+    toplevelAsync(
+      JSON.stringify(['Setup', payload]),
+      (result) => resolve(JSON.parse(result)),
+      (progress) => {
+        reached.push(JSON.parse(progress).tier[0]);
+        waiting.filter(({ tier }) => reached.includes(tier)).forEach(({ resolve }) => resolve());
+      });
+  });
+  const tier = (name) => new Promise((resolve) => {
+    if (reached.includes(name)) resolve();
+    else waiting.push({ tier: name, resolve });
+  });
+  return { response, tier };
+};
+
+// The sizes of the contents of the artifact cache. The transaction reading
+// them runs after the writes already started.
+const cachedSizes = async () => {
+  const db = await new Promise((resolve, reject) => {
+    const request = indexedDB.open('xocaml-artifacts');
+    request.onsuccess = () => resolve(request.result);
+    request.onerror = () => reject(request.error);
+  });
+  const sizes = await new Promise((resolve) => {
+    const request = db.transaction('entries').objectStore('entries').getAll();
+    request.onsuccess = () => resolve(request.result.map((entry) => entry.size));
+  });
+  db.close();
+  return sizes;
+};
+
+const total = (sizes) => sizes.reduce((sum, size) => sum + size, 0);
+
+// Polls a condition until it holds, or fails after the timeout.
+const waitFor = async (condition, timeout = 10000) => {
+  const deadline = Date.now() + timeout;
+  while (!(await condition())) {
+    if (Date.now() > deadline) throw new Error('Timed out waiting for the condition.');
+    await new Promise((resolve) => setTimeout(resolve, 50));
+  }
+};
+
+describe('Persistent Artifact Cache', () => {
+  test('should set up the next session without fetching the standard library', async () => {
+    const first = setup(global.xocaml_api.toplevelAsync, setupPayload);
+    expect((await first.response).class).toBe('return');
+    // Every tier of the first session is loaded, and stored in the cache.
+    await first.tier('Merlin_warm');
+    expect((await cachedSizes()).length).toBeGreaterThan(0);
+
+    const sent = global.XMLHttpRequest.requests.length;
+    const second = setup(loadKernel().processToplevelAction, setupPayload);
+    expect((await second.response).class).toBe('return');
+    const stdlibRequests = global.XMLHttpRequest.requests.slice(sent).filter(({ url }) => url.includes('/dynamic/stdlib'));
+    expect(stdlibRequests).toEqual([]);
+  });
+
+  test('should evict the contents used least recently beyond the limit', async () => {
+    const limit = 65536;
+    const before = await cachedSizes();
+    expect(total(before)).toBeGreaterThan(limit);
+
+    const third = setup(loadKernel().processToplevelAction, { ...setupPayload, cache_limit: limit });
+    expect((await third.response).class).toBe('return');
+    await waitFor(async () => total(await cachedSizes()) <= limit);
+    expect((await cachedSizes()).length).toBeLessThan(before.length);
+  });
+});
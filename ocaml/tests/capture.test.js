@@ -0,0 +1,78 @@
+// File: /tests/capture.test.js
+
+const fs = require('fs');
+const os = require('os');
+const path = require('path');
+const { callToplevelAsync } = require('./test-utils.js');
+const { createMockFS } = require('./mock-fs.js');
+
+jest.setTimeout(30000);
+
+describe('Bounded Output Capture', () => {
+  const setupPayload = { dsc_url: "../output/bld/rattler-build_xeus-ocaml/work/ocaml-build/xlibloader/dynamic/stdlib" };
+  const drive = fs.mkdtempSync(path.join(os.tmpdir(), 'xocaml-drive-'));
+  const maxBytes = 4 * 1024 * 1024;
+  const maxMessages = 10000;
+
+  // The truncation notice of a cell, and the spill file it links to, read from /drive.
+  const truncation = (outputs) => {
+    const notice = outputs[outputs.length - 1];
+    expect(notice[0]).toBe('DisplayData');
+    const [, spilledBytes, file] = notice[1]['text/plain'].match(/^\[Output truncated: (\d+) more bytes were written to (\S+)\]$/);
+    expect(file).toMatch(/^\/drive\/xocaml_outputs\/cell-\d+\.txt$/);
+    expect(notice[1]['text/html']).toContain(`href="xocaml_outputs/${path.basename(file)}"`);
+    const contents = fs.readFileSync(path.join(drive, file.replace(/^\/drive\//, '')), 'latin1');
+    expect(contents.length).toBe(Number(spilledBytes));
+    return contents;
+  };
+
+  beforeAll(async () => {
+    global.Module = { FS: createMockFS(drive) };
+    global.xocaml_api.mountFS();
+    const response = await callToplevelAsync('Setup', setupPayload);
+    expect(response.class).toBe('return');
+  });
+
+  afterAll(() => {
+    fs.rmSync(drive, { recursive: true, force: true });
+  });
+
+  test('should spill the output past the byte cap to /drive', async () => {
+    const total = 5 * 1024 * 1024;
+    const response = await callToplevelAsync('Eval', { source: `print_string (String.make ${total} 'x');;` });
+    expect(response.class).toBe('return');
+
+    const kept = response.value.filter(v => v[0] === 'Stdout').map(v => v[1]).join('');
+    expect(kept.length).toBeLessThanOrEqual(maxBytes);
+    expect(kept).toMatch(/^x+$/);
+    const spilled = truncation(response.value);
+    expect(spilled).toMatch(/^x+/);
+    // Nothing printed was lost: what was not kept in memory is in the file.
+    expect(kept.length + (spilled.match(/^x+/)[0].length)).toBe(total);
+  });
+
+  test('should spill rich outputs past the message cap as plain text', async () => {
+    const source = [
+      `for i = 1 to ${maxMessages + 50} do`,
+      '  output_display_data (`Assoc [ ("text/plain", `String (Printf.sprintf "row %d" i)); ("text/html", `String (Printf.sprintf "<b>%d</b>" i)) ])',
+      'done;;',
+    ].join('\n');
+    const response = await callToplevelAsync('Eval', { source });
+    expect(response.class).toBe('return');
+
+    const displayed = response.value.filter(v => v[0] === 'DisplayData');
+    // The rows kept in memory, and the truncation notice.
+    expect(displayed.length).toBeLessThanOrEqual(maxMessages + 1);
+    expect(displayed[0][1]['text/html']).toBe('<b>1</b>');
+    const spilled = truncation(response.value);
+    expect(spilled).toContain(`row ${maxMessages + 50}\n`);
+    expect(spilled).not.toContain('text/html');
+    expect(spilled).not.toContain('<b>');
+  });
+
+  test('should start over with the caps in the next cell', async () => {
+    const response = await callToplevelAsync('Eval', { source: 'print_string "small";;' });
+    expect(response.value).toContainEqual(['Stdout', 'small']);
+    expect(response.value.find(v => v[0] === 'DisplayData')).toBeUndefined();
+  });
+});
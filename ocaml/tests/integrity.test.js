@@ -0,0 +1,83 @@
+// File: /tests/integrity.test.js
+
+const fs = require('fs');
+const path = require('path');
+const { callToplevelAsync } = require('./test-utils.js');
+
+jest.setTimeout(30000);
+
+describe('Integrity Checks', () => {
+  const setupPayload = { dsc_url: "../output/bld/rattler-build_xeus-ocaml/work/ocaml-build/xlibloader/dynamic/stdlib" };
+
+  // The archive of the standard library and one of its files are served
+  // damaged, so that the file can only be fetched on its own, and fails its check.
+  const damaged = (url) => (url.endsWith('.xpack') || url.endsWith('/stdlib__Complex.cmi') ? 0 : null);
+
+  beforeAll(async () => {
+    global.XMLHttpRequest.corrupt = damaged;
+    const response = await callToplevelAsync('Setup', setupPayload);
+    expect(response.class).toBe('return');
+  });
+
+  afterAll(() => {
+    global.XMLHttpRequest.corrupt = null;
+    global.XMLHttpRequest.resolve = null;
+  });
+
+  test('should reject a file that does not match its digest', async () => {
+    const sent = global.XMLHttpRequest.requests.length;
+    const response = await callToplevelAsync('Eval', { source: 'Complex.norm Complex.one' });
+    expect(response.class).toBe('failed');
+    const requests = global.XMLHttpRequest.requests.slice(sent);
+    expect(requests.filter(({ url }) => url.endsWith('/stdlib__Complex.cmi')).length).toBeGreaterThan(0);
+  });
+
+  test('should retry a rejected download with a growing delay', async () => {
+    // The background tiers fetch the file on its own, and retry it three times.
+    const attempts = () => global.XMLHttpRequest.requests.filter(({ url, async }) => async && url.endsWith('/stdlib__Complex.cmi'));
+    const deadline = Date.now() + 25000;
+    while (attempts().length < 4 && Date.now() < deadline) {
+      await new Promise((resolve) => setTimeout(resolve, 50));
+    }
+    const times = attempts().map(({ time }) => time);
+    expect(times.length).toBe(4);
+    // The delay starts at 250 ms and doubles at each retry.
+    [250, 500, 1000].forEach((delay, n) => expect(times[n + 1] - times[n]).toBeGreaterThanOrEqual(delay * 0.9));
+  });
+
+  test('should fetch a rejected file again on its next use', async () => {
+    global.XMLHttpRequest.corrupt = null;
+    const response = await callToplevelAsync('Eval', { source: 'Complex.norm Complex.one' });
+    expect(response.class).toBe('return');
+    expect(response.value).toEqual([['Value', expect.stringContaining('- : float = 1.')]]);
+  });
+
+  test('should fetch a damaged member of a library archive again, from the archive', async () => {
+    const bundle = '../output/bld/rattler-build_xeus-ocaml/work/ocaml-build/xbundle';
+    const pack = 'ocamlgraph.xpack';
+    const size = fs.statSync(path.resolve(__dirname, '..', bundle, pack)).size;
+    // The libraries are served from the directory xbundle writes them to.
+    global.XMLHttpRequest.resolve = (url) => url.replace(/^.*\/(ocamlgraph\.[a-z]+|[0-9a-f]{32}\.blob)$/, `${bundle}/$1`);
+    // The last byte of the archive is damaged in the first four ranges of its data holding it:
+    // the range of the members and its three retries, after which the member is fetched on its own.
+    const ending = ({ url, range }) => {
+      const bytes = /^bytes=(\d+)-(\d+)$/.exec(range || '');
+      return url.endsWith(`/${pack}`) && bytes !== null && bytes[1] !== '0' && Number(bytes[2]) >= size - 1;
+    };
+    let damagedRanges = 0;
+    global.XMLHttpRequest.corrupt = (url, range) => {
+      if (!ending({ url, range }) || damagedRanges >= 4) return null;
+      damagedRanges += 1;
+      return size - 1;
+    };
+    const sent = global.XMLHttpRequest.requests.length;
+    const response = await callToplevelAsync('Eval', { source: '#require "ocamlgraph"' });
+    expect(response.class).toBe('return');
+    expect(response.value).toContainEqual(['Stdout', expect.stringContaining("Library 'ocamlgraph'")]);
+    expect(damagedRanges).toBe(4);
+    const requests = global.XMLHttpRequest.requests.slice(sent);
+    expect(requests.filter(ending).length).toBe(5);
+    // The member is part of the archive, so it is never looked for as a blob.
+    expect(requests.filter(({ url }) => url.endsWith('.blob'))).toEqual([]);
+  });
+});
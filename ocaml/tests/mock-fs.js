@@ -0,0 +1,50 @@
+// File: /tests/mock-fs.js
+
+const fs = require('fs');
+const path = require('path');
+
+// --- Mock Emscripten FS ---
+// Implements the subset of the Emscripten `Module.FS` API used by the /drive
+// device of xfs.ml, on top of a directory of the Node file system.
+const S_IFMT = 0o170000;
+const S_IFDIR = 0o040000;
+
+const createMockFS = (root) => {
+  const resolve = (drivePath) => path.join(root, drivePath.replace(/^\/drive\/?/, ''));
+  return {
+    existsSync: (p) => fs.existsSync(resolve(p)),
+    stat: (p) => fs.statSync(resolve(p)),
+    isDir: (mode) => (mode & S_IFMT) === S_IFDIR,
+    readdir: (p) => ['.', '..', ...fs.readdirSync(resolve(p))],
+    mkdir: (p, mode) => fs.mkdirSync(resolve(p), { mode }),
+    rmdir: (p) => fs.rmdirSync(resolve(p)),
+    unlink: (p) => fs.unlinkSync(resolve(p)),
+    rename: (from, to) => fs.renameSync(resolve(from), resolve(to)),
+    // Streams track their own position, as Emscripten's do.
+    open: (p, flags) => {
+      const fd = fs.openSync(resolve(p), flags);
+      return { fd, position: flags.startsWith('a') ? fs.fstatSync(fd).size : 0 };
+    },
+    read: (stream, buffer, offset, length) => {
+      const count = fs.readSync(stream.fd, buffer, offset, length, stream.position);
+      stream.position += count;
+      return count;
+    },
+    write: (stream, buffer, offset, length) => {
+      const count = fs.writeSync(stream.fd, buffer, offset, length, stream.position);
+      stream.position += count;
+      return count;
+    },
+    fstat: (fd) => fs.fstatSync(fd),
+    close: (stream) => fs.closeSync(stream.fd),
+    syncfs: (_populate, callback) => callback(null),
+    llseek: (stream, offset, whence) => {
+      const base = whence === 1 ? stream.position : whence === 2 ? fs.fstatSync(stream.fd).size : 0;
+      stream.position = base + offset;
+      return stream.position;
+    },
+    ftruncate: (fd, length) => fs.ftruncateSync(fd, length),
+  };
+};
+
+module.exports = { createMockFS };
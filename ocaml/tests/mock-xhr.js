@@ -0,0 +1,97 @@
+// File: /tests/mock-xhr.js
+
+const fs = require('fs');
+const path = require('path');
+
+// --- NEW: Asynchronous Mock XMLHttpRequest ---
+// This mock simulates the async, binary-safe fetching used by the new xmerlin.ml
+class MockXMLHttpRequest {
+  constructor() {
+    this.status = 0;
+    this.response = null;
+    this.responseType = '';
+    this.onload = () => {};
+    this.onerror = () => {};
+  }
+
+  open(method, url, async) {
+    this._method = method;
+    this._url = url;
+    this._async = async; // Should be true for our async_get
+  }
+
+  setRequestHeader(name, value) {
+    this._headers = { ...this._headers, [name.toLowerCase()]: value };
+  }
+
+  send() {
+    MockXMLHttpRequest.requests.push({
+      url: this._url, range: (this._headers || {}).range || null, async: this._async !== false, time: Date.now(),
+    });
+    // Simulate the async nature of a network request with setTimeout, and
+    // answer synchronous requests, used to fault files in, right away
+    const respond = () => {
+      // The test server root is the project root. The URL will be relative.
+      const url = MockXMLHttpRequest.resolve ? MockXMLHttpRequest.resolve(this._url) : this._url;
+      const filePath = path.resolve(__dirname, '..', url.replace('ocaml/../', ''));
+
+      if (fs.existsSync(filePath)) {
+        this.status = 200;
+        // Read the file and return it as an ArrayBuffer, which is what the
+        // OCaml code now correctly expects for `responseType = 'arraybuffer'`.
+        let buffer = fs.readFileSync(filePath);
+        // Serve a damaged copy of the files a test selects, to check their integrity checks.
+        const damaged = MockXMLHttpRequest.corrupt && MockXMLHttpRequest.corrupt(this._url, (this._headers || {}).range || null);
+        if (typeof damaged === 'number') {
+          buffer = Buffer.from(buffer);
+          buffer[damaged] ^= 0xff;
+        }
+        // Serve `Range: bytes=first-last` requests as a server supporting them would.
+        const range = /^bytes=(\d+)-(\d+)$/.exec((this._headers || {}).range || '');
+        if (range) {
+          this.status = 206;
+          buffer = buffer.subarray(Number(range[1]), Number(range[2]) + 1);
+        }
+        // Convert Node's Buffer to a standard ArrayBuffer
+        this.response = buffer.buffer.slice(buffer.byteOffset, buffer.byteOffset + buffer.byteLength);
+        // Trigger the success callback
+        this.onload();
+      } else {
+        console.error(`MockXMLHttpRequest: File not found at ${filePath} (URL: ${this._url})`);
+        this.status = 404;
+        this.response = null;
+        // Trigger the error callback
+        this.onerror();
+      }
+    };
+    if (this._async === false) respond();
+    else {
+      // Track the asynchronous requests in flight, bounded by the scheduler of xnetwork.ml
+      MockXMLHttpRequest.inFlight += 1;
+      MockXMLHttpRequest.maxInFlight = Math.max(MockXMLHttpRequest.maxInFlight, MockXMLHttpRequest.inFlight);
+      const answer = () => setTimeout(() => {
+        MockXMLHttpRequest.inFlight -= 1;
+        respond();
+      }, 0); // 0ms delay simulates the next turn of the event loop
+      if (MockXMLHttpRequest.holding) MockXMLHttpRequest.held.push(answer);
+      else answer();
+    }
+  }
+}
+// The requests sent, in order: their URL, `Range` header, whether they were asynchronous and when they were sent
+MockXMLHttpRequest.requests = [];
+// While set, asynchronous requests stay in flight unanswered, until `release` is called
+MockXMLHttpRequest.holding = false;
+MockXMLHttpRequest.held = [];
+MockXMLHttpRequest.release = () => {
+  MockXMLHttpRequest.holding = false;
+  MockXMLHttpRequest.held.splice(0).forEach((answer) => answer());
+};
+// A function giving, from the URL and `Range` header of a request, the offset of a byte
+// of the file to damage before it is served, or null to serve it intact
+MockXMLHttpRequest.corrupt = null;
+// A function mapping the URL of a request to the URL of the file to serve, if any
+MockXMLHttpRequest.resolve = null;
+MockXMLHttpRequest.inFlight = 0;
+MockXMLHttpRequest.maxInFlight = 0;
+global.XMLHttpRequest = MockXMLHttpRequest;
@@ -0,0 +1,66 @@
+// File: /tests/modcache.test.js
+
+const fs = require('fs');
+const os = require('os');
+const path = require('path');
+const { callToplevelAsync } = require('./test-utils.js');
+const { createMockFS } = require('./mock-fs.js');
+
+jest.setTimeout(20000);
+
+describe('Compiled-Module Cache', () => {
+  const setupPayload = { dsc_url: "../output/bld/rattler-build_xeus-ocaml/work/ocaml-build/xlibloader/dynamic/stdlib" };
+  const drive = fs.mkdtempSync(path.join(os.tmpdir(), 'xocaml-drive-'));
+  const cacheDir = path.join(drive, '.xocaml_cache');
+
+  // The cache entries on /drive, with the time they were last written.
+  const entries = () =>
+    fs.readdirSync(cacheDir).filter((name) => name.endsWith('.phrases'))
+      .map((name) => ({ name, mtime: fs.statSync(path.join(cacheDir, name)).mtimeMs }));
+
+  // Whether the outputs of a cell report the warning of the helper file, which only type-checking emits.
+  const typeChecked = (response) =>
+    response.value.some(([kind, text]) => kind === 'Stderr' && /unused variable unused/.test(text));
+
+  beforeAll(async () => {
+    global.Module = { FS: createMockFS(drive) };
+    global.xocaml_api.mountFS();
+    const response = await callToplevelAsync('Setup', setupPayload);
+    expect(response.class).toBe('return');
+  });
+
+  afterAll(() => {
+    fs.rmSync(drive, { recursive: true, force: true });
+  });
+
+  test('should load a module from the cache after a reset', async () => {
+    fs.writeFileSync(path.join(drive, 'geometry.ml'), 'let area r =\n  let unused = 0 in\n  3 * r * r\n');
+
+    const first = await callToplevelAsync('Eval', { source: '#mod_use "/drive/geometry.ml";; Geometry.area 2' });
+    expect(first.class).toBe('return');
+    expect(first.value).toContainEqual(['Value', expect.stringContaining('- : int = 12')]);
+    expect(typeChecked(first)).toBe(true);
+    const written = entries();
+    expect(written).toHaveLength(1);
+
+    const reset = await callToplevelAsync('Eval', { source: '#reset;;' });
+    expect(reset.class).toBe('return');
+
+    // The entry is read back, not written again, and the compiled phrases run without type-checking.
+    const second = await callToplevelAsync('Eval', { source: '#mod_use "/drive/geometry.ml";; Geometry.area 3' });
+    expect(second.class).toBe('return');
+    expect(second.value).toContainEqual(['Value', expect.stringContaining('- : int = 27')]);
+    expect(typeChecked(second)).toBe(false);
+    expect(entries()).toEqual(written);
+  });
+
+  test('should parse and type-check a file again once it changed', async () => {
+    fs.writeFileSync(path.join(drive, 'geometry.ml'), 'let area r =\n  let unused = 0 in\n  4 * r * r\n');
+
+    const response = await callToplevelAsync('Eval', { source: '#mod_use "/drive/geometry.ml";; Geometry.area 3' });
+    expect(response.class).toBe('return');
+    expect(response.value).toContainEqual(['Value', expect.stringContaining('- : int = 36')]);
+    expect(typeChecked(response)).toBe(true);
+    expect(entries()).toHaveLength(2);
+  });
+});
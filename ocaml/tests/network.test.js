@@ -0,0 +1,61 @@
+// File: /tests/network.test.js
+
+const { callToplevelAsync, callMerlinSync } = require('./test-utils.js');
+
+jest.setTimeout(30000);
+
+describe('Request Scheduler', () => {
+  // A single request in flight at once, so that the order of the requests shows their priorities.
+  const setupPayload = {
+    dsc_url: "../output/bld/rattler-build_xeus-ocaml/work/ocaml-build/xlibloader/dynamic/stdlib",
+    max_concurrent_requests: 1,
+  };
+  const requests = global.XMLHttpRequest.requests;
+
+  const pause = (ms) => new Promise((resolve) => setTimeout(resolve, ms));
+
+  // Polls a condition until it holds, or fails after the timeout.
+  const waitFor = async (condition, timeout = 10000) => {
+    const deadline = Date.now() + timeout;
+    while (!condition()) {
+      if (Date.now() > deadline) throw new Error('Timed out waiting for the condition.');
+      await pause(50);
+    }
+  };
+
+  beforeAll(async () => {
+    const response = await new Promise((resolve) => {
+      global.xocaml_api.toplevelAsync(
+        JSON.stringify(['Setup', setupPayload]),
+        (result) => resolve(JSON.parse(result)),
+        (progress) => {
+          // Hold the requests of the background tiers, which then queue up.
+          if (JSON.parse(progress).tier[0] === 'Ready') global.XMLHttpRequest.holding = true;
+        });
+    });
+    expect(response.class).toBe('return');
+  });
+
+  afterAll(() => {
+    global.XMLHttpRequest.release();
+  });
+
+  test('should send no more requests at once than the configured limit', async () => {
+    await waitFor(() => global.XMLHttpRequest.held.length > 0);
+    expect(global.XMLHttpRequest.maxInFlight).toBe(1);
+  });
+
+  test('should send the requests of a required library ahead of background ones', async () => {
+    // The library is first prefetched in the background, behind the requests of the background tiers.
+    expect(callMerlinSync('Speculate', { sources: ['#require "ocamlgraph"'] }).class).toBe('return');
+    await pause(300);
+    // Requiring it promotes its waiting requests.
+    const required = callToplevelAsync('Eval', { source: '#require "ocamlgraph"' });
+    await pause(300);
+    const sent = requests.length;
+    global.XMLHttpRequest.release();
+    await waitFor(() => requests.slice(sent).some(({ url }) => url.includes('ocamlgraph')));
+    expect(requests.slice(sent).filter(({ async }) => async)[0].url).toContain('ocamlgraph');
+    await required;
+  });
+});
@@ -0,0 +1,84 @@
+// File: /tests/notebook.test.js
+
+const fs = require('fs');
+const os = require('os');
+const path = require('path');
+const { callToplevelAsync } = require('./test-utils.js');
+const { createMockFS } = require('./mock-fs.js');
+
+jest.setTimeout(20000);
+
+// Writes a notebook with the given code cells to the /drive directory.
+const writeNotebook = (root, name, cells) => {
+  const notebook = {
+    cells: cells.map((source) => ({ cell_type: 'code', metadata: {}, outputs: [], source })),
+    metadata: {}, nbformat: 4, nbformat_minor: 5,
+  };
+  fs.writeFileSync(path.join(root, name), JSON.stringify(notebook));
+};
+
+describe('Ahead-of-Time Notebook Compilation', () => {
+  const setupPayload = { dsc_url: "../output/bld/rattler-build_xeus-ocaml/work/ocaml-build/xlibloader/dynamic/stdlib" };
+  const drive = fs.mkdtempSync(path.join(os.tmpdir(), 'xocaml-drive-'));
+
+  beforeAll(async () => {
+    global.Module = { FS: createMockFS(drive) };
+    global.xocaml_api.mountFS();
+    const response = await callToplevelAsync('Setup', setupPayload);
+    expect(response.class).toBe('return');
+  });
+
+  afterAll(() => {
+    fs.rmSync(drive, { recursive: true, force: true });
+  });
+
+  test('should compile a notebook and load it as a module', async () => {
+    writeNotebook(drive, 'stats.ipynb', [
+      'let square x = x * x',
+      ['let sum_of_squares l =\n', '  List.fold_left (fun acc x -> acc + square x) 0 l'],
+    ]);
+
+    const compiled = await callToplevelAsync('Eval', { source: '#compile_notebook "/drive/stats.ipynb";;' });
+    expect(compiled.class).toBe('return');
+    expect(compiled.value).toContainEqual(['Stdout', expect.stringContaining('Compiled 2 cell(s) into module Stats')]);
+    expect(fs.existsSync(path.join(drive, '_aot', 'stats.cmo'))).toBe(true);
+
+    const loaded = await callToplevelAsync('Eval', { source: '#load_notebook "/drive/stats.ipynb";; Stats.sum_of_squares [1; 2; 3]' });
+    expect(loaded.class).toBe('return');
+    expect(loaded.value).toContainEqual(['Stdout', 'Module Stats loaded.']);
+    expect(loaded.value).toContainEqual(['Value', expect.stringContaining('- : int = 14')]);
+  });
+
+  test('should leave the typing state of the toplevel intact', async () => {
+    await callToplevelAsync('Eval', { source: 'type shape = Circle | Square;; let before = Circle' });
+    writeNotebook(drive, 'shapes.ipynb', ['type shape = Triangle', 'let corners Triangle = 3']);
+    const compiled = await callToplevelAsync('Eval', { source: '#compile_notebook "shapes.ipynb";;' });
+    expect(compiled.class).toBe('return');
+
+    // The type defined before the compilation is still the same type.
+    const response = await callToplevelAsync('Eval', { source: 'let after : shape = Square;; [before; after]' });
+    expect(response.class).toBe('return');
+    expect(response.value).toContainEqual(['Value', expect.stringContaining('- : shape list = [Circle; Square]')]);
+  });
+
+  test('should report a notebook that was not compiled', async () => {
+    writeNotebook(drive, 'draft.ipynb', ['let x = 1']);
+    const response = await callToplevelAsync('Eval', { source: '#load_notebook "/drive/draft.ipynb";;' });
+    expect(response.class).toBe('failed');
+    expect(response.value).toContainEqual(['Stderr', expect.stringContaining('has not been compiled')]);
+  });
+
+  test('should reject notebooks with directives that cannot be compiled', async () => {
+    writeNotebook(drive, 'scripted.ipynb', ['let x = 1', '#use "helpers.ml"']);
+    const response = await callToplevelAsync('Eval', { source: '#compile_notebook "/drive/scripted.ipynb";;' });
+    expect(response.class).toBe('failed');
+    expect(response.value).toContainEqual(['Stderr', expect.stringContaining('[cell 2]: the #use directive cannot be compiled')]);
+  });
+
+  test('should report the type errors of a notebook', async () => {
+    writeNotebook(drive, 'broken.ipynb', ['let x = 1 + "a"']);
+    const response = await callToplevelAsync('Eval', { source: '#compile_notebook "/drive/broken.ipynb";;' });
+    expect(response.class).toBe('failed');
+    expect(response.value).toContainEqual(['Stderr', expect.stringMatching(/This expression has type string[\s\S]*Could not compile/)]);
+  });
+});
@@ -1,23 +1,76 @@
 // File: /tests/toplevel.test.js
 
-const { callToplevelAsync } = require('./test-utils.js');
+const fs = require('fs');
+const path = require('path');
+const { callToplevelAsync, callMerlinSync } = require('./test-utils.js');
 
 jest.setTimeout(10000);
 
 describe('Eval Command (Async)', () => {
   console.log('--- Starting Toplevel Test Suite ---');
+  const setupPayload = { dsc_url: "../output/bld/rattler-build_xeus-ocaml/work/ocaml-build/xlibloader/dynamic/stdlib" };
+
+  // Tiers of the startup streamed by the Setup command
+  const startupProgress = [];
 
   // beforeAll is now async and sends the setup payload
   beforeAll(async () => {
     console.log('--- beforeAll: Running async Setup command ---');
-    const setupPayload = { dsc_url: "../output/bld/rattler-build_xeus-ocaml/work/ocaml-build/xlibloader/dynamic/stdlib" };
-    const response = await callToplevelAsync('Setup', setupPayload);
+    const response = await new Promise((resolve) => {
+      global.xocaml_api.toplevelAsync(
+        JSON.stringify(['Setup', setupPayload]),
+        (result) => resolve(JSON.parse(result)),
+        (progress) => {
+          startupProgress.push(JSON.parse(progress));
+          // Hold the background tiers back until a file has been faulted in.
+          if (startupProgress.length === 1) global.XMLHttpRequest.holding = true;
+        });
+    });
 
     expect(response.class).toBe('return');
-    expect(response.value).toBe('Setup Phase 1 complete');
+    expect(response.value).toBe('Setup Phase 1 complete (environment: snapshot)');
     console.log('--- beforeAll: Setup completed successfully. ---');
   });
 
+  test('should fault in a standard library interface on first use', async () => {
+    const file = 'stdlib__Complex.cmi';
+    const size = fs.statSync(path.resolve(__dirname, '..', setupPayload.dsc_url, file)).size;
+    const length = (range) => {
+      const [, first, last] = /^bytes=(\d+)-(\d+)$/.exec(range || '') || [];
+      return first === undefined ? -1 : Number(last) - Number(first) + 1;
+    };
+    const requests = global.XMLHttpRequest.requests;
+    try {
+      const sent = requests.length;
+      // The file is listed, but neither its archive range nor the file itself was answered yet.
+      expect(requests.filter(({ url, async, range }) => url.endsWith(file) || (!async && length(range) === size))).toEqual([]);
+      const response = await callToplevelAsync('Eval', { source: 'Complex.norm Complex.one' });
+      expect(response.class).toBe('return');
+      expect(response.value).toEqual([['Value', expect.stringContaining('- : float = 1.')]]);
+      // Its first use fetched it, synchronously, as a single byte range of the archive.
+      const faults = requests.slice(sent).filter(({ async }) => !async);
+      expect(faults.filter(({ url, range }) => url.endsWith('.xpack') && length(range) === size).length).toBe(1);
+      expect(requests.slice(sent).filter(({ url }) => url.endsWith(file))).toEqual([]);
+    } finally {
+      global.XMLHttpRequest.release();
+    }
+  });
+
+  // Runs before the restart below, which sends the progress to another listener.
+  test('should report every startup tier, ready first', async () => {
+    expect(startupProgress[0].tier).toEqual(['Ready']);
+    expect(startupProgress[0].elapsed_ms).toBeGreaterThanOrEqual(0);
+    // The critical tier loads the static and critical files.
+    expect(startupProgress[0].files).toBeGreaterThan(0);
+    // The background tiers complete in order after the kernel is ready.
+    const deadline = Date.now() + 25000;
+    while (startupProgress.length < 4 && Date.now() < deadline) {
+      await new Promise((resolve) => setTimeout(resolve, 50));
+    }
+    expect(startupProgress.map((progress) => progress.tier[0])).toEqual(['Ready', 'Interfaces', 'Documentation', 'Merlin_warm']);
+    expect(startupProgress[1].files).toBeGreaterThan(0);
+  }, 30000);
+
   // All other tests in this file remain unchanged.
   test('should evaluate a simple expression', async () => {
     const response = await callToplevelAsync('Eval', { source: '1 + 1' });
@@ -34,7 +87,7 @@ describe('Eval Command (Async)', () => {
 
   test('should capture a type error and send it to stderr', async () => {
     const response = await callToplevelAsync('Eval', { source: '1 + "a"' });
-    expect(response.class).toBe('return');
+    expect(response.class).toBe('failed');
     const stderrOutput = response.value.find(v => v[0] === 'Stderr');
     expect(stderrOutput).toBeDefined();
     expect(stderrOutput[1]).toContain('has type string but an expression was expected of type');
@@ -52,4 +105,249 @@ describe('Eval Command (Async)', () => {
     expect(response.class).toBe('return');
     expect(response.value).toEqual([['Value', expect.stringContaining('- : int list = [2; 3; 4]')]]);
   });
-});
\ No newline at end of file
+
+  test('should evaluate phrases in every compilation tier', async () => {
+    const baseline = await callToplevelAsync('Eval', { source: '#tier "baseline";; let tiered = List.init 4 succ' });
+    expect(baseline.value).toContainEqual(['Stdout', 'Compilation tier: baseline for all phrases.']);
+    expect(baseline.value).toContainEqual(['Value', expect.stringContaining('val tiered : int list = [1; 2; 3; 4]')]);
+
+    await callToplevelAsync('Eval', { source: '#tier "auto";;' });
+    // A phrase re-run past the hot threshold is promoted, and keeps its result.
+    for (let run = 0; run < 4; run += 1) {
+      const response = await callToplevelAsync('Eval', { source: 'List.fold_left (+) 0 tiered' });
+      expect(response.value).toEqual([['Value', expect.stringContaining('- : int = 10')]]);
+    }
+    // A function defined once and used by enough phrases is promoted, and keeps its behaviour.
+    await callToplevelAsync('Eval', { source: 'let add_up l = List.fold_left (+) 0 l' });
+    for (let use = 1; use <= 3; use += 1) {
+      const response = await callToplevelAsync('Eval', { source: `add_up (List.init ${use} succ)` });
+      expect(response.value).toEqual([['Value', expect.stringContaining(`- : int = ${use * (use + 1) / 2}`)]]);
+    }
+    const status = await callToplevelAsync('Eval', { source: '#tier "status";;' });
+    const [, phrases, functions] = status.value[0][1].match(/(\d+) phrase\(s\), (\d+) function\(s\)/);
+    expect(Number(phrases)).toBeGreaterThanOrEqual(2);
+    expect(Number(functions)).toBeGreaterThanOrEqual(1);
+
+    const invalid = await callToplevelAsync('Eval', { source: '#tier "fastest";;' });
+    expect(invalid.value).toContainEqual(['Stderr', expect.stringContaining("Unknown compilation tier 'fastest'")]);
+  });
+
+  test('should keep evaluating phrases while timing them', async () => {
+    const enable = await callToplevelAsync('Eval', { source: '#time true;;' });
+    expect(enable.value).toContainEqual(['Stdout', 'Phrase timing enabled.']);
+
+    const response = await callToplevelAsync('Eval', { source: 'let timed = 6 * 7' });
+    await callToplevelAsync('Eval', { source: '#time false;;' });
+    expect(response.class).toBe('return');
+    expect(response.value).toContainEqual(['Value', expect.stringContaining('val timed : int = 42')]);
+    expect(response.value.find(v => v[0] === 'Stderr')[1]).toMatch(/Time: compile [\d.]+ ms, run [\d.]+ ms/);
+  });
+
+  test('should profile the next cell and render a flame graph', async () => {
+    const request = await callToplevelAsync('Eval', { source: '#profile;;' });
+    expect(request.value).toContainEqual(['Stdout', 'The next cell will be profiled.']);
+
+    const source = 'let rec profiled_fib n = if n < 2 then n else profiled_fib (n - 1) + profiled_fib (n - 2);; profiled_fib 27';
+    const response = await callToplevelAsync('Eval', { source });
+    expect(response.value).toContainEqual(['Value', expect.stringContaining('- : int = 196418')]);
+    const graph = response.value.find(v => v[0] === 'DisplayData');
+    expect(graph).toBeDefined();
+    expect(graph[1]['image/svg+xml']).toContain('profiled_fib');
+    expect(graph[1]['text/plain']).toContain('Top functions by self time');
+  });
+
+  test('should stop profiling when the profiled cell fails', async () => {
+    await callToplevelAsync('Eval', { source: '#profile;;' });
+    const failed = await callToplevelAsync('Eval', { source: 'let rec spin n = if n = 0 then failwith "boom" else spin (n - 1);; spin 1_000_000' });
+    expect(failed.value).toContainEqual(['Value', expect.stringContaining('Exception: Failure "boom"')]);
+
+    const response = await callToplevelAsync('Eval', { source: 'let rec count n = if n = 0 then 0 else 1 + count (n - 1);; count 1000' });
+    expect(response.value).toContainEqual(['Value', expect.stringContaining('- : int = 1000')]);
+    expect(response.value.find(v => v[0] === 'DisplayData')).toBeUndefined();
+  });
+
+  test('should estimate the time per run of benchmarked closures', async () => {
+    const source = [
+      'let bench_results = Bench.measure ~warmup_ms:5. ~quota_ms:100.',
+      '  [ Bench.test "short" (fun () -> List.init 10 Fun.id); Bench.test "long" (fun () -> List.init 1000 Fun.id) ];;',
+      'List.map (fun (r : Bench.result) -> r.name) bench_results;;',
+      'match bench_results with',
+      '| [ short; long ] -> short.runs > 0 && short.batches >= 3 && short.time_per_run_ns > 0. && long.time_per_run_ns > short.time_per_run_ns',
+      '| _ -> false;;',
+    ].join('\n');
+    const response = await callToplevelAsync('Eval', { source });
+    expect(response.value).toContainEqual(['Value', expect.stringContaining('- : string list = ["short"; "long"]')]);
+    expect(response.value).toContainEqual(['Value', expect.stringContaining('- : bool = true')]);
+  });
+
+  test('should display benchmark results as a table', async () => {
+    const response = await callToplevelAsync('Eval', { source: '#bench "List.init 100 Fun.id";;' });
+    const table = response.value.find(v => v[0] === 'DisplayData');
+    expect(table).toBeDefined();
+    expect(table[1]['text/html']).toContain('<th>Time/Run</th>');
+    expect(table[1]['text/html']).toContain('<td>List.init 100 Fun.id</td>');
+    expect(table[1]['text/plain']).toContain('100.00%');
+  }, 20000);
+
+  test('should elide huge values and expand them on demand', async () => {
+    const response = await callToplevelAsync('Eval', { source: 'let elided = List.init 1000 Fun.id' });
+    const printed = response.value.map(v => v[1]).join('');
+    expect(printed).toContain('...');
+    const handle = Number(/#expand (\d+);;/.exec(printed)[1]);
+
+    const expanded = callMerlinSync('Expand', { handle, length: 5000 });
+    expect(expanded.class).toBe('return');
+    expect(expanded.value).toContain('999]');
+    // Without budgets, the ones of the last printing are enlarged.
+    const enlarged = callMerlinSync('Expand', { handle });
+    expect(enlarged.class).toBe('return');
+    expect(enlarged.value).toContain('elided =');
+    expect(callMerlinSync('Expand', { handle: 1000000 }).class).toBe('error');
+  });
+
+  test('should keep the budgets set with #print_length', async () => {
+    await callToplevelAsync('Eval', { source: '#print_length 5;;' });
+    const limited = await callToplevelAsync('Eval', { source: 'List.init 10 Fun.id' });
+    expect(limited.value).toEqual([['Value', expect.stringContaining('...')]]);
+
+    await callToplevelAsync('Eval', { source: 'Xlib.set_print_budget ();;' });
+    const restored = await callToplevelAsync('Eval', { source: 'List.init 10 Fun.id' });
+    expect(restored.value).toEqual([['Value', expect.stringContaining('[0; 1; 2; 3; 4; 5; 6; 7; 8; 9]')]]);
+  });
+
+  test('should restore a checkpoint without re-executing cells', async () => {
+    await callToplevelAsync('Eval', { source: 'let y = 1;; #checkpoint "base";;' });
+    await callToplevelAsync('Eval', { source: 'let y = "redefined";; let z = 3' });
+    const restore = await callToplevelAsync('Eval', { source: '#restore "base";;' });
+    expect(restore.value).toContainEqual(['Stdout', "Checkpoint 'base' restored."]);
+
+    const response = await callToplevelAsync('Eval', { source: 'y;; z' });
+    expect(response.value).toContainEqual(['Value', expect.stringContaining('- : int = 1')]);
+    const stderrOutput = response.value.find(v => v[0] === 'Stderr');
+    expect(stderrOutput[1]).toContain('Unbound value z');
+  });
+
+  test('should await a phrase whose value is a promise', async () => {
+    const source = 'let p = Lwt.map (( * ) 2) (Lwt_js.sleep 0.01 |> Lwt.map (fun () -> 21));; p;; Lwt.fail Exit';
+    const response = await callToplevelAsync('Eval', { source });
+    expect(response.value).toContainEqual(['Value', expect.stringContaining('val p : int Lwt.t')]);
+    expect(response.value).toContainEqual(['Value', expect.stringContaining('- : int = 42')]);
+    expect(response.value).toContainEqual(['Value', expect.stringContaining('Exception: Stdlib.Exit')]);
+
+    // The binding used to await the promise is not left in the environment.
+    const hidden = await callToplevelAsync('Eval', { source: '__xocaml_await__' });
+    expect(hidden.value.find(v => v[0] === 'Stderr')[1]).toContain('Unbound value __xocaml_await__');
+  });
+
+  test('should yield to the event loop and resume the cell', async () => {
+    const source = 'print_string "before";; Lwt.bind (yield ()) (fun () -> print_string "after"; Lwt.return 1)';
+    const response = await callToplevelAsync('Eval', { source });
+    const stdout = response.value.filter(v => v[0] === 'Stdout').map(v => v[1]).join('');
+    expect(stdout).toBe('beforeafter');
+    expect(response.value).toContainEqual(['Value', expect.stringContaining('- : int = 1')]);
+  });
+
+  test('should map a function over a pool of workers', async () => {
+    const source = [
+      'let () = Out_channel.with_open_bin "/tmp/xocaml_sim.ml" (fun oc -> output_string oc "let square x = x * x");;',
+      'let pool = Parallel.create ~workers:2 ~sources:["/tmp/xocaml_sim.ml"] ();;',
+      '(Parallel.map pool ~chunk_size:3 "Xocaml_sim.square" (List.init 10 Fun.id) : int list Lwt.t);;',
+      '(Parallel.map_reduce pool "Xocaml_sim.square" ~reduce:(+) ~init:0 [1; 2; 3] : int Lwt.t);;',
+      'Parallel.shutdown pool;;',
+    ].join('\n');
+    const response = await callToplevelAsync('Eval', { source });
+    expect(response.value).toContainEqual(['Value', expect.stringContaining('- : int list = [0; 1; 4; 9; 16; 25; 36; 49; 64; 81]')]);
+    expect(response.value).toContainEqual(['Value', expect.stringContaining('- : int = 14')]);
+  }, 60000);
+
+  test('should re-run only the cells depending on redefined names', async () => {
+    await callToplevelAsync('Eval', { source: 'let dep_base = 1' });
+    await callToplevelAsync('Eval', { source: 'let dep_derived = dep_base + 1' });
+    await callToplevelAsync('Eval', { source: 'let dep_other = 5' });
+    const edit = await callToplevelAsync('Eval', { source: 'let dep_base = 10' });
+    expect(edit.value).toContainEqual(['Stdout', expect.stringContaining('1 cell(s) use definitions changed')]);
+
+    const response = await callToplevelAsync('Eval', { source: '#run_stale' });
+    expect(response.value).toContainEqual(['Value', expect.stringContaining('val dep_derived : int = 11')]);
+    expect(response.value).not.toContainEqual(['Value', expect.stringContaining('dep_other')]);
+  });
+
+  test('should not make cells stale with a failed redefinition', async () => {
+    await callToplevelAsync('Eval', { source: 'let failed_base = 1' });
+    await callToplevelAsync('Eval', { source: 'let failed_derived = failed_base + 1' });
+    const typeError = await callToplevelAsync('Eval', { source: 'let failed_base = 1 + "a"' });
+    expect(typeError.value).not.toContainEqual(['Stdout', expect.stringContaining('use definitions changed')]);
+    const raised = await callToplevelAsync('Eval', { source: 'let failed_base = failwith "boom"' });
+    expect(raised.value).not.toContainEqual(['Stdout', expect.stringContaining('use definitions changed')]);
+
+    const response = await callToplevelAsync('Eval', { source: '#run_stale' });
+    expect(response.value).not.toContainEqual(['Value', expect.stringContaining('failed_derived')]);
+  });
+
+  test('should reset the toplevel in place and on restart', async () => {
+    const reset = await callToplevelAsync('Eval', { source: 'let before_reset = 1;; #reset;; output_html "<b>ok</b>";;' });
+    expect(reset.value).toContainEqual(['Stdout', expect.stringContaining('Toplevel reset.')]);
+    expect(reset.value.find(v => v[0] === 'Stderr')).toBeUndefined();
+
+    await callToplevelAsync('Eval', { source: 'let after_reset = 2' });
+    const restartProgress = [];
+    const restart = await new Promise((resolve) => {
+      global.xocaml_api.toplevelAsync(
+        JSON.stringify(['Setup', setupPayload]),
+        (result) => resolve(JSON.parse(result)),
+        (progress) => restartProgress.push(JSON.parse(progress)));
+    });
+    expect(restart.class).toBe('return');
+    expect(restart.value).toContain('Toplevel reset.');
+    // The kernel is ready again at once, and the frontend is told so.
+    expect(restartProgress[0].tier).toEqual(['Ready']);
+
+    const response = await callToplevelAsync('Eval', { source: 'after_reset' });
+    expect(response.value.find(v => v[0] === 'Stderr')[1]).toContain('Unbound value after_reset');
+  });
+
+  test('should pipeline queued cells and stop at the first error', async () => {
+    const order = [];
+    const submit = (source) => callToplevelAsync('Eval', { source, stop_on_error: true })
+      .then((response) => { order.push(source); return response; });
+    const [first, second, third] = await Promise.all([
+      submit('let queued = 1'),
+      submit('queued + "a"'),
+      submit('let never_run = 3'),
+    ]);
+    expect(order).toEqual(['let queued = 1', 'queued + "a"', 'let never_run = 3']);
+    expect(first.class).toBe('return');
+    expect(second.class).toBe('failed');
+    expect(third.class).toBe('aborted');
+
+    const response = await callToplevelAsync('Eval', { source: 'never_run' });
+    expect(response.value.find(v => v[0] === 'Stderr')[1]).toContain('Unbound value never_run');
+  });
+
+  test('should run a cell prepared while the kernel was idle', async () => {
+    const sources = ['let prepared = List.length [1; 2; 3]', 'prepared * 2'];
+    const scheduled = callMerlinSync('Speculate', { sources });
+    expect(scheduled.class).toBe('return');
+    await new Promise((resolve) => setTimeout(resolve, 200));
+
+    const definition = await callToplevelAsync('Eval', { source: sources[0] });
+    expect(definition.class).toBe('return');
+    expect(definition.value).toEqual([['Value', expect.stringContaining('val prepared : int = 3')]]);
+    const response = await callToplevelAsync('Eval', { source: sources[1] });
+    expect(response.class).toBe('return');
+    expect(response.value).toEqual([['Value', expect.stringContaining('- : int = 6')]]);
+
+    // Both cells were taken prepared, and the definition ran from the code compiled ahead.
+    const stats = callMerlinSync('Speculate', { sources: [] });
+    expect(stats.class).toBe('return');
+    expect(stats.value.taken - scheduled.value.taken).toBe(2);
+    expect(stats.value.compiled - scheduled.value.compiled).toBe(1);
+  });
+
+  test('should bound the number of requests in flight', async () => {
+    // The background tiers fetch many files, but never more than 6 at once.
+    await new Promise((resolve) => setTimeout(resolve, 200));
+    expect(global.XMLHttpRequest.maxInFlight).toBeGreaterThan(0);
+    expect(global.XMLHttpRequest.maxInFlight).toBeLessThanOrEqual(6);
+  });
+});
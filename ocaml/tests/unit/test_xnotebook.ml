@@ -0,0 +1,63 @@
+(* Unit tests of Xnotebook, the conversion of notebooks into compilation units. *)
+
+let check name condition = if not condition then failwith ("FAILED: " ^ name)
+
+let contains ~sub s =
+  let n = String.length sub in
+  let rec at i = i + n <= String.length s && (String.sub s i n = sub || at (i + 1)) in
+  at 0
+
+let notebook cells =
+  Printf.sprintf {|{"cells": [%s], "metadata": {}, "nbformat": 4, "nbformat_minor": 5}|} (String.concat ", " cells)
+
+let code source = Printf.sprintf {|{"cell_type": "code", "metadata": {}, "outputs": [], "source": %s}|} source
+
+let markdown source = Printf.sprintf {|{"cell_type": "markdown", "metadata": {}, "source": %s}|} source
+
+let test_module_name () =
+  check "module name" (Xnotebook.module_name "/drive/sales-dashboard.ipynb" = "Sales_dashboard");
+  check "module name of a digit" (Xnotebook.module_name "/drive/2024.ipynb" = "Notebook_2024");
+  check "artifact prefix" (Xnotebook.artifact_prefix "/drive/reports/Weekly.ipynb" = "/drive/reports/_aot/weekly")
+
+let test_classify_line () =
+  check "code" (Xnotebook.classify_line "let x = 1" = `Code);
+  check "require" (Xnotebook.classify_line {|  #require "base"  |} = `Require "base");
+  check "other directive" (Xnotebook.classify_line {|#use "helpers.ml"|} = `Directive "use");
+  check "require without a name" (Xnotebook.classify_line "#require" = `Directive "require");
+  check "hash in code" (Xnotebook.classify_line "obj#method" = `Code);
+  check "lone hash" (Xnotebook.classify_line "#" = `Code)
+
+let test_of_ipynb () =
+  let contents =
+    notebook
+      [ markdown {|"# Title"|};
+        code {|["#require \"base\"\n", "let x = 1\n", "let y = x + 1"]|};
+        code {|"#require \"base\"\n#require \"ocamlgraph\"\nlet z = y * 2"|} ]
+  in
+  match Xnotebook.of_ipynb ~path:"/drive/demo.ipynb" contents with
+  | Error msg -> failwith msg
+  | Ok unit ->
+    check "name" (unit.name = "Demo");
+    check "cells" (unit.cells = 2);
+    check "requires" (unit.requires = [ "base"; "ocamlgraph" ]);
+    check "opens Xlib" (String.starts_with ~prefix:"open Xlib\n" unit.source);
+    check "line directive" (contains ~sub:{|# 1 "/drive/demo.ipynb [cell 2]"|} unit.source);
+    check "code kept" (contains ~sub:"let y = x + 1" unit.source && contains ~sub:"let z = y * 2" unit.source);
+    check "require removed" (not (contains ~sub:"#require" unit.source));
+    let digest = Digest.string contents in
+    check "manifest" (Xnotebook.read_manifest (Xnotebook.manifest ~digest unit) = (Digest.to_hex digest, unit.requires))
+
+let test_of_ipynb_errors () =
+  (match Xnotebook.of_ipynb ~path:"/drive/bad.ipynb" (notebook [ code {|"let x = 1"|}; code {|"#use \"helpers.ml\""|} ]) with
+   | Error msg -> check "directive rejected" (contains ~sub:"[cell 2]: the #use directive" msg)
+   | Ok _ -> failwith "FAILED: directive accepted");
+  match Xnotebook.of_ipynb ~path:"/drive/bad.ipynb" "{ not json" with
+  | Error msg -> check "invalid JSON" (contains ~sub:"is not a valid notebook" msg)
+  | Ok _ -> failwith "FAILED: invalid JSON accepted"
+
+let () =
+  test_module_name ();
+  test_classify_line ();
+  test_of_ipynb ();
+  test_of_ipynb_errors ();
+  print_endline "Xnotebook: all tests passed."
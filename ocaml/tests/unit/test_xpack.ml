@@ -0,0 +1,89 @@
+(* Unit tests of Xpack, the archive format of the kernel's artifacts, and of the blobs shared by archives. *)
+
+let check name condition = if not condition then failwith ("FAILED: " ^ name)
+
+let files = [ ("a.cmi", String.make 100 'a'); ("b.cmti", String.make 10000 'b'); ("empty.cmt", ""); ("c.js", String.make 100 'c') ]
+
+let archive = Xpack.create files
+
+let entries =
+  match Xpack.index_size archive with
+  | None -> failwith "FAILED: index size"
+  | Some index_size -> (
+    match Xpack.parse_index (String.sub archive Xpack.header_size index_size) with
+    | Some entries -> entries
+    | None -> failwith "FAILED: parse index")
+
+let entry name = List.find (fun (entry : Xpack.entry) -> entry.name = name) entries
+
+(** The bytes of the data of the archive from [first] to [last], as a range request returns them. *)
+let range first last =
+  let data = Xpack.data_offset ~index_size:(Option.get (Xpack.index_size archive)) in
+  String.sub archive (data + first) (last - first)
+
+let test_round_trip () =
+  check "round trip" (Xpack.read archive = Some files);
+  check "empty archive" (Xpack.read (Xpack.create []) = Some []);
+  check "not an archive" (Xpack.read "not an archive" = None);
+  check "truncated header" (Xpack.index_size (String.sub archive 0 (Xpack.header_size - 1)) = None);
+  (* A corrupted member is left out, the others are kept. *)
+  let corrupted = Bytes.of_string archive in
+  Bytes.set corrupted (String.length archive - 1) 'x';
+  check "corrupted member" (Xpack.read (Bytes.to_string corrupted) = Some (List.filter (fun (name, _) -> name <> "c.js") files))
+
+let test_intact () =
+  check "intact archive" (Xpack.intact archive);
+  check "not an archive" (not (Xpack.intact "not an archive"));
+  (* An archive missing or damaging a member is rejected, although it can be read. *)
+  let corrupted = Bytes.of_string archive in
+  Bytes.set corrupted (String.length archive - 1) 'x';
+  check "corrupted member" (not (Xpack.intact (Bytes.to_string corrupted)));
+  check "truncated data" (not (Xpack.intact (String.sub archive 0 (String.length archive - 1))))
+
+let test_parse_index () =
+  check "names" (List.map (fun (entry : Xpack.entry) -> entry.name) entries = List.map fst files);
+  check "offsets" (List.map (fun (entry : Xpack.entry) -> entry.offset) entries = [ 0; 100; 10100; 10100 ]);
+  check "sizes" (List.map (fun (entry : Xpack.entry) -> entry.size) entries = [ 100; 10000; 0; 100 ]);
+  check "digests" (List.for_all2 (fun (entry : Xpack.entry) (_, content) -> Xpack.verify entry content) entries files);
+  let index_size = Option.get (Xpack.index_size archive) in
+  check "truncated index" (Xpack.parse_index (String.sub archive Xpack.header_size (index_size - 1)) = None)
+
+let test_spans () =
+  let a = entry "a.cmi" and b = entry "b.cmti" and c = entry "c.js" in
+  check "distant members" (Xpack.spans [ c; a ] = [ (0, 100, [ a ]); (10100, 10200, [ c ]) ]);
+  check "neighbouring members" (Xpack.spans [ c; b; a ] = [ (0, 10200, [ a; b; c ]) ]);
+  check "larger gap" (Xpack.spans ~max_gap:20000 [ a; c ] = [ (0, 10200, [ a; c ]) ]);
+  check "no members" (Xpack.spans [] = [])
+
+let test_member_of_span () =
+  let a = entry "a.cmi" and c = entry "c.js" and empty = entry "empty.cmt" in
+  let content = range 0 10200 in
+  check "first member" (Xpack.member_of_span ~first:0 content a = Some (List.assoc "a.cmi" files));
+  check "last member" (Xpack.member_of_span ~first:0 content c = Some (List.assoc "c.js" files));
+  check "empty member" (Xpack.member_of_span ~first:0 content empty = Some "");
+  check "member of a later span" (Xpack.member_of_span ~first:10100 (range 10100 10200) c = Some (List.assoc "c.js" files));
+  check "truncated range" (Xpack.member_of_span ~first:0 (range 0 10150) c = None);
+  check "member before the span" (Xpack.member_of_span ~first:10100 (range 10100 10200) a = None);
+  check "wrong content" (Xpack.member_of_span ~first:0 (range 0 10200) { c with offset = 0 } = None)
+
+let test_partition_shared () =
+  let common = ("common.cmi", "common dependency") in
+  let archives = [ ("graph", [ ("graph.cmi", "graph"); common ]); ("viz", [ common; ("viz.cmi", "viz") ]) ] in
+  let kept, blobs = Xpack.partition_shared archives in
+  check "own members kept" (kept = [ ("graph", [ ("graph.cmi", "graph") ]); ("viz", [ ("viz.cmi", "viz") ]) ]);
+  check "shared member stored once" (blobs = [ (Digest.to_hex (Digest.string "common dependency") ^ ".blob", "common dependency") ]);
+  check "blob name" (Xpack.blob_name "0123" = "0123.blob");
+  (* Artifacts are shared by content: the same name with different contents is not shared. *)
+  let kept, blobs = Xpack.partition_shared [ ("a", [ ("t.cmi", "v1") ]); ("b", [ ("t.cmi", "v2") ]) ] in
+  check "conflicting names" (kept = [ ("a", [ ("t.cmi", "v1") ]); ("b", [ ("t.cmi", "v2") ]) ] && blobs = []);
+  let kept, blobs = Xpack.partition_shared [ ("a", [ ("x.cmi", "same"); ("y.cmi", "same") ]); ("b", []) ] in
+  check "repeated in one archive" (kept = [ ("a", [ ("x.cmi", "same"); ("y.cmi", "same") ]); ("b", []) ] && blobs = [])
+
+let () =
+  test_round_trip ();
+  test_intact ();
+  test_parse_index ();
+  test_spans ();
+  test_member_of_span ();
+  test_partition_shared ();
+  print_endline "Xpack: all tests passed."
@@ -13,7 +13,7 @@ describe('XOCaml Hybrid API (Async Pre-fetch)', () => {
     const response = await callToplevelAsync('Setup', setupPayload);
     
     expect(response.class).toBe('return');
-    expect(response.value).toBe('Setup Phase 1 complete');
+    expect(response.value).toBe('Setup Phase 1 complete (environment: snapshot)');
     console.log('--- beforeAll: Setup completed successfully. ---');
   });
 
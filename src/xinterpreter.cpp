@@ -11,12 +11,14 @@
 #include "xcompletion.hpp"
 #include "xinspection.hpp"
 
+#include <algorithm>
 #include <iostream>
 #include <sstream>
 #include <stdexcept>
 #include <utility>
 #include <vector>
 
+#include "xeus/xcomm.hpp"
 #include "xeus/xhelper.hpp"
 #include <emscripten/bind.h>
 #include <emscripten/val.h>
@@ -47,6 +49,46 @@ namespace xeus_ocaml
         }
     }
 
+    /**
+     * @brief Global C-style callback for the progress of the OCaml setup.
+     *
+     * This function is invoked by the OCaml backend each time a tier of the
+     * startup completes, including the background tiers that complete after
+     * the setup result was delivered.
+     *
+     * @param progress_str A JSON string describing the completed tier.
+     */
+    void global_setup_progress_callback(const std::string& progress_str)
+    {
+        if (g_interpreter_instance)
+        {
+            g_interpreter_instance->handle_setup_progress(progress_str);
+        }
+    }
+
+    /**
+     * @brief Global C-style callback for the in-process toplevel reset.
+     *
+     * This function is invoked by the OCaml backend when a `Reset` action,
+     * sent before the first execution following a restart, completes. Failures are only reported, as
+     * there is no request left to reply to.
+     *
+     * @param result_str A JSON string from the OCaml backend indicating the result
+     *                   of the reset.
+     */
+    void global_reset_callback(const std::string& result_str)
+    {
+        try {
+            nl::json result = nl::json::parse(result_str);
+            if (result.value("class", "") != "return")
+            {
+                std::cerr << "[xeus-ocaml] OCaml reset failed: " << result.value("value", "Unknown error") << std::endl;
+            }
+        } catch (const std::exception& e) {
+            std::cerr << "[xeus-ocaml] Failed to parse reset response: " << e.what() << std::endl;
+        }
+    }
+
     /**
      * @brief Global C-style callback for asynchronous OCaml code execution.
      *
@@ -67,17 +109,39 @@ namespace xeus_ocaml
         }
     }
 
+    /**
+     * @brief Global C-style callback for outputs streamed during an execution.
+     *
+     * This function is invoked by the OCaml backend whenever outputs are flushed
+     * before an `Eval` action completes (between phrases, or when user code calls
+     * `Xlib.yield`). It forwards them to the correct `interpreter` instance.
+     *
+     * @param request_id The unique ID of the original execution request.
+     * @param outputs_str A JSON string containing a list of outputs.
+     */
+    void global_stream_callback(int request_id, const std::string& outputs_str)
+    {
+        if (g_interpreter_instance)
+        {
+            g_interpreter_instance->handle_stream_callback(request_id, outputs_str);
+        }
+    }
+
     /**
      * @brief Emscripten bindings to export global callbacks to JavaScript.
      *
-     * This block makes the C++ `global_setup_callback` and `global_eval_callback`
+     * This block makes the C++ `global_setup_callback`, `global_setup_progress_callback`,
+     * `global_reset_callback`, `global_eval_callback` and `global_stream_callback`
      * functions callable from the JavaScript environment, allowing the OCaml
      * backend to trigger them.
      */
     EMSCRIPTEN_BINDINGS(xocaml_kernel_callbacks)
     {
         emscripten::function("global_setup_callback", &global_setup_callback);
+        emscripten::function("global_setup_progress_callback", &global_setup_progress_callback);
+        emscripten::function("global_reset_callback", &global_reset_callback);
         emscripten::function("global_eval_callback", &global_eval_callback);
+        emscripten::function("global_stream_callback", &global_stream_callback);
     }
 
     // Constructor: registers this instance as the main interpreter and sets the global pointer.
@@ -101,7 +165,36 @@ namespace xeus_ocaml
         }
     }
 
-    // Called once at kernel startup to configure the interpreter by calling the OCaml setup.
+    // Records a completed tier of the startup and forwards it to the `xocaml.status` comms.
+    void interpreter::handle_setup_progress(const std::string& progress_str)
+    {
+        nl::json progress;
+        try {
+            progress = nl::json::parse(progress_str);
+            const nl::json& tier = progress.at("tier");
+            if (tier == nl::json::array({"Ready"}))
+            {
+                // A `Setup` sent again, after a restart reusing the toplevel, reports the tiers anew.
+                m_startup_progress = nl::json::array();
+            }
+            std::clog << "[xeus-ocaml] Startup tier " << (tier.is_array() && !tier.empty() ? tier[0].get<std::string>() : tier.dump())
+                      << " reached after " << progress.value("elapsed_ms", 0.0) << " ms" << std::endl;
+        } catch (const std::exception& e) {
+            std::cerr << "[xeus-ocaml] Failed to parse startup progress: " << e.what() << std::endl;
+            return;
+        }
+        m_startup_progress.push_back(progress);
+        for (xeus::xcomm* status_comm : m_status_comms)
+        {
+            status_comm->send(nl::json::object(), nl::json{{"progress", progress}}, xeus::buffer_sequence());
+        }
+    }
+
+    // Called at kernel startup to configure the interpreter by calling the OCaml setup.
+    // When the toplevel was already set up in this process (a restart that reuses it),
+    // OCaml answers the `Setup` action with an in-process reset instead of reloading.
+    // The setup result arrives once the kernel is ready; the progress of each tier of
+    // the startup, including the ones loaded in the background afterwards, is streamed.
     void interpreter::configure_impl()
     {
         nl::json setup_request = {
@@ -110,7 +203,111 @@ namespace xeus_ocaml
         };
 
         emscripten::val on_setup_complete = emscripten::val::module_property("global_setup_callback");
-        ocaml_engine::call_toplevel_async(setup_request, on_setup_complete);
+        emscripten::val on_setup_progress = emscripten::val::module_property("global_setup_progress_callback");
+        ocaml_engine::call_toplevel_async(setup_request, on_setup_complete, on_setup_progress);
+
+        // Frontends open this comm to follow the progress of the startup.
+        comm_manager().register_comm_target("xocaml.status", [this](xeus::xcomm&& comm, xeus::xmessage)
+        {
+            open_status_comm(std::move(comm));
+        });
+
+        // Frontends open this comm to print more of a toplevel value whose printing was elided.
+        comm_manager().register_comm_target("xocaml.expand", [this](xeus::xcomm&& comm, xeus::xmessage)
+        {
+            open_expand_comm(std::move(comm));
+        });
+
+        // Frontends open this comm to send the upcoming cells, prepared while the kernel is idle.
+        comm_manager().register_comm_target("xocaml.speculate", [this](xeus::xcomm&& comm, xeus::xmessage)
+        {
+            open_speculate_comm(std::move(comm));
+        });
+    }
+
+    // Serves the `Expand` requests received on an `xocaml.expand` comm.
+    void interpreter::open_expand_comm(xeus::xcomm&& comm)
+    {
+        xeus::xcomm* expand_comm = adopt_comm(std::move(comm));
+        expand_comm->on_message([expand_comm](xeus::xmessage request)
+        {
+            const nl::json& data = request.content()["data"];
+            // Budgets the frontend leaves out are derived from the handle's last printing.
+            nl::json arguments = {{"handle", data.value("handle", 0)}};
+            for (const char* budget : {"depth", "length"})
+            {
+                if (data.contains(budget) && data[budget].is_number_integer())
+                {
+                    arguments[budget] = data[budget];
+                }
+            }
+            nl::json expand_request = {"Expand", std::move(arguments)};
+            // Printing is bounded by the requested budgets, so the synchronous entry point is used.
+            nl::json response = ocaml_engine::call_merlin_sync(expand_request);
+            nl::json reply = response.value("class", "") == "return"
+                ? nl::json{{"text", response["value"]}}
+                : nl::json{{"error", response.value("value", "Unknown error")}};
+            expand_comm->send(nl::json::object(), std::move(reply), xeus::buffer_sequence());
+        });
+    }
+
+    // Sends the startup progress to an `xocaml.status` comm, now and as each tier completes.
+    void interpreter::open_status_comm(xeus::xcomm&& comm)
+    {
+        xeus::xcomm* status_comm = adopt_comm(std::move(comm));
+        status_comm->on_message([this, status_comm](xeus::xmessage)
+        {
+            status_comm->send(nl::json::object(), nl::json{{"progress", m_startup_progress}}, xeus::buffer_sequence());
+        });
+        status_comm->send(nl::json::object(), nl::json{{"progress", m_startup_progress}}, xeus::buffer_sequence());
+        m_status_comms.push_back(status_comm);
+    }
+
+    // Keeps a comm opened by the frontend alive, and releases it once the frontend closes it.
+    xeus::xcomm* interpreter::adopt_comm(xeus::xcomm&& comm)
+    {
+        m_closed_comms.clear();
+        auto owned_comm = std::make_unique<xeus::xcomm>(std::move(comm));
+        xeus::xcomm* adopted_comm = owned_comm.get();
+        adopted_comm->on_close([this, adopted_comm](xeus::xmessage)
+        {
+            release_comm(adopted_comm);
+        });
+        m_comms.push_back(std::move(owned_comm));
+        return adopted_comm;
+    }
+
+    // Stops sending to a closed comm, and moves it aside until its close handler has returned.
+    void interpreter::release_comm(xeus::xcomm* comm)
+    {
+        m_status_comms.erase(std::remove(m_status_comms.begin(), m_status_comms.end(), comm), m_status_comms.end());
+        auto owned = std::find_if(m_comms.begin(), m_comms.end(),
+                                  [comm](const std::unique_ptr<xeus::xcomm>& candidate) { return candidate.get() == comm; });
+        if (owned != m_comms.end())
+        {
+            m_closed_comms.push_back(std::move(*owned));
+            m_comms.erase(owned);
+        }
+    }
+
+    // Forwards the upcoming cells received on an `xocaml.speculate` comm.
+    void interpreter::open_speculate_comm(xeus::xcomm&& comm)
+    {
+        xeus::xcomm* speculate_comm = adopt_comm(std::move(comm));
+        speculate_comm->on_message([](xeus::xmessage request)
+        {
+            const nl::json& data = request.content()["data"];
+            nl::json speculate_request = {
+                "Speculate",
+                {{"sources", data.value("cells", nl::json::array())}}
+            };
+            // Scheduling returns at once: the cells are prepared later, while the kernel is idle.
+            nl::json response = ocaml_engine::call_merlin_sync(speculate_request);
+            if (response.value("class", "") != "return")
+            {
+                std::cerr << "[xeus-ocaml] Speculate failed: " << response.value("value", "Unknown error") << std::endl;
+            }
+        });
     }
 
     // Handles an `execute_request` message from the frontend.
@@ -118,19 +315,46 @@ namespace xeus_ocaml
         send_reply_callback cb,
         int execution_counter,
         const std::string& code,
-        xeus::execute_request_config,
+        xeus::execute_request_config config,
         nl::json)
     {
         // Store the request details and send the code to OCaml for asynchronous execution.
+        // Requests are forwarded as soon as they arrive, without waiting for the previous
+        // reply: OCaml queues them and runs them back to back, so a "Run All" has no idle
+        // gap between cells, and it answers them in order. When the request asks for it
+        // with `stop_on_error`, as frontends do for cells run by the user, a failing cell
+        // aborts the cells queued after it. A `silent` request publishes no output.
+        if (m_reset_pending)
+        {
+            // The first execution after a restart: reset the toplevel before running it.
+            // OCaml handles the `Reset` action at once, so it completes before the `Eval`.
+            m_reset_pending = false;
+            nl::json reset_request = nl::json::array({"Reset"});
+            emscripten::val on_reset_complete = emscripten::val::module_property("global_reset_callback");
+            ocaml_engine::call_toplevel_async(reset_request, on_reset_complete);
+        }
+
         int request_id = ++m_request_id_counter;
-        m_pending_requests[request_id] = {std::move(cb), execution_counter};
+        m_pending_requests[request_id] = {std::move(cb), execution_counter, config.silent};
 
-        nl::json eval_request = {"Eval", {{"source", code}}};
+        nl::json eval_request = {"Eval", {{"source", code}, {"stop_on_error", config.stop_on_error}}};
 
         emscripten::val callback_handler = emscripten::val::module_property("global_eval_callback");
         emscripten::val bound_callback = callback_handler.call<emscripten::val>("bind", emscripten::val::null(), request_id);
+        emscripten::val stream_handler = emscripten::val::module_property("global_stream_callback");
+        emscripten::val bound_stream_callback = stream_handler.call<emscripten::val>("bind", emscripten::val::null(), request_id);
 
-        ocaml_engine::call_toplevel_async(eval_request, bound_callback);
+        ocaml_engine::call_toplevel_async(eval_request, bound_callback, bound_stream_callback);
+    }
+
+    // Publishes outputs streamed by OCaml while an execution is still running.
+    void interpreter::handle_stream_callback(int request_id, const std::string& outputs_str)
+    {
+        try {
+            handle_execution_output(request_id, nl::json::parse(outputs_str));
+        } catch (const std::exception& e) {
+            std::cerr << "[xeus-ocaml] Failed to parse streamed outputs: " << e.what() << std::endl;
+        }
     }
 
     // Processes the result from an asynchronous OCaml execution.
@@ -138,9 +362,16 @@ namespace xeus_ocaml
     {
         try {
             nl::json response = nl::json::parse(result_str);
-            if (response.value("class", "") == "return") {
+            const std::string response_class = response.value("class", "");
+            if (response_class == "return") {
                 handle_execution_output(request_id, response.value("value", nl::json::array()));
                 handle_final_response(request_id, ""); // Signal success
+            } else if (response_class == "failed") {
+                // The error has already been published on stderr along with the other outputs.
+                handle_execution_output(request_id, response.value("value", nl::json::array()));
+                handle_final_response(request_id, "A phrase of the cell failed.");
+            } else if (response_class == "aborted") {
+                handle_aborted_response(request_id);
             } else {
                 handle_final_response(request_id, response.value("value", "Unknown execution error."));
             }
@@ -154,7 +385,7 @@ namespace xeus_ocaml
     void interpreter::handle_execution_output(int request_id, const nl::json& outputs)
     {
         auto it = m_pending_requests.find(request_id);
-        if (it == m_pending_requests.end()) return;
+        if (it == m_pending_requests.end() || it->second.m_silent) return;
 
         int execution_count = it->second.m_execution_count;
         for (const auto& output_item : outputs) {
@@ -188,6 +419,16 @@ namespace xeus_ocaml
         m_pending_requests.erase(it);
     }
 
+    // Sends the `aborted` status the messaging protocol defines for cells skipped after an error.
+    void interpreter::handle_aborted_response(int request_id)
+    {
+        auto it = m_pending_requests.find(request_id);
+        if (it == m_pending_requests.end()) return;
+
+        it->second.m_callback(nl::json{{"status", "aborted"}});
+        m_pending_requests.erase(it);
+    }
+
     // Handles a `complete_request` by delegating to the completion handler.
     nl::json interpreter::complete_request_impl(const std::string& code, int cursor_pos) {
         return handle_completion_request(code, cursor_pos);
@@ -213,8 +454,16 @@ namespace xeus_ocaml
         return xeus::create_is_complete_reply("incomplete", "  ");
     }
 
-    // Handles a `shutdown_request`.
-    void interpreter::shutdown_request_impl() {}
+    // Handles a `shutdown_request`, for a shutdown or a restart. xeus does not pass the
+    // request's `restart` flag here, so the toplevel reset is only marked as pending:
+    // it runs before the next execution, which only arrives when the request was a
+    // restart reusing this process. A restart then starts from the post-setup state
+    // with the VFS, the loaded libraries and Merlin still warm, and a real shutdown
+    // does no work.
+    void interpreter::shutdown_request_impl()
+    {
+        m_reset_pending = true;
+    }
 
     // Provides information about the kernel.
     nl::json interpreter::kernel_info_request_impl() {
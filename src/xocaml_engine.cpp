@@ -63,6 +63,20 @@ namespace xeus_ocaml
             }
         }
 
+        void call_toplevel_async(const nl::json& request, emscripten::val callback, emscripten::val stream_callback)
+        {
+            XOCAML_LOG("Toplevel Async Request (streaming)", request.dump(2));
+            try
+            {
+                emscripten::val xocaml = emscripten::val::global("xocaml");
+                xocaml.call<void>("processToplevelAction", request.dump(), callback, stream_callback);
+            }
+            catch (const std::exception& e)
+            {
+                std::cerr << "[xeus-ocaml] Exception in call_toplevel_async: " << e.what() << std::endl;
+            }
+        }
+
         void mount_fs()
         {
             XOCAML_LOG("ocaml_engine", "Calling xocaml.mountFS...");